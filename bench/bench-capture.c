@@ -0,0 +1,237 @@
+/* bench-capture.c - the per-pixel work of the X11 captures
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+/* Masks the part of a capture no monitor shows, as a whole surface and a
+ * strip at a time as when streaming, and copies a window capture through
+ * the shape of a decoration with rounded corners, printing the median
+ * times.  The monitors are laid out so that the last third of the frame
+ * is a quarter shorter than the rest.
+ */
+
+#include "config.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "bench-frames.h"
+#include "screenshot-mask.h"
+#include "screenshot-stream.h"
+
+#define CORNER_RADIUS 12
+
+static gint iterations = 5;
+
+static const GOptionEntry entries[] = {
+  { "iterations", 'n', 0, G_OPTION_ARG_INT, &iterations, "Runs per case (the median is reported)", "N" },
+  { NULL }
+};
+
+static gint
+compare_times (gconstpointer a,
+               gconstpointer b)
+{
+  gint64 ta = *(const gint64 *) a, tb = *(const gint64 *) b;
+
+  return ta < tb ? -1 : ta > tb;
+}
+
+static cairo_region_t *
+make_invisible_region (gint width,
+                       gint height)
+{
+  cairo_rectangle_int_t rect;
+
+  rect.x = width - width / 3;
+  rect.y = height - height / 4;
+  rect.width = width / 3;
+  rect.height = height / 4;
+
+  return cairo_region_create_rectangle (&rect);
+}
+
+/* What XShapeGetRectangles() returns for rounded top corners: a row each
+ * down to the radius, then the rest of the window */
+static cairo_region_t *
+make_shape_region (gint width,
+                   gint height)
+{
+  cairo_region_t *shape = cairo_region_create ();
+  cairo_rectangle_int_t rect;
+  gint y;
+
+  for (y = 0; y < CORNER_RADIUS; y++)
+    {
+      gdouble dy = CORNER_RADIUS - y - 0.5;
+      gint inset = CORNER_RADIUS - (gint) sqrt (CORNER_RADIUS * CORNER_RADIUS - dy * dy);
+
+      rect.x = inset;
+      rect.y = y;
+      rect.width = width - 2 * inset;
+      rect.height = 1;
+      cairo_region_union_rectangle (shape, &rect);
+    }
+
+  rect.x = 0;
+  rect.y = CORNER_RADIUS;
+  rect.width = width;
+  rect.height = height - CORNER_RADIUS;
+  cairo_region_union_rectangle (shape, &rect);
+
+  return shape;
+}
+
+static cairo_surface_t *
+make_surface (gint width,
+              gint height)
+{
+  cairo_surface_t *surface;
+  cairo_t *cr;
+
+  surface = cairo_image_surface_create (CAIRO_FORMAT_RGB24, width, height);
+  cr = cairo_create (surface);
+  cairo_set_source_rgb (cr, 0.3, 0.5, 0.7);
+  cairo_paint (cr);
+  cairo_destroy (cr);
+
+  return surface;
+}
+
+static void
+print_case (const gchar *method,
+            gint         width,
+            gint         height,
+            gint64      *times)
+{
+  qsort (times, iterations, sizeof (gint64), compare_times);
+
+  g_print ("{\"bench\": \"capture\", \"method\": \"%s\", \"size\": \"%dx%d\", "
+           "\"median_ms\": %.3f}\n",
+           method, width, height, times[iterations / 2] / 1000.0);
+}
+
+static void
+run_mask_surface (gint width,
+                  gint height)
+{
+  g_autofree gint64 *times = g_new (gint64, iterations);
+  cairo_region_t *region = make_invisible_region (width, height);
+  cairo_surface_t *surface = make_surface (width, height);
+  gint i;
+
+  for (i = 0; i < iterations; i++)
+    {
+      gint64 start = g_get_monotonic_time ();
+
+      screenshot_mask_surface (surface, region);
+      cairo_surface_flush (surface);
+      times[i] = g_get_monotonic_time () - start;
+    }
+
+  print_case ("mask-surface", width, height, times);
+
+  cairo_surface_destroy (surface);
+  cairo_region_destroy (region);
+}
+
+static void
+run_mask_strips (gint width,
+                 gint height)
+{
+  g_autofree gint64 *times = g_new (gint64, iterations);
+  g_autofree guchar *strip = NULL;
+  cairo_region_t *region = make_invisible_region (width, height);
+  gint rowstride = width * 3;
+  gint i;
+
+  strip = g_malloc0 ((gsize) rowstride * SCREENSHOT_STREAM_STRIP_HEIGHT);
+
+  for (i = 0; i < iterations; i++)
+    {
+      gint64 start = g_get_monotonic_time ();
+      gint y;
+
+      for (y = 0; y < height; y += SCREENSHOT_STREAM_STRIP_HEIGHT)
+        {
+          GdkRectangle strip_rect = { 0, y, width, MIN (SCREENSHOT_STREAM_STRIP_HEIGHT, height - y) };
+
+          screenshot_mask_strip (strip, rowstride, &strip_rect, region, 1);
+        }
+      times[i] = g_get_monotonic_time () - start;
+    }
+
+  print_case ("mask-strips", width, height, times);
+
+  cairo_region_destroy (region);
+}
+
+static void
+run_shape (gint width,
+           gint height)
+{
+  g_autofree gint64 *times = g_new (gint64, iterations);
+  cairo_region_t *shape = make_shape_region (width, height);
+  cairo_surface_t *surface = make_surface (width, height);
+  gint i;
+
+  for (i = 0; i < iterations; i++)
+    {
+      cairo_surface_t *copy;
+      gint64 start = g_get_monotonic_time ();
+
+      copy = screenshot_copy_shaped_surface (surface, shape);
+      cairo_surface_flush (copy);
+      times[i] = g_get_monotonic_time () - start;
+
+      cairo_surface_destroy (copy);
+    }
+
+  print_case ("shape", width, height, times);
+
+  cairo_surface_destroy (surface);
+  cairo_region_destroy (shape);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  g_autoptr(GOptionContext) context = NULL;
+  g_autoptr(GError) error = NULL;
+  guint s;
+
+  context = g_option_context_new (NULL);
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return EXIT_FAILURE;
+    }
+
+  iterations = MAX (iterations, 1);
+
+  for (s = 0; s < bench_n_frame_sizes; s++)
+    {
+      gint width = bench_frame_sizes[s].width;
+      gint height = bench_frame_sizes[s].height;
+
+      run_mask_surface (width, height);
+      run_mask_strips (width, height);
+      run_shape (width, height);
+    }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,225 @@
+/* bench-dedup.c - what --watch saves when little of the screen changed
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+/* Takes a synthetic desktop as the full screenshot, and the same with a
+ * band across the top redrawn, covering a growing part of it, as the
+ * next frame.  For each it prints the time to hash the tiles of the next
+ * frame, and the size and median time of saving it in full as QOI and as
+ * a delta of the tiles that changed.  The delta is loaded back over the
+ * full screenshot, and must give the next frame again.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench-frames.h"
+#include "screenshot-delta.h"
+#include "screenshot-formats.h"
+#include "screenshot-tile-hash.h"
+
+static gint iterations = 5;
+
+static const GOptionEntry entries[] = {
+  { "iterations", 'n', 0, G_OPTION_ARG_INT, &iterations, "Runs per case (the median is reported)", "N" },
+  { NULL }
+};
+
+/* The part of the frame redrawn */
+static const gdouble changes[] = { 0.0, 0.01, 0.1, 0.5 };
+
+static gint
+compare_times (gconstpointer a,
+               gconstpointer b)
+{
+  gint64 ta = *(const gint64 *) a, tb = *(const gint64 *) b;
+
+  return ta < tb ? -1 : ta > tb;
+}
+
+static gboolean
+append_cb (const gchar  *buf,
+           gsize         count,
+           GError      **error,
+           gpointer      data)
+{
+  g_byte_array_append (data, (const guint8 *) buf, count);
+
+  return TRUE;
+}
+
+/* @frame with its top @change inverted */
+static GdkPixbuf *
+redraw (GdkPixbuf *frame,
+        gdouble    change)
+{
+  GdkPixbuf *next = gdk_pixbuf_copy (frame);
+  gint rowstride = gdk_pixbuf_get_rowstride (next);
+  gint row_bytes = gdk_pixbuf_get_width (next) * gdk_pixbuf_get_n_channels (next);
+  gint height = gdk_pixbuf_get_height (next) * change;
+  guchar *pixels = gdk_pixbuf_get_pixels (next);
+  gint x, y;
+
+  for (y = 0; y < height; y++)
+    for (x = 0; x < row_bytes; x++)
+      pixels[(gsize) y * rowstride + x] ^= 0xff;
+
+  return next;
+}
+
+static gboolean
+same_pixels (GdkPixbuf *a,
+             GdkPixbuf *b)
+{
+  gint row_bytes = gdk_pixbuf_get_width (a) * gdk_pixbuf_get_n_channels (a);
+  gint y;
+
+  if (gdk_pixbuf_get_width (a) != gdk_pixbuf_get_width (b) ||
+      gdk_pixbuf_get_height (a) != gdk_pixbuf_get_height (b) ||
+      gdk_pixbuf_get_n_channels (a) != gdk_pixbuf_get_n_channels (b))
+    return FALSE;
+
+  for (y = 0; y < gdk_pixbuf_get_height (a); y++)
+    if (memcmp (gdk_pixbuf_get_pixels (a) + (gsize) y * gdk_pixbuf_get_rowstride (a),
+                gdk_pixbuf_get_pixels (b) + (gsize) y * gdk_pixbuf_get_rowstride (b),
+                row_bytes) != 0)
+      return FALSE;
+
+  return TRUE;
+}
+
+/* The delta drawn over @frame, its reference, must be @next */
+static void
+check_delta (GByteArray *delta,
+             GdkPixbuf  *frame,
+             GdkPixbuf  *next)
+{
+  g_autoptr(GdkPixbuf) loaded = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree gchar *reference = NULL;
+
+  reference = screenshot_delta_get_reference (delta->data, delta->len, &error);
+  if (reference == NULL)
+    g_error ("%s", error->message);
+  if (g_strcmp0 (reference, "Screenshot.qoi") != 0)
+    g_error ("The delta names %s as its reference", reference);
+
+  loaded = screenshot_delta_load (delta->data, delta->len, frame, &error);
+  if (loaded == NULL)
+    g_error ("%s", error->message);
+  if (!same_pixels (loaded, next))
+    g_error ("The delta does not give the frame back");
+}
+
+static void
+run_change (GdkPixbuf *frame,
+            gdouble    change)
+{
+  g_autofree gint64 *hash_times = g_new (gint64, iterations);
+  g_autofree gint64 *full_times = g_new (gint64, iterations);
+  g_autofree gint64 *delta_times = g_new (gint64, iterations);
+  g_autoptr(GdkPixbuf) next = redraw (frame, change);
+  g_autoptr(ScreenshotImage) reference_image = screenshot_image_new_for_pixbuf (frame);
+  g_autoptr(ScreenshotImage) next_image = screenshot_image_new_for_pixbuf (next);
+  g_autoptr(ScreenshotTileHashes) reference = screenshot_tile_hashes_new (reference_image);
+  g_autoptr(GArray) tiles = NULL;
+  gsize full_size = 0, delta_size = 0;
+  gint i;
+
+  for (i = 0; i < iterations; i++)
+    {
+      g_autoptr(ScreenshotTileHashes) hashes = NULL;
+      g_autoptr(GByteArray) full = g_byte_array_new ();
+      g_autoptr(GByteArray) delta = g_byte_array_new ();
+      g_autoptr(GError) error = NULL;
+      gint64 start;
+
+      start = g_get_monotonic_time ();
+      hashes = screenshot_tile_hashes_new (next_image);
+      hash_times[i] = g_get_monotonic_time () - start;
+
+      g_clear_pointer (&tiles, g_array_unref);
+      tiles = screenshot_tile_hashes_diff (hashes, reference);
+
+      start = g_get_monotonic_time ();
+      if (!screenshot_format_save_to_callback (next, "qoi", append_cb, full, &error))
+        g_error ("%s", error->message);
+      full_times[i] = g_get_monotonic_time () - start;
+
+      start = g_get_monotonic_time ();
+      if (!screenshot_delta_save_to_callback (next, tiles, "Screenshot.qoi",
+                                              append_cb, delta, &error))
+        g_error ("%s", error->message);
+      delta_times[i] = g_get_monotonic_time () - start;
+
+      full_size = full->len;
+      delta_size = delta->len;
+
+      if (i == 0)
+        check_delta (delta, frame, next);
+    }
+
+  qsort (hash_times, iterations, sizeof (gint64), compare_times);
+  qsort (full_times, iterations, sizeof (gint64), compare_times);
+  qsort (delta_times, iterations, sizeof (gint64), compare_times);
+
+  g_print ("{\"bench\": \"dedup\", \"size\": \"%dx%d\", \"changed\": %.2f, \"tiles\": %u, "
+           "\"hash_ms\": %.3f, \"full_bytes\": %" G_GSIZE_FORMAT ", \"full_ms\": %.3f, "
+           "\"delta_bytes\": %" G_GSIZE_FORMAT ", \"delta_ms\": %.3f}\n",
+           gdk_pixbuf_get_width (frame), gdk_pixbuf_get_height (frame),
+           change, tiles->len,
+           hash_times[iterations / 2] / 1000.0,
+           full_size, full_times[iterations / 2] / 1000.0,
+           delta_size, delta_times[iterations / 2] / 1000.0);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  static const struct { gint width, height; } sizes[] = {
+    { 1920, 1080 },
+    { 3840, 2160 },
+  };
+  g_autoptr(GOptionContext) context = NULL;
+  g_autoptr(GError) error = NULL;
+  guint s, c;
+
+  context = g_option_context_new (NULL);
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return EXIT_FAILURE;
+    }
+
+  iterations = MAX (iterations, 1);
+
+  for (s = 0; s < G_N_ELEMENTS (sizes); s++)
+    {
+      g_autoptr(GdkPixbuf) frame = bench_frame_new (BENCH_FRAME_DESKTOP,
+                                                    sizes[s].width,
+                                                    sizes[s].height,
+                                                    FALSE);
+
+      for (c = 0; c < G_N_ELEMENTS (changes); c++)
+        run_change (frame, changes[c]);
+    }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,199 @@
+/* bench-effects.c - cost of the window border effects
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+/* Runs the shadow, border and vintage effects on frames of every size,
+ * and screenshot_add_vintage() against the sequence of gdk-pixbuf calls
+ * it used to be made of.  For each it prints the median time and the
+ * largest number of pixel bytes alive at once, which is what sets the
+ * peak memory of the effect.
+ *
+ * The old sequence is reproduced without its first step, a 49x49 box
+ * filter over the outline area whose output was then overwritten, so its
+ * time is a lower bound.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include "bench-frames.h"
+#include "screenshot-shadow.h"
+
+#define OUTLINE_RADIUS SCREENSHOT_DEFAULT_VINTAGE_BORDER_WIDTH
+
+static gint iterations = 5;
+
+static const GOptionEntry entries[] = {
+  { "iterations", 'n', 0, G_OPTION_ARG_INT, &iterations, "Runs per case (the median is reported)", "N" },
+  { NULL }
+};
+
+static gsize
+pixbuf_bytes (GdkPixbuf *pixbuf)
+{
+  return gdk_pixbuf_get_byte_length (pixbuf);
+}
+
+/* Returns the peak number of pixel bytes alive, source included */
+static gsize
+vintage_legacy (GdkPixbuf **src)
+{
+  GdkPixbuf *dest, *tinted;
+  gsize peak;
+
+  dest = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8,
+                         gdk_pixbuf_get_width (*src) + 2 * OUTLINE_RADIUS,
+                         gdk_pixbuf_get_height (*src) + 2 * OUTLINE_RADIUS);
+  gdk_pixbuf_fill (dest, 0);
+
+  gdk_pixbuf_fill (dest, 0xFFEEEEEE);
+  gdk_pixbuf_composite (*src, dest,
+                        OUTLINE_RADIUS, OUTLINE_RADIUS,
+                        gdk_pixbuf_get_width (*src),
+                        gdk_pixbuf_get_height (*src),
+                        OUTLINE_RADIUS, OUTLINE_RADIUS, 1.0, 1.0,
+                        GDK_INTERP_HYPER, 255);
+  peak = pixbuf_bytes (*src) + pixbuf_bytes (dest);
+  g_set_object (src, dest);
+
+  gdk_pixbuf_saturate_and_pixelate (*src, *src, 0.8, FALSE);
+  tinted = gdk_pixbuf_composite_color_simple (*src,
+                                              gdk_pixbuf_get_width (*src),
+                                              gdk_pixbuf_get_height (*src),
+                                              GDK_INTERP_BILINEAR,
+                                              192, 64,
+                                              0xFFFBF2A3, 0xFFFBF2A3);
+  peak = MAX (peak, pixbuf_bytes (*src) + pixbuf_bytes (tinted));
+  g_set_object (src, tinted);
+
+  g_object_unref (dest);
+  g_object_unref (tinted);
+
+  return peak;
+}
+
+static gsize
+run_effect (GdkPixbuf **src,
+            void      (*effect) (GdkPixbuf                   **src,
+                                 const ScreenshotEffectParams *params))
+{
+  ScreenshotEffectParams params;
+  gsize before = pixbuf_bytes (*src);
+
+  screenshot_effect_params_init_default (&params);
+  effect (src, &params);
+
+  return before + pixbuf_bytes (*src);
+}
+
+static gsize
+shadow (GdkPixbuf **src)
+{
+  return run_effect (src, screenshot_add_shadow);
+}
+
+static gsize
+border (GdkPixbuf **src)
+{
+  return run_effect (src, screenshot_add_border);
+}
+
+static gsize
+vintage_fused (GdkPixbuf **src)
+{
+  return run_effect (src, screenshot_add_vintage);
+}
+
+static gint
+compare_times (gconstpointer a,
+               gconstpointer b)
+{
+  gint64 ta = *(const gint64 *) a, tb = *(const gint64 *) b;
+
+  return ta < tb ? -1 : ta > tb;
+}
+
+static void
+run_case (GdkPixbuf   *frame,
+          const gchar *bench,
+          const gchar *method,
+          gsize      (*func) (GdkPixbuf **src))
+{
+  g_autofree gint64 *times = g_new (gint64, iterations);
+  gsize peak = 0;
+  gint i;
+
+  for (i = 0; i < iterations; i++)
+    {
+      GdkPixbuf *pixbuf = gdk_pixbuf_copy (frame);
+      gint64 start;
+
+      start = g_get_monotonic_time ();
+      peak = func (&pixbuf);
+      times[i] = g_get_monotonic_time () - start;
+
+      g_object_unref (pixbuf);
+    }
+
+  qsort (times, iterations, sizeof (gint64), compare_times);
+
+  g_print ("{\"bench\": \"%s\", \"method\": \"%s\", \"size\": \"%dx%d\", "
+           "\"channels\": %d, \"median_ms\": %.3f, \"peak_pixel_bytes\": %" G_GSIZE_FORMAT "}\n",
+           bench, method,
+           gdk_pixbuf_get_width (frame), gdk_pixbuf_get_height (frame),
+           gdk_pixbuf_get_n_channels (frame),
+           times[iterations / 2] / 1000.0,
+           peak);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  g_autoptr(GOptionContext) context = NULL;
+  g_autoptr(GError) error = NULL;
+  guint s;
+  gint has_alpha;
+
+  context = g_option_context_new (NULL);
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return EXIT_FAILURE;
+    }
+
+  iterations = MAX (iterations, 1);
+
+  for (s = 0; s < bench_n_frame_sizes; s++)
+    for (has_alpha = 0; has_alpha < 2; has_alpha++)
+      {
+        g_autoptr(GdkPixbuf) frame = bench_frame_new (BENCH_FRAME_DESKTOP,
+                                                      bench_frame_sizes[s].width,
+                                                      bench_frame_sizes[s].height,
+                                                      has_alpha);
+
+        run_case (frame, "effects", "shadow", shadow);
+        run_case (frame, "effects", "border", border);
+        run_case (frame, "effects", "vintage", vintage_fused);
+
+        run_case (frame, "vintage", "legacy", vintage_legacy);
+        run_case (frame, "vintage", "fused", vintage_fused);
+      }
+
+  return EXIT_SUCCESS;
+}
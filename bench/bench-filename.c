@@ -0,0 +1,174 @@
+/* bench-filename.c - finding a free file name under contention
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+/* Starts many screenshot_build_filename_async() calls at once, as bursts
+ * of captures do, in a directory that already holds a number of
+ * screenshots with the same time stamp, so that each call has to try as
+ * many names.  Prints the median time until every call has returned.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include <glib/gstdio.h>
+
+#include "screenshot-filename-builder.h"
+
+#define ORIGIN "2020-01-01 00-00-00"
+
+static gint iterations = 5;
+
+static const GOptionEntry entries[] = {
+  { "iterations", 'n', 0, G_OPTION_ARG_INT, &iterations, "Runs per case (the median is reported)", "N" },
+  { NULL }
+};
+
+typedef struct {
+  GMainLoop *loop;
+  guint pending;
+} Burst;
+
+static gint
+compare_times (gconstpointer a,
+               gconstpointer b)
+{
+  gint64 ta = *(const gint64 *) a, tb = *(const gint64 *) b;
+
+  return ta < tb ? -1 : ta > tb;
+}
+
+static void
+build_ready_cb (GObject      *source,
+                GAsyncResult *res,
+                gpointer      user_data)
+{
+  Burst *burst = user_data;
+  g_autoptr(GError) error = NULL;
+  g_autofree gchar *path = NULL;
+
+  path = screenshot_build_filename_finish (res, &error);
+  if (path == NULL)
+    g_error ("%s", error->message);
+
+  if (--burst->pending == 0)
+    g_main_loop_quit (burst->loop);
+}
+
+/* The names the builder tries, in order, as long as they are taken */
+static void
+populate (const gchar *dir,
+          guint        n_existing)
+{
+  guint i;
+
+  for (i = 0; i < n_existing; i++)
+    {
+      g_autofree gchar *name = NULL;
+      g_autofree gchar *path = NULL;
+
+      if (i == 0)
+        name = g_strdup_printf ("Screenshot from %s.png", ORIGIN);
+      else
+        name = g_strdup_printf ("Screenshot from %s - %u.png", ORIGIN, i);
+
+      path = g_build_filename (dir, name, NULL);
+      if (!g_file_set_contents (path, "", 0, NULL))
+        g_error ("Unable to create %s", path);
+    }
+}
+
+static void
+run_case (const gchar *dir,
+          guint        n_existing,
+          guint        n_concurrent)
+{
+  g_autofree gint64 *times = g_new (gint64, iterations);
+  g_autoptr(GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+  gint i;
+
+  for (i = 0; i < iterations; i++)
+    {
+      Burst burst = { loop, n_concurrent };
+      gint64 start;
+      guint j;
+
+      start = g_get_monotonic_time ();
+      for (j = 0; j < n_concurrent; j++)
+        screenshot_build_filename_async (dir, ORIGIN, "png", build_ready_cb, &burst);
+      g_main_loop_run (loop);
+      times[i] = g_get_monotonic_time () - start;
+    }
+
+  qsort (times, iterations, sizeof (gint64), compare_times);
+
+  g_print ("{\"bench\": \"filename\", \"existing\": %u, \"concurrent\": %u, "
+           "\"median_ms\": %.3f, \"per_call_us\": %.1f}\n",
+           n_existing, n_concurrent,
+           times[iterations / 2] / 1000.0,
+           (gdouble) times[iterations / 2] / n_concurrent);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  static const guint existing[] = { 0, 10, 100 };
+  static const guint concurrent[] = { 1, 8, 64 };
+  g_autoptr(GOptionContext) context = NULL;
+  g_autoptr(GError) error = NULL;
+  guint e, c;
+
+  context = g_option_context_new (NULL);
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return EXIT_FAILURE;
+    }
+
+  iterations = MAX (iterations, 1);
+
+  for (e = 0; e < G_N_ELEMENTS (existing); e++)
+    {
+      g_autofree gchar *dir = g_dir_make_tmp ("bench-filename-XXXXXX", &error);
+      g_autoptr(GDir) listing = NULL;
+      const gchar *name;
+
+      if (dir == NULL)
+        {
+          g_printerr ("%s\n", error->message);
+          return EXIT_FAILURE;
+        }
+
+      populate (dir, existing[e]);
+
+      for (c = 0; c < G_N_ELEMENTS (concurrent); c++)
+        run_case (dir, existing[e], concurrent[c]);
+
+      listing = g_dir_open (dir, 0, NULL);
+      while (listing != NULL && (name = g_dir_read_name (listing)) != NULL)
+        {
+          g_autofree gchar *path = g_build_filename (dir, name, NULL);
+
+          g_unlink (path);
+        }
+      g_rmdir (dir);
+    }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,140 @@
+/* bench-formats.c - the built-in lossless formats against PNG
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+/* Encodes each synthetic frame as PNG and JPEG with gdk-pixbuf, as QOI
+ * and, when built with libwebp, as lossless WebP, printing the file size,
+ * the median time and the throughput in megapixels per second.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include "bench-frames.h"
+#include "screenshot-formats.h"
+
+static gint iterations = 5;
+
+static const GOptionEntry entries[] = {
+  { "iterations", 'n', 0, G_OPTION_ARG_INT, &iterations, "Runs per case (the median is reported)", "N" },
+  { NULL }
+};
+
+static const gchar *formats[] = { "png", "jpeg", "qoi", "webp" };
+
+static gint
+compare_times (gconstpointer a,
+               gconstpointer b)
+{
+  gint64 ta = *(const gint64 *) a, tb = *(const gint64 *) b;
+
+  return ta < tb ? -1 : ta > tb;
+}
+
+static gboolean
+append_cb (const gchar  *buf,
+           gsize         count,
+           GError      **error,
+           gpointer      data)
+{
+  g_byte_array_append (data, (const guint8 *) buf, count);
+
+  return TRUE;
+}
+
+static void
+run_format (BenchFrameKind  kind,
+            GdkPixbuf      *frame,
+            const gchar    *format)
+{
+  g_autofree gint64 *times = g_new (gint64, iterations);
+  gsize size = 0;
+  gdouble median_ms;
+  gint i;
+
+  for (i = 0; i < iterations; i++)
+    {
+      g_autoptr(GByteArray) bytes = g_byte_array_new ();
+      g_autoptr(GError) error = NULL;
+      gboolean ok;
+      gint64 start;
+
+      start = g_get_monotonic_time ();
+      if (screenshot_format_is_builtin (format))
+        ok = screenshot_format_save_to_callback (frame, format, append_cb, bytes, &error);
+      else if (g_strcmp0 (format, "png") == 0)
+        ok = gdk_pixbuf_save_to_callback (frame, append_cb, bytes, format, &error,
+                                          "tEXt::Software", "gnome-screenshot", NULL);
+      else
+        ok = gdk_pixbuf_save_to_callback (frame, append_cb, bytes, format, &error, NULL);
+      times[i] = g_get_monotonic_time () - start;
+
+      if (!ok)
+        g_error ("%s", error->message);
+
+      size = bytes->len;
+    }
+
+  qsort (times, iterations, sizeof (gint64), compare_times);
+  median_ms = times[iterations / 2] / 1000.0;
+
+  g_print ("{\"bench\": \"formats\", \"frame\": \"%s\", \"size\": \"%dx%d\", \"channels\": %d, "
+           "\"format\": \"%s\", \"bytes\": %" G_GSIZE_FORMAT ", \"median_ms\": %.3f, "
+           "\"mpixels_per_s\": %.1f}\n",
+           bench_frame_kind_to_string (kind),
+           gdk_pixbuf_get_width (frame), gdk_pixbuf_get_height (frame),
+           gdk_pixbuf_get_n_channels (frame),
+           format, size, median_ms,
+           (gdouble) gdk_pixbuf_get_width (frame) * gdk_pixbuf_get_height (frame) /
+           MAX (median_ms, 0.001) / 1000.0);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  g_autoptr(GOptionContext) context = NULL;
+  g_autoptr(GError) error = NULL;
+  BenchFrameKind kind;
+  guint s, f;
+
+  context = g_option_context_new (NULL);
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return EXIT_FAILURE;
+    }
+
+  iterations = MAX (iterations, 1);
+
+  for (s = 0; s < bench_n_frame_sizes; s++)
+    for (kind = 0; kind < BENCH_FRAME_LAST; kind++)
+      {
+        g_autoptr(GdkPixbuf) frame = bench_frame_new (kind,
+                                                      bench_frame_sizes[s].width,
+                                                      bench_frame_sizes[s].height,
+                                                      FALSE);
+
+        for (f = 0; f < G_N_ELEMENTS (formats); f++)
+          if (g_strcmp0 (formats[f], "png") == 0 || g_strcmp0 (formats[f], "jpeg") == 0 ||
+              screenshot_format_is_builtin (formats[f]))
+            run_format (kind, frame, formats[f]);
+      }
+
+  return EXIT_SUCCESS;
+}
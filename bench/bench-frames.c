@@ -0,0 +1,268 @@
+/* bench-frames.c - synthetic screenshots for the benchmarks
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+/* The frames are generated from a fixed seed, so that every run of a
+ * benchmark works on exactly the same pixels.
+ */
+
+#include "config.h"
+
+#include <math.h>
+
+#include "bench-frames.h"
+
+#define BENCH_SEED 0x5c4ee75
+
+const BenchFrameSize bench_frame_sizes[] = {
+  { "720p", 1280, 720 },
+  { "1080p", 1920, 1080 },
+  { "1440p", 2560, 1440 },
+  { "4k", 3840, 2160 },
+  { "3x4k", 11520, 2160 },
+};
+
+const guint bench_n_frame_sizes = G_N_ELEMENTS (bench_frame_sizes);
+
+const gchar *
+bench_frame_kind_to_string (BenchFrameKind kind)
+{
+  switch (kind)
+    {
+    case BENCH_FRAME_DESKTOP:
+      return "desktop";
+    case BENCH_FRAME_TEXT:
+      return "text";
+    case BENCH_FRAME_PHOTO:
+      return "photo";
+    case BENCH_FRAME_LAST:
+    default:
+      g_assert_not_reached ();
+    }
+}
+
+static void
+put_pixel (guchar *p,
+           gint    n_channels,
+           guint32 rgb)
+{
+  p[0] = (rgb >> 16) & 0xff;
+  p[1] = (rgb >> 8) & 0xff;
+  p[2] = rgb & 0xff;
+
+  if (n_channels == 4)
+    p[3] = 0xff;
+}
+
+static void
+fill_rect (GdkPixbuf *pixbuf,
+           gint       x0,
+           gint       y0,
+           gint       width,
+           gint       height,
+           guint32    rgb)
+{
+  gint n_channels = gdk_pixbuf_get_n_channels (pixbuf);
+  gint rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+  guchar *pixels = gdk_pixbuf_get_pixels (pixbuf);
+  gint x1, y1, x, y;
+
+  x1 = MIN (x0 + width, gdk_pixbuf_get_width (pixbuf));
+  y1 = MIN (y0 + height, gdk_pixbuf_get_height (pixbuf));
+  x0 = MAX (x0, 0);
+  y0 = MAX (y0, 0);
+
+  for (y = y0; y < y1; y++)
+    for (x = x0; x < x1; x++)
+      put_pixel (pixels + y * rowstride + x * n_channels, n_channels, rgb);
+}
+
+static void
+draw_desktop (GdkPixbuf *pixbuf,
+              GRand     *rand)
+{
+  gint width = gdk_pixbuf_get_width (pixbuf);
+  gint height = gdk_pixbuf_get_height (pixbuf);
+  gint i, y;
+
+  fill_rect (pixbuf, 0, 0, width, height, 0x2c3e50);
+
+  /* top bar */
+  fill_rect (pixbuf, 0, 0, width, 28, 0x1d1d1d);
+
+  for (i = 0; i < 12; i++)
+    {
+      gint w = g_rand_int_range (rand, width / 6, width / 2);
+      gint h = g_rand_int_range (rand, height / 6, height / 2);
+      gint x = g_rand_int_range (rand, 0, width - w / 2);
+      gint top = g_rand_int_range (rand, 28, height - h / 2);
+
+      /* border, body and a title bar with a vertical gradient */
+      fill_rect (pixbuf, x - 1, top - 1, w + 2, h + 2, 0x9a9a9a);
+      fill_rect (pixbuf, x, top, w, h, 0xf6f5f4);
+
+      for (y = 0; y < 36; y++)
+        {
+          guint v = 0xe8 - y;
+          fill_rect (pixbuf, x, top + y, w, 1, (v << 16) | (v << 8) | v);
+        }
+
+      fill_rect (pixbuf, x + 8, top + 48, w / 3, h - 56, 0xdeddda);
+      fill_rect (pixbuf, x + w - 90, top + 8, 80, 20, 0x3584e4);
+    }
+}
+
+static void
+draw_text (GdkPixbuf *pixbuf,
+           GRand     *rand)
+{
+  gint width = gdk_pixbuf_get_width (pixbuf);
+  gint height = gdk_pixbuf_get_height (pixbuf);
+  gint cx, cy, i;
+
+  fill_rect (pixbuf, 0, 0, width, height, 0xffffff);
+
+  /* 8x16 character cells, each with a few horizontal and vertical strokes */
+  for (cy = 0; cy + 16 <= height; cy += 16)
+    for (cx = 0; cx + 8 <= width; cx += 8)
+      {
+        if (g_rand_int_range (rand, 0, 8) == 0)
+          continue;
+
+        for (i = 0; i < 3; i++)
+          {
+            if (g_rand_boolean (rand))
+              fill_rect (pixbuf, cx + 1, cy + g_rand_int_range (rand, 3, 13),
+                         g_rand_int_range (rand, 2, 7), 1, 0x241f31);
+            else
+              fill_rect (pixbuf, cx + g_rand_int_range (rand, 1, 7), cy + 3,
+                         1, g_rand_int_range (rand, 4, 10), 0x241f31);
+          }
+      }
+}
+
+static void
+draw_photo (GdkPixbuf *pixbuf,
+            GRand     *rand)
+{
+  gint width = gdk_pixbuf_get_width (pixbuf);
+  gint height = gdk_pixbuf_get_height (pixbuf);
+  gint n_channels = gdk_pixbuf_get_n_channels (pixbuf);
+  gint rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+  guchar *pixels = gdk_pixbuf_get_pixels (pixbuf);
+  gdouble freq[3][2], phase[3];
+  gint x, y, c;
+
+  for (c = 0; c < 3; c++)
+    {
+      freq[c][0] = g_rand_double_range (rand, 0.002, 0.05);
+      freq[c][1] = g_rand_double_range (rand, 0.002, 0.05);
+      phase[c] = g_rand_double_range (rand, 0, 2 * G_PI);
+    }
+
+  for (y = 0; y < height; y++)
+    for (x = 0; x < width; x++)
+      {
+        guchar *p = pixels + y * rowstride + x * n_channels;
+
+        for (c = 0; c < 3; c++)
+          {
+            gdouble v = sin (x * freq[c][0] + phase[c]) * cos (y * freq[c][1]) +
+                        0.25 * sin ((x + y) * freq[c][1] * 7.0);
+            gint noise = g_rand_int_range (rand, -6, 7);
+
+            p[c] = CLAMP ((gint) (128 + v * 90) + noise, 0, 255);
+          }
+
+        if (n_channels == 4)
+          p[3] = 0xff;
+      }
+}
+
+/**
+ * bench_frame_new:
+ *
+ * Returns: (transfer full): a new frame of the given kind; the same
+ * arguments always give the same pixels.
+ */
+GdkPixbuf *
+bench_frame_new (BenchFrameKind kind,
+                 gint           width,
+                 gint           height,
+                 gboolean       has_alpha)
+{
+  GdkPixbuf *pixbuf;
+  GRand *rand;
+
+  pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, has_alpha, 8, width, height);
+  rand = g_rand_new_with_seed (BENCH_SEED + kind);
+
+  switch (kind)
+    {
+    case BENCH_FRAME_DESKTOP:
+      draw_desktop (pixbuf, rand);
+      break;
+    case BENCH_FRAME_TEXT:
+      draw_text (pixbuf, rand);
+      break;
+    case BENCH_FRAME_PHOTO:
+      draw_photo (pixbuf, rand);
+      break;
+    case BENCH_FRAME_LAST:
+    default:
+      g_assert_not_reached ();
+    }
+
+  g_rand_free (rand);
+
+  return pixbuf;
+}
+
+/* Peak signal to noise ratio over the colour channels, in dB; INFINITY
+ * when the images are identical.
+ */
+gdouble
+bench_psnr (GdkPixbuf *a,
+            GdkPixbuf *b)
+{
+  gint width = gdk_pixbuf_get_width (a);
+  gint height = gdk_pixbuf_get_height (a);
+  gint na = gdk_pixbuf_get_n_channels (a);
+  gint nb = gdk_pixbuf_get_n_channels (b);
+  gint rsa = gdk_pixbuf_get_rowstride (a);
+  gint rsb = gdk_pixbuf_get_rowstride (b);
+  const guchar *pa = gdk_pixbuf_read_pixels (a);
+  const guchar *pb = gdk_pixbuf_read_pixels (b);
+  gdouble sum = 0.0, mse;
+  gint x, y, c;
+
+  g_return_val_if_fail (gdk_pixbuf_get_width (b) == width, 0.0);
+  g_return_val_if_fail (gdk_pixbuf_get_height (b) == height, 0.0);
+
+  for (y = 0; y < height; y++)
+    for (x = 0; x < width; x++)
+      for (c = 0; c < 3; c++)
+        {
+          gint d = pa[y * rsa + x * na + c] - pb[y * rsb + x * nb + c];
+          sum += d * d;
+        }
+
+  mse = sum / ((gdouble) width * height * 3);
+  if (mse == 0.0)
+    return INFINITY;
+
+  return 10.0 * log10 (255.0 * 255.0 / mse);
+}
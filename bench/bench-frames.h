@@ -0,0 +1,53 @@
+/* bench-frames.h - synthetic screenshots for the benchmarks
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+#ifndef __BENCH_FRAMES_H__
+#define __BENCH_FRAMES_H__
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+  BENCH_FRAME_DESKTOP, /* flat panels, borders and a few gradients */
+  BENCH_FRAME_TEXT,    /* dense one pixel strokes, like a terminal */
+  BENCH_FRAME_PHOTO,   /* smooth noise, like a wallpaper or a video */
+  BENCH_FRAME_LAST
+} BenchFrameKind;
+
+/* From 720p to three 4K monitors side by side */
+typedef struct {
+  const gchar *name;
+  gint width;
+  gint height;
+} BenchFrameSize;
+
+extern const BenchFrameSize bench_frame_sizes[];
+extern const guint bench_n_frame_sizes;
+
+const gchar *bench_frame_kind_to_string (BenchFrameKind  kind);
+GdkPixbuf   *bench_frame_new            (BenchFrameKind  kind,
+                                         gint            width,
+                                         gint            height,
+                                         gboolean        has_alpha);
+
+gdouble      bench_psnr                 (GdkPixbuf      *a,
+                                         GdkPixbuf      *b);
+
+G_END_DECLS
+
+#endif /* __BENCH_FRAMES_H__ */
@@ -0,0 +1,369 @@
+/* bench-image.c - pixel format conversions per capture mode
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+/* Replays what happens to the pixels of a capture between the X server
+ * and the last consumer, for each capture mode, the way it was done with
+ * pixbufs everywhere ("legacy") and with ScreenshotImage ("native").  For
+ * each it prints the number of full conversions between cairo's and
+ * gdk-pixbuf's layouts, the bytes they wrote and the median time.
+ *
+ * The capture is an image surface made once from a synthetic frame;
+ * reading the root window and encoding cost the same either way and are
+ * left out.  The dialog case draws the level picked for a preview at a
+ * fifth of the capture size and the settled preview, then saves.
+ *
+ * The "to-pixbuf" lines compare the conversion kernel alone against
+ * gdk_pixbuf_get_from_surface().
+ */
+
+#include "config.h"
+
+#include <gdk/gdk.h>
+#include <stdlib.h>
+
+#include "bench-frames.h"
+#include "screenshot-image.h"
+#include "screenshot-mipmap.h"
+#include "screenshot-resample.h"
+
+/* The dialog preview is a fifth of the capture */
+#define PREVIEW_SCALE 0.2
+
+typedef enum {
+  MODE_SAVE,      /* straight to a file */
+  MODE_CLIPBOARD, /* straight to the clipboard */
+  MODE_DIALOG,    /* previewed in the dialog, then saved */
+  MODE_EFFECT,    /* a window with an effect, previewed, then saved */
+  MODE_LAST
+} Mode;
+
+static const gchar *mode_names[] = {
+  "save", "clipboard", "dialog", "effect"
+};
+
+typedef struct {
+  guint conversions;
+  gsize bytes;
+} Counts;
+
+static gint iterations = 5;
+
+static const GOptionEntry entries[] = {
+  { "iterations", 'n', 0, G_OPTION_ARG_INT, &iterations, "Runs per case (the median is reported)", "N" },
+  { NULL }
+};
+
+/* Stands in for an effect: a copy, which is what the effects cost in
+ * conversions */
+static GdkPixbuf *
+fake_effect (GdkPixbuf *pixbuf)
+{
+  return gdk_pixbuf_copy (pixbuf);
+}
+
+static GdkPixbuf *
+legacy_to_pixbuf (cairo_surface_t *surface,
+                  Counts          *counts)
+{
+  GdkPixbuf *pixbuf;
+
+  pixbuf = gdk_pixbuf_get_from_surface (surface, 0, 0,
+                                        cairo_image_surface_get_width (surface),
+                                        cairo_image_surface_get_height (surface));
+  counts->conversions++;
+  counts->bytes += gdk_pixbuf_get_byte_length (pixbuf);
+
+  return pixbuf;
+}
+
+static cairo_surface_t *
+legacy_to_surface (GdkPixbuf *pixbuf,
+                   Counts    *counts)
+{
+  cairo_surface_t *surface;
+
+  surface = gdk_cairo_surface_create_from_pixbuf (pixbuf, 1, NULL);
+  counts->conversions++;
+  counts->bytes += (gsize) cairo_image_surface_get_stride (surface) *
+                   cairo_image_surface_get_height (surface);
+
+  return surface;
+}
+
+/* The preview: the nearest level while resizing, then the exact size */
+static void
+legacy_preview (GdkPixbuf *pixbuf,
+                Counts    *counts)
+{
+  g_autoptr(ScreenshotMipmap) mipmap = NULL;
+  g_autoptr(GdkPixbuf) preview = NULL;
+  GdkPixbuf *level;
+  cairo_surface_t *surface;
+
+  mipmap = screenshot_mipmap_new (pixbuf, 64);
+  level = screenshot_mipmap_get_level (mipmap,
+                                       screenshot_mipmap_find_level (mipmap, PREVIEW_SCALE));
+
+  surface = legacy_to_surface (level, counts);
+  cairo_surface_destroy (surface);
+
+  preview = screenshot_resample (level,
+                                 gdk_pixbuf_get_width (pixbuf) * PREVIEW_SCALE,
+                                 gdk_pixbuf_get_height (pixbuf) * PREVIEW_SCALE,
+                                 SCREENSHOT_RESAMPLE_BOX, 0);
+  surface = legacy_to_surface (preview, counts);
+  cairo_surface_destroy (surface);
+}
+
+static void
+run_legacy (Mode             mode,
+            cairo_surface_t *capture,
+            Counts          *counts)
+{
+  g_autoptr(GdkPixbuf) pixbuf = NULL;
+
+  /* gdk_pixbuf_get_from_window() */
+  pixbuf = legacy_to_pixbuf (capture, counts);
+
+  switch (mode)
+    {
+    case MODE_SAVE:
+    case MODE_CLIPBOARD:
+      break;
+
+    case MODE_DIALOG:
+      legacy_preview (pixbuf, counts);
+      break;
+
+    case MODE_EFFECT:
+      {
+        g_autoptr(GdkPixbuf) effect = fake_effect (pixbuf);
+
+        legacy_preview (effect, counts);
+      }
+      break;
+
+    case MODE_LAST:
+    default:
+      g_assert_not_reached ();
+    }
+}
+
+static void
+native_preview (ScreenshotImage *image)
+{
+  g_autoptr(ScreenshotMipmap) mipmap = NULL;
+  g_autoptr(GdkPixbuf) native = NULL;
+  g_autoptr(GdkPixbuf) preview = NULL;
+  cairo_format_t format;
+  GdkPixbuf *level;
+  cairo_surface_t *surface;
+
+  format = screenshot_image_get_native_format (image);
+  native = screenshot_image_get_native_pixbuf (image);
+  mipmap = screenshot_mipmap_new (native, 64);
+  level = screenshot_mipmap_get_level (mipmap,
+                                       screenshot_mipmap_find_level (mipmap, PREVIEW_SCALE));
+
+  surface = screenshot_native_pixbuf_create_surface (level, format);
+  cairo_surface_destroy (surface);
+
+  preview = screenshot_resample (level,
+                                 screenshot_image_get_width (image) * PREVIEW_SCALE,
+                                 screenshot_image_get_height (image) * PREVIEW_SCALE,
+                                 SCREENSHOT_RESAMPLE_BOX, 0);
+  surface = screenshot_native_pixbuf_create_surface (preview, format);
+  cairo_surface_destroy (surface);
+}
+
+static void
+run_native (Mode             mode,
+            cairo_surface_t *capture,
+            Counts          *counts)
+{
+  g_autoptr(ScreenshotImage) image = screenshot_image_new_for_surface (capture);
+  ScreenshotImageStats stats;
+
+  screenshot_image_reset_stats ();
+
+  switch (mode)
+    {
+    case MODE_SAVE:
+    case MODE_CLIPBOARD:
+      /* the encoder or the clipboard */
+      screenshot_image_get_pixbuf (image);
+      break;
+
+    case MODE_DIALOG:
+      native_preview (image);
+      screenshot_image_get_pixbuf (image);
+      break;
+
+    case MODE_EFFECT:
+      {
+        g_autoptr(GdkPixbuf) effect = fake_effect (screenshot_image_get_pixbuf (image));
+        g_autoptr(ScreenshotImage) rendered = screenshot_image_new_for_pixbuf (effect);
+
+        native_preview (rendered);
+        screenshot_image_get_pixbuf (rendered);
+      }
+      break;
+
+    case MODE_LAST:
+    default:
+      g_assert_not_reached ();
+    }
+
+  screenshot_image_get_stats (&stats);
+  counts->conversions = stats.to_pixbuf + stats.to_native;
+  counts->bytes = stats.bytes;
+}
+
+static gint
+compare_times (gconstpointer a,
+               gconstpointer b)
+{
+  gint64 ta = *(const gint64 *) a, tb = *(const gint64 *) b;
+
+  return ta < tb ? -1 : ta > tb;
+}
+
+static void
+run_mode (Mode             mode,
+          cairo_surface_t *capture,
+          const gchar     *method,
+          void           (*func) (Mode, cairo_surface_t *, Counts *))
+{
+  g_autofree gint64 *times = g_new (gint64, iterations);
+  Counts counts = { 0, };
+  gint i;
+
+  for (i = 0; i < iterations; i++)
+    {
+      gint64 start;
+
+      counts.conversions = 0;
+      counts.bytes = 0;
+
+      start = g_get_monotonic_time ();
+      func (mode, capture, &counts);
+      times[i] = g_get_monotonic_time () - start;
+    }
+
+  qsort (times, iterations, sizeof (gint64), compare_times);
+
+  g_print ("{\"bench\": \"image\", \"mode\": \"%s\", \"method\": \"%s\", \"size\": \"%dx%d\", "
+           "\"conversions\": %u, \"converted_bytes\": %" G_GSIZE_FORMAT ", \"median_ms\": %.3f}\n",
+           mode_names[mode], method,
+           cairo_image_surface_get_width (capture),
+           cairo_image_surface_get_height (capture),
+           counts.conversions, counts.bytes,
+           times[iterations / 2] / 1000.0);
+}
+
+static void
+run_kernel (cairo_surface_t *capture)
+{
+  g_autofree gint64 *gdk_times = g_new (gint64, iterations);
+  g_autofree gint64 *kernel_times = g_new (gint64, iterations);
+  gboolean has_alpha;
+  gint width, height, i;
+
+  width = cairo_image_surface_get_width (capture);
+  height = cairo_image_surface_get_height (capture);
+  has_alpha = cairo_image_surface_get_format (capture) == CAIRO_FORMAT_ARGB32;
+
+  for (i = 0; i < iterations; i++)
+    {
+      g_autoptr(GdkPixbuf) pixbuf = NULL;
+      g_autoptr(GdkPixbuf) dest = gdk_pixbuf_new (GDK_COLORSPACE_RGB, has_alpha, 8,
+                                                  width, height);
+      gint64 start;
+
+      start = g_get_monotonic_time ();
+      pixbuf = gdk_pixbuf_get_from_surface (capture, 0, 0, width, height);
+      gdk_times[i] = g_get_monotonic_time () - start;
+
+      start = g_get_monotonic_time ();
+      screenshot_convert_native_to_pixbuf (cairo_image_surface_get_data (capture),
+                                           cairo_image_surface_get_stride (capture),
+                                           gdk_pixbuf_get_pixels (dest),
+                                           gdk_pixbuf_get_rowstride (dest),
+                                           width, height, has_alpha);
+      kernel_times[i] = g_get_monotonic_time () - start;
+    }
+
+  qsort (gdk_times, iterations, sizeof (gint64), compare_times);
+  qsort (kernel_times, iterations, sizeof (gint64), compare_times);
+
+  g_print ("{\"bench\": \"image\", \"mode\": \"to-pixbuf\", \"method\": \"gdk\", \"size\": \"%dx%d\", "
+           "\"channels\": %d, \"median_ms\": %.3f}\n",
+           width, height, has_alpha ? 4 : 3, gdk_times[iterations / 2] / 1000.0);
+  g_print ("{\"bench\": \"image\", \"mode\": \"to-pixbuf\", \"method\": \"kernel\", \"size\": \"%dx%d\", "
+           "\"channels\": %d, \"median_ms\": %.3f}\n",
+           width, height, has_alpha ? 4 : 3, kernel_times[iterations / 2] / 1000.0);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  static const struct { gint width, height; } sizes[] = {
+    { 1920, 1080 },
+    { 3840, 2160 },
+  };
+  g_autoptr(GOptionContext) context = NULL;
+  g_autoptr(GError) error = NULL;
+  guint s;
+  gint has_alpha;
+  Mode mode;
+
+  context = g_option_context_new (NULL);
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return EXIT_FAILURE;
+    }
+
+  iterations = MAX (iterations, 1);
+
+  for (s = 0; s < G_N_ELEMENTS (sizes); s++)
+    for (has_alpha = 0; has_alpha < 2; has_alpha++)
+      {
+        g_autoptr(GdkPixbuf) frame = bench_frame_new (BENCH_FRAME_DESKTOP,
+                                                      sizes[s].width,
+                                                      sizes[s].height,
+                                                      has_alpha);
+        cairo_surface_t *capture;
+
+        /* screens are RGB24, shaped windows ARGB32 */
+        capture = gdk_cairo_surface_create_from_pixbuf (frame, 1, NULL);
+
+        run_kernel (capture);
+
+        for (mode = 0; mode < MODE_LAST; mode++)
+          {
+            run_mode (mode, capture, "legacy", run_legacy);
+            run_mode (mode, capture, "native", run_native);
+          }
+
+        cairo_surface_destroy (capture);
+      }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,149 @@
+/* bench-png8.c - indexed against truecolor PNG files
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+/* Saves each synthetic frame as gdk-pixbuf does and with the indexed
+ * writer, printing the file sizes and the median times.  Frames with too
+ * many colours only report the time it took to find out, which is what
+ * every other PNG capture now pays on top of the usual encoding.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include "bench-frames.h"
+#include "screenshot-png8.h"
+
+static gint iterations = 5;
+
+static const GOptionEntry entries[] = {
+  { "iterations", 'n', 0, G_OPTION_ARG_INT, &iterations, "Runs per case (the median is reported)", "N" },
+  { NULL }
+};
+
+static gint
+compare_times (gconstpointer a,
+               gconstpointer b)
+{
+  gint64 ta = *(const gint64 *) a, tb = *(const gint64 *) b;
+
+  return ta < tb ? -1 : ta > tb;
+}
+
+static gboolean
+append_cb (const gchar  *buf,
+           gsize         count,
+           GError      **error,
+           gpointer      data)
+{
+  g_byte_array_append (data, (const guint8 *) buf, count);
+
+  return TRUE;
+}
+
+static void
+run_frame (BenchFrameKind kind,
+           GdkPixbuf     *frame)
+{
+  g_autofree gint64 *gdk_times = g_new (gint64, iterations);
+  g_autofree gint64 *png8_times = g_new (gint64, iterations);
+  gsize gdk_size = 0, png8_size = 0;
+  gboolean indexed = FALSE;
+  guint32 palette[SCREENSHOT_PNG8_MAX_COLORS];
+  guint n_colors = 0;
+  gint i;
+
+  for (i = 0; i < iterations; i++)
+    {
+      g_autofree gchar *buffer = NULL;
+      g_autoptr(GByteArray) bytes = g_byte_array_new ();
+      g_autoptr(GError) error = NULL;
+      gint64 start;
+
+      start = g_get_monotonic_time ();
+      if (!gdk_pixbuf_save_to_buffer (frame, &buffer, &gdk_size, "png", &error,
+                                      "tEXt::Software", "gnome-screenshot", NULL))
+        g_error ("%s", error->message);
+      gdk_times[i] = g_get_monotonic_time () - start;
+
+      start = g_get_monotonic_time ();
+      indexed = screenshot_png8_save_to_callback (frame, NULL, append_cb, bytes, &error);
+      png8_times[i] = g_get_monotonic_time () - start;
+      png8_size = bytes->len;
+
+      if (!indexed && !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED))
+        g_error ("%s", error->message);
+    }
+
+  if (indexed)
+    g_free (screenshot_png8_index (frame, palette, &n_colors));
+
+  qsort (gdk_times, iterations, sizeof (gint64), compare_times);
+  qsort (png8_times, iterations, sizeof (gint64), compare_times);
+
+  g_print ("{\"bench\": \"png8\", \"frame\": \"%s\", \"size\": \"%dx%d\", \"channels\": %d, "
+           "\"method\": \"gdk\", \"bytes\": %" G_GSIZE_FORMAT ", \"median_ms\": %.3f}\n",
+           bench_frame_kind_to_string (kind),
+           gdk_pixbuf_get_width (frame), gdk_pixbuf_get_height (frame),
+           gdk_pixbuf_get_n_channels (frame),
+           gdk_size, gdk_times[iterations / 2] / 1000.0);
+  g_print ("{\"bench\": \"png8\", \"frame\": \"%s\", \"size\": \"%dx%d\", \"channels\": %d, "
+           "\"method\": \"png8\", \"indexed\": %s, \"colors\": %u, \"bytes\": %" G_GSIZE_FORMAT ", "
+           "\"median_ms\": %.3f}\n",
+           bench_frame_kind_to_string (kind),
+           gdk_pixbuf_get_width (frame), gdk_pixbuf_get_height (frame),
+           gdk_pixbuf_get_n_channels (frame),
+           indexed ? "true" : "false", n_colors,
+           indexed ? png8_size : 0, png8_times[iterations / 2] / 1000.0);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  static const struct { gint width, height; } sizes[] = {
+    { 1920, 1080 },
+    { 3840, 2160 },
+  };
+  g_autoptr(GOptionContext) context = NULL;
+  g_autoptr(GError) error = NULL;
+  BenchFrameKind kind;
+  guint s;
+
+  context = g_option_context_new (NULL);
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return EXIT_FAILURE;
+    }
+
+  iterations = MAX (iterations, 1);
+
+  for (s = 0; s < G_N_ELEMENTS (sizes); s++)
+    for (kind = 0; kind < BENCH_FRAME_LAST; kind++)
+      {
+        g_autoptr(GdkPixbuf) frame = bench_frame_new (kind,
+                                                      sizes[s].width,
+                                                      sizes[s].height,
+                                                      FALSE);
+
+        run_frame (kind, frame);
+      }
+
+  return EXIT_SUCCESS;
+}
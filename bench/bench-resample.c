@@ -0,0 +1,189 @@
+/* bench-resample.c - speed and quality of the screenshot resampler
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+/* Scales synthetic frames with screenshot_resample() and with the
+ * gdk-pixbuf filters it replaces, and prints one JSON object per case:
+ * the median time and, as a quality figure, the PSNR against
+ * GDK_INTERP_HYPER, which is slow but accurate.
+ */
+
+#include "config.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "bench-frames.h"
+#include "screenshot-resample.h"
+
+typedef enum {
+  METHOD_GDK_BILINEAR,
+  METHOD_GDK_HYPER,
+  METHOD_BOX,
+  METHOD_LANCZOS
+} Method;
+
+static const gchar *method_names[] = {
+  "gdk-bilinear", "gdk-hyper", "box", "lanczos"
+};
+
+static gint iterations = 5;
+static gboolean quick = FALSE;
+
+static const GOptionEntry entries[] = {
+  { "iterations", 'n', 0, G_OPTION_ARG_INT, &iterations, "Runs per case (the median is reported)", "N" },
+  { "quick", 'q', 0, G_OPTION_ARG_NONE, &quick, "Only run the 1080p cases", NULL },
+  { NULL }
+};
+
+static GdkPixbuf *
+run_method (Method     method,
+            GdkPixbuf *src,
+            gint       width,
+            gint       height,
+            guint      n_threads)
+{
+  switch (method)
+    {
+    case METHOD_GDK_BILINEAR:
+      return gdk_pixbuf_scale_simple (src, width, height, GDK_INTERP_BILINEAR);
+    case METHOD_GDK_HYPER:
+      return gdk_pixbuf_scale_simple (src, width, height, GDK_INTERP_HYPER);
+    case METHOD_BOX:
+      return screenshot_resample (src, width, height, SCREENSHOT_RESAMPLE_BOX, n_threads);
+    case METHOD_LANCZOS:
+      return screenshot_resample (src, width, height, SCREENSHOT_RESAMPLE_LANCZOS, n_threads);
+    default:
+      g_assert_not_reached ();
+    }
+}
+
+static gint
+compare_times (gconstpointer a,
+               gconstpointer b)
+{
+  gint64 ta = *(const gint64 *) a, tb = *(const gint64 *) b;
+
+  return ta < tb ? -1 : ta > tb;
+}
+
+static void
+run_case (BenchFrameKind  kind,
+          GdkPixbuf      *src,
+          GdkPixbuf      *reference,
+          gint            width,
+          gint            height,
+          Method          method,
+          guint           n_threads)
+{
+  g_autofree gint64 *times = g_new (gint64, iterations);
+  GdkPixbuf *result = NULL;
+  gdouble ms, psnr;
+  gint i;
+
+  for (i = 0; i < iterations; i++)
+    {
+      gint64 start;
+
+      g_clear_object (&result);
+
+      start = g_get_monotonic_time ();
+      result = run_method (method, src, width, height, n_threads);
+      times[i] = g_get_monotonic_time () - start;
+    }
+
+  qsort (times, iterations, sizeof (gint64), compare_times);
+  ms = times[iterations / 2] / 1000.0;
+  psnr = bench_psnr (result, reference);
+
+  g_print ("{\"bench\": \"resample\", \"frame\": \"%s\", \"channels\": %d, "
+           "\"src\": \"%dx%d\", \"dest\": \"%dx%d\", \"method\": \"%s\", "
+           "\"threads\": %u, \"median_ms\": %.3f, \"mpix_per_s\": %.1f, ",
+           bench_frame_kind_to_string (kind),
+           gdk_pixbuf_get_n_channels (src),
+           gdk_pixbuf_get_width (src), gdk_pixbuf_get_height (src),
+           width, height,
+           method_names[method],
+           n_threads,
+           ms,
+           (gdouble) gdk_pixbuf_get_width (src) * gdk_pixbuf_get_height (src) / (ms * 1000.0));
+
+  if (isinf (psnr))
+    g_print ("\"psnr_db\": null}\n");
+  else
+    g_print ("\"psnr_db\": %.2f}\n", psnr);
+
+  g_object_unref (result);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  static const struct { gint width, height; } sizes[] = {
+    { 1920, 1080 },
+    { 3840, 2160 },
+  };
+  static const gdouble factors[] = { 0.5, 0.3, 0.75 };
+  g_autoptr(GOptionContext) context = NULL;
+  g_autoptr(GError) error = NULL;
+  guint n_cpus = g_get_num_processors ();
+  guint s, f;
+  gint kind;
+
+  context = g_option_context_new (NULL);
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return EXIT_FAILURE;
+    }
+
+  iterations = MAX (iterations, 1);
+
+  for (s = 0; s < G_N_ELEMENTS (sizes); s++)
+    {
+      if (quick && s > 0)
+        break;
+
+      for (kind = 0; kind < BENCH_FRAME_LAST; kind++)
+        {
+          g_autoptr(GdkPixbuf) src = bench_frame_new (kind, sizes[s].width, sizes[s].height, TRUE);
+
+          for (f = 0; f < G_N_ELEMENTS (factors); f++)
+            {
+              g_autoptr(GdkPixbuf) reference = NULL;
+              gint width = (gint) (sizes[s].width * factors[f] + 0.5);
+              gint height = (gint) (sizes[s].height * factors[f] + 0.5);
+
+              reference = run_method (METHOD_GDK_HYPER, src, width, height, 1);
+
+              run_case (kind, src, reference, width, height, METHOD_GDK_BILINEAR, 1);
+              run_case (kind, src, reference, width, height, METHOD_GDK_HYPER, 1);
+              run_case (kind, src, reference, width, height, METHOD_BOX, 1);
+              run_case (kind, src, reference, width, height, METHOD_LANCZOS, 1);
+
+              if (n_cpus > 1)
+                {
+                  run_case (kind, src, reference, width, height, METHOD_BOX, n_cpus);
+                  run_case (kind, src, reference, width, height, METHOD_LANCZOS, n_cpus);
+                }
+            }
+        }
+    }
+
+  return EXIT_SUCCESS;
+}
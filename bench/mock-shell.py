@@ -0,0 +1,189 @@
+#!/usr/bin/env python3
+
+# A stand-in for the screenshot interface of GNOME Shell, serving
+# synthetic frames, so that gnome-screenshot can be measured without a
+# desktop.  It owns org.gnome.Shell.Screenshot on the session bus, answers
+# every call after the configured latency and prints "ready" once the name
+# is owned.
+
+import argparse
+import struct
+import sys
+import zlib
+
+from gi.repository import Gio, GLib
+
+INTERFACE = '''
+<node>
+  <interface name="org.gnome.Shell.Screenshot">
+    <method name="Screenshot">
+      <arg type="b" direction="in" name="include_cursor"/>
+      <arg type="b" direction="in" name="flash"/>
+      <arg type="s" direction="in" name="filename"/>
+      <arg type="b" direction="out" name="success"/>
+      <arg type="s" direction="out" name="filename_used"/>
+    </method>
+    <method name="ScreenshotWindow">
+      <arg type="b" direction="in" name="include_frame"/>
+      <arg type="b" direction="in" name="include_cursor"/>
+      <arg type="b" direction="in" name="flash"/>
+      <arg type="s" direction="in" name="filename"/>
+      <arg type="b" direction="out" name="success"/>
+      <arg type="s" direction="out" name="filename_used"/>
+    </method>
+    <method name="ScreenshotArea">
+      <arg type="i" direction="in" name="x"/>
+      <arg type="i" direction="in" name="y"/>
+      <arg type="i" direction="in" name="width"/>
+      <arg type="i" direction="in" name="height"/>
+      <arg type="b" direction="in" name="flash"/>
+      <arg type="s" direction="in" name="filename"/>
+      <arg type="b" direction="out" name="success"/>
+      <arg type="s" direction="out" name="filename_used"/>
+    </method>
+    <method name="SelectArea">
+      <arg type="i" direction="out" name="x"/>
+      <arg type="i" direction="out" name="y"/>
+      <arg type="i" direction="out" name="width"/>
+      <arg type="i" direction="out" name="height"/>
+    </method>
+    <method name="FlashArea">
+      <arg type="i" direction="in" name="x"/>
+      <arg type="i" direction="in" name="y"/>
+      <arg type="i" direction="in" name="width"/>
+      <arg type="i" direction="in" name="height"/>
+    </method>
+  </interface>
+</node>
+'''
+
+
+def png_chunk(kind, data):
+    chunk = kind + data
+    return struct.pack('>I', len(data)) + chunk + struct.pack('>I', zlib.crc32(chunk))
+
+
+def make_frame(width, height):
+    '''A desktop-like frame: horizontal bands, a panel and a window, in
+    the PNG the shell would write'''
+    rows = []
+    panel = bytes((40, 40, 40)) * width
+    left = width // 8
+    right = width - width // 8
+    for y in range(height):
+        if y < 32:
+            row = panel
+        else:
+            shade = 60 + (y * 120 // height)
+            background = bytes((shade // 2, shade // 2, shade))
+            if height // 8 <= y < height - height // 8:
+                row = (background * left +
+                       bytes((246, 245, 244)) * (right - left) +
+                       background * (width - right))
+            else:
+                row = background * width
+        rows.append(b'\0' + row)
+
+    header = struct.pack('>IIBBBBB', width, height, 8, 2, 0, 0, 0)
+    return (b'\x89PNG\r\n\x1a\n' +
+            png_chunk(b'IHDR', header) +
+            png_chunk(b'IDAT', zlib.compress(b''.join(rows), 1)) +
+            png_chunk(b'IEND', b''))
+
+
+class MockShell:
+    def __init__(self, args):
+        self.args = args
+        self.frames = {}
+
+    def frame(self, width, height):
+        if (width, height) not in self.frames:
+            self.frames[(width, height)] = make_frame(width, height)
+        return self.frames[(width, height)]
+
+    def write_frame(self, filename, width, height):
+        with open(filename, 'wb') as f:
+            f.write(self.frame(max(width, 1), max(height, 1)))
+        return GLib.Variant('(bs)', (True, filename))
+
+    def handle(self, method, params):
+        a = self.args
+        if method == 'Screenshot':
+            return a.latency, lambda: self.write_frame(params[2], a.width, a.height)
+        if method == 'ScreenshotWindow':
+            return a.latency, lambda: self.write_frame(params[3], a.window_width, a.window_height)
+        if method == 'ScreenshotArea':
+            return a.latency, lambda: self.write_frame(params[5], params[2], params[3])
+        if method == 'SelectArea':
+            x, y, width, height = a.area
+            return a.select_latency, lambda: GLib.Variant('(iiii)', (x, y, width, height))
+        if method == 'FlashArea':
+            return 0, lambda: None
+        return None, None
+
+    def method_call(self, connection, sender, path, interface, method, params, invocation):
+        latency, reply = self.handle(method, params.unpack())
+        if reply is None:
+            invocation.return_dbus_error('org.freedesktop.DBus.Error.UnknownMethod', method)
+            return
+
+        def respond():
+            invocation.return_value(reply())
+            return GLib.SOURCE_REMOVE
+
+        if latency > 0:
+            GLib.timeout_add(latency, respond)
+        else:
+            respond()
+
+
+def parse_size(value):
+    width, height = value.split('x')
+    return int(width), int(height)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Mock GNOME Shell screenshot service')
+    parser.add_argument('--size', type=parse_size, default=(1920, 1080),
+                        help='size of full screen captures (default: 1920x1080)')
+    parser.add_argument('--window-size', type=parse_size, default=(1280, 800),
+                        help='size of window captures (default: 1280x800)')
+    parser.add_argument('--area', type=lambda v: tuple(int(n) for n in v.split(',')),
+                        default=(100, 100, 800, 600),
+                        help='what SelectArea returns, as x,y,width,height')
+    parser.add_argument('--latency', type=int, default=0,
+                        help='milliseconds before answering a capture')
+    parser.add_argument('--select-latency', type=int, default=0,
+                        help='milliseconds before answering SelectArea')
+    args = parser.parse_args()
+    args.width, args.height = args.size
+    args.window_width, args.window_height = args.window_size
+
+    shell = MockShell(args)
+    # encode the frame for full screen captures before any call
+    shell.frame(args.width, args.height)
+
+    loop = GLib.MainLoop()
+    node = Gio.DBusNodeInfo.new_for_xml(INTERFACE)
+
+    def bus_acquired(connection, name):
+        connection.register_object('/org/gnome/Shell/Screenshot',
+                                   node.interfaces[0],
+                                   shell.method_call, None, None)
+
+    def name_acquired(connection, name):
+        print('ready', flush=True)
+
+    def name_lost(connection, name):
+        print('Unable to own {}'.format(name), file=sys.stderr)
+        loop.quit()
+
+    Gio.bus_own_name(Gio.BusType.SESSION, 'org.gnome.Shell.Screenshot',
+                     Gio.BusNameOwnerFlags.NONE,
+                     bus_acquired, name_acquired, name_lost)
+    loop.run()
+    return 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,236 @@
+#!/usr/bin/env python3
+
+# Measures gnome-screenshot from start to saved file, without a desktop.
+#
+# A private session bus is started with mock-shell.py on it in place of
+# GNOME Shell, and an Xvfb server when there is no display or --xvfb is
+# given; with --backend x11 there is no mock and the X11 fallback is
+# used instead.  gnome-screenshot is then run repeatedly for each mode,
+# with its settings in memory, and one JSON object is printed per mode:
+# the median and 95th percentile of the wall time, the peak resident set
+# size and the median time of each stage from its own trace.
+#
+# Exits with 77, which meson reports as skipped, when dbus-daemon, Xvfb
+# or PyGObject are missing.
+
+import argparse
+import json
+import os
+import shutil
+import signal
+import subprocess
+import sys
+import tempfile
+import time
+
+SKIP = 77
+
+MODES = {
+    'screen': [],
+    'window': ['--window'],
+    'area': ['--area'],
+}
+
+
+def skip(reason):
+    print(reason, file=sys.stderr)
+    sys.exit(SKIP)
+
+
+def percentile(values, q):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(q * len(values)))]
+
+
+def start_bus(env):
+    if shutil.which('dbus-daemon') is None:
+        skip('dbus-daemon not found')
+
+    bus = subprocess.Popen(['dbus-daemon', '--session', '--nofork', '--print-address=1'],
+                           stdout=subprocess.PIPE, env=env, universal_newlines=True)
+    env['DBUS_SESSION_BUS_ADDRESS'] = bus.stdout.readline().strip()
+    return bus
+
+
+def start_xvfb(env, size):
+    if shutil.which('Xvfb') is None:
+        skip('Xvfb not found and no display to use')
+
+    read_fd, write_fd = os.pipe()
+    xvfb = subprocess.Popen(['Xvfb', '-displayfd', str(write_fd), '-nolisten', 'tcp',
+                             '-screen', '0', '{}x24'.format(size)],
+                            pass_fds=(write_fd,), env=env)
+    os.close(write_fd)
+    with os.fdopen(read_fd) as f:
+        display = f.readline().strip()
+    if not display:
+        skip('Xvfb did not start')
+
+    env['DISPLAY'] = ':' + display
+    env.pop('WAYLAND_DISPLAY', None)
+    return xvfb
+
+
+def start_mock_shell(env, args):
+    mock = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'mock-shell.py')
+    shell = subprocess.Popen([sys.executable, mock,
+                              '--size', args.size,
+                              '--window-size', args.window_size,
+                              '--latency', str(args.latency),
+                              '--select-latency', str(args.select_latency)],
+                             stdout=subprocess.PIPE, env=env, universal_newlines=True)
+    if shell.stdout.readline().strip() != 'ready':
+        shell.wait()
+        skip('the mock shell did not start, is PyGObject installed?')
+
+    return shell
+
+
+def compile_schema(schema, workdir, env):
+    schema_dir = os.path.join(workdir, 'schemas')
+    os.mkdir(schema_dir)
+    shutil.copy(schema, schema_dir)
+    subprocess.check_call(['glib-compile-schemas', schema_dir])
+
+    env['GSETTINGS_SCHEMA_DIR'] = schema_dir
+    env['GSETTINGS_BACKEND'] = 'memory'
+
+
+def stage_times(trace_path):
+    '''The duration of each span of a trace, in milliseconds'''
+    stages = {}
+    try:
+        with open(trace_path) as f:
+            events = json.load(f)['traceEvents']
+    except (OSError, ValueError):
+        return stages
+
+    for event in events:
+        if event.get('ph') == 'X':
+            stages[event['name']] = stages.get(event['name'], 0) + event['dur'] / 1000
+    return stages
+
+
+def run_once(args, mode, workdir, env, index):
+    output = os.path.join(workdir, 'shot-{}-{}.png'.format(mode, index))
+    trace = os.path.join(workdir, 'trace-{}-{}.json'.format(mode, index))
+    run_env = dict(env, GNOME_SCREENSHOT_TRACE=trace)
+
+    start = time.monotonic()
+    process = subprocess.Popen([args.gnome_screenshot, '--file', output] + MODES[mode],
+                               env=run_env)
+    _, status, usage = os.wait4(process.pid, 0)
+    elapsed = (time.monotonic() - start) * 1000
+    process.returncode = os.waitstatus_to_exitcode(status)
+
+    if process.returncode != 0 or not os.path.exists(output):
+        raise RuntimeError('gnome-screenshot failed in {} mode (exit status {})'.format(
+            mode, process.returncode))
+
+    size = os.path.getsize(output)
+    os.unlink(output)
+
+    # in kilobytes on Linux
+    return elapsed, usage.ru_maxrss * 1024, size, stage_times(trace)
+
+
+def run_mode(args, mode, workdir, env):
+    times, rss, stages = [], [], {}
+    size = 0
+
+    for i in range(args.warmup + args.runs):
+        elapsed, peak, size, spans = run_once(args, mode, workdir, env, i)
+        if i < args.warmup:
+            continue
+        times.append(elapsed)
+        rss.append(peak)
+        for name, duration in spans.items():
+            stages.setdefault(name, []).append(duration)
+
+    print(json.dumps({
+        'bench': 'e2e',
+        'backend': args.backend,
+        'mode': mode,
+        'size': args.size,
+        'latency_ms': args.latency,
+        'runs': args.runs,
+        'median_ms': round(percentile(times, 0.5), 3),
+        'p95_ms': round(percentile(times, 0.95), 3),
+        'median_rss_bytes': percentile(rss, 0.5),
+        'max_rss_bytes': max(rss),
+        'file_bytes': size,
+        'stages_ms': {name: round(percentile(values, 0.5), 3)
+                      for name, values in sorted(stages.items())},
+    }), flush=True)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='End-to-end gnome-screenshot benchmark')
+    parser.add_argument('--gnome-screenshot', required=True,
+                        help='the gnome-screenshot executable to run')
+    parser.add_argument('--schema', required=True,
+                        help='org.gnome.gnome-screenshot.gschema.xml')
+    parser.add_argument('--backend', choices=['shell', 'x11'], default='shell',
+                        help='capture through the mock shell or the X11 fallback')
+    parser.add_argument('--modes', default='screen,window,area',
+                        help='comma separated list of screen, window and area')
+    parser.add_argument('--runs', type=int, default=10,
+                        help='measured runs per mode (default: 10)')
+    parser.add_argument('--warmup', type=int, default=1,
+                        help='runs per mode before measuring (default: 1)')
+    parser.add_argument('--size', default='1920x1080',
+                        help='size of the screen (default: 1920x1080)')
+    parser.add_argument('--window-size', default='1280x800',
+                        help='size of window captures from the mock shell')
+    parser.add_argument('--latency', type=int, default=0,
+                        help='milliseconds the mock shell takes per capture')
+    parser.add_argument('--select-latency', type=int, default=0,
+                        help='milliseconds the mock shell takes to select an area')
+    parser.add_argument('--xvfb', action='store_true',
+                        help='start Xvfb even if there is a display')
+    args = parser.parse_args()
+
+    modes = args.modes.split(',')
+    for mode in modes:
+        if mode not in MODES:
+            parser.error('unknown mode: {}'.format(mode))
+
+    # the X11 fallback selects areas with the pointer
+    if args.backend == 'x11' and 'area' in modes:
+        print('Leaving out the area mode, which needs a pointer with X11', file=sys.stderr)
+        modes.remove('area')
+
+    env = dict(os.environ)
+    env.pop('DBUS_SESSION_BUS_ADDRESS', None)
+    if args.backend == 'x11':
+        env['GNOME_SCREENSHOT_FORCE_FALLBACK'] = '1'
+
+    children = []
+    with tempfile.TemporaryDirectory(prefix='gnome-screenshot-e2e-') as workdir:
+        env['XDG_CACHE_HOME'] = os.path.join(workdir, 'cache')
+        env['XDG_CONFIG_HOME'] = os.path.join(workdir, 'config')
+        env['XDG_DATA_HOME'] = os.path.join(workdir, 'data')
+
+        try:
+            compile_schema(args.schema, workdir, env)
+            if args.xvfb or 'DISPLAY' not in env:
+                children.append(start_xvfb(env, args.size))
+            children.append(start_bus(env))
+            if args.backend == 'shell':
+                children.append(start_mock_shell(env, args))
+
+            for mode in modes:
+                run_mode(args, mode, workdir, env)
+        except RuntimeError as e:
+            print(e, file=sys.stderr)
+            return 1
+        finally:
+            for child in reversed(children):
+                child.send_signal(signal.SIGTERM)
+                child.wait()
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,263 @@
+/* screenshot-admission.c - which capture requests run, and when
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+/* When gnome-screenshot keeps running, as a service or for the remote
+ * command lines and actions of later invocations, requests can come much
+ * faster than captures finish: a held down Print key, or a script.  Each
+ * capture takes the whole frame, encodes it and writes it, so running
+ * them all at once only makes every one of them slower.
+ *
+ * Requests therefore go through here first.  One that would save the
+ * same kind of screenshot to the same place as a request already running
+ * or waiting is coalesced into it, since the earlier one will show the
+ * screen as it is now anyway.  A remote command line that asked for a
+ * request coalesced or merged away waits for the one standing for it,
+ * see screenshot_capture_request_stand_for().  Up to max_running run at once; the others
+ * wait in a queue of at most max_queued, in order.  When that is full the
+ * new request is either dropped, or merged into the last one waiting,
+ * taking its place so that the latest options win.  Only screenshots
+ * saved under a name of their own can go that way: one for a file the
+ * caller named, or for the clipboard, is queued anyway, since whoever
+ * asked for it waits for it or pastes it next.
+ *
+ * The dialog and explicit destinations never coalesce, see
+ * screenshot_capture_request_is_equivalent().
+ */
+
+#include "config.h"
+
+#include "screenshot-admission.h"
+#include "screenshot-metrics.h"
+
+typedef struct {
+  ScreenshotCaptureRequest *request;
+  gint64 queued_at;
+} QueuedRequest;
+
+struct _ScreenshotAdmission
+{
+  guint max_running;
+  guint max_queued;
+  ScreenshotAdmissionOverflow overflow;
+  ScreenshotAdmissionStartFunc start_func;
+  gpointer user_data;
+
+  /* of ScreenshotCaptureRequest, and of QueuedRequest */
+  GPtrArray *running;
+  GQueue queued;
+};
+
+static const gchar *decision_nicks[] = {
+  [SCREENSHOT_ADMISSION_STARTED] = "started",
+  [SCREENSHOT_ADMISSION_QUEUED] = "queued",
+  [SCREENSHOT_ADMISSION_COALESCED] = "coalesced",
+  [SCREENSHOT_ADMISSION_MERGED] = "merged",
+  [SCREENSHOT_ADMISSION_DROPPED] = "dropped"
+};
+
+const gchar *
+screenshot_admission_decision_get_nick (ScreenshotAdmissionDecision decision)
+{
+  return decision_nicks[decision];
+}
+
+static void
+queued_request_free (QueuedRequest *queued)
+{
+  screenshot_capture_request_unref (queued->request);
+  g_slice_free (QueuedRequest, queued);
+}
+
+/**
+ * screenshot_admission_new:
+ * @max_running: how many captures may run at once, at least 1
+ * @max_queued: how many may wait for their turn
+ * @overflow: what to do with a request when @max_queued are waiting
+ * @start_func: called to run a request, once it is its turn
+ * @user_data: passed to @start_func
+ *
+ * Every request started must be handed back to
+ * screenshot_admission_done() once it is done with.
+ */
+ScreenshotAdmission *
+screenshot_admission_new (guint                         max_running,
+                          guint                         max_queued,
+                          ScreenshotAdmissionOverflow   overflow,
+                          ScreenshotAdmissionStartFunc  start_func,
+                          gpointer                      user_data)
+{
+  ScreenshotAdmission *admission;
+
+  admission = g_slice_new0 (ScreenshotAdmission);
+  admission->max_running = MAX (max_running, 1);
+  admission->max_queued = max_queued;
+  admission->overflow = overflow;
+  admission->start_func = start_func;
+  admission->user_data = user_data;
+  admission->running = g_ptr_array_new_with_free_func ((GDestroyNotify) screenshot_capture_request_unref);
+  g_queue_init (&admission->queued);
+
+  return admission;
+}
+
+void
+screenshot_admission_free (ScreenshotAdmission *admission)
+{
+  g_ptr_array_unref (admission->running);
+  g_queue_clear_full (&admission->queued, (GDestroyNotify) queued_request_free);
+  g_slice_free (ScreenshotAdmission, admission);
+}
+
+/* The request running or waiting that can stand for @request, or NULL */
+static ScreenshotCaptureRequest *
+find_equivalent (ScreenshotAdmission      *admission,
+                 ScreenshotCaptureRequest *request)
+{
+  GList *l;
+  guint i;
+
+  for (i = 0; i < admission->running->len; i++)
+    if (screenshot_capture_request_is_equivalent (admission->running->pdata[i], request))
+      return admission->running->pdata[i];
+
+  for (l = admission->queued.head; l != NULL; l = l->next)
+    {
+      QueuedRequest *queued = l->data;
+
+      if (screenshot_capture_request_is_equivalent (queued->request, request))
+        return queued->request;
+    }
+
+  return NULL;
+}
+
+/* Whether @request only saves under a new name in the folder, so that
+ * nobody misses it if another stands for it
+ */
+static gboolean
+is_expendable (ScreenshotCaptureRequest *request)
+{
+  return !screenshot_capture_request_has_explicit_destination (request) &&
+         !request->options.copy_to_clipboard;
+}
+
+static void
+start (ScreenshotAdmission      *admission,
+       ScreenshotCaptureRequest *request)
+{
+  g_ptr_array_add (admission->running, screenshot_capture_request_ref (request));
+  admission->start_func (request, admission->user_data);
+}
+
+static ScreenshotAdmissionDecision
+admit (ScreenshotAdmission      *admission,
+       ScreenshotCaptureRequest *request)
+{
+  ScreenshotCaptureRequest *equivalent;
+  QueuedRequest *queued;
+
+  equivalent = find_equivalent (admission, request);
+  if (equivalent != NULL)
+    {
+      screenshot_capture_request_stand_for (equivalent, request);
+      return SCREENSHOT_ADMISSION_COALESCED;
+    }
+
+  if (admission->running->len < admission->max_running)
+    {
+      start (admission, request);
+      return SCREENSHOT_ADMISSION_STARTED;
+    }
+
+  if (admission->queued.length < admission->max_queued ||
+      !is_expendable (request))
+    {
+      queued = g_slice_new (QueuedRequest);
+      queued->request = screenshot_capture_request_ref (request);
+      queued->queued_at = g_get_monotonic_time ();
+      g_queue_push_tail (&admission->queued, queued);
+
+      return SCREENSHOT_ADMISSION_QUEUED;
+    }
+
+  queued = admission->queued.tail != NULL ? admission->queued.tail->data : NULL;
+
+  if (admission->overflow == SCREENSHOT_ADMISSION_OVERFLOW_MERGE &&
+      queued != NULL && is_expendable (queued->request))
+    {
+      /* keeps its place, and how long it has been waiting */
+      screenshot_capture_request_stand_for (request, queued->request);
+      screenshot_capture_request_unref (queued->request);
+      queued->request = screenshot_capture_request_ref (request);
+
+      return SCREENSHOT_ADMISSION_MERGED;
+    }
+
+  return SCREENSHOT_ADMISSION_DROPPED;
+}
+
+/**
+ * screenshot_admission_submit:
+ * @admission: a #ScreenshotAdmission
+ * @request: a capture request
+ *
+ * Starts @request, queues it, or decides that it does not need to run.
+ *
+ * Returns: what was done with @request
+ */
+ScreenshotAdmissionDecision
+screenshot_admission_submit (ScreenshotAdmission      *admission,
+                             ScreenshotCaptureRequest *request)
+{
+  ScreenshotAdmissionDecision decision;
+
+  decision = admit (admission, request);
+
+  screenshot_metrics_count_admission (decision_nicks[decision]);
+  screenshot_metrics_set_queue_depth (admission->queued.length);
+
+  return decision;
+}
+
+/**
+ * screenshot_admission_done:
+ * @admission: a #ScreenshotAdmission
+ * @request: a capture request
+ *
+ * Lets the requests waiting behind @request start.  Does nothing if
+ * @request was not started by @admission, or was already done.
+ */
+void
+screenshot_admission_done (ScreenshotAdmission      *admission,
+                           ScreenshotCaptureRequest *request)
+{
+  if (!g_ptr_array_remove (admission->running, request))
+    return;
+
+  while (admission->running->len < admission->max_running &&
+         !g_queue_is_empty (&admission->queued))
+    {
+      QueuedRequest *queued = g_queue_pop_head (&admission->queued);
+
+      screenshot_metrics_observe_queue_wait (g_get_monotonic_time () - queued->queued_at);
+      screenshot_metrics_count_admission (decision_nicks[SCREENSHOT_ADMISSION_STARTED]);
+      start (admission, queued->request);
+      queued_request_free (queued);
+    }
+
+  screenshot_metrics_set_queue_depth (admission->queued.length);
+}
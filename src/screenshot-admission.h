@@ -0,0 +1,60 @@
+/* screenshot-admission.h - which capture requests run, and when
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+#ifndef __SCREENSHOT_ADMISSION_H__
+#define __SCREENSHOT_ADMISSION_H__
+
+#include "screenshot-capture-request.h"
+
+G_BEGIN_DECLS
+
+/* The values of the capture-queue-overflow setting */
+typedef enum {
+  SCREENSHOT_ADMISSION_OVERFLOW_DROP,
+  SCREENSHOT_ADMISSION_OVERFLOW_MERGE
+} ScreenshotAdmissionOverflow;
+
+typedef enum {
+  SCREENSHOT_ADMISSION_STARTED,
+  SCREENSHOT_ADMISSION_QUEUED,
+  SCREENSHOT_ADMISSION_COALESCED,
+  SCREENSHOT_ADMISSION_MERGED,
+  SCREENSHOT_ADMISSION_DROPPED
+} ScreenshotAdmissionDecision;
+
+typedef void (*ScreenshotAdmissionStartFunc) (ScreenshotCaptureRequest *request,
+                                              gpointer                  user_data);
+
+typedef struct _ScreenshotAdmission ScreenshotAdmission;
+
+ScreenshotAdmission         *screenshot_admission_new    (guint                         max_running,
+                                                          guint                         max_queued,
+                                                          ScreenshotAdmissionOverflow   overflow,
+                                                          ScreenshotAdmissionStartFunc  start_func,
+                                                          gpointer                      user_data);
+void                         screenshot_admission_free   (ScreenshotAdmission          *admission);
+
+ScreenshotAdmissionDecision  screenshot_admission_submit (ScreenshotAdmission          *admission,
+                                                          ScreenshotCaptureRequest     *request);
+void                         screenshot_admission_done   (ScreenshotAdmission          *admission,
+                                                          ScreenshotCaptureRequest     *request);
+
+const gchar                 *screenshot_admission_decision_get_nick (ScreenshotAdmissionDecision decision);
+
+G_END_DECLS
+
+#endif /* __SCREENSHOT_ADMISSION_H__ */
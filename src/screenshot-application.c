@@ -24,31 +24,52 @@
 
 #include <gdk/gdkx.h>
 #include <gdk/gdkkeysyms.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
 #include <locale.h>
 #include <glib/gi18n.h>
 #include <gio/gio.h>
+#include <gio/gunixoutputstream.h>
 #include <gtk/gtk.h>
 
 #include "screenshot-application.h"
+#include "screenshot-admission.h"
 #include "screenshot-area-selection.h"
+#include "screenshot-capture-request.h"
 #include "screenshot-config.h"
+#include "screenshot-content.h"
+#include "screenshot-delta.h"
+#include "screenshot-effect-stack.h"
+#include "screenshot-encoder.h"
 #include "screenshot-filename-builder.h"
+#include "screenshot-formats.h"
+#include "screenshot-history.h"
+#include "screenshot-image.h"
 #include "screenshot-interactive-dialog.h"
-#include "screenshot-shadow.h"
+#include "screenshot-pixbuf-pool.h"
 #include "screenshot-utils.h"
 #include "screenshot-dialog.h"
+#include "screenshot-resample.h"
+#include "screenshot-stream.h"
+#include "screenshot-metrics.h"
+#include "screenshot-trace.h"
+#include "screenshot-viewer.h"
+#include "screenshot-watch.h"
 
 #define LAST_SAVE_DIRECTORY_KEY "last-save-directory"
 
+/* one at a time, the rest wait in the admission queue */
+#define MAX_RUNNING_CAPTURES 1
+
+#define VIEWER_MAX_DEFAULT_WIDTH  1280
+#define VIEWER_MAX_DEFAULT_HEIGHT 800
+
 /* Event callbacks */
 static gboolean keyPress(GtkWidget *widget, gpointer data);
-static gboolean sizeChanged(GtkWidget *widget, GtkAllocation *allocation, gpointer data);
-
-static GtkWidget *image; /* As displayed on the screen */
 
 G_DEFINE_TYPE(ScreenshotApplication, screenshot_application, GTK_TYPE_APPLICATION);
 void destroy_widget(GtkButton *button, GtkWidget *widget){
@@ -85,22 +106,90 @@ void showArlert()
 
 
 
-static void screenshot_save_to_file(ScreenshotApplication *self);
+static void screenshot_save_to_file(ScreenshotCaptureRequest *request);
 static void screenshot_show_interactive_dialog(ScreenshotApplication *self);
+static void link_watch_screenshot_to(ScreenshotApplication *self, const gchar *target);
 
 pthread_mutex_t clients_mutex = PTHREAD_MUTEX_INITIALIZER;
 struct _ScreenshotApplicationPriv
 {
-  gchar *icc_profile_base64;
-  GdkPixbuf *screenshot;
-
-  gchar *save_uri;
-  gchar *save_path;
-  gboolean should_overwrite;
-
+  ScreenshotAdmission *admission;
+
+  /* the recent frames of the screen, with --history */
+  ScreenshotHistory *history;
+
+  /* with --watch, and what each of its screenshots is taken with */
+  ScreenshotWatch *watch;
+  ScreenshotCaptureRequest *watch_request;
+
+  /* the last full screenshot of the watch, that deltas are made against,
+   * the last file it saved, that checks finding nothing new link to, and
+   * the newest screenshot asked for, until it is saved or failed */
+  ScreenshotTileHashes *watch_keyframe;
+  gchar *watch_keyframe_path;
+  gchar *watch_last_path;
+  ScreenshotCaptureRequest *watch_newest;
+
+  /* each capture carries its own request through the callbacks, this is
+   * the one shown in the dialog */
+  ScreenshotCaptureRequest *dialog_request;
   ScreenshotDialog *dialog;
+
+  /* what the dialog would save, encoded while it is open */
+  GCancellable *encode_cancellable;
+  ScreenshotImage *encode_source;
+  gchar *encode_format;
+  GBytes *encoded;
+  gboolean save_pending;
 };
 
+/* The callbacks of a capture only get its request */
+static ScreenshotApplication *
+get_application(void)
+{
+  return SCREENSHOT_APPLICATION(g_application_get_default());
+}
+
+/* Lets the remote command lines that asked for @request, or for the
+ * requests it stands for, return with @exit_status */
+static void
+finish_command_line(ScreenshotCaptureRequest *request,
+                    gint exit_status)
+{
+  guint i;
+
+  if (request->merged_command_lines != NULL)
+  {
+    for (i = 0; i < request->merged_command_lines->len; i++)
+      g_application_command_line_set_exit_status(request->merged_command_lines->pdata[i],
+                                                 exit_status);
+    g_clear_pointer(&request->merged_command_lines, g_ptr_array_unref);
+  }
+
+  if (request->command_line == NULL)
+    return;
+
+  g_application_command_line_set_exit_status(request->command_line, exit_status);
+  g_clear_object(&request->command_line);
+}
+
+/* A command line naming a file learns of failures through the exit
+ * status.  A remote one is told; this instance goes on for the others,
+ * as it does when it keeps the history, which must outlive it */
+static void
+exit_if_explicit_destination(ScreenshotCaptureRequest *request)
+{
+  gboolean remote = request->command_line != NULL;
+
+  finish_command_line(request, EXIT_FAILURE);
+  if (remote)
+    return;
+
+  if (screenshot_capture_request_has_explicit_destination(request) &&
+      get_application()->priv->history == NULL)
+    exit(EXIT_FAILURE);
+}
+
 static void
 save_folder_to_settings(ScreenshotApplication *self)
 {
@@ -110,7 +199,7 @@ save_folder_to_settings(ScreenshotApplication *self)
 }
 
 static void
-set_recent_entry(ScreenshotApplication *self)
+set_recent_entry(ScreenshotCaptureRequest *request)
 {
   g_autofree gchar *app_exec = NULL;
   g_autoptr(GAppInfo) app = NULL;
@@ -119,6 +208,10 @@ set_recent_entry(ScreenshotApplication *self)
   const char *exec_name = NULL;
   static char *groups[2] = {"Graphics", NULL};
 
+  /* nothing to remember when streaming to a file descriptor */
+  if (request->save_uri == NULL)
+    return;
+
   app = g_app_info_get_default_for_type("image/png", TRUE);
 
   if (!app)
@@ -140,7 +233,51 @@ set_recent_entry(ScreenshotApplication *self)
   recent_data.groups = groups;
   recent_data.is_private = FALSE;
 
-  gtk_recent_manager_add_full(recent, self->priv->save_uri, &recent_data);
+  gtk_recent_manager_add_full(recent, request->save_uri, &recent_data);
+}
+
+/* Drops the encoding made for the save dialog, stopping it if it is
+ * still running.
+ */
+static void
+cancel_speculative_encode(ScreenshotApplication *self)
+{
+  ScreenshotApplicationPriv *priv = self->priv;
+
+  if (priv->encode_cancellable != NULL)
+  {
+    g_cancellable_cancel(priv->encode_cancellable);
+    g_clear_object(&priv->encode_cancellable);
+  }
+
+  g_clear_pointer(&priv->encode_source, screenshot_image_unref);
+  g_clear_pointer(&priv->encode_format, g_free);
+  g_clear_pointer(&priv->encoded, g_bytes_unref);
+}
+
+/* Ends the spans of a screenshot that is done with, one way or another,
+ * counts it and writes out the trace and the metrics; the next request
+ * waiting can then start */
+static void
+finish_trace(ScreenshotCaptureRequest *request,
+             const gchar *outcome)
+{
+  ScreenshotApplication *self = get_application();
+
+  if (self->priv->admission != NULL)
+    screenshot_admission_done(self->priv->admission, request);
+
+  if (request->trace_span == NULL)
+    return;
+
+  screenshot_trace_end(g_steal_pointer(&request->wait_span));
+  screenshot_trace_end(g_steal_pointer(&request->save_span));
+  screenshot_trace_set_backend(request->trace_span, outcome);
+  screenshot_trace_end(g_steal_pointer(&request->trace_span));
+  screenshot_trace_flush();
+
+  screenshot_metrics_count_capture(request->mode, outcome);
+  screenshot_metrics_flush();
 }
 
 static void
@@ -148,16 +285,78 @@ screenshot_close_interactive_dialog(ScreenshotApplication *self)
 {
   ScreenshotDialog *dialog = self->priv->dialog;
   save_folder_to_settings(self);
+  cancel_speculative_encode(self);
+  self->priv->save_pending = FALSE;
+  /* unless it was saved, another capture replaces it */
+  finish_trace(self->priv->dialog_request, "replaced");
+  g_clear_pointer(&self->priv->dialog_request, screenshot_capture_request_unref);
   gtk_widget_destroy(dialog->dialog);
   g_free(dialog);
+  self->priv->dialog = NULL;
 }
 
+/* Remembers where the watch saved @request, for the deltas and links
+ * that come after it, and makes the links that waited for it */
 static void
-save_pixbuf_handle_success(ScreenshotApplication *self)
+watch_saved(ScreenshotApplication *self,
+            ScreenshotCaptureRequest *request)
 {
-  set_recent_entry(self);
+  ScreenshotApplicationPriv *priv = self->priv;
+  gboolean is_delta = g_strcmp0(request->file_type, SCREENSHOT_DELTA_EXTENSION) == 0;
+  guint i;
 
-  if (screenshot_config->interactive)
+  screenshot_metrics_count_watch_save(is_delta ? "delta" : "full");
+
+  if (!is_delta)
+  {
+    g_clear_pointer(&priv->watch_keyframe, screenshot_tile_hashes_free);
+    priv->watch_keyframe = g_steal_pointer(&request->tile_hashes);
+    g_free(priv->watch_keyframe_path);
+    priv->watch_keyframe_path = g_strdup(request->save_path);
+  }
+
+  if (request == priv->watch_newest)
+  {
+    g_free(priv->watch_last_path);
+    priv->watch_last_path = g_strdup(request->save_path);
+    g_clear_pointer(&priv->watch_newest, screenshot_capture_request_unref);
+  }
+
+  for (i = 0; i < request->n_links; i++)
+    link_watch_screenshot_to(self, request->save_path);
+  request->n_links = 0;
+}
+
+/* The checks that waited for @request have nothing to link to */
+static void
+watch_failed(ScreenshotApplication *self,
+             ScreenshotCaptureRequest *request)
+{
+  if (request->n_links > 0)
+    g_warning("%u unchanged screenshots are not saved, the one they would link to failed",
+              request->n_links);
+  request->n_links = 0;
+
+  if (request == self->priv->watch_newest)
+    g_clear_pointer(&self->priv->watch_newest, screenshot_capture_request_unref);
+}
+
+static void
+save_pixbuf_handle_success(ScreenshotCaptureRequest *request)
+{
+  ScreenshotApplication *self = get_application();
+
+  if (request->tile_hashes != NULL)
+    watch_saved(self, request);
+
+  finish_trace(request, "saved");
+  finish_command_line(request, EXIT_SUCCESS);
+
+  /* no image viewer can open a delta */
+  if (g_strcmp0(request->file_type, SCREENSHOT_DELTA_EXTENSION) != 0)
+    set_recent_entry(request);
+
+  if (request->options.interactive)
   {
     screenshot_close_interactive_dialog(self);
   }
@@ -168,17 +367,25 @@ save_pixbuf_handle_success(ScreenshotApplication *self)
 }
 
 static void
-save_pixbuf_handle_error(ScreenshotApplication *self,
+save_pixbuf_handle_error(ScreenshotCaptureRequest *request,
                          GError *error)
 {
-  if (screenshot_config->interactive)
+  ScreenshotApplication *self = get_application();
+
+  screenshot_metrics_count_failure("save", screenshot_metrics_error_reason(error));
+  finish_trace(request, "failed");
+
+  if (request->tile_hashes != NULL)
+    watch_failed(self, request);
+
+  if (request->options.interactive)
   {
     ScreenshotDialog *dialog = self->priv->dialog;
 
     screenshot_dialog_set_busy(dialog, FALSE);
 
     if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_EXISTS) &&
-        !self->priv->should_overwrite)
+        !request->should_overwrite)
     {
       g_autofree gchar *folder = screenshot_dialog_get_folder(dialog);
       g_autofree gchar *folder_uri = g_path_get_basename(folder);
@@ -195,8 +402,8 @@ save_pixbuf_handle_error(ScreenshotApplication *self,
 
       if (response == GTK_RESPONSE_YES)
       {
-        self->priv->should_overwrite = TRUE;
-        screenshot_save_to_file(self);
+        request->should_overwrite = TRUE;
+        screenshot_save_to_file(request);
 
         return;
       }
@@ -215,31 +422,11 @@ save_pixbuf_handle_error(ScreenshotApplication *self,
   else
   {
     g_critical("Unable to save the screenshot: %s", error->message);
-    if (screenshot_config->play_sound)
+    if (request->options.play_sound)
       screenshot_play_sound_effect("dialog-error", _("Unable to capture a screenshot"));
     g_application_release(G_APPLICATION(self));
-    if (screenshot_config->file != NULL)
-      exit(EXIT_FAILURE);
-  }
-}
-
-static void
-save_pixbuf_ready_cb(GObject *source,
-                     GAsyncResult *res,
-                     gpointer user_data)
-{
-  g_autoptr(GError) error = NULL;
-  ScreenshotApplication *self = user_data;
-
-  gdk_pixbuf_save_to_stream_finish(res, &error);
-
-  if (error != NULL)
-  {
-    save_pixbuf_handle_error(self, error);
-    return;
+    exit_if_explicit_destination(request);
   }
-
-  save_pixbuf_handle_success(self);
 }
 
 static void
@@ -264,60 +451,206 @@ find_out_writable_format_by_extension(gpointer data,
   }
 }
 
-static gboolean
-is_png(gchar *format)
+/* @extension must be a real one, "auto" has to be resolved first, see
+ * resolve_file_type() */
+static gchar *
+get_writable_format(const gchar *extension)
 {
-  if (g_strcmp0(format, "png") == 0)
-    return TRUE;
+  gchar *format = g_strdup(extension);
+  GSList *formats = NULL;
+
+  formats = gdk_pixbuf_get_formats();
+  g_slist_foreach(formats,
+                  find_out_writable_format_by_extension,
+                  (gpointer)&format);
+  g_slist_free(formats);
+
+  return format;
+}
+
+static gchar *
+get_format_for_filename(const gchar *basename)
+{
+  const gchar *extension = g_strrstr(basename, ".");
+
+  if (extension == NULL)
+    extension = "png";
   else
-    return FALSE;
+    extension++;
+
+  return get_writable_format(extension);
+}
+
+static void
+speculative_encode_ready_cb(GObject *source,
+                            GAsyncResult *res,
+                            gpointer user_data)
+{
+  ScreenshotApplication *self = user_data;
+  ScreenshotApplicationPriv *priv;
+  g_autoptr(GError) error = NULL;
+  GBytes *bytes;
+
+  bytes = screenshot_encode_finish(res, &error);
+
+  /* replaced by another encoding, or the dialog is gone */
+  if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    return;
+
+  priv = self->priv;
+  g_clear_object(&priv->encode_cancellable);
+
+  if (error != NULL)
+  {
+    /* forget it, so that saving tries again and reports the error */
+    g_clear_pointer(&priv->encode_source, screenshot_image_unref);
+    g_clear_pointer(&priv->encode_format, g_free);
+
+    if (priv->save_pending)
+    {
+      priv->save_pending = FALSE;
+      save_pixbuf_handle_error(priv->dialog_request, error);
+    }
+
+    return;
+  }
+
+  priv->encoded = bytes;
+
+  if (priv->save_pending)
+  {
+    priv->save_pending = FALSE;
+    screenshot_save_to_file(priv->dialog_request);
+  }
 }
 
+/* Makes sure @image is being encoded as @format, replacing any other
+ * encoding.  Returns TRUE if the result is already there.
+ */
 static gboolean
-has_profile(ScreenshotApplication *self)
+ensure_encoded(ScreenshotApplication *self,
+               ScreenshotImage *image,
+               const gchar *format)
 {
-  if (self->priv->icc_profile_base64 != NULL)
-    return TRUE;
-  else
-    return FALSE;
+  ScreenshotApplicationPriv *priv = self->priv;
+
+  if (image == priv->encode_source &&
+      g_strcmp0(format, priv->encode_format) == 0)
+    return priv->encoded != NULL;
+
+  cancel_speculative_encode(self);
+
+  priv->encode_source = screenshot_image_ref(image);
+  priv->encode_format = g_strdup(format);
+  priv->encode_cancellable = g_cancellable_new();
+
+  screenshot_encode_async(image, format, priv->dialog_request->icc_profile_base64,
+                          priv->dialog_request->jpeg_quality,
+                          priv->encode_cancellable,
+                          speculative_encode_ready_cb, self);
+
+  return FALSE;
+}
+
+/* Starts encoding what the dialog would save now, so that Save only has
+ * to write it out.
+ */
+static void
+encode_for_dialog(ScreenshotApplication *self)
+{
+  g_autofree gchar *filename = screenshot_dialog_get_filename(self->priv->dialog);
+  g_autofree gchar *format = get_format_for_filename(filename);
+
+  ensure_encoded(self, screenshot_dialog_get_screenshot(self->priv->dialog), format);
+}
+
+static void
+dialog_changed_cb(GtkWidget *widget,
+                  ScreenshotApplication *self)
+{
+  /* a save in progress keeps what it was started with */
+  if (self->priv->save_pending)
+    return;
+
+  encode_for_dialog(self);
+}
+
+/* A delta, encoded before it has a name to be written to */
+typedef struct
+{
+  ScreenshotCaptureRequest *request;
+  GBytes *bytes;
+} SaveEncodedJob;
+
+static void
+save_encoded_job_free(SaveEncodedJob *job)
+{
+  screenshot_capture_request_unref(job->request);
+  g_clear_pointer(&job->bytes, g_bytes_unref);
+  g_free(job);
 }
 
 static void
-save_with_description_and_profile(ScreenshotApplication *self,
-                                  GFileOutputStream *os,
-                                  gchar *format)
-{
-  gdk_pixbuf_save_to_stream_async(self->priv->screenshot,
-                                  G_OUTPUT_STREAM(os),
-                                  format, NULL,
-                                  save_pixbuf_ready_cb, self,
-                                  "icc-profile", self->priv->icc_profile_base64,
-                                  "tEXt::Software", "gnome-screenshot",
-                                  NULL);
+save_encoded_ready_cb(GObject *source,
+                      GAsyncResult *res,
+                      gpointer user_data)
+{
+  g_autoptr(ScreenshotCaptureRequest) request = user_data;
+  g_autoptr(GError) error = NULL;
+  gssize written;
+
+  written = screenshot_encode_to_stream_finish(res, &error);
+  if (written < 0)
+  {
+    save_pixbuf_handle_error(request, error);
+    return;
+  }
+
+  screenshot_trace_set_bytes(request->save_span, written);
+  save_pixbuf_handle_success(request);
 }
+
+/* Everything goes through the encoder, which writes PNG indexed when the
+ * capture has few enough colours and with the same description and
+ * profile as gdk-pixbuf would otherwise, and writes the formats
+ * gdk-pixbuf cannot.  It writes into @os as it encodes, then closes it,
+ * so that errors completing a file are reported too.
+ */
 static void
-save_with_description(ScreenshotApplication *self,
-                      GFileOutputStream *os,
-                      gchar *format)
+save_to_stream(ScreenshotCaptureRequest *request,
+               GOutputStream *os,
+               gchar *format)
 {
-  gdk_pixbuf_save_to_stream_async(self->priv->screenshot,
-                                  G_OUTPUT_STREAM(os),
-                                  format, NULL,
-                                  save_pixbuf_ready_cb, self,
-                                  "tEXt::Software", "gnome-screenshot",
-                                  NULL);
+  screenshot_trace_end(request->save_span);
+  request->save_span = screenshot_trace_begin("save");
+  screenshot_trace_set_backend(request->save_span, format);
+
+  screenshot_encode_to_stream_async(request->screenshot, format,
+                                    request->icc_profile_base64,
+                                    g_strcmp0(format, "jpeg") == 0 ? request->jpeg_quality : -1,
+                                    os, NULL,
+                                    save_encoded_ready_cb,
+                                    screenshot_capture_request_ref(request));
 }
 
 static void
-save_with_no_profile_or_description(ScreenshotApplication *self,
-                                    GFileOutputStream *os,
-                                    gchar *format)
+save_bytes_ready_cb(GObject *source,
+                    GAsyncResult *res,
+                    gpointer user_data)
 {
-  gdk_pixbuf_save_to_stream_async(self->priv->screenshot,
-                                  G_OUTPUT_STREAM(os),
-                                  format, NULL,
-                                  save_pixbuf_ready_cb, self,
-                                  NULL);
+  g_autoptr(ScreenshotCaptureRequest) request = user_data;
+  g_autoptr(GError) error = NULL;
+
+  screenshot_write_bytes_finish(res, &error);
+
+  if (error != NULL)
+  {
+    save_pixbuf_handle_error(request, error);
+    return;
+  }
+
+  g_debug("Saved %s", request->save_uri);
+  save_pixbuf_handle_success(request);
 }
 
 static void
@@ -325,69 +658,87 @@ save_file_create_ready_cb(GObject *source,
                           GAsyncResult *res,
                           gpointer user_data)
 {
-  ScreenshotApplication *self = user_data;
+  g_autoptr(ScreenshotCaptureRequest) request = user_data;
   g_autoptr(GFileOutputStream) os = NULL;
   g_autoptr(GError) error = NULL;
   g_autofree gchar *basename = g_file_get_basename(G_FILE(source));
-  g_autofree gchar *format = NULL;
-  gchar *extension = g_strrstr(basename, ".");
-  GSList *formats = NULL;
-
-  if (extension == NULL)
-    extension = "png";
-  else
-    extension++;
-
-  format = g_strdup(extension);
-
-  formats = gdk_pixbuf_get_formats();
-  g_slist_foreach(formats,
-                  find_out_writable_format_by_extension,
-                  (gpointer)&format);
-  g_slist_free(formats);
+  g_autofree gchar *format = get_format_for_filename(basename);
 
-  if (self->priv->should_overwrite)
+  if (request->should_overwrite)
     os = g_file_replace_finish(G_FILE(source), res, &error);
   else
     os = g_file_create_finish(G_FILE(source), res, &error);
 
   if (error != NULL)
   {
-    save_pixbuf_handle_error(self, error);
+    save_pixbuf_handle_error(request, error);
     return;
   }
 
-  if (is_png(format))
-  {
-    if (has_profile(self))
-      save_with_description_and_profile(self, os, format);
-    else
-      save_with_description(self, os, format);
-  }
-  else
-  {
-    save_with_no_profile_or_description(self, os, format);
-  }
+  save_to_stream(request, G_OUTPUT_STREAM(os), format);
+}
+
+/* Encodes straight into the descriptor given on the command line, so that
+ * the image can be piped to another program without touching the disk.
+ * There is no file name to take the format from, so the default file type
+ * is used.
+ */
+static void
+screenshot_save_to_fd(ScreenshotCaptureRequest *request)
+{
+  g_autoptr(GOutputStream) os = NULL;
+  g_autofree gchar *format = NULL;
+
+  os = g_unix_output_stream_new(request->options.file_fd, FALSE);
+  format = get_writable_format(request->file_type);
+
+  save_to_stream(request, os, format);
 }
 
 static void
-screenshot_save_to_file(ScreenshotApplication *self)
+screenshot_save_to_file(ScreenshotCaptureRequest *request)
 {
+  ScreenshotApplication *self = get_application();
   g_autoptr(GFile) target_file = NULL;
 
-  if (self->priv->dialog != NULL)
+  target_file = g_file_new_for_uri(request->save_uri);
+
+  if (self->priv->dialog != NULL && request == self->priv->dialog_request)
+  {
+    g_autofree gchar *basename = g_file_get_basename(target_file);
+    g_autofree gchar *format = get_format_for_filename(basename);
+
     screenshot_dialog_set_busy(self->priv->dialog, TRUE);
 
-  target_file = g_file_new_for_uri(self->priv->save_uri);
+    /* wait for the encoding, which normally started with the dialog */
+    if (!ensure_encoded(self, request->screenshot, format))
+    {
+      self->priv->save_pending = TRUE;
+      return;
+    }
+
+    /* the bytes are kept, so overwriting or retrying elsewhere after an
+     * error is only a write */
+    screenshot_write_bytes_async(self->priv->encoded, target_file,
+                                 request->should_overwrite, NULL,
+                                 save_bytes_ready_cb,
+                                 screenshot_capture_request_ref(request));
+    return;
+  }
+
+  /* until the file is open, then until it is written */
+  screenshot_trace_end(request->save_span);
+  request->save_span = screenshot_trace_begin("open");
 
-  if (self->priv->should_overwrite)
+  if (request->should_overwrite)
   {
     g_file_replace_async(target_file,
                          NULL, FALSE,
                          G_FILE_CREATE_NONE,
                          G_PRIORITY_DEFAULT,
                          NULL,
-                         save_file_create_ready_cb, self);
+                         save_file_create_ready_cb,
+                         screenshot_capture_request_ref(request));
   }
   else
   {
@@ -395,9 +746,9 @@ screenshot_save_to_file(ScreenshotApplication *self)
                         G_FILE_CREATE_NONE,
                         G_PRIORITY_DEFAULT,
                         NULL,
-                        save_file_create_ready_cb, self);
+                        save_file_create_ready_cb,
+                        screenshot_capture_request_ref(request));
   }
-  g_print("->saveok: %s\n", self->priv->save_uri);
 }
 
 static void
@@ -408,17 +759,21 @@ screenshot_back(ScreenshotApplication *self)
 }
 
 static void
-screenshot_save_to_clipboard(ScreenshotApplication *self) // ham luu vao clipbo
+screenshot_save_to_clipboard(ScreenshotCaptureRequest *request) // ham luu vao clipbo
 {
   GtkClipboard *clipboard;
 
   clipboard = gtk_clipboard_get_for_display(gdk_display_get_default(),
                                             GDK_SELECTION_CLIPBOARD);
 
-  if (!self->priv->screenshot)
+  if (!request->screenshot)
+  {
     g_print("----clipnull\n");
+    return;
+  }
 
-  gtk_clipboard_set_image(clipboard, self->priv->screenshot);
+  /* the clipboard only takes pixbufs */
+  gtk_clipboard_set_image(clipboard, screenshot_image_get_pixbuf(request->screenshot));
   g_print("----clipboard\n");
 }
 /* Callback functions */
@@ -438,66 +793,19 @@ keyPress(GtkWidget *widget, gpointer data)
     return TRUE;
 }
 
-/* If the window has been resized, that resizes the scrolledwindow,
- * and we scale the image to the dimensions of the scrolledwindow so that
- * the scrollbars disappear again. Yuk! */
-static gboolean
-sizeChanged(GtkWidget *widget, GtkAllocation *allocation, gpointer data)
-{
-  GdkPixbuf *sourcePixbuf = data; /* As read from a file */
-  GdkPixbuf *imagePixbuf;         /* pixbuf of the on-screen image */
-
-  imagePixbuf = gtk_image_get_pixbuf(GTK_IMAGE(image));
-  if (imagePixbuf == NULL)
-  {
-    g_message("Can't get on-screen pixbuf");
-    return TRUE;
-  }
-  /* Recreate the displayed image if the image size has changed. */
-  if (allocation->width != gdk_pixbuf_get_width(imagePixbuf) ||
-      allocation->height != gdk_pixbuf_get_height(imagePixbuf))
-  {
-
-    gtk_image_set_from_pixbuf(
-        GTK_IMAGE(image),
-        gdk_pixbuf_scale_simple(sourcePixbuf,
-                                allocation->width,
-                                allocation->height,
-                                GDK_INTERP_BILINEAR));
-    g_object_unref(imagePixbuf); /* Free the old one */
-  }
-
-  return FALSE;
-}
-void zoom(GtkWidget *button,ScreenshotApplication *self){
+void zoom(GtkWidget *button,ScreenshotCaptureRequest *request){
   GtkWidget *window;
-    GtkWidget *viewport;
-    GdkPixbuf *sourcePixbuf = NULL; /* As read from a file */
-    // char filename[200]= "/home/viet132pham/Pictures/Screenshot from 2022-01-08 22-58-57.png";
-    // char *filename2 = "/home/viet132pham/Pictures/tuyen.png";
+    GtkWidget *viewer;
+    ScreenshotImage *source = request->screenshot; /* The captured screenshot */
     int n = 1;
   gtk_init(&n , NULL);
 
-    /* Make pixbuf, then make image from pixbuf because
-     * gtk_image_new_from_file() doesn't flag errors */
-      GError *error = NULL;
-    // while(1)
-    // {
-      sourcePixbuf = gdk_pixbuf_new_from_file(self->priv->save_path, &error);
-      if (sourcePixbuf == NULL)
-      {
-        g_message("%s", error->message);
-      }
-    // }
-
-    /* On expose/resize, the image's pixbuf will be overwritten
-     * but we will still need the original image so take a copy of it */
-    image = gtk_image_new_from_pixbuf(gdk_pixbuf_copy(sourcePixbuf));
-
-    viewport = gtk_scrolled_window_new(NULL, NULL);
-    /* Saying "1x1" reduces the window's minumum size from 55x55 to 42x42. */
-    gtk_scrolled_window_set_min_content_width(GTK_SCROLLED_WINDOW(viewport), 1);
-    gtk_scrolled_window_set_min_content_height(GTK_SCROLLED_WINDOW(viewport), 1);
+    /* The viewer shares the screenshot that is already in memory instead of
+     * reading it back from save_path: the file is still being written
+     * asynchronously at this point, and decoding it again is wasted work.
+     * It zooms and pans by drawing mipmapped tiles, so resizing the window
+     * never rescales the whole image. */
+    viewer = screenshot_viewer_new(source);
 
     window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
     gtk_window_set_title(GTK_WINDOW(window), "image1-gtk3");
@@ -508,26 +816,18 @@ void zoom(GtkWidget *button,ScreenshotApplication *self){
     /* Quit on control-Q. */
     g_signal_connect(window, "key-press-event", G_CALLBACK(keyPress), NULL);
 
-    /* When the window is resized, scale the image to fit */
-    g_signal_connect(viewport, "size-allocate",
-                     G_CALLBACK(sizeChanged), sourcePixbuf);
-
-    /* The image is in a scrolled window container so that the main window
-     * can be resized smaller than the current image. */
-    gtk_container_add(GTK_CONTAINER(viewport), image);
-    gtk_container_add(GTK_CONTAINER(window), viewport);
+    gtk_container_add(GTK_CONTAINER(window), viewer);
 
-    //gtk_window_set_resizable(GTK_WINDOW(window), 1);
-    /* Open the window the same size as the image */
+    /* Open the window the same size as the image, unless it is huge */
     gtk_window_set_default_size(GTK_WINDOW(window),
-                                gdk_pixbuf_get_width(sourcePixbuf),
-                                gdk_pixbuf_get_height(sourcePixbuf));
+                                MIN(screenshot_image_get_width(source), VIEWER_MAX_DEFAULT_WIDTH),
+                                MIN(screenshot_image_get_height(source), VIEWER_MAX_DEFAULT_HEIGHT));
 
     gtk_widget_show_all(window);
 
     gtk_main();
 }
-void create_open_image(ScreenshotApplication *self){
+void create_open_image(ScreenshotCaptureRequest *request){
   // GtkWidget *grid;
   GtkWidget* button;
   GtkWidget* window;
@@ -544,8 +844,11 @@ void create_open_image(ScreenshotApplication *self){
   button = gtk_button_new_with_label ( "If you want open image: Click" );
   // gtk_grid_attach ( GTK_GRID ( grid ), button, 0, 0, 1, 1 );
   gtk_container_add(GTK_CONTAINER(window),button);
-  printf("\nDAY LA FILE NAME : %s\n",self->priv->save_path);
-  g_signal_connect ( button,    "clicked", G_CALLBACK ( zoom ),self);
+  g_debug("Offering to open %s", request->save_path);
+  /* the dialog, and its request, may be gone by the time it is clicked */
+  g_signal_connect_data ( button,    "clicked", G_CALLBACK ( zoom ),
+                          screenshot_capture_request_ref(request),
+                          (GClosureNotify)screenshot_capture_request_unref, 0);
   g_signal_connect(window, "destroy", gtk_main_quit, 0);
   gtk_widget_show_all(window);
   
@@ -556,44 +859,49 @@ static void
 screenshot_dialog_response_cb(ScreenshotResponse response,
                               ScreenshotApplication *self)
 {
-  char command[120];
+  /* closing the dialog drops its reference */
+  g_autoptr(ScreenshotCaptureRequest) request =
+    screenshot_capture_request_ref(self->priv->dialog_request);
+  ScreenshotImage *shown = screenshot_dialog_get_screenshot(self->priv->dialog);
+
+  /* save what the dialog shows, with the effect picked there */
+  screenshot_image_ref(shown);
+  g_clear_pointer(&request->screenshot, screenshot_image_unref);
+  request->screenshot = shown;
+
   switch (response)
   {
   case SCREENSHOT_RESPONSE_SAVE:
     /* update to the new URI */
 
-    g_free(self->priv->save_uri);
-    self->priv->save_uri = screenshot_dialog_get_uri(self->priv->dialog);
-    screenshot_save_to_file(self);
-    printf("->uri: %s\n", self->priv->save_uri);
-    create_open_image(self);
+    g_free(request->save_uri);
+    request->save_uri = screenshot_dialog_get_uri(self->priv->dialog);
+    screenshot_save_to_file(request);
+    g_debug("Saving to %s", request->save_uri);
+    create_open_image(request);
     break;
   case SCREENSHOT_RESPONSE_COPY:
-    screenshot_save_to_clipboard(self);
+    cancel_speculative_encode(self);
+    screenshot_save_to_clipboard(request);
     break;
   case SCREENSHOT_RESPONSE_BACK:
     screenshot_back(self);
     break;
   case SCREENSHOT_RESPONSE_EDIT:
-  g_free(self->priv->save_uri);
-    self->priv->save_uri = screenshot_dialog_get_uri(self->priv->dialog);
-    screenshot_save_to_file(self);
-    sprintf(command,"pinta \"%s\"", self->priv->save_path);
+  g_free(request->save_uri);
+    request->save_uri = screenshot_dialog_get_uri(self->priv->dialog);
+    screenshot_save_to_file(request);
     if(screenshot_config->pinta_check == FALSE){
       showArlert();
       exit(0);
     }else{
-      if (fork() == 0)
-    {
-      if (system(command) < 0)
-      {
-        exit(-1);
-      }
-      exit(-1);
-    }
-    else
-    {    }
+      /* no shell: the path may hold quotes or anything else */
+      g_autoptr(GError) error = NULL;
+      gchar *argv[] = { "pinta", request->save_path, NULL };
 
+      if (!g_spawn_async(NULL, argv, NULL, G_SPAWN_SEARCH_PATH,
+                         NULL, NULL, NULL, &error))
+        g_warning("Unable to start pinta: %s", error->message);
     }
     
     break;
@@ -608,24 +916,35 @@ screenshot_dialog_response_cb(ScreenshotResponse response,
   return;
 }
 
+/* Effects only apply around a window */
+static ScreenshotEffectType
+get_capture_effect(ScreenshotCaptureRequest *request)
+{
+  if (!request->options.take_window_shot)
+    return SCREENSHOT_EFFECT_NONE;
+
+  return screenshot_effect_type_from_nick(request->options.border_effect);
+}
+
 static void
 build_filename_ready_cb(GObject *source,
                         GAsyncResult *res,
                         gpointer user_data)
 {
-  ScreenshotApplication *self = user_data;
+  g_autoptr(ScreenshotCaptureRequest) request = user_data;
+  ScreenshotApplication *self = get_application();
   g_autoptr(GError) error = NULL;
   g_autofree gchar *save_path = screenshot_build_filename_finish(res, &error);
 
   if (save_path != NULL)
   {
     g_autoptr(GFile) file = g_file_new_for_path(save_path);
-    self->priv->save_uri = g_file_get_uri(file);
-    self->priv->save_path = g_file_get_path(file);
+    request->save_uri = g_file_get_uri(file);
+    request->save_path = g_file_get_path(file);
     g_print("path: %s\n", g_file_get_path(file));
   }
   else
-    self->priv->save_uri = NULL;
+    request->save_uri = NULL;
 
   /* now release the application */
   g_application_release(G_APPLICATION(self));
@@ -634,8 +953,12 @@ build_filename_ready_cb(GObject *source,
   {
     g_critical("Impossible to find a valid location to save the screenshot: %s",
                error->message);
+    finish_trace(request, "failed");
+
+    if (request->tile_hashes != NULL)
+      watch_failed(self, request);
 
-    if (screenshot_config->interactive)
+    if (request->options.interactive)
       screenshot_show_dialog(NULL,
                              GTK_MESSAGE_ERROR,
                              GTK_BUTTONS_OK,
@@ -643,88 +966,297 @@ build_filename_ready_cb(GObject *source,
                              _("Error creating file"));
     else
     {
-      if (screenshot_config->play_sound)
+      if (request->options.play_sound)
         screenshot_play_sound_effect("dialog-error", _("Unable to capture a screenshot"));
-      if (screenshot_config->file != NULL)
-        exit(EXIT_FAILURE);
+      exit_if_explicit_destination(request);
     }
 
     return;
   }
-  if (screenshot_config->play_sound)
-    screenshot_play_sound_effect(screenshot_config->sound, _("Screenshot taken"));
+  if (request->options.play_sound)
+    screenshot_play_sound_effect(request->options.sound, _("Screenshot taken"));
 
-  if (screenshot_config->interactive)
+  if (request->options.interactive)
   {
-    self->priv->dialog = screenshot_dialog_new(self->priv->screenshot,
-                                               self->priv->save_uri,
+    self->priv->dialog_request = screenshot_capture_request_ref(request);
+    self->priv->dialog = screenshot_dialog_new(request->effects,
+                                               get_capture_effect(request),
+                                               request->options.take_window_shot,
+                                               request->save_uri,
                                                (SaveScreenshotCallback)screenshot_dialog_response_cb,
                                                self);
+
+    /* start encoding now, and again whenever the result would differ */
+    g_signal_connect(self->priv->dialog->filename_entry, "changed",
+                     G_CALLBACK(dialog_changed_cb), self);
+    g_signal_connect_after(self->priv->dialog->effect_combo, "changed",
+                           G_CALLBACK(dialog_changed_cb), self);
+    encode_for_dialog(self);
   }
   else
   {
     g_application_hold(G_APPLICATION(self));
-    screenshot_save_to_file(self);
+    screenshot_save_to_file(request);
   }
 }
 
 static void
-finish_prepare_screenshot(ScreenshotApplication *self,
-                          GdkRectangle *rectangle)
+scale_screenshot(ScreenshotImage **screenshot,
+                 gdouble scale)
 {
-  GdkPixbuf *screenshot;
-
-  screenshot = screenshot_get_pixbuf(rectangle);
-
-  if (screenshot == NULL)
+  GdkPixbuf *scaled;
+  ScreenshotTraceSpan *span;
+  gint width, height;
+
+  width = MAX((gint)(screenshot_image_get_width(*screenshot) * scale + 0.5), 1);
+  height = MAX((gint)(screenshot_image_get_height(*screenshot) * scale + 0.5), 1);
+
+  /* this is what gets saved, so use the best filter */
+  span = screenshot_trace_begin("scale");
+  scaled = screenshot_resample(screenshot_image_get_pixbuf(*screenshot), width, height,
+                               SCREENSHOT_RESAMPLE_LANCZOS, 0);
+  if (scaled != NULL)
+    screenshot_trace_set_bytes(span, gdk_pixbuf_get_byte_length(scaled));
+  screenshot_trace_end(span);
+
+  if (scaled == NULL)
   {
-    g_critical("Unable to capture a screenshot of any window");
+    g_warning("Unable to scale the screenshot to %dx%d", width, height);
+    return;
+  }
 
-    if (screenshot_config->interactive)
-      screenshot_show_dialog(NULL,
-                             GTK_MESSAGE_ERROR,
-                             GTK_BUTTONS_OK,
-                             _("Unable to capture a screenshot"),
-                             _("All possible methods failed"));
-    else
-    {
-      if (screenshot_config->play_sound)
-        screenshot_play_sound_effect("dialog-error", _("Unable to capture a screenshot"));
-    }
+  screenshot_image_unref(*screenshot);
+  *screenshot = screenshot_image_new_for_pixbuf(scaled);
+  g_object_unref(scaled);
+}
 
-    g_application_release(G_APPLICATION(self));
-    if (screenshot_config->file != NULL)
-      exit(EXIT_FAILURE);
+/* Whether the capture can go straight to its destination in strips,
+ * never existing as a whole image: nothing may need the full frame, so no
+ * dialog, clipboard, window effect or scaling.
+ */
+static gboolean
+can_stream_capture(ScreenshotCaptureRequest *request,
+                   const gchar *format)
+{
+  return !request->options.interactive &&
+         !request->options.copy_to_clipboard &&
+         !request->options.take_window_shot &&
+         request->options.scale == 1.0 &&
+         screenshot_stream_supports_format(format);
+}
+
+static GdkRectangle *
+get_capture_rectangle(ScreenshotCaptureRequest *request)
+{
+  return request->has_rectangle ? &request->rectangle : NULL;
+}
+
+static void
+stream_capture_ready_cb(GObject *source,
+                        GAsyncResult *res,
+                        gpointer user_data)
+{
+  g_autoptr(ScreenshotCaptureRequest) request = user_data;
+  g_autoptr(GError) error = NULL;
 
+  if (!screenshot_stream_capture_finish(res, &error))
+  {
+    save_pixbuf_handle_error(request, error);
     return;
   }
 
-  if (screenshot_config->take_window_shot)
+  if (request->options.play_sound)
+    screenshot_play_sound_effect(request->options.sound, _("Screenshot taken"));
+
+  save_pixbuf_handle_success(request);
+}
+
+static void
+stream_capture(ScreenshotCaptureRequest *request,
+               GFile *file,
+               const gchar *format)
+{
+  /* capture, encoding and writing all at once, off the main loop */
+  request->save_span = screenshot_trace_begin("stream-capture");
+  screenshot_trace_set_backend(request->save_span, format);
+
+  screenshot_stream_capture_async(&request->options, get_capture_rectangle(request),
+                                  file, request->options.file_fd,
+                                  request->should_overwrite, format, NULL,
+                                  stream_capture_ready_cb,
+                                  screenshot_capture_request_ref(request));
+}
+
+static void
+stream_build_filename_ready_cb(GObject *source,
+                               GAsyncResult *res,
+                               gpointer user_data)
+{
+  g_autoptr(ScreenshotCaptureRequest) request = user_data;
+  g_autoptr(GError) error = NULL;
+  g_autoptr(GFile) file = NULL;
+  g_autofree gchar *save_path = screenshot_build_filename_finish(res, &error);
+  g_autofree gchar *format = NULL;
+
+  if (save_path == NULL)
   {
-    switch (screenshot_config->border_effect[0])
-    {
-    case 's': /* shadow */
-      screenshot_add_shadow(&screenshot);
-      break;
-    case 'b': /* border */
-      screenshot_add_border(&screenshot);
-      break;
-    case 'v': /* vintage */
-      screenshot_add_vintage(&screenshot);
-      break;
-    case 'n': /* none */
-    default:
-      break;
-    }
+    save_pixbuf_handle_error(request, error);
+    return;
   }
 
-  self->priv->screenshot = screenshot;
-  g_print("screenshot_config->copy_to_clipboard: %d\n", screenshot_config->copy_to_clipboard);
+  file = g_file_new_for_path(save_path);
+  g_free(request->save_uri);
+  request->save_uri = g_file_get_uri(file);
+  request->should_overwrite = FALSE;
 
-  if (screenshot_config->copy_to_clipboard)
+  format = get_writable_format(request->options.file_type);
+  stream_capture(request, file, format);
+}
+
+/* Takes the capture straight to the file or descriptor when nothing needs
+ * it in memory, which keeps large desktops from needing a frame sized
+ * buffer and an encoded copy of it.  Returns FALSE if the usual path must
+ * be taken instead, which includes the "auto" file type: it is chosen by
+ * looking at the whole capture.
+ */
+static gboolean
+try_stream_capture(ScreenshotCaptureRequest *request)
+{
+  ScreenshotCaptureOptions *options = &request->options;
+  g_autofree gchar *format = NULL;
+
+  if (options->file_fd >= 0)
+    format = get_writable_format(options->file_type);
+  else if (options->file != NULL)
+  {
+    g_autofree gchar *basename = g_file_get_basename(options->file);
+    format = get_format_for_filename(basename);
+  }
+  else
+    format = get_writable_format(options->file_type);
+
+  if (!can_stream_capture(request, format))
+    return FALSE;
+
+  if (options->file_fd >= 0)
+  {
+    g_clear_pointer(&request->save_uri, g_free);
+    stream_capture(request, NULL, format);
+  }
+  else if (options->file != NULL)
   {
-    self->priv->save_uri = g_build_filename("file:///tmp", "temp_file_clipboard.png", NULL);
-    self->priv->should_overwrite = TRUE;
+    g_free(request->save_uri);
+    request->save_uri = g_file_get_uri(options->file);
+    request->should_overwrite = TRUE;
+    stream_capture(request, options->file, format);
+  }
+  else
+  {
+    screenshot_build_filename_async(options->save_dir, NULL,
+                                    options->file_type,
+                                    stream_build_filename_ready_cb,
+                                    screenshot_capture_request_ref(request));
+  }
+
+  return TRUE;
+}
+
+/* Picks the file type used when no file name says otherwise: the
+ * configured one, or with "auto" the one that suits what the capture
+ * shows.
+ */
+static void
+resolve_file_type(ScreenshotCaptureRequest *request)
+{
+  ScreenshotContentStats stats;
+  ScreenshotTraceSpan *span;
+
+  g_free(request->file_type);
+  request->jpeg_quality = -1;
+
+  if (g_strcmp0(request->options.file_type, "auto") != 0)
+  {
+    request->file_type = g_strdup(request->options.file_type);
+    return;
+  }
+
+  span = screenshot_trace_begin("analyze");
+  screenshot_content_analyze(request->screenshot, &stats);
+  request->file_type = g_strdup(screenshot_content_pick_file_type(&stats,
+                                                                  request->options.auto_quality_floor));
+  screenshot_trace_set_backend(span, request->file_type);
+  screenshot_trace_end(span);
+
+  if (g_strcmp0(request->file_type, "jpg") == 0)
+    request->jpeg_quality = request->options.auto_quality_floor;
+
+  g_debug("Content: %u colors, %.2f bits of entropy, %.0f%% flat; saving as %s",
+          stats.n_colors, stats.entropy, stats.flat_fraction * 100, request->file_type);
+}
+
+/* The frame kept by the history closest to the time asked for */
+static ScreenshotImage *
+get_history_frame(ScreenshotCaptureRequest *request)
+{
+  ScreenshotApplication *self = get_application();
+  g_autoptr(GError) error = NULL;
+  ScreenshotImage *screenshot;
+  ScreenshotTraceSpan *span;
+  gint64 wanted, taken_at = 0;
+
+  if (self->priv->history == NULL)
+  {
+    g_critical("No history of the screen is kept; start gnome-screenshot --history first");
+    return NULL;
+  }
+
+  wanted = request->requested_at - (gint64)(request->options.ago * G_USEC_PER_SEC);
+
+  span = screenshot_trace_begin("capture");
+  screenshot_trace_set_backend(span, "history");
+  screenshot = screenshot_history_lookup(self->priv->history, wanted, &taken_at, &error);
+  screenshot_trace_end(span);
+
+  if (screenshot == NULL)
+  {
+    g_critical("Unable to take the screenshot from the history: %s", error->message);
+    return NULL;
+  }
+
+  g_debug("Screen from %.2f seconds before the request, %.2f seconds asked for",
+          (gdouble)(request->requested_at - taken_at) / G_USEC_PER_SEC,
+          request->options.ago);
+
+  return screenshot;
+}
+
+/* Applies the effects to @screenshot, which the request takes over, and
+ * sends it where the request says */
+static void
+process_screenshot(ScreenshotCaptureRequest *request,
+                   ScreenshotImage *screenshot)
+{
+  ScreenshotApplication *self = get_application();
+
+  if (request->options.scale != 1.0)
+    scale_screenshot(&screenshot, request->options.scale);
+
+  /* Keep the capture as taken, so that the save dialog can switch
+   * effects without capturing again */
+  request->effects = screenshot_effect_stack_new(screenshot,
+                                                 &request->options.effect_params);
+  screenshot_image_unref(screenshot);
+
+  request->screenshot =
+    screenshot_image_ref(screenshot_effect_stack_render(request->effects,
+                                                        get_capture_effect(request)));
+  resolve_file_type(request);
+  g_debug("copy_to_clipboard: %d", request->options.copy_to_clipboard);
+
+  if (request->options.copy_to_clipboard)
+  {
+    request->save_uri = g_build_filename("file:///tmp", "temp_file_clipboard.png", NULL);
+    request->should_overwrite = TRUE;
     // g_application_hold(G_APPLICATION(self));
     int status = system("rm -f /tmp/temp_file_clipboard.png");
     if (status < 0)
@@ -732,7 +1264,7 @@ finish_prepare_screenshot(ScreenshotApplication *self,
       exit(-1);
     }
     g_application_hold(G_APPLICATION(self));
-    screenshot_save_to_file(self);
+    screenshot_save_to_file(request);
 
     // g_application_release(G_APPLICATION(self));
 
@@ -747,10 +1279,10 @@ finish_prepare_screenshot(ScreenshotApplication *self,
     // }
     // g_application_release(G_APPLICATION(self));
 
-    if (screenshot_config->play_sound)
-      screenshot_play_sound_effect(screenshot_config->sound, _("Screenshot taken"));
+    if (request->options.play_sound)
+      screenshot_play_sound_effect(request->options.sound, _("Screenshot taken"));
 
-    if (screenshot_config->file == NULL)
+    if (!screenshot_capture_request_has_explicit_destination(request))
     {
       g_application_release(G_APPLICATION(self));
 
@@ -765,33 +1297,88 @@ finish_prepare_screenshot(ScreenshotApplication *self,
    *
    * screenshot_ensure_icc_profile (window);
    */
-  if (screenshot_config->file != NULL)
+  if (request->options.file_fd >= 0)
+    screenshot_save_to_fd(request);
+  else if (request->options.file != NULL)
   {
-    self->priv->save_uri = g_file_get_uri(screenshot_config->file);
+    request->save_uri = g_file_get_uri(request->options.file);
 
-    self->priv->should_overwrite = TRUE;
-    screenshot_save_to_file(self);
+    request->should_overwrite = TRUE;
+    screenshot_save_to_file(request);
   }
   else
-    screenshot_build_filename_async(screenshot_config->save_dir, NULL, build_filename_ready_cb, self);
+    screenshot_build_filename_async(request->options.save_dir, NULL, request->file_type,
+                                    build_filename_ready_cb,
+                                    screenshot_capture_request_ref(request));
+}
+
+static void
+finish_prepare_screenshot(ScreenshotCaptureRequest *request)
+{
+  ScreenshotApplication *self = get_application();
+  ScreenshotImage *screenshot;
+
+  screenshot_trace_end(g_steal_pointer(&request->wait_span));
+
+  if (request->options.ago >= 0)
+  {
+    screenshot = get_history_frame(request);
+  }
+  else
+  {
+    if (try_stream_capture(request))
+      return;
+
+    screenshot = screenshot_get_image(&request->options, get_capture_rectangle(request));
+    if (screenshot == NULL)
+      g_critical("Unable to capture a screenshot of any window");
+  }
+
+  if (screenshot == NULL)
+  {
+    if (request->options.interactive)
+      screenshot_show_dialog(NULL,
+                             GTK_MESSAGE_ERROR,
+                             GTK_BUTTONS_OK,
+                             _("Unable to capture a screenshot"),
+                             _("All possible methods failed"));
+    else
+    {
+      if (request->options.play_sound)
+        screenshot_play_sound_effect("dialog-error", _("Unable to capture a screenshot"));
+    }
+
+    screenshot_metrics_count_failure("capture", request->options.ago >= 0 ? "no-history" : "all-methods-failed");
+    finish_trace(request, "failed");
+    g_application_release(G_APPLICATION(self));
+    exit_if_explicit_destination(request);
+
+    return;
+  }
+
+  process_screenshot(request, screenshot);
 }
 
 static void
 rectangle_found_cb(GdkRectangle *rectangle,
                    gpointer user_data)
 {
-  ScreenshotApplication *self = user_data;
+  g_autoptr(ScreenshotCaptureRequest) request = user_data;
+  ScreenshotApplication *self = get_application();
 
   if (rectangle != NULL)
   {
-    finish_prepare_screenshot(self, rectangle);
+    request->rectangle = *rectangle;
+    request->has_rectangle = TRUE;
+    finish_prepare_screenshot(request);
   }
   else
   {
     /* user dismissed the area selection, possibly show the dialog again */
+    finish_trace(request, "cancelled");
     g_application_release(G_APPLICATION(self));
 
-    if (screenshot_config->interactive)
+    if (request->options.interactive)
       screenshot_show_interactive_dialog(self);
   }
 }
@@ -799,12 +1386,13 @@ rectangle_found_cb(GdkRectangle *rectangle,
 static gboolean
 prepare_screenshot_timeout(gpointer user_data)
 {
-  ScreenshotApplication *self = user_data;
+  ScreenshotCaptureRequest *request = user_data;
 
-  if (screenshot_config->take_area_shot)
-    screenshot_select_area_async(rectangle_found_cb, self);
+  if (request->options.take_area_shot)
+    screenshot_select_area_async(rectangle_found_cb,
+                                 screenshot_capture_request_ref(request));
   else
-    finish_prepare_screenshot(self, NULL);
+    finish_prepare_screenshot(request);
 
   screenshot_save_config();
 
@@ -812,29 +1400,353 @@ prepare_screenshot_timeout(gpointer user_data)
 }
 
 static void
-screenshot_start(ScreenshotApplication *self)
+run_capture(ScreenshotCaptureRequest *request,
+            ScreenshotApplication *self)
 {
-  guint delay = screenshot_config->delay * 1000;
+  guint delay = request->options.delay * 1000;
 
   /* hold the GApplication while doing the async screenshot op */
   g_application_hold(G_APPLICATION(self));
 
-  if (screenshot_config->take_area_shot)
+  request->trace_span = screenshot_trace_begin("screenshot");
+  request->wait_span = screenshot_trace_begin("wait");
+
+  if (request->options.take_area_shot)
     delay = 0;
 
   /* HACK: give time to the dialog to actually disappear.
    * We don't have any way to tell when the compositor has finished
    * re-drawing.
    */
-  if (delay == 0 && screenshot_config->interactive)
+  if (delay == 0 && request->options.interactive)
     delay = 200;
 
   if (delay > 0)
-    g_timeout_add(delay,
-                  prepare_screenshot_timeout,
-                  self);
+    g_timeout_add_full(G_PRIORITY_DEFAULT, delay,
+                       prepare_screenshot_timeout,
+                       screenshot_capture_request_ref(request),
+                       (GDestroyNotify)screenshot_capture_request_unref);
   else
-    g_idle_add(prepare_screenshot_timeout, self);
+    g_idle_add_full(G_PRIORITY_DEFAULT_IDLE,
+                    prepare_screenshot_timeout,
+                    screenshot_capture_request_ref(request),
+                    (GDestroyNotify)screenshot_capture_request_unref);
+}
+
+/* Starts a capture configured by @command_line, which waits for it if it
+ * is remote, or by an action or the dialog if it is %NULL */
+static void
+screenshot_start_for_command_line(ScreenshotApplication *self,
+                                  GApplicationCommandLine *command_line)
+{
+  g_autoptr(ScreenshotCaptureRequest) request = NULL;
+  ScreenshotAdmissionDecision decision;
+
+  /* from here on, changes to the configuration are for the next one */
+  request = screenshot_capture_request_new(screenshot_config);
+
+  /* until the screenshot is saved, it has not worked */
+  if (command_line != NULL && g_application_command_line_get_is_remote(command_line))
+  {
+    request->command_line = g_object_ref(command_line);
+    g_application_command_line_set_exit_status(command_line, EXIT_FAILURE);
+  }
+
+  /* the dialog is driven by the user, one capture at a time already */
+  if (request->options.interactive)
+  {
+    run_capture(request, self);
+    return;
+  }
+
+  decision = screenshot_admission_submit(self->priv->admission, request);
+  g_debug("Capture request %s", screenshot_admission_decision_get_nick(decision));
+
+  /* when coalesced or merged, the command line waits for the request
+   * standing for this one */
+  if (decision == SCREENSHOT_ADMISSION_DROPPED && request->command_line != NULL)
+    g_application_command_line_printerr(request->command_line, _("Too many screenshots are waiting already; this one is not taken.\n"));
+}
+
+static void
+screenshot_start(ScreenshotApplication *self)
+{
+  screenshot_start_for_command_line(self, NULL);
+}
+
+/* Keeps this instance running, taking frames for --ago */
+static void
+start_history(ScreenshotApplication *self)
+{
+  if (self->priv->history != NULL)
+    return;
+
+  self->priv->history = screenshot_history_new(screenshot_config->history_rate,
+                                               (gsize)screenshot_config->history_memory_limit * 1024 * 1024);
+  g_application_hold(G_APPLICATION(self));
+}
+
+static void
+link_filename_ready_cb(GObject *source,
+                       GAsyncResult *res,
+                       gpointer user_data)
+{
+  g_autofree gchar *target = user_data;
+  g_autoptr(GError) error = NULL;
+  g_autofree gchar *save_path = screenshot_build_filename_finish(res, &error);
+
+  if (save_path == NULL)
+  {
+    g_warning("Unable to find a name for the unchanged screenshot: %s", error->message);
+    return;
+  }
+
+  /* a reference to the same file, where hard links are not possible */
+  if (link(target, save_path) != 0)
+  {
+    g_autoptr(GFile) file = NULL;
+
+    g_debug("Unable to hard link %s: %s", target, g_strerror(errno));
+    file = g_file_new_for_path(save_path);
+    if (!g_file_make_symbolic_link(file, target, NULL, &error))
+    {
+      g_warning("Unable to link the unchanged screenshot: %s", error->message);
+      return;
+    }
+  }
+
+  screenshot_metrics_count_watch_save("link");
+  screenshot_metrics_flush();
+}
+
+static void
+link_watch_screenshot_to(ScreenshotApplication *self,
+                         const gchar *target)
+{
+  const gchar *extension = strrchr(target, '.');
+
+  screenshot_build_filename_async(self->priv->watch_request->options.save_dir, NULL,
+                                  extension != NULL ? extension + 1 : "png",
+                                  link_filename_ready_cb,
+                                  g_strdup(target));
+}
+
+/* Saves the last screenshot of the watch again, as a link, for a check
+ * that found too little changed */
+static void
+link_watch_screenshot(ScreenshotApplication *self)
+{
+  ScreenshotApplicationPriv *priv = self->priv;
+
+  /* the newest screenshot is still on its way: link once it is saved */
+  if (priv->watch_newest != NULL)
+    priv->watch_newest->n_links++;
+  else if (priv->watch_last_path != NULL)
+    link_watch_screenshot_to(self, priv->watch_last_path);
+}
+
+static void
+delta_filename_ready_cb(GObject *source,
+                        GAsyncResult *res,
+                        gpointer user_data)
+{
+  SaveEncodedJob *job = user_data;
+  g_autoptr(ScreenshotCaptureRequest) request = screenshot_capture_request_ref(job->request);
+  g_autoptr(GBytes) bytes = g_bytes_ref(job->bytes);
+  g_autoptr(GFile) file = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree gchar *save_path = screenshot_build_filename_finish(res, &error);
+
+  save_encoded_job_free(job);
+
+  if (save_path == NULL)
+  {
+    save_pixbuf_handle_error(request, error);
+    return;
+  }
+
+  file = g_file_new_for_path(save_path);
+  request->save_uri = g_file_get_uri(file);
+  request->save_path = g_steal_pointer(&save_path);
+
+  screenshot_write_bytes_async(bytes, file, FALSE, NULL,
+                               save_bytes_ready_cb,
+                               screenshot_capture_request_ref(request));
+}
+
+static void
+delta_encoded_cb(GObject *source,
+                 GAsyncResult *res,
+                 gpointer user_data)
+{
+  g_autoptr(ScreenshotCaptureRequest) request = user_data;
+  g_autoptr(GError) error = NULL;
+  SaveEncodedJob *job;
+  GBytes *bytes;
+
+  bytes = screenshot_encode_finish(res, &error);
+  if (bytes == NULL)
+  {
+    save_pixbuf_handle_error(request, error);
+    return;
+  }
+
+  screenshot_trace_set_bytes(request->save_span, g_bytes_get_size(bytes));
+
+  job = g_new0(SaveEncodedJob, 1);
+  job->request = screenshot_capture_request_ref(request);
+  job->bytes = bytes;
+
+  screenshot_build_filename_async(request->options.save_dir, NULL,
+                                  SCREENSHOT_DELTA_EXTENSION,
+                                  delta_filename_ready_cb, job);
+}
+
+/* Whether @frame changed little enough since the last full screenshot of
+ * the watch to be saved as a delta; past half of it, a full screenshot
+ * costs little more, and the deltas after it start over smaller */
+static gboolean
+can_save_watch_delta(ScreenshotApplication *self,
+                     ScreenshotCaptureRequest *request,
+                     ScreenshotImage *frame)
+{
+  ScreenshotApplicationPriv *priv = self->priv;
+  guint64 area;
+
+  /* the tiles are of the frame as captured */
+  if (!screenshot_config->watch_delta ||
+      priv->watch_keyframe_path == NULL ||
+      request->options.scale != 1.0)
+    return FALSE;
+
+  area = (guint64)screenshot_image_get_width(frame) * screenshot_image_get_height(frame);
+
+  return screenshot_tile_hashes_changed(request->tile_hashes, priv->watch_keyframe) <= area / 2;
+}
+
+/* Saves only the tiles of @frame that differ from the last full
+ * screenshot of the watch */
+static void
+save_watch_delta(ScreenshotCaptureRequest *request,
+                 ScreenshotImage *frame)
+{
+  ScreenshotApplicationPriv *priv = get_application()->priv;
+  g_autoptr(GArray) tiles = NULL;
+  g_autofree gchar *reference = NULL;
+
+  tiles = screenshot_tile_hashes_diff(request->tile_hashes, priv->watch_keyframe);
+  reference = g_path_get_basename(priv->watch_keyframe_path);
+
+  request->screenshot = screenshot_image_ref(frame);
+  g_free(request->file_type);
+  request->file_type = g_strdup(SCREENSHOT_DELTA_EXTENSION);
+
+  request->save_span = screenshot_trace_begin("save");
+  screenshot_trace_set_backend(request->save_span, SCREENSHOT_DELTA_EXTENSION);
+
+  screenshot_encode_delta_async(frame, tiles, reference, NULL,
+                                delta_encoded_cb,
+                                screenshot_capture_request_ref(request));
+}
+
+/* Each frame passed on by the watch is saved as its own screenshot, or
+ * as a delta of the last full one; checks that found too little changed
+ * may link the last one again */
+static void
+watch_frame_cb(ScreenshotImage *frame,
+               const ScreenshotTileHashes *hashes,
+               gpointer user_data)
+{
+  ScreenshotApplication *self = user_data;
+  ScreenshotApplicationPriv *priv = self->priv;
+  g_autoptr(ScreenshotCaptureRequest) request = NULL;
+
+  if (frame == NULL)
+  {
+    if (screenshot_config->watch_unchanged == SCREENSHOT_WATCH_UNCHANGED_LINK)
+      link_watch_screenshot(self);
+    return;
+  }
+
+  request = screenshot_capture_request_copy(priv->watch_request);
+  request->tile_hashes = screenshot_tile_hashes_copy(hashes);
+
+  /* links wait until this one is saved */
+  g_clear_pointer(&priv->watch_newest, screenshot_capture_request_unref);
+  priv->watch_newest = screenshot_capture_request_ref(request);
+  g_clear_pointer(&priv->watch_last_path, g_free);
+
+  g_application_hold(G_APPLICATION(self));
+  request->trace_span = screenshot_trace_begin("screenshot");
+
+  if (can_save_watch_delta(self, request, frame))
+    save_watch_delta(request, frame);
+  else
+    process_screenshot(request, screenshot_image_ref(frame));
+}
+
+static void
+begin_watch(ScreenshotApplication *self,
+            ScreenshotCaptureRequest *request)
+{
+  self->priv->watch_request = screenshot_capture_request_ref(request);
+  self->priv->watch = screenshot_watch_new(request,
+                                           screenshot_config->watch_threshold,
+                                           screenshot_config->watch_max_rate,
+                                           watch_frame_cb, self);
+}
+
+static void
+watch_area_found_cb(GdkRectangle *rectangle,
+                    gpointer user_data)
+{
+  g_autoptr(ScreenshotCaptureRequest) request = user_data;
+  ScreenshotApplication *self = get_application();
+
+  /* the user dismissed the area selection, nothing to watch */
+  if (rectangle == NULL)
+  {
+    g_application_release(G_APPLICATION(self));
+    return;
+  }
+
+  request->rectangle = *rectangle;
+  request->has_rectangle = TRUE;
+  begin_watch(self, request);
+}
+
+/* Keeps this instance running, taking a screenshot each time what is
+ * watched changes */
+static void
+start_watch(ScreenshotApplication *self)
+{
+  g_autoptr(ScreenshotCaptureRequest) request = NULL;
+
+  request = screenshot_capture_request_new(screenshot_config);
+  request->options.flash = FALSE;
+  request->options.play_sound = FALSE;
+
+  g_application_hold(G_APPLICATION(self));
+
+  if (request->options.take_area_shot)
+  {
+    screenshot_select_area_async(watch_area_found_cb,
+                                 screenshot_capture_request_ref(request));
+    return;
+  }
+
+  /* the part of the screen where the window is now */
+  if (request->options.take_window_shot)
+  {
+    if (screenshot_get_window_rectangle(request->options.include_border, &request->rectangle))
+      request->has_rectangle = TRUE;
+    else
+      g_message("No window to watch, watching the whole screen instead");
+
+    request->options.take_window_shot = FALSE;
+  }
+
+  begin_watch(self, request);
 }
 
 static gboolean version_arg = FALSE;
@@ -850,6 +1762,12 @@ static const GOptionEntry entries[] = {
     {"border-effect", 'e', 0, G_OPTION_ARG_STRING, NULL, N_("Effect to add to the border (shadow, border, vintage or none)"), N_("effect")},
     {"interactive", 'i', 0, G_OPTION_ARG_NONE, NULL, N_("Interactively set options"), NULL},
     {"file", 'f', 0, G_OPTION_ARG_FILENAME, NULL, N_("Save screenshot directly to this file"), N_("filename")},
+    {"file-type", 0, 0, G_OPTION_ARG_STRING, NULL, N_("File type to save in when no file name gives one (png, jpg, bmp, tiff, qoi, webp or auto)"), N_("type")},
+    {"scale", 0, 0, G_OPTION_ARG_DOUBLE, NULL, N_("Scale the screenshot by this factor before saving it, e.g. 0.5 to save a HiDPI capture at 1x"), N_("factor")},
+    {"effect-option", 0, 0, G_OPTION_ARG_STRING_ARRAY, NULL, N_("Set a parameter of the border effects for this screenshot, e.g. shadow-radius=12 (may be repeated)"), N_("NAME=VALUE")},
+    {"history", 0, 0, G_OPTION_ARG_NONE, NULL, N_("Keep running and keep the last moments of the screen in memory, for --ago"), NULL},
+    {"watch", 0, 0, G_OPTION_ARG_NONE, NULL, N_("Keep running and take a screenshot each time the screen, window or area changes"), NULL},
+    {"ago", 0, 0, G_OPTION_ARG_DOUBLE, NULL, N_("Save the screen as it was this many seconds ago, as kept by gnome-screenshot --history"), N_("seconds")},
     {"version", 0, 0, G_OPTION_ARG_NONE, &version_arg, N_("Print version information and exit"), NULL},
     {NULL},
 };
@@ -864,8 +1782,11 @@ screenshot_application_handle_local_options(GApplication *app,
     exit(EXIT_SUCCESS);
   }
 
-  /* Start headless instances in non-unique mode */
-  if (!g_variant_dict_contains(options, "interactive"))
+  /* Start headless instances in non-unique mode; the history is asked
+   * for its frames by later command lines */
+  if (!g_variant_dict_contains(options, "interactive") &&
+      !g_variant_dict_contains(options, "history") &&
+      !g_variant_dict_contains(options, "ago"))
   {
     GApplicationFlags old_flags;
 
@@ -894,6 +1815,12 @@ screenshot_application_command_line(GApplication *app,
   gchar *border_effect_arg = NULL;
   guint delay_arg = 0;
   gchar *file_arg = NULL;
+  gchar *file_type_arg = NULL;
+  gdouble scale_arg = 1.0;
+  gboolean history_arg = FALSE;
+  gboolean watch_arg = FALSE;
+  gdouble ago_arg = -1;
+  g_autofree const gchar **effect_option_args = NULL;
   GVariantDict *options;
   gint exit_status = EXIT_SUCCESS;
   gboolean res;
@@ -909,8 +1836,47 @@ screenshot_application_command_line(GApplication *app,
   g_variant_dict_lookup(options, "border-effect", "&s", &border_effect_arg);
   g_variant_dict_lookup(options, "delay", "i", &delay_arg);
   g_variant_dict_lookup(options, "file", "^&ay", &file_arg);
+  g_variant_dict_lookup(options, "file-type", "&s", &file_type_arg);
+  g_variant_dict_lookup(options, "scale", "d", &scale_arg);
+  g_variant_dict_lookup(options, "effect-option", "^a&s", &effect_option_args);
+  g_variant_dict_lookup(options, "history", "b", &history_arg);
+  g_variant_dict_lookup(options, "watch", "b", &watch_arg);
 
-  res = screenshot_config_parse_command_line(clipboard_arg,
+  if (history_arg)
+  {
+    start_history(self);
+    goto out;
+  }
+
+  if (g_variant_dict_lookup(options, "ago", "d", &ago_arg))
+  {
+    if (ago_arg < 0)
+    {
+      g_application_command_line_printerr(command_line, _("Invalid time: %g; it must be at least 0.\n"), ago_arg);
+      exit_status = EXIT_FAILURE;
+      goto out;
+    }
+
+    /* in the instance started with --history, if there is one */
+    if (self->priv->history == NULL)
+    {
+      g_application_command_line_printerr(command_line, _("No history of the screen is kept; start gnome-screenshot --history first.\n"));
+      exit_status = EXIT_FAILURE;
+      goto out;
+    }
+  }
+
+  /* each screenshot of the watch is saved under a name of its own */
+  if (watch_arg &&
+      (interactive_arg || delay_arg || clipboard_arg || file_arg != NULL || ago_arg >= 0))
+  {
+    g_application_command_line_printerr(command_line, _("Conflicting options: --watch cannot be used with --interactive, --delay, --clipboard, --file or --ago.\n"));
+    exit_status = EXIT_FAILURE;
+    goto out;
+  }
+
+  res = screenshot_config_parse_command_line(command_line,
+                                             clipboard_arg,
                                              window_arg,
                                              area_arg,
                                              include_border_arg,
@@ -919,18 +1885,28 @@ screenshot_application_command_line(GApplication *app,
                                              border_effect_arg,
                                              delay_arg,
                                              interactive_arg,
-                                             file_arg);
+                                             file_arg,
+                                             file_type_arg,
+                                             scale_arg,
+                                             ago_arg,
+                                             effect_option_args);
   if (!res)
   {
     exit_status = EXIT_FAILURE;
     goto out;
   }
 
+  if (watch_arg)
+  {
+    start_watch(self);
+    goto out;
+  }
+
   /* interactive mode: trigger the dialog and wait for the response */
   if (screenshot_config->interactive)
     g_application_activate(app);
   else
-    screenshot_start(self);
+    screenshot_start_for_command_line(self, command_line);
 
 out:
   return exit_status;
@@ -991,7 +1967,8 @@ action_screen_shot(GSimpleAction *action,
 {
   ScreenshotApplication *self = SCREENSHOT_APPLICATION(user_data);
 
-  screenshot_config_parse_command_line(FALSE, /* clipboard */
+  screenshot_config_parse_command_line(NULL,  /* command line */
+                                       FALSE, /* clipboard */
                                        FALSE, /* window */
                                        FALSE, /* area */
                                        FALSE, /* include border */
@@ -1000,7 +1977,11 @@ action_screen_shot(GSimpleAction *action,
                                        NULL,  /* border effect */
                                        0,     /* delay */
                                        FALSE, /* interactive */
-                                       NULL); /* file */
+                                       NULL,  /* file */
+                                       NULL,  /* file type */
+                                       1.0,   /* scale */
+                                       -1,    /* ago */
+                                       NULL); /* effect options */
   screenshot_start(self);
 }
 
@@ -1011,7 +1992,8 @@ action_window_shot(GSimpleAction *action,
 {
   ScreenshotApplication *self = SCREENSHOT_APPLICATION(user_data);
 
-  screenshot_config_parse_command_line(FALSE, /* clipboard */
+  screenshot_config_parse_command_line(NULL,  /* command line */
+                                       FALSE, /* clipboard */
                                        TRUE,  /* window */
                                        FALSE, /* area */
                                        FALSE, /* include border */
@@ -1020,7 +2002,11 @@ action_window_shot(GSimpleAction *action,
                                        NULL,  /* border effect */
                                        0,     /* delay */
                                        FALSE, /* interactive */
-                                       NULL); /* file */
+                                       NULL,  /* file */
+                                       NULL,  /* file type */
+                                       1.0,   /* scale */
+                                       -1,    /* ago */
+                                       NULL); /* effect options */
   screenshot_start(self);
 }
 
@@ -1041,6 +2027,13 @@ screenshot_application_startup(GApplication *app)
   G_APPLICATION_CLASS(screenshot_application_parent_class)->startup(app);
 
   screenshot_load_config();
+  screenshot_metrics_init(screenshot_config->metrics_file);
+
+  self->priv->admission = screenshot_admission_new(MAX_RUNNING_CAPTURES,
+                                                   screenshot_config->capture_queue_length,
+                                                   screenshot_config->capture_queue_overflow,
+                                                   (ScreenshotAdmissionStartFunc)run_capture,
+                                                   self);
 
   g_set_application_name(_("Screenshot"));
   gtk_window_set_default_icon_name(SCREENSHOT_ICON_NAME);
@@ -1067,6 +2060,7 @@ screenshot_application_activate(GApplication *app)
   }
 
   screenshot_config->interactive = TRUE;
+  screenshot_config->ago = -1;
   screenshot_show_interactive_dialog(SCREENSHOT_APPLICATION(app));
 }
 
@@ -1074,6 +2068,8 @@ static void
 screenshot_application_finalize(GObject *object)
 {
   ScreenshotApplication *self = SCREENSHOT_APPLICATION(object);
+  ScreenshotPixbufPoolStats pool_stats;
+
   if (screenshot_config->copy_to_clipboard)
   {
     int status = system("xclip -selection clipboard -t image/png -i /tmp/temp_file_clipboard.png && rm -f  /tmp/temp_file_clipboard.png");
@@ -1083,9 +2079,22 @@ screenshot_application_finalize(GObject *object)
       exit(-1);
     }
   }
-  g_clear_object(&self->priv->screenshot);
-  g_free(self->priv->icc_profile_base64);
-  g_free(self->priv->save_uri);
+  g_clear_pointer(&self->priv->dialog_request, screenshot_capture_request_unref);
+  g_clear_pointer(&self->priv->admission, screenshot_admission_free);
+  g_clear_pointer(&self->priv->history, screenshot_history_free);
+  g_clear_pointer(&self->priv->watch, screenshot_watch_free);
+  g_clear_pointer(&self->priv->watch_request, screenshot_capture_request_unref);
+  g_clear_pointer(&self->priv->watch_keyframe, screenshot_tile_hashes_free);
+  g_free(self->priv->watch_keyframe_path);
+  g_free(self->priv->watch_last_path);
+  g_clear_pointer(&self->priv->watch_newest, screenshot_capture_request_unref);
+  cancel_speculative_encode(self);
+
+  screenshot_pixbuf_pool_get_stats(&pool_stats);
+  g_debug("Pixel buffer pool: %" G_GUINT64_FORMAT " hits, %" G_GUINT64_FORMAT " misses, "
+          "%" G_GUINT64_FORMAT " recycled, %" G_GUINT64_FORMAT " discarded",
+          pool_stats.hits, pool_stats.misses, pool_stats.recycled, pool_stats.discarded);
+  screenshot_pixbuf_pool_trim();
 
   G_OBJECT_CLASS(screenshot_application_parent_class)->finalize(object);
 }
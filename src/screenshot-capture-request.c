@@ -0,0 +1,245 @@
+/* screenshot-capture-request.c - one capture, from the request to the file
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+/* A request takes a copy of the configuration when the capture is asked
+ * for and then carries everything about that capture: the image, the
+ * file it goes to and its trace.  Each step of the pipeline holds a
+ * reference for as long as it runs, so captures can overlap, and changes
+ * to the configuration, from the interactive dialog or the next command
+ * line, only apply to the captures asked for afterwards.
+ *
+ * Like the rest of the capture code, everything but the reference count
+ * is only touched from one thread at a time.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "screenshot-capture-request.h"
+
+static void
+copy_options (ScreenshotCaptureOptions *options,
+              const ScreenshotConfig   *config)
+{
+  options->take_window_shot = config->take_window_shot;
+  options->take_area_shot = config->take_area_shot;
+  options->include_pointer = config->include_pointer;
+  options->include_border = config->include_border;
+  options->border_effect = g_strdup (config->border_effect);
+  options->effect_params = config->effect_params;
+  options->flash = TRUE;
+
+  options->delay = config->delay;
+  options->scale = config->scale;
+  options->ago = config->ago;
+
+  options->interactive = config->interactive;
+  options->copy_to_clipboard = config->copy_to_clipboard;
+  options->play_sound = config->play_sound;
+  options->sound = g_strdup (config->sound);
+
+  options->save_dir = g_strdup (config->save_dir);
+  options->file_type = g_strdup (config->file_type);
+  options->auto_quality_floor = config->auto_quality_floor;
+  options->file = config->file != NULL ? g_object_ref (config->file) : NULL;
+  options->file_fd = config->file_fd;
+}
+
+static void
+dup_options (ScreenshotCaptureOptions       *options,
+             const ScreenshotCaptureOptions *from)
+{
+  *options = *from;
+  options->border_effect = g_strdup (from->border_effect);
+  options->sound = g_strdup (from->sound);
+  options->save_dir = g_strdup (from->save_dir);
+  options->file_type = g_strdup (from->file_type);
+  options->file = from->file != NULL ? g_object_ref (from->file) : NULL;
+}
+
+static void
+clear_options (ScreenshotCaptureOptions *options)
+{
+  g_free (options->border_effect);
+  g_free (options->sound);
+  g_free (options->save_dir);
+  g_free (options->file_type);
+  g_clear_object (&options->file);
+}
+
+/**
+ * screenshot_capture_request_new:
+ * @config: the configuration to capture with
+ *
+ * Returns: a new request, with its own copy of the options in @config
+ */
+ScreenshotCaptureRequest *
+screenshot_capture_request_new (const ScreenshotConfig *config)
+{
+  ScreenshotCaptureRequest *request;
+
+  request = g_slice_new0 (ScreenshotCaptureRequest);
+  request->ref_count = 1;
+  request->requested_at = g_get_monotonic_time ();
+  copy_options (&request->options, config);
+
+  if (config->take_window_shot)
+    request->mode = "window";
+  else if (config->take_area_shot)
+    request->mode = "area";
+  else
+    request->mode = "screen";
+
+  request->jpeg_quality = -1;
+
+  return request;
+}
+
+/**
+ * screenshot_capture_request_copy:
+ * @request: a request
+ *
+ * Returns: a new request for the same capture as @request, of the same
+ *   area, as if it was asked for now
+ */
+ScreenshotCaptureRequest *
+screenshot_capture_request_copy (ScreenshotCaptureRequest *request)
+{
+  ScreenshotCaptureRequest *copy;
+
+  copy = g_slice_new0 (ScreenshotCaptureRequest);
+  copy->ref_count = 1;
+  copy->requested_at = g_get_monotonic_time ();
+  dup_options (&copy->options, &request->options);
+  copy->mode = request->mode;
+  copy->rectangle = request->rectangle;
+  copy->has_rectangle = request->has_rectangle;
+  copy->jpeg_quality = -1;
+
+  return copy;
+}
+
+ScreenshotCaptureRequest *
+screenshot_capture_request_ref (ScreenshotCaptureRequest *request)
+{
+  g_atomic_int_inc (&request->ref_count);
+  return request;
+}
+
+void
+screenshot_capture_request_unref (ScreenshotCaptureRequest *request)
+{
+  if (!g_atomic_int_dec_and_test (&request->ref_count))
+    return;
+
+  /* normally ended with an outcome before the last reference goes */
+  g_clear_pointer (&request->wait_span, screenshot_trace_end);
+  g_clear_pointer (&request->save_span, screenshot_trace_end);
+  g_clear_pointer (&request->trace_span, screenshot_trace_end);
+
+  g_clear_object (&request->command_line);
+  g_clear_pointer (&request->merged_command_lines, g_ptr_array_unref);
+  g_clear_pointer (&request->screenshot, screenshot_image_unref);
+  g_clear_pointer (&request->effects, screenshot_effect_stack_unref);
+  g_clear_pointer (&request->tile_hashes, screenshot_tile_hashes_free);
+  g_free (request->icc_profile_base64);
+  g_free (request->file_type);
+  g_free (request->save_uri);
+  g_free (request->save_path);
+
+  clear_options (&request->options);
+
+  g_slice_free (ScreenshotCaptureRequest, request);
+}
+
+/**
+ * screenshot_capture_request_stand_for:
+ * @request: a request
+ * @other: a request that will not run, as @request stands for it
+ *
+ * Makes the remote command lines waiting for @other wait for @request
+ * instead, so that they learn how it went.
+ */
+void
+screenshot_capture_request_stand_for (ScreenshotCaptureRequest *request,
+                                      ScreenshotCaptureRequest *other)
+{
+  guint i;
+
+  if (other->command_line == NULL && other->merged_command_lines == NULL)
+    return;
+
+  if (request->merged_command_lines == NULL)
+    request->merged_command_lines = g_ptr_array_new_with_free_func (g_object_unref);
+
+  if (other->command_line != NULL)
+    g_ptr_array_add (request->merged_command_lines, g_steal_pointer (&other->command_line));
+
+  if (other->merged_command_lines != NULL)
+    {
+      for (i = 0; i < other->merged_command_lines->len; i++)
+        g_ptr_array_add (request->merged_command_lines,
+                         g_object_ref (other->merged_command_lines->pdata[i]));
+
+      g_clear_pointer (&other->merged_command_lines, g_ptr_array_unref);
+    }
+}
+
+/* Whether the command line named an explicit destination (a file or an
+ * inherited file descriptor), in which case failures must be reported
+ * through the exit status.
+ */
+gboolean
+screenshot_capture_request_has_explicit_destination (ScreenshotCaptureRequest *request)
+{
+  return request->options.file != NULL || request->options.file_fd >= 0;
+}
+
+/**
+ * screenshot_capture_request_is_equivalent:
+ * @a: a request
+ * @b: another request
+ *
+ * Returns: whether @a and @b would save the same kind of screenshot to
+ *   the same place, so that one of them can stand for both.  Requests
+ *   for an explicit destination, the dialog or the history never are.
+ */
+gboolean
+screenshot_capture_request_is_equivalent (ScreenshotCaptureRequest *a,
+                                          ScreenshotCaptureRequest *b)
+{
+  const ScreenshotCaptureOptions *oa = &a->options, *ob = &b->options;
+
+  if (screenshot_capture_request_has_explicit_destination (a) ||
+      screenshot_capture_request_has_explicit_destination (b) ||
+      oa->interactive || ob->interactive ||
+      oa->ago >= 0 || ob->ago >= 0)
+    return FALSE;
+
+  /* by mode, as a window capture may have become one of the screen */
+  return g_strcmp0 (a->mode, b->mode) == 0 &&
+         oa->include_pointer == ob->include_pointer &&
+         oa->include_border == ob->include_border &&
+         g_strcmp0 (oa->border_effect, ob->border_effect) == 0 &&
+         memcmp (&oa->effect_params, &ob->effect_params, sizeof (ScreenshotEffectParams)) == 0 &&
+         oa->delay == ob->delay &&
+         oa->scale == ob->scale &&
+         oa->copy_to_clipboard == ob->copy_to_clipboard &&
+         g_strcmp0 (oa->save_dir, ob->save_dir) == 0 &&
+         g_strcmp0 (oa->file_type, ob->file_type) == 0;
+}
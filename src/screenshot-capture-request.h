@@ -0,0 +1,126 @@
+/* screenshot-capture-request.h - one capture, from the request to the file
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+#ifndef __SCREENSHOT_CAPTURE_REQUEST_H__
+#define __SCREENSHOT_CAPTURE_REQUEST_H__
+
+#include <gdk/gdk.h>
+
+#include "screenshot-config.h"
+#include "screenshot-effect-stack.h"
+#include "screenshot-image.h"
+#include "screenshot-tile-hash.h"
+#include "screenshot-trace.h"
+
+G_BEGIN_DECLS
+
+/* What is captured and where it goes, as configured when the capture was
+ * asked for */
+typedef struct {
+  gboolean take_window_shot;
+  gboolean take_area_shot;
+  gboolean include_pointer;
+  gboolean include_border;
+  gchar *border_effect;
+  ScreenshotEffectParams effect_params;
+  gboolean flash;
+
+  guint delay;
+  gdouble scale;
+
+  /* seconds before the request to take the screen from the history,
+   * or -1 to capture it now */
+  gdouble ago;
+
+  gboolean interactive;
+  gboolean copy_to_clipboard;
+  gboolean play_sound;
+  gchar *sound;
+
+  gchar *save_dir;
+  gchar *file_type;
+  gint auto_quality_floor;
+  GFile *file;
+  gint file_fd;
+} ScreenshotCaptureOptions;
+
+typedef struct {
+  gint ref_count;
+
+  ScreenshotCaptureOptions options;
+
+  /* the monotonic time the capture was asked for */
+  gint64 requested_at;
+
+  /* "screen", "window" or "area", as asked for */
+  const gchar *mode;
+
+  /* the area picked by the user, for area captures */
+  GdkRectangle rectangle;
+  gboolean has_rectangle;
+
+  /* the capture as taken, and as it is saved */
+  ScreenshotEffectStack *effects;
+  ScreenshotImage *screenshot;
+  gchar *icc_profile_base64;
+
+  /* the tiles of the capture, for the screenshots of a watch, and how
+   * many checks after it found too little changed, to be linked to it
+   * once it is saved */
+  ScreenshotTileHashes *tile_hashes;
+  guint n_links;
+
+  /* the default file type, with "auto" resolved, and the JPEG quality
+   * that goes with it, or -1 */
+  gchar *file_type;
+  gint jpeg_quality;
+
+  gchar *save_uri;
+  gchar *save_path;
+  gboolean should_overwrite;
+
+  /* the remote command line that asked for it, waiting to learn whether
+   * it was saved, or NULL */
+  GApplicationCommandLine *command_line;
+
+  /* those of the requests coalesced or merged into it, which wait for
+   * it as well, or NULL */
+  GPtrArray *merged_command_lines;
+
+  /* from the request to the file, and the stages run from here */
+  ScreenshotTraceSpan *trace_span;
+  ScreenshotTraceSpan *wait_span;
+  ScreenshotTraceSpan *save_span;
+} ScreenshotCaptureRequest;
+
+ScreenshotCaptureRequest *screenshot_capture_request_new   (const ScreenshotConfig   *config);
+ScreenshotCaptureRequest *screenshot_capture_request_copy  (ScreenshotCaptureRequest *request);
+ScreenshotCaptureRequest *screenshot_capture_request_ref   (ScreenshotCaptureRequest *request);
+void                      screenshot_capture_request_unref (ScreenshotCaptureRequest *request);
+
+void                      screenshot_capture_request_stand_for (ScreenshotCaptureRequest *request,
+                                                                ScreenshotCaptureRequest *other);
+
+gboolean                  screenshot_capture_request_has_explicit_destination (ScreenshotCaptureRequest *request);
+gboolean                  screenshot_capture_request_is_equivalent            (ScreenshotCaptureRequest *a,
+                                                                               ScreenshotCaptureRequest *b);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (ScreenshotCaptureRequest, screenshot_capture_request_unref)
+
+G_END_DECLS
+
+#endif /* __SCREENSHOT_CAPTURE_REQUEST_H__ */
@@ -23,6 +23,11 @@
 #include "config.h"
 
 #include <glib/gi18n.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "screenshot-config.h"
 
@@ -34,10 +39,61 @@
 #define AUTO_SAVE_DIRECTORY_KEY "auto-save-directory"
 #define LAST_SAVE_DIRECTORY_KEY "last-save-directory"
 #define DEFAULT_FILE_TYPE_KEY   "default-file-type"
+#define AUTO_QUALITY_FLOOR_KEY  "auto-quality-floor"
+#define METRICS_FILE_KEY        "metrics-file"
+#define CAPTURE_QUEUE_LENGTH_KEY "capture-queue-length"
+#define CAPTURE_QUEUE_OVERFLOW_KEY "capture-queue-overflow"
+#define HISTORY_RATE_KEY        "history-rate"
+#define HISTORY_MEMORY_LIMIT_KEY "history-memory-limit"
+#define WATCH_THRESHOLD_KEY     "watch-threshold"
+#define WATCH_MAX_RATE_KEY      "watch-max-rate"
+#define WATCH_UNCHANGED_KEY     "watch-unchanged"
+#define WATCH_DELTA_KEY         "watch-delta"
 #define HAS_SOUND               "has-sounds"
 #define SOUND_KEY               "sound"
+#define SHADOW_RADIUS_KEY       "shadow-radius"
+#define SHADOW_OFFSET_KEY       "shadow-offset"
+#define SHADOW_OPACITY_KEY      "shadow-opacity"
+#define BORDER_WIDTH_KEY        "border-width"
+#define VINTAGE_BORDER_WIDTH_KEY "vintage-border-width"
+
+/* Upscaling is allowed, but not to absurd sizes */
+#define MAX_SCALE 4.0
+
 ScreenshotConfig *screenshot_config;
 
+/* The effect parameters, which can also be set with --effect-option */
+static const struct {
+  const gchar *key;
+  gsize offset;
+  gboolean is_double;
+} effect_param_keys[] = {
+  { SHADOW_RADIUS_KEY, G_STRUCT_OFFSET (ScreenshotEffectParams, shadow_radius), FALSE },
+  { SHADOW_OFFSET_KEY, G_STRUCT_OFFSET (ScreenshotEffectParams, shadow_offset), FALSE },
+  { SHADOW_OPACITY_KEY, G_STRUCT_OFFSET (ScreenshotEffectParams, shadow_opacity), TRUE },
+  { BORDER_WIDTH_KEY, G_STRUCT_OFFSET (ScreenshotEffectParams, border_width), FALSE },
+  { VINTAGE_BORDER_WIDTH_KEY, G_STRUCT_OFFSET (ScreenshotEffectParams, vintage_border_width), FALSE },
+};
+
+static void
+load_effect_params (ScreenshotConfig *config)
+{
+  gpointer params = &config->effect_params;
+  guint i;
+
+  screenshot_effect_params_init_default (&config->effect_params);
+
+  for (i = 0; i < G_N_ELEMENTS (effect_param_keys); i++)
+    {
+      if (effect_param_keys[i].is_double)
+        G_STRUCT_MEMBER (gdouble, params, effect_param_keys[i].offset) =
+          g_settings_get_double (config->settings, effect_param_keys[i].key);
+      else
+        G_STRUCT_MEMBER (gint, params, effect_param_keys[i].offset) =
+          g_settings_get_int (config->settings, effect_param_keys[i].key);
+    }
+}
+
 void
 screenshot_load_config (void)
 {
@@ -67,9 +123,42 @@ screenshot_load_config (void)
   config->file_type =
     g_settings_get_string (config->settings,
                            DEFAULT_FILE_TYPE_KEY);
+  config->auto_quality_floor =
+    g_settings_get_int (config->settings,
+                        AUTO_QUALITY_FLOOR_KEY);
+  config->metrics_file =
+    g_settings_get_string (config->settings,
+                           METRICS_FILE_KEY);
+  config->capture_queue_length =
+    g_settings_get_int (config->settings,
+                        CAPTURE_QUEUE_LENGTH_KEY);
+  config->capture_queue_overflow =
+    g_settings_get_enum (config->settings,
+                         CAPTURE_QUEUE_OVERFLOW_KEY);
+  config->history_rate =
+    g_settings_get_double (config->settings,
+                           HISTORY_RATE_KEY);
+  config->history_memory_limit =
+    g_settings_get_int (config->settings,
+                        HISTORY_MEMORY_LIMIT_KEY);
+  config->watch_threshold =
+    g_settings_get_double (config->settings,
+                           WATCH_THRESHOLD_KEY);
+  config->watch_max_rate =
+    g_settings_get_double (config->settings,
+                           WATCH_MAX_RATE_KEY);
+  config->watch_unchanged =
+    g_settings_get_enum (config->settings,
+                         WATCH_UNCHANGED_KEY);
+  config->watch_delta =
+    g_settings_get_boolean (config->settings,
+                            WATCH_DELTA_KEY);
   config->include_icc_profile =
     g_settings_get_boolean (config->settings,
                             INCLUDE_ICC_PROFILE);
+  config->scale = 1.0;
+  config->ago = -1;
+  load_effect_params (config);
 
   if (config->border_effect == NULL)
     config->border_effect = g_strdup ("none");
@@ -77,6 +166,7 @@ screenshot_load_config (void)
     config->border_effect = g_strdup ("none");
   config->take_window_shot = FALSE;
   config->take_area_shot = FALSE;
+  config->file_fd = -1;
 
   config->play_sound = 
     g_settings_get_boolean (config->settings,
@@ -113,8 +203,168 @@ screenshot_save_config (void)
     g_settings_set_int (c->settings, DELAY_KEY, c->delay);
 }
 
+/* Errors go to whoever gave the command line, which is another process
+ * when this instance is already running */
+static void G_GNUC_PRINTF (2, 3)
+print_error (GApplicationCommandLine *command_line,
+             const gchar             *format,
+             ...)
+{
+  g_autofree gchar *message = NULL;
+  va_list args;
+
+  va_start (args, format);
+  message = g_strdup_vprintf (format, args);
+  va_end (args);
+
+  if (command_line != NULL)
+    g_application_command_line_printerr (command_line, "%s", message);
+  else
+    g_printerr ("%s", message);
+}
+
+/* Accepts the same file types as the default-file-type key, for this
+ * screenshot only */
+static gboolean
+parse_file_type (GApplicationCommandLine *command_line,
+                 const gchar             *file_type_arg)
+{
+  g_autoptr(GSettingsSchema) schema = NULL;
+  g_autoptr(GSettingsSchemaKey) key = NULL;
+  g_autoptr(GVariant) value = NULL;
+
+  g_object_get (screenshot_config->settings, "settings-schema", &schema, NULL);
+  key = g_settings_schema_get_key (schema, DEFAULT_FILE_TYPE_KEY);
+  value = g_variant_ref_sink (g_variant_new_string (file_type_arg));
+
+  if (!g_settings_schema_key_range_check (key, value))
+    {
+      print_error (command_line, _("Invalid file type: %s\n"), file_type_arg);
+      return FALSE;
+    }
+
+  g_free (screenshot_config->file_type);
+  screenshot_config->file_type = g_strdup (file_type_arg);
+
+  return TRUE;
+}
+
+/* Recognizes the destinations that name an already open file descriptor
+ * rather than a path: "-" and /dev/stdout for the standard output, and
+ * /dev/fd/N for a descriptor inherited from the parent process.
+ */
+static gboolean
+parse_file_descriptor (const gchar *file_arg,
+                       gint        *fd_out)
+{
+  const gchar *fd_str;
+  gchar *end = NULL;
+  gint64 fd;
+
+  if (g_strcmp0 (file_arg, "-") == 0 ||
+      g_strcmp0 (file_arg, "/dev/stdout") == 0)
+    {
+      *fd_out = STDOUT_FILENO;
+      return TRUE;
+    }
+
+  if (!g_str_has_prefix (file_arg, "/dev/fd/"))
+    return FALSE;
+
+  fd_str = file_arg + strlen ("/dev/fd/");
+  fd = g_ascii_strtoll (fd_str, &end, 10);
+  if (end == fd_str || *end != '\0' || fd < 0 || fd > G_MAXINT)
+    return FALSE;
+
+  *fd_out = (gint) fd;
+  return TRUE;
+}
+
+/* Parses NAME=VALUE, where NAME is one of the effect keys in the schema,
+ * and sets the parameter for this run only; it is never saved.  The value
+ * is checked against the range given in the schema.
+ */
+static gboolean
+parse_effect_option (GApplicationCommandLine *command_line,
+                     const gchar             *option)
+{
+  g_autoptr(GSettingsSchema) schema = NULL;
+  g_autoptr(GSettingsSchemaKey) schema_key = NULL;
+  g_autoptr(GVariant) value = NULL;
+  g_autofree gchar *name = NULL;
+  gpointer params = &screenshot_config->effect_params;
+  const gchar *value_str;
+  gchar *end = NULL;
+  guint i;
+
+  value_str = strchr (option, '=');
+  if (value_str == NULL)
+    {
+      print_error (command_line, _("Invalid effect option: “%s”; it must be NAME=VALUE.\n"), option);
+      return FALSE;
+    }
+
+  name = g_strndup (option, value_str - option);
+  value_str++;
+
+  for (i = 0; i < G_N_ELEMENTS (effect_param_keys); i++)
+    if (g_strcmp0 (name, effect_param_keys[i].key) == 0)
+      break;
+
+  if (i == G_N_ELEMENTS (effect_param_keys))
+    {
+      print_error (command_line, _("Unknown effect option: “%s”.\n"), name);
+      return FALSE;
+    }
+
+  if (effect_param_keys[i].is_double)
+    {
+      gdouble d = g_ascii_strtod (value_str, &end);
+
+      value = g_variant_ref_sink (g_variant_new_double (d));
+    }
+  else
+    {
+      gint64 n = g_ascii_strtoll (value_str, &end, 10);
+
+      if (n >= G_MININT32 && n <= G_MAXINT32)
+        value = g_variant_ref_sink (g_variant_new_int32 (n));
+    }
+
+  g_object_get (screenshot_config->settings, "settings-schema", &schema, NULL);
+  schema_key = g_settings_schema_get_key (schema, name);
+
+  if (end == value_str || *end != '\0' || value == NULL ||
+      !g_settings_schema_key_range_check (schema_key, value))
+    {
+      print_error (command_line, _("Invalid value for effect option “%s”: “%s”.\n"),
+                   name, value_str);
+      return FALSE;
+    }
+
+  if (effect_param_keys[i].is_double)
+    G_STRUCT_MEMBER (gdouble, params, effect_param_keys[i].offset) =
+      g_variant_get_double (value);
+  else
+    G_STRUCT_MEMBER (gint, params, effect_param_keys[i].offset) =
+      g_variant_get_int32 (value);
+
+  return TRUE;
+}
+
+/**
+ * screenshot_config_parse_command_line:
+ * @command_line: (nullable): the command line the arguments come from,
+ *   or %NULL for an action
+ *
+ * Sets the configuration for the next screenshot from the arguments.
+ * Errors are printed for @command_line.
+ *
+ * Returns: whether the arguments are valid
+ */
 gboolean
-screenshot_config_parse_command_line (gboolean clipboard_arg,
+screenshot_config_parse_command_line (GApplicationCommandLine *command_line,
+                                      gboolean clipboard_arg,
                                       gboolean window_arg,
                                       gboolean area_arg,
                                       gboolean include_border_arg,
@@ -123,22 +373,61 @@ screenshot_config_parse_command_line (gboolean clipboard_arg,
                                       const gchar *border_effect_arg,
                                       guint delay_arg,
                                       gboolean interactive_arg,
-                                      const gchar *file_arg)
+                                      const gchar *file_arg,
+                                      const gchar *file_type_arg,
+                                      gdouble scale_arg,
+                                      gdouble ago_arg,
+                                      const gchar * const *effect_option_args)
 {
   if (window_arg && area_arg)
     {
-      g_printerr (_("Conflicting options: --window and --area should not be "
-                    "used at the same time.\n"));
+      print_error (command_line, _("Conflicting options: --window and --area should not be "
+                                   "used at the same time.\n"));
       return FALSE;
     }
 
   if (delay_arg && area_arg)
     {
-      g_printerr (_("Conflicting options: --area and --delay should not be "
-                    "used at the same time.\n"));
+      print_error (command_line, _("Conflicting options: --area and --delay should not be "
+                                   "used at the same time.\n"));
+      return FALSE;
+    }
+
+  /* the history only keeps the whole screen, as it was */
+  if (ago_arg >= 0 &&
+      (window_arg || area_arg || delay_arg || include_pointer_arg || interactive_arg))
+    {
+      print_error (command_line, _("Conflicting options: --ago cannot be used with --window, "
+                                   "--area, --delay, --include-pointer or --interactive.\n"));
       return FALSE;
     }
 
+  if (scale_arg <= 0.0 || scale_arg > MAX_SCALE)
+    {
+      print_error (command_line, _("Invalid scale: %g; it must be larger than 0 and at most %g.\n"),
+                   scale_arg, MAX_SCALE);
+      return FALSE;
+    }
+
+  screenshot_config->scale = scale_arg;
+  screenshot_config->ago = ago_arg;
+
+  /* what the previous command line asked for is not for this one */
+  g_clear_object (&screenshot_config->file);
+  screenshot_config->file_fd = -1;
+  g_free (screenshot_config->file_type);
+  screenshot_config->file_type =
+    g_settings_get_string (screenshot_config->settings,
+                           DEFAULT_FILE_TYPE_KEY);
+  load_effect_params (screenshot_config);
+
+  if (file_type_arg != NULL && !parse_file_type (command_line, file_type_arg))
+    return FALSE;
+
+  for (; effect_option_args != NULL && *effect_option_args != NULL; effect_option_args++)
+    if (!parse_effect_option (command_line, *effect_option_args))
+      return FALSE;
+
   screenshot_config->interactive = interactive_arg;
 
   if (screenshot_config->interactive)
@@ -169,7 +458,34 @@ screenshot_config_parse_command_line (gboolean clipboard_arg,
       screenshot_config->include_border = !disable_border_arg;
       screenshot_config->include_pointer = include_pointer_arg;
       screenshot_config->copy_to_clipboard = clipboard_arg;
-      if (file_arg != NULL)
+      if (file_arg != NULL &&
+          parse_file_descriptor (file_arg, &screenshot_config->file_fd))
+        {
+          /* the descriptors would be those of this instance */
+          if (command_line != NULL &&
+              g_application_command_line_get_is_remote (command_line))
+            {
+              screenshot_config->file_fd = -1;
+              print_error (command_line,
+                           _("Invalid file: %s; gnome-screenshot is already running, "
+                             "and cannot write to the files of another process.\n"),
+                           file_arg);
+              return FALSE;
+            }
+
+          if (fcntl (screenshot_config->file_fd, F_GETFL) == -1)
+            {
+              print_error (command_line, _("Invalid file descriptor: %s\n"), file_arg);
+              return FALSE;
+            }
+
+          /* report a closed pipe as a write error instead of dying */
+          signal (SIGPIPE, SIG_IGN);
+        }
+      else if (file_arg != NULL && command_line != NULL)
+        screenshot_config->file =
+          g_application_command_line_create_file_for_arg (command_line, file_arg);
+      else if (file_arg != NULL)
         screenshot_config->file = g_file_new_for_commandline_arg (file_arg);
     }
 
@@ -23,6 +23,8 @@
 
 #include <gio/gio.h>
 
+#include "screenshot-shadow.h"
+
 G_BEGIN_DECLS
 
 typedef struct {
@@ -30,7 +32,18 @@ typedef struct {
 
   gchar *save_dir;
   gchar *file_type;
+  gint auto_quality_floor;
+  gchar *metrics_file;
+  guint capture_queue_length;
+  gint capture_queue_overflow;
+  gdouble history_rate;
+  guint history_memory_limit;
+  gdouble watch_threshold;
+  gdouble watch_max_rate;
+  gint watch_unchanged;
+  gboolean watch_delta;
   GFile *file;
+  gint file_fd;
 
   gboolean copy_to_clipboard;
 
@@ -42,10 +55,13 @@ typedef struct {
 
   gboolean include_border;
   gchar *border_effect;
+  ScreenshotEffectParams effect_params;
   gchar *sound;
   gboolean play_sound;//play sound or not 
 
   guint delay;
+  gdouble scale;
+  gdouble ago;
 
   gboolean pinta_check;
   gboolean gthump_check;
@@ -58,7 +74,8 @@ extern ScreenshotConfig *screenshot_config;
 
 void        screenshot_load_config                (void);
 void        screenshot_save_config                (void);
-gboolean    screenshot_config_parse_command_line  (gboolean clipboard_arg,
+gboolean    screenshot_config_parse_command_line  (GApplicationCommandLine *command_line,
+                                                   gboolean clipboard_arg,
                                                    gboolean window_arg,
                                                    gboolean area_arg,
                                                    gboolean include_border_arg,
@@ -67,7 +84,11 @@ gboolean    screenshot_config_parse_command_line  (gboolean clipboard_arg,
                                                    const gchar *border_effect_arg,
                                                    guint delay_arg,
                                                    gboolean interactive_arg,
-                                                   const gchar *file_arg);
+                                                   const gchar *file_arg,
+                                                   const gchar *file_type_arg,
+                                                   gdouble scale_arg,
+                                                   gdouble ago_arg,
+                                                   const gchar * const *effect_option_args);
 
 G_END_DECLS
 
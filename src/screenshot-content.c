@@ -0,0 +1,201 @@
+/* screenshot-content.c - picks a file type from what a capture shows
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+/* Most screenshots show windows, text and icons: few distinct colours and
+ * long runs of identical pixels, which PNG compresses well and JPEG
+ * smears.  Some show a photo, a game or a video frame instead, where
+ * every pixel differs a little from its neighbour, PNG files get huge and
+ * JPEG loses nothing anyone would notice.
+ *
+ * Telling them apart does not need the whole capture.  A grid of at most
+ * 256 x 256 samples is taken, in whichever form the capture already is,
+ * and for each one the colour is counted, up to one more than a palette
+ * can hold, and the difference to the pixel on its left is added to a
+ * histogram.  The entropy of that histogram is what a predictor like
+ * PNG's would leave for the compressor: near zero for flat UI, several
+ * bits for photographic content.
+ */
+
+#include "config.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "screenshot-content.h"
+
+/* The sample grid */
+#define SAMPLE_ROWS 256
+#define SAMPLE_COLUMNS 256
+
+/* Open addressing, with room for a palette and one more colour */
+#define COLOR_TABLE_BITS 10
+#define COLOR_TABLE_SIZE (1 << COLOR_TABLE_BITS)
+
+/* |dr| + |dg| + |db| */
+#define N_DIFFERENCES (3 * 255 + 1)
+
+/* Below these, JPEG would not pay off */
+#define PHOTO_MIN_ENTROPY 3.0
+#define PHOTO_MAX_FLAT_FRACTION 0.5
+
+typedef struct {
+  gint64 slots[COLOR_TABLE_SIZE];
+  guint n_colors;
+} ColorSet;
+
+static void
+color_set_add (ColorSet *set,
+               guint32   color)
+{
+  guint i;
+
+  if (set->n_colors > SCREENSHOT_CONTENT_MAX_PALETTE)
+    return;
+
+  i = (color * 2654435761u) >> (32 - COLOR_TABLE_BITS);
+
+  while (set->slots[i] != -1)
+    {
+      if (set->slots[i] == color)
+        return;
+
+      i = (i + 1) & (COLOR_TABLE_SIZE - 1);
+    }
+
+  set->slots[i] = color;
+  set->n_colors++;
+}
+
+static guint32
+read_color (const ScreenshotImagePixels *pixels,
+            const guchar                *p)
+{
+  const guchar *c = p + pixels->color_offset;
+  guint32 color = (c[0] << 16) | (c[1] << 8) | c[2];
+
+  if (pixels->alpha_offset >= 0)
+    color |= (guint32) p[pixels->alpha_offset] << 24;
+  else
+    color |= 0xff000000;
+
+  return color;
+}
+
+/**
+ * screenshot_content_analyze:
+ * @image: a capture
+ * @stats: (out): what it shows
+ *
+ * Samples @image without converting it and classifies its content.
+ */
+void
+screenshot_content_analyze (ScreenshotImage        *image,
+                            ScreenshotContentStats *stats)
+{
+  ScreenshotImagePixels pixels;
+  ColorSet *colors;
+  guint histogram[N_DIFFERENCES] = { 0, };
+  gint width, height, n_rows, n_columns, row, column;
+  guint n_differences = 0;
+  gdouble entropy = 0.0;
+  guint i;
+
+  memset (stats, 0, sizeof (ScreenshotContentStats));
+
+  width = screenshot_image_get_width (image);
+  height = screenshot_image_get_height (image);
+  screenshot_image_peek_pixels (image, &pixels);
+
+  colors = g_new (ColorSet, 1);
+  memset (colors->slots, 0xff, sizeof (colors->slots));
+  colors->n_colors = 0;
+
+  n_rows = MIN (height, SAMPLE_ROWS);
+  n_columns = MIN (width, SAMPLE_COLUMNS);
+
+  for (row = 0; row < n_rows; row++)
+    {
+      const guchar *line = pixels.data + (gsize) (row * height / n_rows) * pixels.rowstride;
+
+      for (column = 0; column < n_columns; column++)
+        {
+          gint x = column * width / n_columns;
+          const guchar *p = line + x * pixels.bytes_per_pixel;
+          guint32 color = read_color (&pixels, p);
+
+          color_set_add (colors, color);
+          stats->n_samples++;
+
+          if ((color >> 24) != 0xff)
+            stats->translucent = TRUE;
+
+          if (x > 0)
+            {
+              const guchar *a = p + pixels.color_offset;
+              const guchar *b = a - pixels.bytes_per_pixel;
+
+              histogram[ABS (a[0] - b[0]) + ABS (a[1] - b[1]) + ABS (a[2] - b[2])]++;
+              n_differences++;
+            }
+        }
+    }
+
+  stats->n_colors = colors->n_colors;
+  g_free (colors);
+
+  for (i = 0; i < N_DIFFERENCES && n_differences > 0; i++)
+    {
+      gdouble p;
+
+      if (histogram[i] == 0)
+        continue;
+
+      p = (gdouble) histogram[i] / n_differences;
+      entropy -= p * log2 (p);
+    }
+
+  stats->entropy = entropy;
+  stats->flat_fraction = n_differences > 0 ? (gdouble) histogram[0] / n_differences : 1.0;
+
+  if (stats->n_colors <= SCREENSHOT_CONTENT_MAX_PALETTE)
+    stats->kind = SCREENSHOT_CONTENT_PALETTE;
+  else if (!stats->translucent &&
+           stats->entropy >= PHOTO_MIN_ENTROPY &&
+           stats->flat_fraction <= PHOTO_MAX_FLAT_FRACTION)
+    stats->kind = SCREENSHOT_CONTENT_PHOTO;
+  else
+    stats->kind = SCREENSHOT_CONTENT_TRUECOLOR;
+}
+
+/**
+ * screenshot_content_pick_file_type:
+ * @stats: the result of screenshot_content_analyze()
+ * @quality_floor: the lowest JPEG quality allowed; 100 never picks JPEG,
+ *   which would lose detail even then
+ *
+ * Returns: the file type extension to save the capture with
+ */
+const gchar *
+screenshot_content_pick_file_type (const ScreenshotContentStats *stats,
+                                   gint                          quality_floor)
+{
+  if (stats->kind == SCREENSHOT_CONTENT_PHOTO && quality_floor < 100)
+    return "jpg";
+
+  /* palette content ends up indexed, see screenshot-png8.c */
+  return "png";
+}
@@ -0,0 +1,50 @@
+/* screenshot-content.h - picks a file type from what a capture shows
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+#ifndef __SCREENSHOT_CONTENT_H__
+#define __SCREENSHOT_CONTENT_H__
+
+#include "screenshot-image.h"
+
+G_BEGIN_DECLS
+
+/* The most colours an indexed PNG can hold */
+#define SCREENSHOT_CONTENT_MAX_PALETTE 256
+
+typedef enum {
+  SCREENSHOT_CONTENT_PALETTE,    /* few colours, like plain UI */
+  SCREENSHOT_CONTENT_TRUECOLOR,  /* many colours, but mostly flat areas */
+  SCREENSHOT_CONTENT_PHOTO       /* continuous tone, like photos or video */
+} ScreenshotContentKind;
+
+typedef struct {
+  guint n_samples;
+  guint n_colors;          /* at most SCREENSHOT_CONTENT_MAX_PALETTE + 1 */
+  gdouble entropy;         /* bits per sample of the neighbour differences */
+  gdouble flat_fraction;   /* samples equal to their left neighbour */
+  gboolean translucent;    /* some sample is not opaque */
+  ScreenshotContentKind kind;
+} ScreenshotContentStats;
+
+void         screenshot_content_analyze        (ScreenshotImage              *image,
+                                                ScreenshotContentStats       *stats);
+const gchar *screenshot_content_pick_file_type (const ScreenshotContentStats *stats,
+                                                gint                          quality_floor);
+
+G_END_DECLS
+
+#endif /* __SCREENSHOT_CONTENT_H__ */
@@ -0,0 +1,341 @@
+/* screenshot-delta.c - the tiles of a frame that changed, in a file
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+/* Screenshots taken one after the other by --watch mostly show the same
+ * thing: a clock ticks, a line is added to a log.  Rather than the whole
+ * frame again, a delta holds only the tiles that differ from an earlier
+ * screenshot saved in full, the reference, see screenshot-tile-hash.c, so
+ * encoding and the file both shrink with the part that did not change.
+ * The reference is always a full screenshot, never another delta, so any
+ * frame is its reference with a single delta drawn over it.
+ *
+ * A delta file is, with numbers as 32 bit big endian integers:
+ *
+ *   "GSDELTA1"
+ *   the width and height of the frame, and the size of the tiles
+ *   the number of tiles, n
+ *   the length of the name of the reference, and the name, in UTF-8; it
+ *     is in the same folder
+ *   the index of each tile, row by row, in rows of as many tiles as
+ *     cover the width
+ *   unless n is 0, a QOI image a tile wide and n tiles high, with the
+ *     tiles one under the other in the same order; those on the right
+ *     and bottom edges of the frame only fill its top left corner
+ *
+ * Image viewers do not know the format; screenshot_delta_load() draws a
+ * delta over its reference to give the frame back.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "screenshot-delta.h"
+#include "screenshot-formats.h"
+#include "screenshot-tile-hash.h"
+
+#define DELTA_MAGIC "GSDELTA1"
+
+/* The magic and the five numbers before the name of the reference */
+#define DELTA_HEADER_SIZE (sizeof (DELTA_MAGIC) - 1 + 5 * 4)
+
+typedef struct {
+  guint32 width;
+  guint32 height;
+  guint32 n_tiles;
+  const gchar *reference;
+  guint32 reference_len;
+  const guchar *indices;
+  const guchar *mosaic;
+  gsize mosaic_size;
+} DeltaHeader;
+
+static void
+append_32 (GByteArray *header,
+           guint32     value)
+{
+  value = GUINT32_TO_BE (value);
+  g_byte_array_append (header, (const guint8 *) &value, sizeof (value));
+}
+
+static guint32
+read_32 (const guchar *p)
+{
+  return (guint32) p[0] << 24 | (guint32) p[1] << 16 | (guint32) p[2] << 8 | p[3];
+}
+
+/* The tiles, one under the other */
+static GdkPixbuf *
+make_mosaic (GdkPixbuf *pixbuf,
+             GArray    *tiles)
+{
+  gint width = gdk_pixbuf_get_width (pixbuf);
+  gint height = gdk_pixbuf_get_height (pixbuf);
+  gint columns = (width + SCREENSHOT_TILE_SIZE - 1) / SCREENSHOT_TILE_SIZE;
+  GdkPixbuf *mosaic;
+  guint i;
+
+  mosaic = gdk_pixbuf_new (GDK_COLORSPACE_RGB,
+                           gdk_pixbuf_get_has_alpha (pixbuf), 8,
+                           SCREENSHOT_TILE_SIZE,
+                           SCREENSHOT_TILE_SIZE * tiles->len);
+  if (mosaic == NULL)
+    return NULL;
+
+  gdk_pixbuf_fill (mosaic, 0);
+
+  for (i = 0; i < tiles->len; i++)
+    {
+      guint tile = g_array_index (tiles, guint, i);
+      gint x = (tile % columns) * SCREENSHOT_TILE_SIZE;
+      gint y = (tile / columns) * SCREENSHOT_TILE_SIZE;
+
+      gdk_pixbuf_copy_area (pixbuf, x, y,
+                            MIN (SCREENSHOT_TILE_SIZE, width - x),
+                            MIN (SCREENSHOT_TILE_SIZE, height - y),
+                            mosaic, 0, i * SCREENSHOT_TILE_SIZE);
+    }
+
+  return mosaic;
+}
+
+/**
+ * screenshot_delta_save_to_callback:
+ * @pixbuf: the frame
+ * @tiles: (element-type guint): the indices of the tiles of @pixbuf that
+ *   differ from the reference, see screenshot_tile_hashes_diff()
+ * @reference: the file name of the reference, without the folder
+ *
+ * Writes the tiles of @pixbuf listed in @tiles as a delta file.
+ */
+gboolean
+screenshot_delta_save_to_callback (GdkPixbuf          *pixbuf,
+                                   GArray             *tiles,
+                                   const gchar        *reference,
+                                   GdkPixbufSaveFunc   save_func,
+                                   gpointer            user_data,
+                                   GError            **error)
+{
+  g_autoptr(GByteArray) header = NULL;
+  g_autoptr(GdkPixbuf) mosaic = NULL;
+  gsize reference_len = strlen (reference);
+  guint i;
+
+  header = g_byte_array_new ();
+  g_byte_array_append (header, (const guint8 *) DELTA_MAGIC, strlen (DELTA_MAGIC));
+  append_32 (header, gdk_pixbuf_get_width (pixbuf));
+  append_32 (header, gdk_pixbuf_get_height (pixbuf));
+  append_32 (header, SCREENSHOT_TILE_SIZE);
+  append_32 (header, tiles->len);
+  append_32 (header, reference_len);
+  g_byte_array_append (header, (const guint8 *) reference, reference_len);
+
+  for (i = 0; i < tiles->len; i++)
+    append_32 (header, g_array_index (tiles, guint, i));
+
+  if (!save_func ((const gchar *) header->data, header->len, error, user_data))
+    return FALSE;
+
+  if (tiles->len == 0)
+    return TRUE;
+
+  mosaic = make_mosaic (pixbuf, tiles);
+  if (mosaic == NULL)
+    {
+      g_set_error_literal (error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_INSUFFICIENT_MEMORY,
+                           "Not enough memory for the changed tiles");
+      return FALSE;
+    }
+
+  return screenshot_format_save_to_callback (mosaic, "qoi", save_func, user_data, error);
+}
+
+static gboolean
+parse_header (const guchar  *data,
+              gsize          size,
+              DeltaHeader   *header,
+              GError       **error)
+{
+  const guchar *p;
+  gsize left;
+  guint64 n_frame_tiles;
+  guint32 i;
+
+  if (size < DELTA_HEADER_SIZE || memcmp (data, DELTA_MAGIC, strlen (DELTA_MAGIC)) != 0)
+    goto invalid;
+
+  p = data + strlen (DELTA_MAGIC);
+  header->width = read_32 (p);
+  header->height = read_32 (p + 4);
+  header->n_tiles = read_32 (p + 12);
+  header->reference_len = read_32 (p + 16);
+
+  /* only the tiles of the tile hashes are written */
+  if (read_32 (p + 8) != SCREENSHOT_TILE_SIZE ||
+      header->width == 0 || header->height == 0 ||
+      header->width > G_MAXINT / 4 || header->height > G_MAXINT / 4)
+    goto invalid;
+
+  n_frame_tiles = (guint64) ((header->width + SCREENSHOT_TILE_SIZE - 1) / SCREENSHOT_TILE_SIZE) *
+                  ((header->height + SCREENSHOT_TILE_SIZE - 1) / SCREENSHOT_TILE_SIZE);
+  if (header->n_tiles > n_frame_tiles)
+    goto invalid;
+
+  p = data + DELTA_HEADER_SIZE;
+  left = size - DELTA_HEADER_SIZE;
+
+  /* a file name in the same folder, nothing that leads out of it */
+  header->reference = (const gchar *) p;
+  if (header->reference_len == 0 || header->reference_len > left ||
+      !g_utf8_validate (header->reference, header->reference_len, NULL) ||
+      memchr (header->reference, '/', header->reference_len) != NULL ||
+      memchr (header->reference, G_DIR_SEPARATOR, header->reference_len) != NULL ||
+      (header->reference_len == 1 && header->reference[0] == '.') ||
+      (header->reference_len == 2 && memcmp (header->reference, "..", 2) == 0))
+    goto invalid;
+
+  p += header->reference_len;
+  left -= header->reference_len;
+
+  if ((guint64) header->n_tiles * 4 > left)
+    goto invalid;
+
+  header->indices = p;
+  for (i = 0; i < header->n_tiles; i++)
+    if (read_32 (p + 4 * i) >= n_frame_tiles)
+      goto invalid;
+
+  header->mosaic = p + (gsize) header->n_tiles * 4;
+  header->mosaic_size = left - (gsize) header->n_tiles * 4;
+
+  return TRUE;
+
+ invalid:
+  g_set_error_literal (error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_CORRUPT_IMAGE,
+                       "The delta is corrupt");
+  return FALSE;
+}
+
+/**
+ * screenshot_delta_get_reference:
+ * @data: a delta file, as written by screenshot_delta_save_to_callback()
+ * @size: the length of @data
+ * @error: return location for an error
+ *
+ * Returns: (transfer full) (nullable): the file name of the reference of
+ *   @data, in the same folder as it
+ */
+gchar *
+screenshot_delta_get_reference (const guchar  *data,
+                                gsize          size,
+                                GError       **error)
+{
+  DeltaHeader header;
+
+  if (!parse_header (data, size, &header, error))
+    return NULL;
+
+  return g_strndup (header.reference, header.reference_len);
+}
+
+/**
+ * screenshot_delta_load:
+ * @data: a delta file, as written by screenshot_delta_save_to_callback()
+ * @size: the length of @data
+ * @reference: the reference of @data, see screenshot_delta_get_reference()
+ * @error: return location for an error
+ *
+ * Returns: (transfer full) (nullable): the frame, @reference with the
+ *   tiles of @data drawn over it
+ */
+GdkPixbuf *
+screenshot_delta_load (const guchar  *data,
+                       gsize          size,
+                       GdkPixbuf     *reference,
+                       GError       **error)
+{
+  g_autoptr(GdkPixbuf) mosaic = NULL;
+  g_autoptr(GdkPixbuf) frame = NULL;
+  DeltaHeader header;
+  gint columns;
+  guint32 i;
+
+  if (!parse_header (data, size, &header, error))
+    return NULL;
+
+  if ((guint32) gdk_pixbuf_get_width (reference) != header.width ||
+      (guint32) gdk_pixbuf_get_height (reference) != header.height)
+    {
+      g_set_error (error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_FAILED,
+                   "The delta is of a %ux%u frame, the reference is %dx%d",
+                   header.width, header.height,
+                   gdk_pixbuf_get_width (reference), gdk_pixbuf_get_height (reference));
+      return NULL;
+    }
+
+  if (header.n_tiles > 0)
+    {
+      mosaic = screenshot_format_load_qoi (header.mosaic, header.mosaic_size, error);
+      if (mosaic == NULL)
+        return NULL;
+
+      if (gdk_pixbuf_get_width (mosaic) != SCREENSHOT_TILE_SIZE ||
+          (guint64) gdk_pixbuf_get_height (mosaic) != (guint64) SCREENSHOT_TILE_SIZE * header.n_tiles)
+        {
+          g_set_error_literal (error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_CORRUPT_IMAGE,
+                               "The delta is corrupt");
+          return NULL;
+        }
+    }
+
+  /* with an alpha channel if either has one */
+  if (mosaic != NULL && gdk_pixbuf_get_has_alpha (mosaic) && !gdk_pixbuf_get_has_alpha (reference))
+    frame = gdk_pixbuf_add_alpha (reference, FALSE, 0, 0, 0);
+  else
+    frame = gdk_pixbuf_copy (reference);
+
+  if (mosaic != NULL && !gdk_pixbuf_get_has_alpha (mosaic) && gdk_pixbuf_get_has_alpha (frame))
+    {
+      GdkPixbuf *with_alpha = gdk_pixbuf_add_alpha (mosaic, FALSE, 0, 0, 0);
+
+      g_object_unref (mosaic);
+      mosaic = with_alpha;
+    }
+
+  if (frame == NULL || (header.n_tiles > 0 && mosaic == NULL))
+    {
+      g_set_error_literal (error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_INSUFFICIENT_MEMORY,
+                           "Not enough memory for the frame");
+      return NULL;
+    }
+
+  columns = (header.width + SCREENSHOT_TILE_SIZE - 1) / SCREENSHOT_TILE_SIZE;
+
+  for (i = 0; i < header.n_tiles; i++)
+    {
+      guint32 tile = read_32 (header.indices + 4 * i);
+      gint x = (tile % columns) * SCREENSHOT_TILE_SIZE;
+      gint y = (tile / columns) * SCREENSHOT_TILE_SIZE;
+
+      gdk_pixbuf_copy_area (mosaic, 0, i * SCREENSHOT_TILE_SIZE,
+                            MIN (SCREENSHOT_TILE_SIZE, (gint) header.width - x),
+                            MIN (SCREENSHOT_TILE_SIZE, (gint) header.height - y),
+                            frame, x, y);
+    }
+
+  return g_steal_pointer (&frame);
+}
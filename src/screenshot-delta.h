@@ -0,0 +1,44 @@
+/* screenshot-delta.h - the tiles of a frame that changed, in a file
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+#ifndef __SCREENSHOT_DELTA_H__
+#define __SCREENSHOT_DELTA_H__
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+G_BEGIN_DECLS
+
+/* The extension of the files written */
+#define SCREENSHOT_DELTA_EXTENSION "gsdelta"
+
+gboolean   screenshot_delta_save_to_callback (GdkPixbuf          *pixbuf,
+                                              GArray             *tiles,
+                                              const gchar        *reference,
+                                              GdkPixbufSaveFunc   save_func,
+                                              gpointer            user_data,
+                                              GError            **error);
+gchar     *screenshot_delta_get_reference    (const guchar       *data,
+                                              gsize               size,
+                                              GError            **error);
+GdkPixbuf *screenshot_delta_load             (const guchar       *data,
+                                              gsize               size,
+                                              GdkPixbuf          *reference,
+                                              GError            **error);
+
+G_END_DECLS
+
+#endif /* __SCREENSHOT_DELTA_H__ */
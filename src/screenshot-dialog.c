@@ -21,6 +21,7 @@
 
 #include "screenshot-config.h"
 #include "screenshot-dialog.h"
+#include "screenshot-resample.h"
 #include "screenshot-utils.h"
 #include <glib/gi18n.h>
 #include <gio/gio.h>
@@ -37,6 +38,53 @@ static GtkTargetEntry drag_types[] =
   { "image/png", 0, TYPE_IMAGE_PNG },
 };
 
+/* Preview levels smaller than this are never needed */
+#define PREVIEW_MIN_SIZE 64
+
+/* How long the preview size must stay the same before it is rescaled
+ * properly, in milliseconds */
+#define PREVIEW_SETTLE_TIMEOUT 150
+
+static gboolean
+preview_settle_timeout (gpointer data)
+{
+  ScreenshotDialog *dialog = data;
+  GtkWidget *drawing_area = dialog->preview_darea;
+  GdkPixbuf *level;
+  gint width, height, scale_factor;
+
+  dialog->preview_settle_id = 0;
+
+  scale_factor = gtk_widget_get_scale_factor (drawing_area);
+  width = gtk_widget_get_allocated_width (drawing_area) * scale_factor;
+  height = gtk_widget_get_allocated_height (drawing_area) * scale_factor;
+
+  /* not allocated yet, or hidden: keep the preview there is */
+  if (width <= 0 || height <= 0)
+    return G_SOURCE_REMOVE;
+
+  /* the nearest level is at most twice the size we want, so the area
+   * average only ever looks at a small image */
+  level = screenshot_mipmap_get_level (dialog->preview_mipmap,
+                                       dialog->level_surface_index);
+
+  g_clear_object (&dialog->preview_image);
+  dialog->preview_image = screenshot_resample (level,
+                                               width,
+                                               height,
+                                               SCREENSHOT_RESAMPLE_BOX,
+                                               0);
+
+  g_clear_pointer (&dialog->preview_surface, cairo_surface_destroy);
+  dialog->preview_surface = screenshot_native_pixbuf_create_surface (dialog->preview_image,
+                                                                     dialog->preview_format);
+  cairo_surface_set_device_scale (dialog->preview_surface, scale_factor, scale_factor);
+
+  gtk_widget_queue_draw (drawing_area);
+
+  return G_SOURCE_REMOVE;
+}
+
 static void
 on_preview_draw (GtkWidget      *drawing_area,
                  cairo_t        *cr,
@@ -44,31 +92,154 @@ on_preview_draw (GtkWidget      *drawing_area,
 {
   ScreenshotDialog *dialog = data;
   GtkStyleContext *context;
-  int width, height;
+  cairo_surface_t *surface;
+  int width, height, scale_factor;
 
+  /* nothing to show until the preview levels are ready */
+  if (dialog->preview_mipmap == NULL)
+    return;
+
+  scale_factor = gtk_widget_get_scale_factor (drawing_area);
   width = gtk_widget_get_allocated_width (drawing_area);
   height = gtk_widget_get_allocated_height (drawing_area);
 
-  if (!dialog->preview_image ||
-      gdk_pixbuf_get_width (dialog->preview_image) != width ||
-      gdk_pixbuf_get_height (dialog->preview_image) != height)
-    {
-      g_clear_object (&dialog->preview_image);
-      dialog->preview_image = gdk_pixbuf_scale_simple (dialog->screenshot,
-                                                       width,
-                                                       height,
-                                                       GDK_INTERP_BILINEAR);
-    }
-
   context = gtk_widget_get_style_context (drawing_area);
   gtk_style_context_save (context);
-
   gtk_style_context_set_state (context, gtk_widget_get_state_flags (drawing_area));
-  gtk_render_icon (context, cr, dialog->preview_image, 0, 0);
+
+  if (dialog->preview_image != NULL &&
+      gdk_pixbuf_get_width (dialog->preview_image) == width * scale_factor &&
+      gdk_pixbuf_get_height (dialog->preview_image) == height * scale_factor)
+    {
+      gtk_render_icon_surface (context, cr, dialog->preview_surface, 0, 0);
+    }
+  else
+    {
+      guint level;
+
+      /* While the size keeps changing, let cairo scale the nearest
+       * preview level, and only rescale properly once it settles. */
+      level = screenshot_mipmap_find_level (dialog->preview_mipmap,
+                                            (gdouble) width * scale_factor /
+                                            gdk_pixbuf_get_width (screenshot_mipmap_get_level (dialog->preview_mipmap, 0)));
+
+      if (dialog->level_surface == NULL || dialog->level_surface_index != level)
+        {
+          g_clear_pointer (&dialog->level_surface, cairo_surface_destroy);
+          dialog->level_surface =
+            screenshot_native_pixbuf_create_surface (screenshot_mipmap_get_level (dialog->preview_mipmap, level),
+                                                     dialog->preview_format);
+          dialog->level_surface_index = level;
+        }
+
+      surface = dialog->level_surface;
+      cairo_scale (cr,
+                   (gdouble) width / cairo_image_surface_get_width (surface),
+                   (gdouble) height / cairo_image_surface_get_height (surface));
+      gtk_render_icon_surface (context, cr, surface, 0, 0);
+
+      if (dialog->preview_settle_id != 0)
+        g_source_remove (dialog->preview_settle_id);
+      dialog->preview_settle_id = g_timeout_add (PREVIEW_SETTLE_TIMEOUT,
+                                                 preview_settle_timeout,
+                                                 dialog);
+    }
 
   gtk_style_context_restore (context);
 }
 
+static void
+preview_mipmap_ready_cb (GObject      *source,
+                         GAsyncResult *res,
+                         gpointer      data)
+{
+  g_autoptr(GError) error = NULL;
+  ScreenshotMipmap *mipmap;
+  ScreenshotDialog *dialog;
+
+  mipmap = screenshot_mipmap_new_finish (res, &error);
+
+  /* if this was cancelled, the dialog is gone or shows another effect */
+  if (mipmap == NULL)
+    {
+      if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        g_warning ("Unable to prepare the screenshot preview: %s", error->message);
+      return;
+    }
+
+  /* the previous levels were kept on screen until now; a pending
+   * rescale would pick its level in them, the next draw starts another */
+  dialog = data;
+  if (dialog->preview_settle_id != 0)
+    {
+      g_source_remove (dialog->preview_settle_id);
+      dialog->preview_settle_id = 0;
+    }
+
+  g_clear_pointer (&dialog->preview_mipmap, screenshot_mipmap_unref);
+  g_clear_pointer (&dialog->level_surface, cairo_surface_destroy);
+  dialog->level_surface_index = 0;
+  g_clear_pointer (&dialog->preview_surface, cairo_surface_destroy);
+  g_clear_object (&dialog->preview_image);
+
+  dialog->preview_mipmap = mipmap;
+  dialog->preview_format = screenshot_image_get_native_format (dialog->screenshot);
+  gtk_widget_queue_draw (dialog->preview_darea);
+}
+
+/* Builds the preview levels of dialog->screenshot off the main thread */
+static void
+preview_load (ScreenshotDialog *dialog)
+{
+  if (dialog->preview_cancellable != NULL)
+    {
+      g_cancellable_cancel (dialog->preview_cancellable);
+      g_object_unref (dialog->preview_cancellable);
+    }
+
+  dialog->preview_cancellable = g_cancellable_new ();
+  screenshot_mipmap_new_async (dialog->screenshot, PREVIEW_MIN_SIZE,
+                               dialog->preview_cancellable,
+                               preview_mipmap_ready_cb, dialog);
+}
+
+static void
+preview_update_size (ScreenshotDialog *dialog)
+{
+  gint width, height, scale_factor;
+
+  width = screenshot_image_get_width (dialog->screenshot);
+  height = screenshot_image_get_height (dialog->screenshot);
+  scale_factor = gtk_widget_get_scale_factor (dialog->dialog);
+
+  width /= 5 * scale_factor;
+  height /= 5 * scale_factor;
+
+  gtk_widget_set_size_request (dialog->preview_darea, width, height);
+  gtk_aspect_frame_set (GTK_ASPECT_FRAME (dialog->aspect_frame), 0.0, 0.5,
+                        (gfloat) width / (gfloat) height,
+                        FALSE);
+}
+
+static void
+on_preview_destroy (GtkWidget        *drawing_area,
+                    ScreenshotDialog *dialog)
+{
+  g_cancellable_cancel (dialog->preview_cancellable);
+  g_clear_object (&dialog->preview_cancellable);
+
+  if (dialog->preview_settle_id != 0)
+    {
+      g_source_remove (dialog->preview_settle_id);
+      dialog->preview_settle_id = 0;
+    }
+
+  g_clear_pointer (&dialog->level_surface, cairo_surface_destroy);
+  g_clear_pointer (&dialog->preview_surface, cairo_surface_destroy);
+  g_clear_pointer (&dialog->preview_mipmap, screenshot_mipmap_unref);
+  g_clear_object (&dialog->preview_image);
+}
+
 static gboolean
 on_preview_button_press_event (GtkWidget      *drawing_area,
                                GdkEventButton *event,
@@ -104,7 +275,8 @@ drag_data_get (GtkWidget          *widget,
                ScreenshotDialog   *dialog)
 {
   if (info == TYPE_IMAGE_PNG)
-    gtk_selection_data_set_pixbuf (selection_data, dialog->screenshot);
+    gtk_selection_data_set_pixbuf (selection_data,
+                                   screenshot_image_get_pixbuf (dialog->screenshot));
   else
     g_warning ("Unknown type %d", info);
 }
@@ -114,8 +286,18 @@ drag_begin (GtkWidget        *widget,
             GdkDragContext   *context,
             ScreenshotDialog *dialog)
 {
-  gtk_drag_set_icon_pixbuf (context, dialog->preview_image,
-                            dialog->drag_x, dialog->drag_y);
+  /* the preview may still be settling after a resize */
+  if (dialog->preview_surface != NULL)
+    {
+      g_autoptr(ScreenshotImage) icon = NULL;
+
+      /* the preview is native, the icon has to be a pixbuf */
+      icon = screenshot_image_new_for_surface (dialog->preview_surface);
+      gtk_drag_set_icon_pixbuf (context, screenshot_image_get_pixbuf (icon),
+                                dialog->drag_x, dialog->drag_y);
+    }
+  else
+    gtk_drag_set_icon_default (context);
 }
 
 static gboolean
@@ -162,29 +344,21 @@ setup_drawing_area (ScreenshotDialog *dialog, GtkBuilder *ui)
 {
   GtkWidget *preview_darea;
   GtkWidget *aspect_frame;
-  gint width, height, scale_factor;
 
   aspect_frame = GTK_WIDGET (gtk_builder_get_object (ui, "aspect_frame"));
   preview_darea = GTK_WIDGET (gtk_builder_get_object (ui, "preview_darea"));
+  dialog->aspect_frame = aspect_frame;
+  dialog->preview_darea = preview_darea;
 
-  width = gdk_pixbuf_get_width (dialog->screenshot);
-  height = gdk_pixbuf_get_height (dialog->screenshot);
-  scale_factor = gtk_widget_get_scale_factor (dialog->dialog);
-
-  width /= 5 * scale_factor;
-  height /= 5 * scale_factor;
+  preview_update_size (dialog);
 
-  gtk_widget_set_size_request (preview_darea, width, height);
-  gtk_aspect_frame_set (GTK_ASPECT_FRAME (aspect_frame), 0.0, 0.5,
-                        (gfloat) width / (gfloat) height,
-                        FALSE);
-
-  if (screenshot_config->take_window_shot)
+  if (dialog->window_shot)
     gtk_frame_set_shadow_type (GTK_FRAME (aspect_frame), GTK_SHADOW_NONE);
   else
     gtk_frame_set_shadow_type (GTK_FRAME (aspect_frame), GTK_SHADOW_IN);
 
   g_signal_connect (preview_darea, "draw", G_CALLBACK (on_preview_draw), dialog);
+  g_signal_connect (preview_darea, "destroy", G_CALLBACK (on_preview_destroy), dialog);
   g_signal_connect (preview_darea, "button_press_event", G_CALLBACK (on_preview_button_press_event), dialog);
   g_signal_connect (preview_darea, "button_release_event", G_CALLBACK (on_preview_button_release_event), dialog);
 
@@ -198,10 +372,69 @@ setup_drawing_area (ScreenshotDialog *dialog, GtkBuilder *ui)
                     G_CALLBACK (drag_begin), dialog);
   g_signal_connect (G_OBJECT (preview_darea), "drag_data_get",
                     G_CALLBACK (drag_data_get), dialog);
+
+  preview_load (dialog);
+}
+
+static void
+effect_combo_changed_cb (GtkComboBox      *combo,
+                         ScreenshotDialog *dialog)
+{
+  const gchar *nick;
+
+  nick = gtk_combo_box_get_active_id (combo);
+  if (nick == NULL)
+    return;
+
+  /* each effect is only rendered the first time it is picked */
+  dialog->effect = screenshot_effect_type_from_nick (nick);
+  dialog->screenshot = screenshot_effect_stack_render (dialog->effects,
+                                                       dialog->effect);
+
+  /* and becomes the default for the next capture */
+  g_free (screenshot_config->border_effect);
+  screenshot_config->border_effect = g_strdup (nick);
+
+  preview_update_size (dialog);
+  preview_load (dialog);
+}
+
+static void
+setup_effect_combo (ScreenshotDialog *dialog, GtkBuilder *ui)
+{
+  GtkWidget *effect_label;
+  guint i;
+
+  effect_label = GTK_WIDGET (gtk_builder_get_object (ui, "effect_label"));
+  dialog->effect_combo = GTK_WIDGET (gtk_builder_get_object (ui, "effect_combo"));
+
+  for (i = 0; i < SCREENSHOT_N_EFFECTS; i++)
+    gtk_combo_box_text_append (GTK_COMBO_BOX_TEXT (dialog->effect_combo),
+                               screenshot_effect_type_get_nick (i),
+                               screenshot_effect_type_get_label (i));
+
+  gtk_combo_box_set_active_id (GTK_COMBO_BOX (dialog->effect_combo),
+                               screenshot_effect_type_get_nick (dialog->effect));
+  g_signal_connect (dialog->effect_combo, "changed",
+                    G_CALLBACK (effect_combo_changed_cb), dialog);
+
+  /* effects only make sense around a window */
+  gtk_widget_set_visible (effect_label, dialog->window_shot);
+  gtk_widget_set_visible (dialog->effect_combo, dialog->window_shot);
+}
+
+static void
+on_dialog_destroy (GtkWidget        *widget,
+                   ScreenshotDialog *dialog)
+{
+  g_clear_pointer (&dialog->effects, screenshot_effect_stack_unref);
+  dialog->screenshot = NULL;
 }
 
 ScreenshotDialog *
-screenshot_dialog_new (GdkPixbuf              *screenshot,
+screenshot_dialog_new (ScreenshotEffectStack  *effects,
+                       ScreenshotEffectType    effect,
+                       gboolean                window_shot,
                        char                   *initial_uri,
                        SaveScreenshotCallback f,
                        gpointer               user_data)
@@ -221,7 +454,10 @@ screenshot_dialog_new (GdkPixbuf              *screenshot,
   current_folder = g_file_get_uri (parent_file);
 
   dialog = g_new0 (ScreenshotDialog, 1);
-  dialog->screenshot = screenshot;
+  dialog->effects = screenshot_effect_stack_ref (effects);
+  dialog->effect = effect;
+  dialog->window_shot = window_shot;
+  dialog->screenshot = screenshot_effect_stack_render (effects, effect);
   dialog->callback = f;
   dialog->user_data = user_data;
 
@@ -235,6 +471,9 @@ screenshot_dialog_new (GdkPixbuf              *screenshot,
   g_signal_connect (dialog->dialog, "key-press-event",
                     G_CALLBACK (dialog_key_press_cb),
                     NULL);
+  g_signal_connect (dialog->dialog, "destroy",
+                    G_CALLBACK (on_dialog_destroy),
+                    dialog);
 
   dialog->filename_entry = GTK_WIDGET (gtk_builder_get_object (ui, "filename_entry"));
   dialog->save_widget = GTK_WIDGET (gtk_builder_get_object (ui, "save_widget"));
@@ -257,6 +496,8 @@ screenshot_dialog_new (GdkPixbuf              *screenshot,
 
   gtk_widget_show_all (dialog->dialog);
 
+  setup_effect_combo (dialog, ui);
+
   /* select the name of the file but leave out the extension if there's any;
    * the dialog must be realized for select_region to work
    */
@@ -286,6 +527,13 @@ screenshot_dialog_get_uri (ScreenshotDialog *dialog)
   return g_build_filename (folder, file, NULL);
 }
 
+/* Returns the image to save: the capture with the chosen effect. */
+ScreenshotImage *
+screenshot_dialog_get_screenshot (ScreenshotDialog *dialog)
+{
+  return dialog->screenshot;
+}
+
 char *
 screenshot_dialog_get_folder (ScreenshotDialog *dialog)
 {
@@ -22,6 +22,9 @@
 
 #include <gtk/gtk.h>
 
+#include "screenshot-effect-stack.h"
+#include "screenshot-mipmap.h"
+
 typedef enum {
   SCREENSHOT_RESPONSE_SAVE,
   SCREENSHOT_RESPONSE_COPY,
@@ -33,10 +36,28 @@ typedef enum {
 typedef void (*SaveScreenshotCallback) (ScreenshotResponse response, gpointer *user_data);
 
 typedef struct {
-  GdkPixbuf *screenshot;
+  /* the capture, and the effect currently applied to it */
+  ScreenshotEffectStack *effects;
+  ScreenshotEffectType effect;
+  ScreenshotImage *screenshot;
+  /* effects only apply around a window */
+  gboolean window_shot;
   GdkPixbuf *preview_image;
 
+  /* preview levels, built in a thread from the native pixels of the
+   * capture, and the surfaces drawn from them without conversion */
+  ScreenshotMipmap *preview_mipmap;
+  cairo_format_t preview_format;
+  GCancellable *preview_cancellable;
+  cairo_surface_t *level_surface;
+  guint level_surface_index;
+  cairo_surface_t *preview_surface;
+  guint preview_settle_id;
+
   GtkWidget *dialog;
+  GtkWidget *aspect_frame;
+  GtkWidget *preview_darea;
+  GtkWidget *effect_combo;
   GtkWidget *save_widget;
   GtkWidget *filename_entry;
   GtkWidget *save_button;
@@ -52,15 +73,18 @@ typedef struct {
   gpointer user_data;
 }  ScreenshotDialog;
 
-ScreenshotDialog *screenshot_dialog_new          (GdkPixbuf              *screenshot,
-                                                  char                   *initial_uri,
-                                                  SaveScreenshotCallback f,
-                                                  gpointer               user_data);
+ScreenshotDialog *screenshot_dialog_new            (ScreenshotEffectStack  *effects,
+                                                    ScreenshotEffectType    effect,
+                                                    gboolean                window_shot,
+                                                    char                   *initial_uri,
+                                                    SaveScreenshotCallback  f,
+                                                    gpointer                user_data);
 
-char             *screenshot_dialog_get_uri      (ScreenshotDialog *dialog);
-char             *screenshot_dialog_get_folder   (ScreenshotDialog *dialog);
-char             *screenshot_dialog_get_filename (ScreenshotDialog *dialog);
-void              screenshot_dialog_set_busy     (ScreenshotDialog *dialog,
-                                                  gboolean          busy);
+ScreenshotImage  *screenshot_dialog_get_screenshot (ScreenshotDialog *dialog);
+char             *screenshot_dialog_get_uri        (ScreenshotDialog *dialog);
+char             *screenshot_dialog_get_folder     (ScreenshotDialog *dialog);
+char             *screenshot_dialog_get_filename   (ScreenshotDialog *dialog);
+void              screenshot_dialog_set_busy       (ScreenshotDialog *dialog,
+                                                    gboolean          busy);
 
 #endif /* __SCREENSHOT_DIALOG_H__ */
@@ -0,0 +1,192 @@
+/* screenshot-effect-stack.c - border effects rendered on demand
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+/* The stack keeps the capture as it was taken and renders each effect
+ * from it the first time it is asked for, then keeps the result.  The
+ * effect can therefore be changed after the capture, as often as wanted,
+ * without ever applying one effect on top of another.
+ *
+ * The effects work on pixbufs, so the capture is only converted from its
+ * native format when one is picked; without one it is shown and saved as
+ * it was taken.
+ */
+
+#include "config.h"
+
+#include <glib/gi18n.h>
+
+#include "screenshot-effect-stack.h"
+#include "screenshot-trace.h"
+
+struct _ScreenshotEffectStack
+{
+  gint ref_count;
+  ScreenshotEffectParams params;
+  ScreenshotImage *rendered[SCREENSHOT_N_EFFECTS];
+};
+
+static const struct {
+  const gchar *label;
+  const gchar *nick;
+} effects[SCREENSHOT_N_EFFECTS] = {
+  /* Translators:
+   * these are the names of the effects available which will be
+   * displayed inside a combo box in interactive mode for the user
+   * to chooser.
+   */
+  [SCREENSHOT_EFFECT_NONE] = { N_("None"), "none" },
+  [SCREENSHOT_EFFECT_SHADOW] = { N_("Drop shadow"), "shadow" },
+  [SCREENSHOT_EFFECT_BORDER] = { N_("Border"), "border" },
+  [SCREENSHOT_EFFECT_VINTAGE] = { N_("Vintage"), "vintage" }
+};
+
+/* Like the rest of gnome-screenshot, only looks at the first letter */
+ScreenshotEffectType
+screenshot_effect_type_from_nick (const gchar *nick)
+{
+  if (nick == NULL)
+    return SCREENSHOT_EFFECT_NONE;
+
+  switch (nick[0])
+    {
+    case 's': /* shadow */
+      return SCREENSHOT_EFFECT_SHADOW;
+    case 'b': /* border */
+      return SCREENSHOT_EFFECT_BORDER;
+    case 'v': /* vintage */
+      return SCREENSHOT_EFFECT_VINTAGE;
+    case 'n': /* none */
+    default:
+      return SCREENSHOT_EFFECT_NONE;
+    }
+}
+
+const gchar *
+screenshot_effect_type_get_nick (ScreenshotEffectType effect)
+{
+  g_return_val_if_fail (effect < SCREENSHOT_N_EFFECTS, NULL);
+
+  return effects[effect].nick;
+}
+
+/* Returns the translated name of @effect */
+const gchar *
+screenshot_effect_type_get_label (ScreenshotEffectType effect)
+{
+  g_return_val_if_fail (effect < SCREENSHOT_N_EFFECTS, NULL);
+
+  return gettext (effects[effect].label);
+}
+
+/**
+ * screenshot_effect_stack_new:
+ * @original: the capture, without any effect
+ * @params: the effect parameters, copied
+ */
+ScreenshotEffectStack *
+screenshot_effect_stack_new (ScreenshotImage              *original,
+                             const ScreenshotEffectParams *params)
+{
+  ScreenshotEffectStack *stack;
+
+  g_return_val_if_fail (original != NULL, NULL);
+
+  stack = g_slice_new0 (ScreenshotEffectStack);
+  stack->ref_count = 1;
+  stack->params = *params;
+  stack->rendered[SCREENSHOT_EFFECT_NONE] = screenshot_image_ref (original);
+
+  return stack;
+}
+
+ScreenshotEffectStack *
+screenshot_effect_stack_ref (ScreenshotEffectStack *stack)
+{
+  stack->ref_count++;
+  return stack;
+}
+
+void
+screenshot_effect_stack_unref (ScreenshotEffectStack *stack)
+{
+  guint i;
+
+  if (--stack->ref_count > 0)
+    return;
+
+  for (i = 0; i < SCREENSHOT_N_EFFECTS; i++)
+    g_clear_pointer (&stack->rendered[i], screenshot_image_unref);
+
+  g_slice_free (ScreenshotEffectStack, stack);
+}
+
+ScreenshotImage *
+screenshot_effect_stack_get_original (ScreenshotEffectStack *stack)
+{
+  return stack->rendered[SCREENSHOT_EFFECT_NONE];
+}
+
+/**
+ * screenshot_effect_stack_render:
+ *
+ * Returns the capture with @effect applied, rendering it if this is the
+ * first time it is asked for.
+ *
+ * Returns: (transfer none): the rendered image, owned by the stack
+ */
+ScreenshotImage *
+screenshot_effect_stack_render (ScreenshotEffectStack *stack,
+                                ScreenshotEffectType   effect)
+{
+  ScreenshotTraceSpan *span;
+  GdkPixbuf *pixbuf;
+
+  g_return_val_if_fail (effect < SCREENSHOT_N_EFFECTS, NULL);
+
+  if (stack->rendered[effect] != NULL)
+    return stack->rendered[effect];
+
+  span = screenshot_trace_begin ("effect");
+  screenshot_trace_set_backend (span, effects[effect].nick);
+
+  /* the effects replace the pixbuf they are given, never modify it */
+  pixbuf = g_object_ref (screenshot_image_get_pixbuf (stack->rendered[SCREENSHOT_EFFECT_NONE]));
+
+  switch (effect)
+    {
+    case SCREENSHOT_EFFECT_SHADOW:
+      screenshot_add_shadow (&pixbuf, &stack->params);
+      break;
+    case SCREENSHOT_EFFECT_BORDER:
+      screenshot_add_border (&pixbuf, &stack->params);
+      break;
+    case SCREENSHOT_EFFECT_VINTAGE:
+      screenshot_add_vintage (&pixbuf, &stack->params);
+      break;
+    case SCREENSHOT_EFFECT_NONE:
+    case SCREENSHOT_N_EFFECTS:
+    default:
+      g_assert_not_reached ();
+    }
+
+  stack->rendered[effect] = screenshot_image_new_for_pixbuf (pixbuf);
+  screenshot_trace_set_bytes (span, gdk_pixbuf_get_byte_length (pixbuf));
+  screenshot_trace_end (span);
+  g_object_unref (pixbuf);
+
+  return stack->rendered[effect];
+}
@@ -0,0 +1,55 @@
+/* screenshot-effect-stack.h - border effects rendered on demand
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+#ifndef __SCREENSHOT_EFFECT_STACK_H__
+#define __SCREENSHOT_EFFECT_STACK_H__
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "screenshot-image.h"
+#include "screenshot-shadow.h"
+
+G_BEGIN_DECLS
+
+typedef enum {
+  SCREENSHOT_EFFECT_NONE,
+  SCREENSHOT_EFFECT_SHADOW,
+  SCREENSHOT_EFFECT_BORDER,
+  SCREENSHOT_EFFECT_VINTAGE,
+  SCREENSHOT_N_EFFECTS
+} ScreenshotEffectType;
+
+ScreenshotEffectType   screenshot_effect_type_from_nick   (const gchar           *nick);
+const gchar           *screenshot_effect_type_get_nick    (ScreenshotEffectType   effect);
+const gchar           *screenshot_effect_type_get_label   (ScreenshotEffectType   effect);
+
+typedef struct _ScreenshotEffectStack ScreenshotEffectStack;
+
+ScreenshotEffectStack *screenshot_effect_stack_new          (ScreenshotImage              *original,
+                                                             const ScreenshotEffectParams *params);
+ScreenshotEffectStack *screenshot_effect_stack_ref          (ScreenshotEffectStack *stack);
+void                   screenshot_effect_stack_unref        (ScreenshotEffectStack *stack);
+
+ScreenshotImage       *screenshot_effect_stack_get_original (ScreenshotEffectStack *stack);
+ScreenshotImage       *screenshot_effect_stack_render       (ScreenshotEffectStack *stack,
+                                                             ScreenshotEffectType   effect);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (ScreenshotEffectStack, screenshot_effect_stack_unref)
+
+G_END_DECLS
+
+#endif /* __SCREENSHOT_EFFECT_STACK_H__ */
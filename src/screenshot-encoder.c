@@ -0,0 +1,606 @@
+/* screenshot-encoder.c - encodes screenshots in memory and writes them out
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+/* Encoding a large capture takes long enough to be noticed, so the save
+ * dialog starts it as soon as it is shown, while the user is still
+ * picking a name, and only has to write the result out on Save.  The
+ * image is encoded into memory by a worker thread, and the encoder checks
+ * for cancellation every time it produces data, so a stale encoding stops
+ * early instead of running to the end.  A capture that is still in the X
+ * server's pixel format is converted by that thread too.  PNG files are
+ * written indexed when the capture has few enough colours.
+ *
+ * The encoded bytes are kept until the dialog closes, so asking to
+ * overwrite, or to pick another place after a failed write, never encodes
+ * again.  They are written to a temporary file next to the destination,
+ * which is synced and then renamed over it: a write that fails half way,
+ * or a crash, leaves the destination as it was.
+ *
+ * Where the image is not kept, for --file and descriptors, the encoder
+ * writes into the destination stream as it goes instead, so the encoded
+ * file is never in memory as a whole, and closes it: replacing a file
+ * only completes then.
+ *
+ * The screenshots of --watch can also be encoded as deltas, of only the
+ * tiles that changed since a full one, see screenshot-delta.c.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+#include <gio/gfiledescriptorbased.h>
+
+#include "screenshot-delta.h"
+#include "screenshot-encoder.h"
+#include "screenshot-formats.h"
+#include "screenshot-png8.h"
+#include "screenshot-trace.h"
+
+/* Attempts at finding an unused temporary name */
+#define WRITE_TMP_ATTEMPTS 16
+
+typedef struct {
+  ScreenshotImage *image;
+  gchar *format;
+  gchar *icc_profile_base64;
+  gint jpeg_quality;
+
+  /* for a delta */
+  GArray *tiles;
+  gchar *reference;
+
+  /* where to write, rather than into memory */
+  GOutputStream *stream;
+} EncodeJob;
+
+/* Into @buffer, or @stream if it is set */
+typedef struct {
+  GByteArray *buffer;
+  GOutputStream *stream;
+  gsize written;
+  GCancellable *cancellable;
+} EncodeSink;
+
+static void
+encode_job_free (EncodeJob *job)
+{
+  screenshot_image_unref (job->image);
+  g_free (job->format);
+  g_free (job->icc_profile_base64);
+  g_clear_pointer (&job->tiles, g_array_unref);
+  g_free (job->reference);
+  g_clear_object (&job->stream);
+  g_slice_free (EncodeJob, job);
+}
+
+static gboolean
+encode_write_cb (const gchar  *buf,
+                 gsize         count,
+                 GError      **error,
+                 gpointer      data)
+{
+  EncodeSink *sink = data;
+
+  /* makes the saver give up */
+  if (g_cancellable_set_error_if_cancelled (sink->cancellable, error))
+    return FALSE;
+
+  if (sink->stream != NULL)
+    {
+      if (!g_output_stream_write_all (sink->stream, buf, count, NULL,
+                                      sink->cancellable, error))
+        return FALSE;
+    }
+  else
+    g_byte_array_append (sink->buffer, (const guint8 *) buf, count);
+
+  sink->written += count;
+
+  return TRUE;
+}
+
+/* Writes @job's image to @sink, telling which encoder did in @backend */
+static gboolean
+encode_image (EncodeJob     *job,
+              EncodeSink    *sink,
+              const gchar  **backend,
+              GError       **error)
+{
+  GError *local_error = NULL;
+  gchar *keys[3] = { NULL, };
+  gchar *values[3] = { NULL, };
+  g_autofree gchar *quality = NULL;
+  gint n_options = 0;
+
+  if (job->tiles != NULL)
+    {
+      *backend = SCREENSHOT_DELTA_EXTENSION;
+      return screenshot_delta_save_to_callback (screenshot_image_get_pixbuf (job->image),
+                                                job->tiles, job->reference,
+                                                encode_write_cb, sink, error);
+    }
+
+  if (screenshot_format_is_builtin (job->format))
+    {
+      *backend = job->format;
+      return screenshot_format_save_to_callback (screenshot_image_get_pixbuf (job->image),
+                                                 job->format,
+                                                 encode_write_cb, sink, error);
+    }
+
+  /* captures with few colours make much smaller indexed files */
+  if (g_strcmp0 (job->format, "png") == 0)
+    {
+      *backend = "png8";
+      if (screenshot_png8_save_to_callback (screenshot_image_get_pixbuf (job->image),
+                                            job->icc_profile_base64,
+                                            encode_write_cb, sink, &local_error))
+        return TRUE;
+
+      if (!g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED))
+        {
+          g_propagate_error (error, local_error);
+          return FALSE;
+        }
+
+      g_clear_error (&local_error);
+    }
+
+  /* the same options as when saving straight to a stream */
+  if (g_strcmp0 (job->format, "png") == 0)
+    {
+      if (job->icc_profile_base64 != NULL)
+        {
+          keys[n_options] = "icc-profile";
+          values[n_options++] = job->icc_profile_base64;
+        }
+
+      keys[n_options] = "tEXt::Software";
+      values[n_options++] = "gnome-screenshot";
+    }
+  else if (g_strcmp0 (job->format, "jpeg") == 0 && job->jpeg_quality >= 0)
+    {
+      quality = g_strdup_printf ("%d", job->jpeg_quality);
+      keys[n_options] = "quality";
+      values[n_options++] = quality;
+    }
+
+  *backend = "gdk-pixbuf";
+  return gdk_pixbuf_save_to_callbackv (screenshot_image_get_pixbuf (job->image),
+                                       encode_write_cb, sink,
+                                       job->format, keys, values, error);
+}
+
+static void
+encode_thread (GTask        *task,
+               gpointer      source_object,
+               gpointer      data,
+               GCancellable *cancellable)
+{
+  EncodeJob *job = data;
+  EncodeSink sink = { NULL, };
+  ScreenshotTraceSpan *span;
+  const gchar *backend = NULL;
+  GError *error = NULL;
+
+  sink.buffer = g_byte_array_new ();
+  sink.cancellable = cancellable;
+
+  span = screenshot_trace_begin ("encode");
+
+  if (!encode_image (job, &sink, &backend, &error))
+    {
+      screenshot_trace_set_backend (span, "failed");
+      screenshot_trace_end (span);
+      g_byte_array_unref (sink.buffer);
+      g_task_return_error (task, error);
+      return;
+    }
+
+  screenshot_trace_set_backend (span, backend);
+  screenshot_trace_set_bytes (span, sink.buffer->len);
+  screenshot_trace_end (span);
+
+  g_task_return_pointer (task, g_byte_array_free_to_bytes (sink.buffer),
+                         (GDestroyNotify) g_bytes_unref);
+}
+
+/**
+ * screenshot_encode_async:
+ * @image: the image to encode
+ * @format: a writable gdk-pixbuf format name, such as "png", or a
+ *   built-in one, see screenshot_format_is_builtin()
+ * @icc_profile_base64: (nullable): the profile to embed in PNG files
+ * @jpeg_quality: the quality of JPEG files, or -1 for gdk-pixbuf's default
+ *
+ * Encodes @image in a worker thread.
+ */
+void
+screenshot_encode_async (ScreenshotImage     *image,
+                         const gchar         *format,
+                         const gchar         *icc_profile_base64,
+                         gint                 jpeg_quality,
+                         GCancellable        *cancellable,
+                         GAsyncReadyCallback  callback,
+                         gpointer             user_data)
+{
+  g_autoptr(GTask) task = NULL;
+  EncodeJob *job;
+
+  g_return_if_fail (image != NULL);
+  g_return_if_fail (format != NULL);
+
+  job = g_slice_new0 (EncodeJob);
+  job->image = screenshot_image_ref (image);
+  job->format = g_strdup (format);
+  job->icc_profile_base64 = g_strdup (icc_profile_base64);
+  job->jpeg_quality = jpeg_quality;
+
+  task = g_task_new (NULL, cancellable, callback, user_data);
+  g_task_set_task_data (task, job, (GDestroyNotify) encode_job_free);
+
+  g_task_run_in_thread (task, encode_thread);
+}
+
+/**
+ * screenshot_encode_delta_async:
+ * @image: the frame to encode
+ * @tiles: (element-type guint): the tiles of @image that changed since
+ *   @reference
+ * @reference: the file name of the full screenshot the tiles go onto
+ *
+ * Encodes the tiles of @image listed in @tiles as a delta, in a worker
+ * thread.  The result is given by screenshot_encode_finish().
+ */
+void
+screenshot_encode_delta_async (ScreenshotImage     *image,
+                               GArray              *tiles,
+                               const gchar         *reference,
+                               GCancellable        *cancellable,
+                               GAsyncReadyCallback  callback,
+                               gpointer             user_data)
+{
+  g_autoptr(GTask) task = NULL;
+  EncodeJob *job;
+
+  g_return_if_fail (image != NULL);
+  g_return_if_fail (tiles != NULL);
+  g_return_if_fail (reference != NULL);
+
+  job = g_slice_new0 (EncodeJob);
+  job->image = screenshot_image_ref (image);
+  job->format = g_strdup (SCREENSHOT_DELTA_EXTENSION);
+  job->jpeg_quality = -1;
+  job->tiles = g_array_ref (tiles);
+  job->reference = g_strdup (reference);
+
+  task = g_task_new (NULL, cancellable, callback, user_data);
+  g_task_set_task_data (task, job, (GDestroyNotify) encode_job_free);
+
+  g_task_run_in_thread (task, encode_thread);
+}
+
+static void
+encode_to_stream_thread (GTask        *task,
+                         gpointer      source_object,
+                         gpointer      data,
+                         GCancellable *cancellable)
+{
+  EncodeJob *job = data;
+  EncodeSink sink = { NULL, };
+  ScreenshotTraceSpan *span;
+  const gchar *backend = NULL;
+  GError *error = NULL;
+
+  sink.stream = job->stream;
+  sink.cancellable = cancellable;
+
+  span = screenshot_trace_begin ("encode");
+
+  if (!encode_image (job, &sink, &backend, &error))
+    {
+      g_autoptr(GCancellable) abandon = g_cancellable_new ();
+
+      /* closing normally would put a file being replaced in place, half
+       * written */
+      g_cancellable_cancel (abandon);
+      g_output_stream_close (job->stream, abandon, NULL);
+    }
+  else
+    g_output_stream_close (job->stream, cancellable, &error);
+
+  if (error != NULL)
+    {
+      screenshot_trace_set_backend (span, "failed");
+      screenshot_trace_end (span);
+      g_task_return_error (task, error);
+      return;
+    }
+
+  screenshot_trace_set_backend (span, backend);
+  screenshot_trace_set_bytes (span, sink.written);
+  screenshot_trace_end (span);
+
+  g_task_return_int (task, sink.written);
+}
+
+/**
+ * screenshot_encode_to_stream_async:
+ * @image: the image to encode
+ * @format: as for screenshot_encode_async()
+ * @icc_profile_base64: (nullable): the profile to embed in PNG files
+ * @jpeg_quality: the quality of JPEG files, or -1 for gdk-pixbuf's default
+ * @stream: where to write the file
+ *
+ * Encodes @image in a worker thread, writing each part to @stream as soon
+ * as it is encoded, then closes @stream.  Errors closing it, such as
+ * those of a file being replaced, are returned like those writing it.
+ */
+void
+screenshot_encode_to_stream_async (ScreenshotImage     *image,
+                                   const gchar         *format,
+                                   const gchar         *icc_profile_base64,
+                                   gint                 jpeg_quality,
+                                   GOutputStream       *stream,
+                                   GCancellable        *cancellable,
+                                   GAsyncReadyCallback  callback,
+                                   gpointer             user_data)
+{
+  g_autoptr(GTask) task = NULL;
+  EncodeJob *job;
+
+  g_return_if_fail (image != NULL);
+  g_return_if_fail (format != NULL);
+  g_return_if_fail (G_IS_OUTPUT_STREAM (stream));
+
+  job = g_slice_new0 (EncodeJob);
+  job->image = screenshot_image_ref (image);
+  job->format = g_strdup (format);
+  job->icc_profile_base64 = g_strdup (icc_profile_base64);
+  job->jpeg_quality = jpeg_quality;
+  job->stream = g_object_ref (stream);
+
+  task = g_task_new (NULL, cancellable, callback, user_data);
+  g_task_set_task_data (task, job, (GDestroyNotify) encode_job_free);
+
+  g_task_run_in_thread (task, encode_to_stream_thread);
+}
+
+/**
+ * screenshot_encode_to_stream_finish:
+ *
+ * Returns: the number of bytes written, or -1 with @error set
+ */
+gssize
+screenshot_encode_to_stream_finish (GAsyncResult  *result,
+                                    GError       **error)
+{
+  return g_task_propagate_int (G_TASK (result), error);
+}
+
+/**
+ * screenshot_encode_finish:
+ *
+ * Returns: (transfer full): the encoded file, or %NULL with @error set,
+ *   to %G_IO_ERROR_CANCELLED if the encoding was cancelled
+ */
+GBytes *
+screenshot_encode_finish (GAsyncResult  *result,
+                          GError       **error)
+{
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+typedef struct {
+  GBytes *bytes;
+  GFile *file;
+  gboolean overwrite;
+} WriteJob;
+
+static void
+write_job_free (WriteJob *job)
+{
+  g_bytes_unref (job->bytes);
+  g_object_unref (job->file);
+  g_slice_free (WriteJob, job);
+}
+
+/**
+ * screenshot_create_tmp_file:
+ * @file: the final destination
+ * @tmp_file_out: (out): the file created
+ *
+ * Creates a new, empty, hidden file in the directory of @file, to be
+ * moved over it once written.
+ *
+ * Returns: (transfer full): a stream to write to the new file
+ */
+GFileOutputStream *
+screenshot_create_tmp_file (GFile         *file,
+                            GFile        **tmp_file_out,
+                            GCancellable  *cancellable,
+                            GError       **error)
+{
+  g_autoptr(GFile) parent = g_file_get_parent (file);
+  g_autofree gchar *basename = g_file_get_basename (file);
+  gint i;
+
+  for (i = 0; i < WRITE_TMP_ATTEMPTS; i++)
+    {
+      g_autofree gchar *tmp_name = NULL;
+      g_autoptr(GFile) tmp_file = NULL;
+      g_autoptr(GError) local_error = NULL;
+      GFileOutputStream *os;
+
+      tmp_name = g_strdup_printf (".%s.%08x", basename, g_random_int ());
+      tmp_file = g_file_get_child (parent, tmp_name);
+
+      os = g_file_create (tmp_file, G_FILE_CREATE_NONE, cancellable, &local_error);
+      if (os != NULL)
+        {
+          *tmp_file_out = g_steal_pointer (&tmp_file);
+          return os;
+        }
+
+      if (!g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_EXISTS) ||
+          i == WRITE_TMP_ATTEMPTS - 1)
+        {
+          g_propagate_error (error, g_steal_pointer (&local_error));
+          return NULL;
+        }
+    }
+
+  g_assert_not_reached ();
+}
+
+/**
+ * screenshot_close_tmp_file:
+ * @os: a stream from screenshot_create_tmp_file()
+ *
+ * Flushes what was written to @os to the disk and closes it, so that once
+ * the file is moved into place it cannot turn out empty after a crash.
+ */
+gboolean
+screenshot_close_tmp_file (GFileOutputStream  *os,
+                           GCancellable       *cancellable,
+                           GError            **error)
+{
+  if (!g_output_stream_flush (G_OUTPUT_STREAM (os), cancellable, error))
+    return FALSE;
+
+  if (G_IS_FILE_DESCRIPTOR_BASED (os) &&
+      fsync (g_file_descriptor_based_get_fd (G_FILE_DESCRIPTOR_BASED (os))) != 0)
+    {
+      int errsv = errno;
+
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                   "Error syncing file: %s", g_strerror (errsv));
+      return FALSE;
+    }
+
+  return g_output_stream_close (G_OUTPUT_STREAM (os), cancellable, error);
+}
+
+static gboolean
+write_bytes (WriteJob      *job,
+             GCancellable  *cancellable,
+             GError       **error)
+{
+  g_autoptr(GFileOutputStream) os = NULL;
+  g_autoptr(GFile) tmp_file = NULL;
+  gconstpointer contents;
+  gsize size;
+
+  /* fail before writing anything if the answer is known */
+  if (!job->overwrite && g_file_query_exists (job->file, cancellable))
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_EXISTS,
+                           "Error opening file: File exists");
+      return FALSE;
+    }
+
+  os = screenshot_create_tmp_file (job->file, &tmp_file, cancellable, error);
+  if (os == NULL)
+    return FALSE;
+
+  contents = g_bytes_get_data (job->bytes, &size);
+
+  if (!g_output_stream_write_all (G_OUTPUT_STREAM (os), contents, size,
+                                  NULL, cancellable, error) ||
+      !screenshot_close_tmp_file (os, cancellable, error) ||
+      !g_file_move (tmp_file, job->file,
+                    job->overwrite ? G_FILE_COPY_OVERWRITE : G_FILE_COPY_NONE,
+                    cancellable, NULL, NULL, error))
+    {
+      g_file_delete (tmp_file, NULL, NULL);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static void
+write_bytes_thread (GTask        *task,
+                    gpointer      source_object,
+                    gpointer      data,
+                    GCancellable *cancellable)
+{
+  WriteJob *job = data;
+  ScreenshotTraceSpan *span;
+  GError *error = NULL;
+  gboolean ok;
+
+  span = screenshot_trace_begin ("write");
+  screenshot_trace_set_bytes (span, g_bytes_get_size (job->bytes));
+
+  ok = write_bytes (job, cancellable, &error);
+
+  if (!ok)
+    screenshot_trace_set_backend (span, "failed");
+  screenshot_trace_end (span);
+
+  if (!ok)
+    {
+      g_task_return_error (task, error);
+      return;
+    }
+
+  g_task_return_boolean (task, TRUE);
+}
+
+/**
+ * screenshot_write_bytes_async:
+ * @bytes: the file contents
+ * @file: where to save them
+ * @overwrite: whether to replace @file if it exists, otherwise
+ *   %G_IO_ERROR_EXISTS is returned
+ *
+ * Saves @bytes to @file atomically, in a worker thread.
+ */
+void
+screenshot_write_bytes_async (GBytes              *bytes,
+                              GFile               *file,
+                              gboolean             overwrite,
+                              GCancellable        *cancellable,
+                              GAsyncReadyCallback  callback,
+                              gpointer             user_data)
+{
+  g_autoptr(GTask) task = NULL;
+  WriteJob *job;
+
+  g_return_if_fail (bytes != NULL);
+  g_return_if_fail (G_IS_FILE (file));
+
+  job = g_slice_new0 (WriteJob);
+  job->bytes = g_bytes_ref (bytes);
+  job->file = g_object_ref (file);
+  job->overwrite = overwrite;
+
+  task = g_task_new (NULL, cancellable, callback, user_data);
+  g_task_set_task_data (task, job, (GDestroyNotify) write_job_free);
+
+  g_task_run_in_thread (task, write_bytes_thread);
+}
+
+gboolean
+screenshot_write_bytes_finish (GAsyncResult  *result,
+                               GError       **error)
+{
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
@@ -0,0 +1,75 @@
+/* screenshot-encoder.h - encodes screenshots in memory and writes them out
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+#ifndef __SCREENSHOT_ENCODER_H__
+#define __SCREENSHOT_ENCODER_H__
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <gio/gio.h>
+
+#include "screenshot-image.h"
+
+G_BEGIN_DECLS
+
+void    screenshot_encode_async  (ScreenshotImage      *image,
+                                  const gchar          *format,
+                                  const gchar          *icc_profile_base64,
+                                  gint                  jpeg_quality,
+                                  GCancellable         *cancellable,
+                                  GAsyncReadyCallback   callback,
+                                  gpointer              user_data);
+GBytes *screenshot_encode_finish (GAsyncResult         *result,
+                                  GError              **error);
+
+void   screenshot_encode_to_stream_async  (ScreenshotImage      *image,
+                                           const gchar          *format,
+                                           const gchar          *icc_profile_base64,
+                                           gint                  jpeg_quality,
+                                           GOutputStream        *stream,
+                                           GCancellable         *cancellable,
+                                           GAsyncReadyCallback   callback,
+                                           gpointer              user_data);
+gssize screenshot_encode_to_stream_finish (GAsyncResult         *result,
+                                           GError              **error);
+
+void    screenshot_encode_delta_async (ScreenshotImage     *image,
+                                       GArray              *tiles,
+                                       const gchar         *reference,
+                                       GCancellable        *cancellable,
+                                       GAsyncReadyCallback  callback,
+                                       gpointer             user_data);
+
+void     screenshot_write_bytes_async  (GBytes               *bytes,
+                                        GFile                *file,
+                                        gboolean              overwrite,
+                                        GCancellable         *cancellable,
+                                        GAsyncReadyCallback   callback,
+                                        gpointer              user_data);
+gboolean screenshot_write_bytes_finish (GAsyncResult         *result,
+                                        GError              **error);
+
+GFileOutputStream *screenshot_create_tmp_file (GFile         *file,
+                                               GFile        **tmp_file_out,
+                                               GCancellable  *cancellable,
+                                               GError       **error);
+gboolean           screenshot_close_tmp_file  (GFileOutputStream  *os,
+                                               GCancellable       *cancellable,
+                                               GError            **error);
+
+G_END_DECLS
+
+#endif /* __SCREENSHOT_ENCODER_H__ */
@@ -26,7 +26,7 @@
 #include <string.h>
 
 #include "screenshot-filename-builder.h"
-#include "screenshot-config.h"
+#include "screenshot-trace.h"
 
 typedef enum
 {
@@ -40,6 +40,7 @@ typedef struct
 {
   char *base_paths[NUM_TESTS];
   char *screenshot_origin;
+  char *file_type;
   int iteration;
   TestType type;
 } AsyncExistenceJob;
@@ -111,7 +112,7 @@ build_path (AsyncExistenceJob *job)
   const gchar *base_path, *file_type;
 
   base_path = job->base_paths[job->type];
-  file_type = screenshot_config->file_type;
+  file_type = job->file_type;
 
   if (base_path == NULL ||
       base_path[0] == '\0')
@@ -157,6 +158,7 @@ async_existence_job_free (AsyncExistenceJob *job)
     g_free (job->base_paths[idx]);
 
   g_free (job->screenshot_origin);
+  g_free (job->file_type);
 
   g_slice_free (AsyncExistenceJob, job);
 }
@@ -177,14 +179,11 @@ prepare_next_cycle (AsyncExistenceJob *job)
   return res;
 }
 
-static void
-try_check_file (GTask *task,
-                gpointer source_object,
-                gpointer data,
-                GCancellable *cancellable)
+static char *
+find_unused_path (AsyncExistenceJob *job,
+                  GCancellable *cancellable,
+                  GError **error_out)
 {
-  AsyncExistenceJob *job = data;
-
   while (TRUE)
     {
       g_autoptr(GError) error = NULL;
@@ -219,26 +218,47 @@ try_check_file (GTask *task,
            * directory and treat this as a generic error.
            */
           if (g_file_query_exists (parent, NULL))
-            {
-              g_task_return_pointer (task, g_steal_pointer (&path), NULL);
-              return;
-            }
+            return g_steal_pointer (&path);
         }
 
       if (!prepare_next_cycle (job))
         {
-          g_task_return_new_error (task,
-                                   G_IO_ERROR,
-                                   G_IO_ERROR_FAILED,
-                                   "%s", "Failed to find a valid place to save");
-          return;
+          g_set_error (error_out,
+                       G_IO_ERROR,
+                       G_IO_ERROR_FAILED,
+                       "%s", "Failed to find a valid place to save");
+          return NULL;
         }
     }
 }
 
+static void
+try_check_file (GTask *task,
+                gpointer source_object,
+                gpointer data,
+                GCancellable *cancellable)
+{
+  static const char *type_names[NUM_TESTS] = { "saved", "default", "fallback" };
+  AsyncExistenceJob *job = data;
+  ScreenshotTraceSpan *span;
+  GError *error = NULL;
+  char *path;
+
+  span = screenshot_trace_begin ("build-filename");
+  path = find_unused_path (job, cancellable, &error);
+  screenshot_trace_set_backend (span, path != NULL ? type_names[job->type] : "failed");
+  screenshot_trace_end (span);
+
+  if (path == NULL)
+    g_task_return_error (task, error);
+  else
+    g_task_return_pointer (task, path, g_free);
+}
+
 void
 screenshot_build_filename_async (const char *save_dir,
                                  const char *screenshot_origin,
+                                 const char *file_type,
                                  GAsyncReadyCallback callback,
                                  gpointer user_data)
 {
@@ -254,6 +274,7 @@ screenshot_build_filename_async (const char *save_dir,
   job->type = TEST_SAVED_DIR;
 
   job->screenshot_origin = g_strdup (screenshot_origin);
+  job->file_type = g_strdup (file_type);
 
   task = g_task_new (NULL, NULL, callback, user_data);
   g_task_set_task_data (task, job, (GDestroyNotify) async_existence_job_free);
@@ -25,6 +25,7 @@
 
 void screenshot_build_filename_async (const char *save_dir,
                                       const char *screenshot_origin,
+                                      const char *file_type,
                                       GAsyncReadyCallback callback,
                                       gpointer user_data);
 gchar *screenshot_build_filename_finish (GAsyncResult *result,
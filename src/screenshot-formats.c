@@ -0,0 +1,471 @@
+/* screenshot-formats.c - file formats gdk-pixbuf cannot write
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+/* Two lossless formats for captures taken in bursts or for monitoring,
+ * where PNG's deflate is the bottleneck:
+ *
+ * QOI (https://qoiformat.org) encodes each pixel as a run, a reference
+ * to a recently seen colour or a small difference to the previous one,
+ * in a single pass with no entropy coding.  It is several times faster
+ * than PNG for files of about the same size, and needs no library.  It
+ * is also read back, for the frames kept in memory by the history, see
+ * screenshot-history.c.
+ *
+ * WebP in its lossless mode is slower than PNG but gives noticeably
+ * smaller files, for archives.  It is only available when gnome-screenshot
+ * was built with libwebp.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <glib/gi18n.h>
+#include <gio/gio.h>
+
+#ifdef HAVE_LIBWEBP
+#include <webp/encode.h>
+#endif
+
+#include "screenshot-formats.h"
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF  0x40
+#define QOI_OP_LUMA  0x80
+#define QOI_OP_RUN   0xc0
+#define QOI_OP_RGB   0xfe
+#define QOI_OP_RGBA  0xff
+
+#define QOI_MAX_RUN 62
+
+/* Written out whenever it cannot take the end of a run and the longest
+ * op anymore */
+#define QOI_BUFFER_SIZE 65536
+#define QOI_MAX_OP_SIZE 6
+
+/* "qoif", width, height, channels and colour space; the data ends with
+ * seven zero bytes and a one */
+#define QOI_HEADER_SIZE 14
+#define QOI_END_MARKER_SIZE 8
+
+typedef union {
+  struct { guchar r, g, b, a; } rgba;
+  guint32 v;
+} QoiPixel;
+
+typedef struct {
+  guchar data[QOI_BUFFER_SIZE];
+  gsize len;
+  GdkPixbufSaveFunc save_func;
+  gpointer user_data;
+} QoiWriter;
+
+static gboolean
+qoi_flush (QoiWriter  *writer,
+           GError    **error)
+{
+  gboolean ok = TRUE;
+
+  if (writer->len > 0)
+    ok = writer->save_func ((const gchar *) writer->data, writer->len,
+                            error, writer->user_data);
+  writer->len = 0;
+
+  return ok;
+}
+
+static void
+qoi_write_32 (QoiWriter *writer,
+              guint32    value)
+{
+  writer->data[writer->len++] = value >> 24;
+  writer->data[writer->len++] = value >> 16;
+  writer->data[writer->len++] = value >> 8;
+  writer->data[writer->len++] = value;
+}
+
+static gboolean
+save_qoi (GdkPixbuf          *pixbuf,
+          GdkPixbufSaveFunc   save_func,
+          gpointer            user_data,
+          GError            **error)
+{
+  static const guchar end_marker[] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+  const guchar *pixels = gdk_pixbuf_read_pixels (pixbuf);
+  gint rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+  gint n_channels = gdk_pixbuf_get_n_channels (pixbuf);
+  gint width = gdk_pixbuf_get_width (pixbuf);
+  gint height = gdk_pixbuf_get_height (pixbuf);
+  g_autofree QoiWriter *writer = NULL;
+  QoiPixel index[64];
+  QoiPixel prev, px;
+  guint run = 0;
+  gint x, y;
+
+  writer = g_new (QoiWriter, 1);
+  writer->len = 0;
+  writer->save_func = save_func;
+  writer->user_data = user_data;
+
+  memcpy (writer->data, "qoif", 4);
+  writer->len = 4;
+  qoi_write_32 (writer, width);
+  qoi_write_32 (writer, height);
+  writer->data[writer->len++] = n_channels;
+  writer->data[writer->len++] = 0; /* sRGB with linear alpha */
+
+  memset (index, 0, sizeof (index));
+  prev.rgba.r = prev.rgba.g = prev.rgba.b = 0;
+  prev.rgba.a = 255;
+  px = prev;
+
+  for (y = 0; y < height; y++)
+    {
+      const guchar *p = pixels + (gsize) y * rowstride;
+
+      for (x = 0; x < width; x++, p += n_channels)
+        {
+          px.rgba.r = p[0];
+          px.rgba.g = p[1];
+          px.rgba.b = p[2];
+          if (n_channels == 4)
+            px.rgba.a = p[3];
+
+          if (writer->len > QOI_BUFFER_SIZE - QOI_MAX_OP_SIZE &&
+              !qoi_flush (writer, error))
+            return FALSE;
+
+          if (px.v == prev.v)
+            {
+              if (++run == QOI_MAX_RUN)
+                {
+                  writer->data[writer->len++] = QOI_OP_RUN | (run - 1);
+                  run = 0;
+                }
+              continue;
+            }
+
+          if (run > 0)
+            {
+              writer->data[writer->len++] = QOI_OP_RUN | (run - 1);
+              run = 0;
+            }
+
+          {
+            guint hash = (px.rgba.r * 3 + px.rgba.g * 5 + px.rgba.b * 7 + px.rgba.a * 11) % 64;
+
+            if (index[hash].v == px.v)
+              {
+                writer->data[writer->len++] = QOI_OP_INDEX | hash;
+              }
+            else if (px.rgba.a == prev.rgba.a)
+              {
+                gint8 vr = px.rgba.r - prev.rgba.r;
+                gint8 vg = px.rgba.g - prev.rgba.g;
+                gint8 vb = px.rgba.b - prev.rgba.b;
+                gint8 vg_r = vr - vg;
+                gint8 vg_b = vb - vg;
+
+                index[hash] = px;
+
+                if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2)
+                  {
+                    writer->data[writer->len++] = QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
+                  }
+                else if (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 && vg_b > -9 && vg_b < 8)
+                  {
+                    writer->data[writer->len++] = QOI_OP_LUMA | (vg + 32);
+                    writer->data[writer->len++] = (vg_r + 8) << 4 | (vg_b + 8);
+                  }
+                else
+                  {
+                    writer->data[writer->len++] = QOI_OP_RGB;
+                    writer->data[writer->len++] = px.rgba.r;
+                    writer->data[writer->len++] = px.rgba.g;
+                    writer->data[writer->len++] = px.rgba.b;
+                  }
+              }
+            else
+              {
+                index[hash] = px;
+
+                writer->data[writer->len++] = QOI_OP_RGBA;
+                writer->data[writer->len++] = px.rgba.r;
+                writer->data[writer->len++] = px.rgba.g;
+                writer->data[writer->len++] = px.rgba.b;
+                writer->data[writer->len++] = px.rgba.a;
+              }
+          }
+
+          prev = px;
+        }
+    }
+
+  if (run > 0)
+    writer->data[writer->len++] = QOI_OP_RUN | (run - 1);
+
+  if (writer->len > QOI_BUFFER_SIZE - sizeof (end_marker) &&
+      !qoi_flush (writer, error))
+    return FALSE;
+
+  memcpy (writer->data + writer->len, end_marker, sizeof (end_marker));
+  writer->len += sizeof (end_marker);
+
+  return qoi_flush (writer, error);
+}
+
+static guint32
+qoi_read_32 (const guchar *p)
+{
+  return (guint32) p[0] << 24 | (guint32) p[1] << 16 | (guint32) p[2] << 8 | p[3];
+}
+
+/**
+ * screenshot_format_load_qoi:
+ * @data: a QOI image, as written by screenshot_format_save_to_callback()
+ * @size: the length of @data
+ * @error: return location for an error
+ *
+ * Only the subset of QOI written here is read: the colour index is
+ * updated by the same ops as in save_qoi().
+ *
+ * Returns: (transfer full) (nullable): the decoded image
+ */
+GdkPixbuf *
+screenshot_format_load_qoi (const guchar  *data,
+                            gsize          size,
+                            GError       **error)
+{
+  g_autoptr(GdkPixbuf) pixbuf = NULL;
+  const guchar *p, *end;
+  guchar *pixels;
+  QoiPixel index[64];
+  QoiPixel px;
+  guint32 width, height;
+  guint n_channels;
+  guint run = 0;
+  gint rowstride;
+  guint32 x, y;
+
+  if (size < QOI_HEADER_SIZE + QOI_END_MARKER_SIZE || memcmp (data, "qoif", 4) != 0)
+    goto invalid;
+
+  width = qoi_read_32 (data + 4);
+  height = qoi_read_32 (data + 8);
+  n_channels = data[12];
+  if (width == 0 || height == 0 || width > G_MAXINT / 4 || height > G_MAXINT / 4 ||
+      (n_channels != 3 && n_channels != 4))
+    goto invalid;
+
+  pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, n_channels == 4, 8, width, height);
+  if (pixbuf == NULL)
+    {
+      g_set_error (error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_INSUFFICIENT_MEMORY,
+                   _("Unable to allocate %ux%u pixels"), width, height);
+      return NULL;
+    }
+
+  pixels = gdk_pixbuf_get_pixels (pixbuf);
+  rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+
+  memset (index, 0, sizeof (index));
+  px.rgba.r = px.rgba.g = px.rgba.b = 0;
+  px.rgba.a = 255;
+
+  /* an op starting before the end marker has all its bytes */
+  p = data + QOI_HEADER_SIZE;
+  end = data + size - QOI_END_MARKER_SIZE;
+
+  for (y = 0; y < height; y++)
+    {
+      guchar *q = pixels + (gsize) y * rowstride;
+
+      for (x = 0; x < width; x++, q += n_channels)
+        {
+          if (run > 0)
+            {
+              run--;
+            }
+          else
+            {
+              gboolean new_colour = TRUE;
+              guchar op;
+
+              if (p >= end)
+                goto invalid;
+
+              op = *p++;
+
+              if (op == QOI_OP_RGB)
+                {
+                  px.rgba.r = p[0];
+                  px.rgba.g = p[1];
+                  px.rgba.b = p[2];
+                  p += 3;
+                }
+              else if (op == QOI_OP_RGBA)
+                {
+                  px.rgba.r = p[0];
+                  px.rgba.g = p[1];
+                  px.rgba.b = p[2];
+                  px.rgba.a = p[3];
+                  p += 4;
+                }
+              else if ((op & 0xc0) == QOI_OP_INDEX)
+                {
+                  px = index[op];
+                  new_colour = FALSE;
+                }
+              else if ((op & 0xc0) == QOI_OP_DIFF)
+                {
+                  px.rgba.r += ((op >> 4) & 0x03) - 2;
+                  px.rgba.g += ((op >> 2) & 0x03) - 2;
+                  px.rgba.b += (op & 0x03) - 2;
+                }
+              else if ((op & 0xc0) == QOI_OP_LUMA)
+                {
+                  gint vg = (op & 0x3f) - 32;
+
+                  px.rgba.r += vg - 8 + ((p[0] >> 4) & 0x0f);
+                  px.rgba.g += vg;
+                  px.rgba.b += vg - 8 + (p[0] & 0x0f);
+                  p++;
+                }
+              else
+                {
+                  /* this pixel and as many more */
+                  run = op & 0x3f;
+                  new_colour = FALSE;
+                }
+
+              if (new_colour)
+                index[(px.rgba.r * 3 + px.rgba.g * 5 + px.rgba.b * 7 + px.rgba.a * 11) % 64] = px;
+            }
+
+          q[0] = px.rgba.r;
+          q[1] = px.rgba.g;
+          q[2] = px.rgba.b;
+          if (n_channels == 4)
+            q[3] = px.rgba.a;
+        }
+    }
+
+  return g_steal_pointer (&pixbuf);
+
+ invalid:
+  g_set_error_literal (error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_CORRUPT_IMAGE,
+                       _("The QOI image is corrupt"));
+  return NULL;
+}
+
+#ifdef HAVE_LIBWEBP
+static gboolean
+save_webp (GdkPixbuf          *pixbuf,
+           GdkPixbufSaveFunc   save_func,
+           gpointer            user_data,
+           GError            **error)
+{
+  guint8 *output = NULL;
+  gsize size;
+  gboolean ok;
+
+  if (gdk_pixbuf_get_width (pixbuf) > WEBP_MAX_DIMENSION ||
+      gdk_pixbuf_get_height (pixbuf) > WEBP_MAX_DIMENSION)
+    {
+      g_set_error (error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_FAILED,
+                   _("Unable to encode the screenshot: %s"),
+                   "too large for WebP");
+      return FALSE;
+    }
+
+  if (gdk_pixbuf_get_has_alpha (pixbuf))
+    size = WebPEncodeLosslessRGBA (gdk_pixbuf_read_pixels (pixbuf),
+                                   gdk_pixbuf_get_width (pixbuf),
+                                   gdk_pixbuf_get_height (pixbuf),
+                                   gdk_pixbuf_get_rowstride (pixbuf),
+                                   &output);
+  else
+    size = WebPEncodeLosslessRGB (gdk_pixbuf_read_pixels (pixbuf),
+                                  gdk_pixbuf_get_width (pixbuf),
+                                  gdk_pixbuf_get_height (pixbuf),
+                                  gdk_pixbuf_get_rowstride (pixbuf),
+                                  &output);
+
+  if (size == 0)
+    {
+      WebPFree (output);
+      g_set_error (error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_FAILED,
+                   _("Unable to encode the screenshot: %s"),
+                   "WebP encoding failed");
+      return FALSE;
+    }
+
+  ok = save_func ((const gchar *) output, size, error, user_data);
+  WebPFree (output);
+
+  return ok;
+}
+#endif /* HAVE_LIBWEBP */
+
+/**
+ * screenshot_format_is_builtin:
+ * @format: a format name, as returned for an extension
+ *
+ * Returns: whether @format is written by gnome-screenshot itself rather
+ *   than by gdk-pixbuf
+ */
+gboolean
+screenshot_format_is_builtin (const gchar *format)
+{
+  if (g_strcmp0 (format, "qoi") == 0)
+    return TRUE;
+
+#ifdef HAVE_LIBWEBP
+  if (g_strcmp0 (format, "webp") == 0)
+    return TRUE;
+#endif
+
+  return FALSE;
+}
+
+/**
+ * screenshot_format_save_to_callback:
+ * @pixbuf: the image to save
+ * @format: a format for which screenshot_format_is_builtin() is %TRUE
+ *
+ * Like gdk_pixbuf_save_to_callback(), for the built-in formats.
+ */
+gboolean
+screenshot_format_save_to_callback (GdkPixbuf          *pixbuf,
+                                    const gchar        *format,
+                                    GdkPixbufSaveFunc   save_func,
+                                    gpointer            user_data,
+                                    GError            **error)
+{
+  if (g_strcmp0 (format, "qoi") == 0)
+    return save_qoi (pixbuf, save_func, user_data, error);
+
+#ifdef HAVE_LIBWEBP
+  if (g_strcmp0 (format, "webp") == 0)
+    return save_webp (pixbuf, save_func, user_data, error);
+#endif
+
+  g_set_error (error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_UNKNOWN_TYPE,
+               _("Image type “%s” is not supported"), format);
+
+  return FALSE;
+}
@@ -0,0 +1,38 @@
+/* screenshot-formats.h - file formats gdk-pixbuf cannot write
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+#ifndef __SCREENSHOT_FORMATS_H__
+#define __SCREENSHOT_FORMATS_H__
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+G_BEGIN_DECLS
+
+gboolean   screenshot_format_is_builtin       (const gchar        *format);
+gboolean   screenshot_format_save_to_callback (GdkPixbuf          *pixbuf,
+                                               const gchar        *format,
+                                               GdkPixbufSaveFunc   save_func,
+                                               gpointer            user_data,
+                                               GError            **error);
+
+GdkPixbuf *screenshot_format_load_qoi         (const guchar       *data,
+                                               gsize               size,
+                                               GError            **error);
+
+G_END_DECLS
+
+#endif /* __SCREENSHOT_FORMATS_H__ */
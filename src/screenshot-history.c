@@ -0,0 +1,297 @@
+/* screenshot-history.c - the recent contents of the screen, kept in memory
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+/* By the time a notification or an error message is noticed, it is often
+ * gone.  With --history, gnome-screenshot keeps running and takes a frame
+ * of the whole screen a few times a second, through the same backends as
+ * any other capture but without the flash, and keeps the last ones in
+ * memory; --ago then saves the frame closest to the time asked for
+ * instead of taking a new one.
+ *
+ * Frames are kept as QOI, which takes a few milliseconds per frame in an
+ * encoder thread and typically shrinks a desktop ten times or more, see
+ * screenshot-formats.c.  The oldest frames are dropped once they take
+ * more than max_bytes, and a frame is skipped while the previous one is
+ * still being encoded, so a slow machine keeps fewer frames rather than
+ * falling behind.
+ *
+ * Most of the time the screen does not change at all between two frames.
+ * Each frame is hashed by tiles first, see screenshot-tile-hash.c, which
+ * is much cheaper than encoding it, and one that is the same as the last
+ * frame kept shares its data instead of being encoded again.
+ */
+
+#include "config.h"
+
+#include <glib/gi18n.h>
+
+#include "screenshot-encoder.h"
+#include "screenshot-formats.h"
+#include "screenshot-history.h"
+#include "screenshot-tile-hash.h"
+#include "screenshot-utils.h"
+
+/* Frames are taken at most this often.  Each one is a full screen
+ * screenshot_get_image(), and the hashing of its tiles, on the main loop:
+ * a shell capture waits for its D-Bus reply, an X11 one for the whole
+ * frame, for a few milliseconds on a small screen and tens on a large
+ * one.  At this rate that can take much of the main loop, and delays
+ * whatever else this instance does, such as the captures asked of it;
+ * only the encoding happens in a thread.  Lower rates are much cheaper.
+ */
+#define HISTORY_MAX_RATE 30.0
+
+typedef struct {
+  gint64 taken_at;
+  GBytes *data;
+
+  /* the size of @data, or 0 if the previous frame has the same */
+  gsize n_bytes;
+} HistoryFrame;
+
+struct _ScreenshotHistory
+{
+  gsize max_bytes;
+  gsize n_bytes;
+
+  /* of HistoryFrame, oldest first */
+  GQueue frames;
+
+  ScreenshotCaptureOptions options;
+  guint timeout_id;
+
+  /* the frame being encoded, if any */
+  GCancellable *cancellable;
+  gint64 encoding_taken_at;
+  ScreenshotTileHashes *encoding_hashes;
+
+  /* the tiles of the newest frame */
+  ScreenshotTileHashes *last_hashes;
+};
+
+static void
+history_frame_free (HistoryFrame *frame)
+{
+  g_bytes_unref (frame->data);
+  g_slice_free (HistoryFrame, frame);
+}
+
+/* Takes @data, which is shared with the newest frame if @n_bytes is 0 */
+static void
+history_add_frame (ScreenshotHistory *history,
+                   gint64             taken_at,
+                   GBytes            *data,
+                   gsize              n_bytes)
+{
+  HistoryFrame *frame, *next;
+
+  frame = g_slice_new (HistoryFrame);
+  frame->taken_at = taken_at;
+  frame->data = data;
+  frame->n_bytes = n_bytes;
+  g_queue_push_tail (&history->frames, frame);
+
+  /* frames that share their data still add up, over hours */
+  history->n_bytes += n_bytes + sizeof (HistoryFrame);
+
+  /* always keep the newest one */
+  while (history->n_bytes > history->max_bytes && history->frames.length > 1)
+    {
+      frame = g_queue_pop_head (&history->frames);
+      next = g_queue_peek_head (&history->frames);
+
+      /* the data stays for the next frame */
+      if (next->data == frame->data)
+        next->n_bytes = frame->n_bytes;
+      else
+        history->n_bytes -= frame->n_bytes;
+
+      history->n_bytes -= sizeof (HistoryFrame);
+
+      history_frame_free (frame);
+    }
+}
+
+static void
+encode_ready_cb (GObject      *source,
+                 GAsyncResult *res,
+                 gpointer      user_data)
+{
+  ScreenshotHistory *history = user_data;
+  g_autoptr(GError) error = NULL;
+  GBytes *bytes;
+
+  bytes = screenshot_encode_finish (res, &error);
+
+  /* the history is gone */
+  if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    return;
+
+  g_clear_object (&history->cancellable);
+  g_clear_pointer (&history->last_hashes, screenshot_tile_hashes_free);
+
+  if (bytes == NULL)
+    {
+      g_clear_pointer (&history->encoding_hashes, screenshot_tile_hashes_free);
+      g_warning ("Unable to keep a frame of the screen: %s", error->message);
+      return;
+    }
+
+  history->last_hashes = g_steal_pointer (&history->encoding_hashes);
+  history_add_frame (history, history->encoding_taken_at, bytes,
+                     g_bytes_get_size (bytes));
+}
+
+static gboolean
+record_frame_timeout (gpointer user_data)
+{
+  ScreenshotHistory *history = user_data;
+  g_autoptr(ScreenshotImage) frame = NULL;
+  g_autoptr(ScreenshotTileHashes) hashes = NULL;
+  HistoryFrame *newest;
+  gint64 taken_at;
+
+  if (history->cancellable != NULL)
+    {
+      g_debug ("Skipping a frame, the previous one is still being encoded");
+      return G_SOURCE_CONTINUE;
+    }
+
+  taken_at = g_get_monotonic_time ();
+  frame = screenshot_get_image (&history->options, NULL);
+  if (frame == NULL)
+    return G_SOURCE_CONTINUE;
+
+  hashes = screenshot_tile_hashes_new (frame);
+  newest = g_queue_peek_tail (&history->frames);
+
+  if (newest != NULL && history->last_hashes != NULL &&
+      screenshot_tile_hashes_changed (hashes, history->last_hashes) == 0)
+    {
+      history_add_frame (history, taken_at, g_bytes_ref (newest->data), 0);
+      return G_SOURCE_CONTINUE;
+    }
+
+  history->cancellable = g_cancellable_new ();
+  history->encoding_taken_at = taken_at;
+  history->encoding_hashes = g_steal_pointer (&hashes);
+  screenshot_encode_async (frame, "qoi", NULL, -1,
+                           history->cancellable,
+                           encode_ready_cb, history);
+
+  return G_SOURCE_CONTINUE;
+}
+
+/**
+ * screenshot_history_new:
+ * @rate: how many frames to take per second
+ * @max_bytes: how much memory the frames may take
+ *
+ * Starts taking frames of the whole screen, until freed.
+ */
+ScreenshotHistory *
+screenshot_history_new (gdouble rate,
+                        gsize   max_bytes)
+{
+  ScreenshotHistory *history;
+  guint interval;
+
+  history = g_slice_new0 (ScreenshotHistory);
+  history->max_bytes = max_bytes;
+  g_queue_init (&history->frames);
+
+  /* the whole screen, without the pointer or the flash */
+  history->options.scale = 1.0;
+  history->options.file_fd = -1;
+  history->options.flash = FALSE;
+
+  interval = 1000 / CLAMP (rate, 0.1, HISTORY_MAX_RATE);
+  history->timeout_id = g_timeout_add (interval, record_frame_timeout, history);
+
+  g_debug ("Keeping a frame of the screen every %u ms, in up to %" G_GSIZE_FORMAT " bytes",
+           interval, max_bytes);
+
+  return history;
+}
+
+void
+screenshot_history_free (ScreenshotHistory *history)
+{
+  g_source_remove (history->timeout_id);
+
+  if (history->cancellable != NULL)
+    {
+      g_cancellable_cancel (history->cancellable);
+      g_object_unref (history->cancellable);
+    }
+
+  g_queue_clear_full (&history->frames, (GDestroyNotify) history_frame_free);
+  g_clear_pointer (&history->encoding_hashes, screenshot_tile_hashes_free);
+  g_clear_pointer (&history->last_hashes, screenshot_tile_hashes_free);
+  g_slice_free (ScreenshotHistory, history);
+}
+
+/**
+ * screenshot_history_lookup:
+ * @history: a #ScreenshotHistory
+ * @time: the monotonic time of the screen wanted
+ * @taken_at: (out) (optional): the monotonic time the frame returned was
+ *   taken at
+ * @error: return location for an error
+ *
+ * Returns: (transfer full) (nullable): the frame taken closest to @time,
+ *   or %NULL if there is none yet
+ */
+ScreenshotImage *
+screenshot_history_lookup (ScreenshotHistory  *history,
+                           gint64              time,
+                           gint64             *taken_at,
+                           GError            **error)
+{
+  g_autoptr(GdkPixbuf) pixbuf = NULL;
+  HistoryFrame *closest = NULL;
+  GList *l;
+
+  for (l = history->frames.head; l != NULL; l = l->next)
+    {
+      HistoryFrame *frame = l->data;
+
+      if (closest == NULL ||
+          ABS (frame->taken_at - time) < ABS (closest->taken_at - time))
+        closest = frame;
+      else
+        break;
+    }
+
+  if (closest == NULL)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                           _("No frame of the screen has been kept yet"));
+      return NULL;
+    }
+
+  pixbuf = screenshot_format_load_qoi (g_bytes_get_data (closest->data, NULL),
+                                       g_bytes_get_size (closest->data),
+                                       error);
+  if (pixbuf == NULL)
+    return NULL;
+
+  if (taken_at != NULL)
+    *taken_at = closest->taken_at;
+
+  return screenshot_image_new_for_pixbuf (pixbuf);
+}
@@ -0,0 +1,40 @@
+/* screenshot-history.h - the recent contents of the screen, kept in memory
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+#ifndef __SCREENSHOT_HISTORY_H__
+#define __SCREENSHOT_HISTORY_H__
+
+#include <gio/gio.h>
+
+#include "screenshot-image.h"
+
+G_BEGIN_DECLS
+
+typedef struct _ScreenshotHistory ScreenshotHistory;
+
+ScreenshotHistory *screenshot_history_new    (gdouble             rate,
+                                              gsize               max_bytes);
+void               screenshot_history_free   (ScreenshotHistory  *history);
+
+ScreenshotImage   *screenshot_history_lookup (ScreenshotHistory  *history,
+                                              gint64              time,
+                                              gint64             *taken_at,
+                                              GError            **error);
+
+G_END_DECLS
+
+#endif /* __SCREENSHOT_HISTORY_H__ */
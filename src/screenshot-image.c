@@ -0,0 +1,680 @@
+/* screenshot-image.c - a capture in the format it was taken in
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+/* The X server hands out pixels as cairo does, premultiplied 0xAARRGGBB
+ * words (BGRA bytes on little endian machines), while GdkPixbuf wants
+ * unpremultiplied RGB(A) bytes.  A ScreenshotImage holds the capture in
+ * whichever of the two it was made in and produces the other only when a
+ * consumer asks for it, at most once, so drawing the capture in the
+ * dialog never goes through a pixbuf and saving it never goes through a
+ * surface.
+ *
+ * Consumers that treat all the channels alike, like the resampler that
+ * builds the preview levels, can work on the native pixels directly
+ * through screenshot_image_get_native_pixbuf().
+ *
+ * The conversions themselves are vectorized: opaque pixels, which is
+ * nearly all of a screenshot, only need their red and blue swapped, with
+ * SSE2, and the packing to and from 3 byte RGB uses SSSE3 shuffles when
+ * the CPU has them.  Translucent pixels take the scalar path.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "screenshot-image.h"
+#include "screenshot-pixbuf-pool.h"
+
+#if defined(__GNUC__) && defined(__SSE2__)
+#include <immintrin.h>
+#define HAVE_SSE2_KERNELS 1
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_SSSE3_KERNELS 1
+#endif
+#endif
+
+struct _ScreenshotImage
+{
+  gint ref_count;
+  gint width;
+  gint height;
+  gboolean has_alpha;
+
+  /* either is created from the other the first time it is needed,
+   * possibly from a worker thread */
+  GMutex lock;
+  cairo_surface_t *surface;
+  GdkPixbuf *pixbuf;
+};
+
+typedef void (* ConvertRowFunc) (const guchar *src,
+                                 guchar       *dest,
+                                 gint          width);
+
+static GMutex stats_lock;
+static ScreenshotImageStats image_stats;
+
+/* unpremultiply_table[a * 256 + c] is c unpremultiplied by a, rounded as
+ * gdk_pixbuf_get_from_surface() does */
+static guint8 unpremultiply_table[256 * 256];
+
+static void
+init_unpremultiply_table (void)
+{
+  static gsize initialized = 0;
+
+  if (g_once_init_enter (&initialized))
+    {
+      guint a, c;
+
+      for (a = 1; a < 256; a++)
+        for (c = 0; c < 256; c++)
+          unpremultiply_table[a * 256 + c] = MIN ((c * 255 + a / 2) / a, 255);
+
+      g_once_init_leave (&initialized, 1);
+    }
+}
+
+/* Same rounding as gdk_cairo_surface_create_from_pixbuf() */
+static inline guint
+premultiply (guint c,
+             guint a)
+{
+  guint t = c * a + 0x80;
+
+  return ((t >> 8) + t) >> 8;
+}
+
+/* Scalar kernels; they read and write whole words, so they work on either
+ * byte order. */
+
+static void
+argb32_to_rgba_row_scalar (const guchar *src,
+                           guchar       *dest,
+                           gint          width)
+{
+  const guint32 *s = (const guint32 *) src;
+  gint x;
+
+  for (x = 0; x < width; x++)
+    {
+      guint32 p = s[x];
+      guint a = p >> 24;
+      const guint8 *table = unpremultiply_table + a * 256;
+
+      dest[0] = table[(p >> 16) & 0xff];
+      dest[1] = table[(p >> 8) & 0xff];
+      dest[2] = table[p & 0xff];
+      dest[3] = a;
+      dest += 4;
+    }
+}
+
+static void
+rgb24_to_rgb_row_scalar (const guchar *src,
+                         guchar       *dest,
+                         gint          width)
+{
+  const guint32 *s = (const guint32 *) src;
+  gint x;
+
+  for (x = 0; x < width; x++)
+    {
+      guint32 p = s[x];
+
+      dest[0] = p >> 16;
+      dest[1] = p >> 8;
+      dest[2] = p;
+      dest += 3;
+    }
+}
+
+static void
+rgba_to_argb32_row_scalar (const guchar *src,
+                           guchar       *dest,
+                           gint          width)
+{
+  guint32 *d = (guint32 *) dest;
+  gint x;
+
+  for (x = 0; x < width; x++)
+    {
+      guint a = src[3];
+
+      if (a == 0xff)
+        d[x] = 0xff000000 | (src[0] << 16) | (src[1] << 8) | src[2];
+      else
+        d[x] = (a << 24) |
+               (premultiply (src[0], a) << 16) |
+               (premultiply (src[1], a) << 8) |
+               premultiply (src[2], a);
+      src += 4;
+    }
+}
+
+static void
+rgb_to_rgb24_row_scalar (const guchar *src,
+                         guchar       *dest,
+                         gint          width)
+{
+  guint32 *d = (guint32 *) dest;
+  gint x;
+
+  for (x = 0; x < width; x++)
+    {
+      d[x] = 0xff000000 | (src[0] << 16) | (src[1] << 8) | src[2];
+      src += 3;
+    }
+}
+
+#ifdef HAVE_SSE2_KERNELS
+/* Swaps the first and third byte of every pixel, which turns opaque
+ * BGRA into RGBA and back. */
+static inline __m128i
+swap_red_blue (__m128i v)
+{
+  const __m128i ag_mask = _mm_set1_epi32 (0xff00ff00);
+  const __m128i rb_mask = _mm_set1_epi32 (0x00ff00ff);
+  __m128i rb = _mm_and_si128 (v, rb_mask);
+
+  return _mm_or_si128 (_mm_and_si128 (v, ag_mask),
+                       _mm_or_si128 (_mm_slli_epi32 (rb, 16),
+                                     _mm_srli_epi32 (rb, 16)));
+}
+
+static inline gboolean
+all_opaque (__m128i v)
+{
+  const __m128i alpha_mask = _mm_set1_epi32 (0xff000000);
+
+  return _mm_movemask_epi8 (_mm_cmpeq_epi32 (_mm_and_si128 (v, alpha_mask),
+                                             alpha_mask)) == 0xffff;
+}
+
+/* Both directions are the same swap on opaque pixels; blocks with any
+ * translucent pixel go through @scalar. */
+static inline void
+swap_row_sse2 (const guchar   *src,
+               guchar         *dest,
+               gint            width,
+               ConvertRowFunc  scalar)
+{
+  gint x = 0;
+
+  for (; x + 4 <= width; x += 4)
+    {
+      __m128i v = _mm_loadu_si128 ((const __m128i *) (src + x * 4));
+
+      if (all_opaque (v))
+        _mm_storeu_si128 ((__m128i *) (dest + x * 4), swap_red_blue (v));
+      else
+        scalar (src + x * 4, dest + x * 4, 4);
+    }
+
+  scalar (src + x * 4, dest + x * 4, width - x);
+}
+
+static void
+argb32_to_rgba_row_sse2 (const guchar *src,
+                         guchar       *dest,
+                         gint          width)
+{
+  swap_row_sse2 (src, dest, width, argb32_to_rgba_row_scalar);
+}
+
+static void
+rgba_to_argb32_row_sse2 (const guchar *src,
+                         guchar       *dest,
+                         gint          width)
+{
+  swap_row_sse2 (src, dest, width, rgba_to_argb32_row_scalar);
+}
+#endif /* HAVE_SSE2_KERNELS */
+
+#ifdef HAVE_SSSE3_KERNELS
+/* 4 BGRX pixels to 12 RGB bytes; the 16 byte store spills 4 bytes into
+ * the next pixels, so the last ones are left to the scalar loop. */
+__attribute__ ((target ("ssse3")))
+static void
+rgb24_to_rgb_row_ssse3 (const guchar *src,
+                        guchar       *dest,
+                        gint          width)
+{
+  const __m128i shuffle = _mm_setr_epi8 (2, 1, 0, 6, 5, 4, 10, 9,
+                                         8, 14, 13, 12, -1, -1, -1, -1);
+  gint x = 0;
+
+  for (; x + 6 <= width; x += 4)
+    {
+      __m128i v = _mm_loadu_si128 ((const __m128i *) (src + x * 4));
+
+      _mm_storeu_si128 ((__m128i *) (dest + x * 3), _mm_shuffle_epi8 (v, shuffle));
+    }
+
+  rgb24_to_rgb_row_scalar (src + x * 4, dest + x * 3, width - x);
+}
+
+/* 12 RGB bytes to 4 opaque BGRX pixels; the 16 byte load reads 4 bytes
+ * past them, so the last pixels are left to the scalar loop. */
+__attribute__ ((target ("ssse3")))
+static void
+rgb_to_rgb24_row_ssse3 (const guchar *src,
+                        guchar       *dest,
+                        gint          width)
+{
+  const __m128i shuffle = _mm_setr_epi8 (2, 1, 0, -1, 5, 4, 3, -1,
+                                         8, 7, 6, -1, 11, 10, 9, -1);
+  const __m128i alpha = _mm_set1_epi32 (0xff000000);
+  gint x = 0;
+
+  for (; x + 6 <= width; x += 4)
+    {
+      __m128i v = _mm_loadu_si128 ((const __m128i *) (src + x * 3));
+
+      _mm_storeu_si128 ((__m128i *) (dest + x * 4),
+                        _mm_or_si128 (_mm_shuffle_epi8 (v, shuffle), alpha));
+    }
+
+  rgb_to_rgb24_row_scalar (src + x * 3, dest + x * 4, width - x);
+}
+#endif /* HAVE_SSSE3_KERNELS */
+
+static ConvertRowFunc
+get_to_pixbuf_row_func (gboolean has_alpha)
+{
+  if (has_alpha)
+    {
+#ifdef HAVE_SSE2_KERNELS
+      return argb32_to_rgba_row_sse2;
+#else
+      return argb32_to_rgba_row_scalar;
+#endif
+    }
+
+#ifdef HAVE_SSSE3_KERNELS
+  if (__builtin_cpu_supports ("ssse3"))
+    return rgb24_to_rgb_row_ssse3;
+#endif
+  return rgb24_to_rgb_row_scalar;
+}
+
+static ConvertRowFunc
+get_to_native_row_func (gboolean has_alpha)
+{
+  if (has_alpha)
+    {
+#ifdef HAVE_SSE2_KERNELS
+      return rgba_to_argb32_row_sse2;
+#else
+      return rgba_to_argb32_row_scalar;
+#endif
+    }
+
+#ifdef HAVE_SSSE3_KERNELS
+  if (__builtin_cpu_supports ("ssse3"))
+    return rgb_to_rgb24_row_ssse3;
+#endif
+  return rgb_to_rgb24_row_scalar;
+}
+
+/**
+ * screenshot_convert_native_to_pixbuf:
+ * @has_alpha: whether @src is ARGB32, to RGBA, or RGB24, to RGB
+ *
+ * Converts cairo pixels to GdkPixbuf ones; @src must be 4 byte aligned.
+ */
+void
+screenshot_convert_native_to_pixbuf (const guchar *src,
+                                     gint          src_stride,
+                                     guchar       *dest,
+                                     gint          dest_stride,
+                                     gint          width,
+                                     gint          height,
+                                     gboolean      has_alpha)
+{
+  ConvertRowFunc convert_row = get_to_pixbuf_row_func (has_alpha);
+  gint y;
+
+  init_unpremultiply_table ();
+
+  for (y = 0; y < height; y++)
+    convert_row (src + y * src_stride, dest + y * dest_stride, width);
+}
+
+/**
+ * screenshot_convert_pixbuf_to_native:
+ * @has_alpha: whether @src is RGBA, to ARGB32, or RGB, to RGB24
+ *
+ * Converts GdkPixbuf pixels to cairo ones; @dest must be 4 byte aligned.
+ */
+void
+screenshot_convert_pixbuf_to_native (const guchar *src,
+                                     gint          src_stride,
+                                     guchar       *dest,
+                                     gint          dest_stride,
+                                     gint          width,
+                                     gint          height,
+                                     gboolean      has_alpha)
+{
+  ConvertRowFunc convert_row = get_to_native_row_func (has_alpha);
+  gint y;
+
+  for (y = 0; y < height; y++)
+    convert_row (src + y * src_stride, dest + y * dest_stride, width);
+}
+
+static void
+count_conversion (guint64 *counter,
+                  gsize    bytes)
+{
+  g_mutex_lock (&stats_lock);
+  (*counter)++;
+  image_stats.bytes += bytes;
+  g_mutex_unlock (&stats_lock);
+}
+
+/**
+ * screenshot_image_new_for_surface:
+ * @surface: an ARGB32 or RGB24 image surface; a reference is taken
+ *
+ * The surface must not be drawn to afterwards.
+ */
+ScreenshotImage *
+screenshot_image_new_for_surface (cairo_surface_t *surface)
+{
+  ScreenshotImage *image;
+  cairo_format_t format;
+
+  g_return_val_if_fail (cairo_surface_get_type (surface) == CAIRO_SURFACE_TYPE_IMAGE, NULL);
+
+  format = cairo_image_surface_get_format (surface);
+  g_return_val_if_fail (format == CAIRO_FORMAT_ARGB32 || format == CAIRO_FORMAT_RGB24, NULL);
+
+  cairo_surface_flush (surface);
+
+  image = g_slice_new0 (ScreenshotImage);
+  image->ref_count = 1;
+  image->width = cairo_image_surface_get_width (surface);
+  image->height = cairo_image_surface_get_height (surface);
+  image->has_alpha = format == CAIRO_FORMAT_ARGB32;
+  image->surface = cairo_surface_reference (surface);
+  g_mutex_init (&image->lock);
+
+  return image;
+}
+
+/**
+ * screenshot_image_new_for_pixbuf:
+ * @pixbuf: an 8 bit RGB or RGBA pixbuf; a reference is taken
+ */
+ScreenshotImage *
+screenshot_image_new_for_pixbuf (GdkPixbuf *pixbuf)
+{
+  ScreenshotImage *image;
+
+  g_return_val_if_fail (GDK_IS_PIXBUF (pixbuf), NULL);
+  g_return_val_if_fail (gdk_pixbuf_get_bits_per_sample (pixbuf) == 8, NULL);
+
+  image = g_slice_new0 (ScreenshotImage);
+  image->ref_count = 1;
+  image->width = gdk_pixbuf_get_width (pixbuf);
+  image->height = gdk_pixbuf_get_height (pixbuf);
+  image->has_alpha = gdk_pixbuf_get_has_alpha (pixbuf);
+  image->pixbuf = g_object_ref (pixbuf);
+  g_mutex_init (&image->lock);
+
+  return image;
+}
+
+ScreenshotImage *
+screenshot_image_ref (ScreenshotImage *image)
+{
+  g_atomic_int_inc (&image->ref_count);
+  return image;
+}
+
+void
+screenshot_image_unref (ScreenshotImage *image)
+{
+  if (!g_atomic_int_dec_and_test (&image->ref_count))
+    return;
+
+  g_clear_pointer (&image->surface, cairo_surface_destroy);
+  g_clear_object (&image->pixbuf);
+  g_mutex_clear (&image->lock);
+  g_slice_free (ScreenshotImage, image);
+}
+
+/* In device pixels */
+gint
+screenshot_image_get_width (ScreenshotImage *image)
+{
+  return image->width;
+}
+
+gint
+screenshot_image_get_height (ScreenshotImage *image)
+{
+  return image->height;
+}
+
+gboolean
+screenshot_image_get_has_alpha (ScreenshotImage *image)
+{
+  return image->has_alpha;
+}
+
+cairo_format_t
+screenshot_image_get_native_format (ScreenshotImage *image)
+{
+  return image->has_alpha ? CAIRO_FORMAT_ARGB32 : CAIRO_FORMAT_RGB24;
+}
+
+/**
+ * screenshot_image_get_pixbuf:
+ *
+ * Returns the image as unpremultiplied RGB(A), converting it the first
+ * time if it was captured natively.  This can be called from any thread,
+ * and is best called from the one that is going to use the pixels, like
+ * an encoder.
+ *
+ * Returns: (transfer none): the pixbuf, owned by @image
+ */
+GdkPixbuf *
+screenshot_image_get_pixbuf (ScreenshotImage *image)
+{
+  GdkPixbuf *pixbuf;
+
+  g_mutex_lock (&image->lock);
+
+  if (image->pixbuf == NULL)
+    {
+      pixbuf = screenshot_pixbuf_pool_new_pixbuf (image->has_alpha,
+                                                  image->width,
+                                                  image->height);
+      if (pixbuf == NULL)
+        g_error ("Unable to allocate %dx%d pixels", image->width, image->height);
+
+      screenshot_convert_native_to_pixbuf (cairo_image_surface_get_data (image->surface),
+                                           cairo_image_surface_get_stride (image->surface),
+                                           gdk_pixbuf_get_pixels (pixbuf),
+                                           gdk_pixbuf_get_rowstride (pixbuf),
+                                           image->width, image->height,
+                                           image->has_alpha);
+      count_conversion (&image_stats.to_pixbuf, gdk_pixbuf_get_byte_length (pixbuf));
+
+      image->pixbuf = pixbuf;
+    }
+
+  pixbuf = image->pixbuf;
+
+  g_mutex_unlock (&image->lock);
+
+  return pixbuf;
+}
+
+/**
+ * screenshot_image_get_surface:
+ *
+ * Returns the image as a cairo image surface, converting it the first
+ * time if it was made from a pixbuf.  The surface has no device scale.
+ *
+ * Returns: (transfer none): the surface, owned by @image
+ */
+cairo_surface_t *
+screenshot_image_get_surface (ScreenshotImage *image)
+{
+  cairo_surface_t *surface;
+
+  g_mutex_lock (&image->lock);
+
+  if (image->surface == NULL)
+    {
+      surface = cairo_image_surface_create (screenshot_image_get_native_format (image),
+                                            image->width, image->height);
+
+      cairo_surface_flush (surface);
+      screenshot_convert_pixbuf_to_native (gdk_pixbuf_read_pixels (image->pixbuf),
+                                           gdk_pixbuf_get_rowstride (image->pixbuf),
+                                           cairo_image_surface_get_data (surface),
+                                           cairo_image_surface_get_stride (surface),
+                                           image->width, image->height,
+                                           image->has_alpha);
+      cairo_surface_mark_dirty (surface);
+      count_conversion (&image_stats.to_native,
+                        (gsize) cairo_image_surface_get_stride (surface) * image->height);
+
+      image->surface = surface;
+    }
+
+  surface = image->surface;
+
+  g_mutex_unlock (&image->lock);
+
+  return surface;
+}
+
+/**
+ * screenshot_image_get_native_pixbuf:
+ *
+ * Returns a 4 channel pixbuf that shares the pixels of the surface, in
+ * cairo's premultiplied layout rather than RGBA.  It is only meant for
+ * code that does the same thing to every channel, like resampling; the
+ * result can be turned back into a surface without any conversion with
+ * screenshot_native_pixbuf_create_surface().
+ *
+ * Returns: (transfer full): a new pixbuf
+ */
+GdkPixbuf *
+screenshot_image_get_native_pixbuf (ScreenshotImage *image)
+{
+  cairo_surface_t *surface = screenshot_image_get_surface (image);
+
+  return gdk_pixbuf_new_from_data (cairo_image_surface_get_data (surface),
+                                   GDK_COLORSPACE_RGB, TRUE, 8,
+                                   image->width, image->height,
+                                   cairo_image_surface_get_stride (surface),
+                                   (GdkPixbufDestroyNotify) cairo_surface_destroy,
+                                   cairo_surface_reference (surface));
+}
+
+/**
+ * screenshot_image_peek_pixels:
+ *
+ * Fills @pixels with the image as it is now, without converting it.  The
+ * colour channels come in RGB or BGR order and, for native images with
+ * alpha, premultiplied; this is meant for analysis that only compares
+ * pixels with each other.  The data stays valid as long as @image.
+ */
+void
+screenshot_image_peek_pixels (ScreenshotImage       *image,
+                              ScreenshotImagePixels *pixels)
+{
+  g_mutex_lock (&image->lock);
+
+  if (image->surface != NULL)
+    {
+      cairo_surface_flush (image->surface);
+      pixels->data = cairo_image_surface_get_data (image->surface);
+      pixels->rowstride = cairo_image_surface_get_stride (image->surface);
+      pixels->bytes_per_pixel = 4;
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+      pixels->color_offset = 0;
+      pixels->alpha_offset = image->has_alpha ? 3 : -1;
+#else
+      pixels->color_offset = 1;
+      pixels->alpha_offset = image->has_alpha ? 0 : -1;
+#endif
+    }
+  else
+    {
+      pixels->data = gdk_pixbuf_read_pixels (image->pixbuf);
+      pixels->rowstride = gdk_pixbuf_get_rowstride (image->pixbuf);
+      pixels->bytes_per_pixel = gdk_pixbuf_get_n_channels (image->pixbuf);
+      pixels->color_offset = 0;
+      pixels->alpha_offset = image->has_alpha ? 3 : -1;
+    }
+
+  g_mutex_unlock (&image->lock);
+}
+
+static const cairo_user_data_key_t native_pixbuf_key;
+
+/**
+ * screenshot_native_pixbuf_create_surface:
+ * @native: a pixbuf holding native pixels, like a resampled copy of
+ *   screenshot_image_get_native_pixbuf()
+ * @format: the format of the image it came from
+ *
+ * Returns: (transfer full): a surface sharing the pixels of @native,
+ *   which is kept alive as long as the surface
+ */
+cairo_surface_t *
+screenshot_native_pixbuf_create_surface (GdkPixbuf      *native,
+                                         cairo_format_t  format)
+{
+  cairo_surface_t *surface;
+
+  g_return_val_if_fail (gdk_pixbuf_get_n_channels (native) == 4, NULL);
+
+  surface = cairo_image_surface_create_for_data (gdk_pixbuf_get_pixels (native),
+                                                 format,
+                                                 gdk_pixbuf_get_width (native),
+                                                 gdk_pixbuf_get_height (native),
+                                                 gdk_pixbuf_get_rowstride (native));
+  cairo_surface_set_user_data (surface, &native_pixbuf_key,
+                               g_object_ref (native), g_object_unref);
+
+  return surface;
+}
+
+void
+screenshot_image_get_stats (ScreenshotImageStats *stats)
+{
+  g_mutex_lock (&stats_lock);
+  *stats = image_stats;
+  g_mutex_unlock (&stats_lock);
+}
+
+void
+screenshot_image_reset_stats (void)
+{
+  g_mutex_lock (&stats_lock);
+  memset (&image_stats, 0, sizeof (image_stats));
+  g_mutex_unlock (&stats_lock);
+}
@@ -0,0 +1,88 @@
+/* screenshot-image.h - a capture in the format it was taken in
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+#ifndef __SCREENSHOT_IMAGE_H__
+#define __SCREENSHOT_IMAGE_H__
+
+#include <cairo.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+G_BEGIN_DECLS
+
+typedef struct _ScreenshotImage ScreenshotImage;
+
+ScreenshotImage *screenshot_image_new_for_surface    (cairo_surface_t *surface);
+ScreenshotImage *screenshot_image_new_for_pixbuf     (GdkPixbuf       *pixbuf);
+
+ScreenshotImage *screenshot_image_ref                (ScreenshotImage *image);
+void             screenshot_image_unref              (ScreenshotImage *image);
+
+gint             screenshot_image_get_width          (ScreenshotImage *image);
+gint             screenshot_image_get_height         (ScreenshotImage *image);
+gboolean         screenshot_image_get_has_alpha      (ScreenshotImage *image);
+cairo_format_t   screenshot_image_get_native_format  (ScreenshotImage *image);
+
+GdkPixbuf       *screenshot_image_get_pixbuf         (ScreenshotImage *image);
+cairo_surface_t *screenshot_image_get_surface        (ScreenshotImage *image);
+GdkPixbuf       *screenshot_image_get_native_pixbuf  (ScreenshotImage *image);
+
+/* The pixels of an image in whichever form it already has, for code that
+ * only compares pixels with each other, see screenshot_image_peek_pixels() */
+typedef struct {
+  const guchar *data;
+  gint rowstride;
+  gint bytes_per_pixel;   /* 3 or 4 */
+  gint color_offset;      /* of the three colour bytes, in some order */
+  gint alpha_offset;      /* -1 if the image has no alpha */
+} ScreenshotImagePixels;
+
+void             screenshot_image_peek_pixels        (ScreenshotImage       *image,
+                                                      ScreenshotImagePixels *pixels);
+
+cairo_surface_t *screenshot_native_pixbuf_create_surface (GdkPixbuf      *native,
+                                                          cairo_format_t  format);
+
+/* Conversion kernels, exposed for the benchmarks */
+void             screenshot_convert_native_to_pixbuf (const guchar    *src,
+                                                      gint             src_stride,
+                                                      guchar          *dest,
+                                                      gint             dest_stride,
+                                                      gint             width,
+                                                      gint             height,
+                                                      gboolean         has_alpha);
+void             screenshot_convert_pixbuf_to_native (const guchar    *src,
+                                                      gint             src_stride,
+                                                      guchar          *dest,
+                                                      gint             dest_stride,
+                                                      gint             width,
+                                                      gint             height,
+                                                      gboolean         has_alpha);
+
+typedef struct {
+  guint64 to_pixbuf;    /* native images converted for a pixbuf consumer */
+  guint64 to_native;    /* pixbufs converted for drawing */
+  guint64 bytes;        /* pixel bytes written by those conversions */
+} ScreenshotImageStats;
+
+void             screenshot_image_get_stats          (ScreenshotImageStats *stats);
+void             screenshot_image_reset_stats        (void);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (ScreenshotImage, screenshot_image_unref)
+
+G_END_DECLS
+
+#endif /* __SCREENSHOT_IMAGE_H__ */
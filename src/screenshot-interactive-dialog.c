@@ -26,6 +26,7 @@
 #include <glib/gi18n.h>
 
 #include "screenshot-config.h"
+#include "screenshot-effect-stack.h"
 #include "screenshot-interactive-dialog.h"
 #include "screenshot-utils.h"
 
@@ -46,13 +47,6 @@ enum
   N_COLUMNS
 };
 
-typedef enum {
-  SCREENSHOT_EFFECT_NONE,
-  SCREENSHOT_EFFECT_SHADOW,
-  SCREENSHOT_EFFECT_BORDER,
-  SCREENSHOT_EFFECT_VINTAGE
-} ScreenshotEffectType;
-
 typedef enum {
   SCREEN_CAPTURE,
   NONE,
@@ -187,26 +181,6 @@ interactive_dialog_key_press_cb (GtkWidget   *widget,
   return FALSE;
 }
 
-typedef struct {
-  ScreenshotEffectType id;
-  const gchar *label;
-  const gchar *nick;
-} ScreenshotEffect;
-
-static const ScreenshotEffect effects[] = {
-  /* Translators:
-   * these are the names of the effects available which will be
-   * displayed inside a combo box in interactive mode for the user
-   * to chooser.
-   */
-  { SCREENSHOT_EFFECT_NONE, N_("None"), "none" },
-  { SCREENSHOT_EFFECT_SHADOW, N_("Drop shadow"), "shadow" },
-  { SCREENSHOT_EFFECT_BORDER, N_("Border"), "border" },
-  { SCREENSHOT_EFFECT_VINTAGE, N_("Vintage"), "vintage" }
-};
-
-static guint n_effects = G_N_ELEMENTS (effects);
-
 static GtkWidget *
 create_effects_combo (void)
 {
@@ -220,15 +194,15 @@ create_effects_combo (void)
                               G_TYPE_STRING,
                               G_TYPE_UINT);
 
-  for (i = 0; i < n_effects; i++)
+  for (i = 0; i < SCREENSHOT_N_EFFECTS; i++)
     {
       GtkTreeIter iter;
 
       gtk_list_store_insert (model, &iter, i);
       gtk_list_store_set (model, &iter,
-                          COLUMN_ID, effects[i].id,
-                          COLUMN_LABEL, gettext (effects[i].label),
-                          COLUMN_NICK, effects[i].nick,
+                          COLUMN_ID, i,
+                          COLUMN_LABEL, screenshot_effect_type_get_label (i),
+                          COLUMN_NICK, screenshot_effect_type_get_nick (i),
                           -1);
     }
 
@@ -236,27 +210,8 @@ create_effects_combo (void)
   gtk_combo_box_set_model (GTK_COMBO_BOX (retval),
                            GTK_TREE_MODEL (model));
 
-  switch (screenshot_config->border_effect[0])
-    {
-    case 's': /* shadow */
-      gtk_combo_box_set_active (GTK_COMBO_BOX (retval),
-                                SCREENSHOT_EFFECT_SHADOW);
-      break;
-    case 'b': /* border */
-      gtk_combo_box_set_active (GTK_COMBO_BOX (retval),
-                                SCREENSHOT_EFFECT_BORDER);
-      break;
-    case 'v': /* vintage */
-      gtk_combo_box_set_active (GTK_COMBO_BOX (retval),
-                                SCREENSHOT_EFFECT_VINTAGE);
-      break;
-    case 'n': /* none */
-      gtk_combo_box_set_active (GTK_COMBO_BOX (retval),
-                                SCREENSHOT_EFFECT_NONE);
-      break;
-    default:
-      break;
-    }
+  gtk_combo_box_set_active (GTK_COMBO_BOX (retval),
+                            screenshot_effect_type_from_nick (screenshot_config->border_effect));
 
   renderer = gtk_cell_renderer_text_new ();
   gtk_cell_layout_pack_start (GTK_CELL_LAYOUT (retval), renderer, TRUE);
@@ -0,0 +1,141 @@
+/* screenshot-mask.c - hiding what a capture should not show
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+/* The X11 captures hide the parts of the root window no monitor shows,
+ * and the outside of a window's shape, such as the corners of rounded
+ * decorations.  These run on every such capture, over every pixel of it,
+ * and are kept apart from the X code so that they can be measured on
+ * synthetic frames.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "screenshot-mask.h"
+
+static void
+append_region (cairo_t              *cr,
+               const cairo_region_t *region)
+{
+  gint n_rects = cairo_region_num_rectangles (region);
+  gint i;
+
+  for (i = 0; i < n_rects; i++)
+    {
+      cairo_rectangle_int_t rect;
+
+      cairo_region_get_rectangle (region, i, &rect);
+      cairo_rectangle (cr, rect.x, rect.y, rect.width, rect.height);
+    }
+}
+
+/**
+ * screenshot_mask_surface:
+ * @surface: a capture
+ * @region: what to hide, in display pixels
+ *
+ * Paints @region of @surface black.
+ */
+void
+screenshot_mask_surface (cairo_surface_t      *surface,
+                         const cairo_region_t *region)
+{
+  cairo_t *cr;
+
+  cr = cairo_create (surface);
+  cairo_set_source_rgb (cr, 0, 0, 0);
+  append_region (cr, region);
+  cairo_fill (cr);
+  cairo_destroy (cr);
+}
+
+/**
+ * screenshot_mask_strip:
+ * @strip: RGB rows of a capture
+ * @strip_rect: where they are in the capture, in device pixels
+ * @region: what to hide, in display pixels
+ * @scale: the device pixels per display pixel
+ *
+ * Like screenshot_mask_surface(), on a strip of a capture that is
+ * streamed to disk.
+ */
+void
+screenshot_mask_strip (guchar               *strip,
+                       gint                  rowstride,
+                       const GdkRectangle   *strip_rect,
+                       const cairo_region_t *region,
+                       gint                  scale)
+{
+  gint n_rects;
+  gint i;
+
+  n_rects = cairo_region_num_rectangles (region);
+
+  for (i = 0; i < n_rects; i++)
+    {
+      cairo_rectangle_int_t rect, dest;
+      gint y;
+
+      cairo_region_get_rectangle (region, i, &rect);
+      rect.x *= scale;
+      rect.y *= scale;
+      rect.width *= scale;
+      rect.height *= scale;
+
+      if (!gdk_rectangle_intersect (&rect, strip_rect, &dest))
+        continue;
+
+      for (y = dest.y; y < dest.y + dest.height; y++)
+        memset (strip + (y - strip_rect->y) * rowstride + (dest.x - strip_rect->x) * 3,
+                0, dest.width * 3);
+    }
+}
+
+/**
+ * screenshot_copy_shaped_surface:
+ * @surface: a capture of a window
+ * @shape: the window's shape, in display pixels
+ *
+ * Returns: (transfer full): a copy of @surface with an alpha channel,
+ *   transparent outside of @shape
+ */
+cairo_surface_t *
+screenshot_copy_shaped_surface (cairo_surface_t      *surface,
+                                const cairo_region_t *shape)
+{
+  cairo_surface_t *copy;
+  gdouble x_scale, y_scale;
+  cairo_t *cr;
+
+  /* a new surface is fully transparent */
+  copy = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+                                     cairo_image_surface_get_width (surface),
+                                     cairo_image_surface_get_height (surface));
+  cairo_surface_get_device_scale (surface, &x_scale, &y_scale);
+  cairo_surface_set_device_scale (copy, x_scale, y_scale);
+
+  /* copy the shaped part only, as opaque pixels */
+  cr = cairo_create (copy);
+  append_region (cr, shape);
+  cairo_clip (cr);
+  cairo_set_source_surface (cr, surface, 0, 0);
+  cairo_paint (cr);
+  cairo_destroy (cr);
+
+  return copy;
+}
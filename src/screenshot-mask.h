@@ -0,0 +1,37 @@
+/* screenshot-mask.h - hiding what a capture should not show
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+#ifndef __SCREENSHOT_MASK_H__
+#define __SCREENSHOT_MASK_H__
+
+#include <gdk/gdk.h>
+
+G_BEGIN_DECLS
+
+void             screenshot_mask_surface        (cairo_surface_t      *surface,
+                                                 const cairo_region_t *region);
+void             screenshot_mask_strip          (guchar               *strip,
+                                                 gint                  rowstride,
+                                                 const GdkRectangle   *strip_rect,
+                                                 const cairo_region_t *region,
+                                                 gint                  scale);
+cairo_surface_t *screenshot_copy_shaped_surface (cairo_surface_t      *surface,
+                                                 const cairo_region_t *shape);
+
+G_END_DECLS
+
+#endif /* __SCREENSHOT_MASK_H__ */
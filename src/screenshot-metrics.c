@@ -0,0 +1,756 @@
+/* screenshot-metrics.c - counters for fleet monitoring
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+/* Aggregate numbers about screenshots across many desktops: how many were
+ * taken in each mode and how they ended, how often the shell could not be
+ * used, why captures and saves failed, how long each stage of the
+ * pipeline took, how many bytes came out of it and how much memory the
+ * process needed.
+ *
+ * They are written in the Prometheus text format to the file named by
+ * the metrics-file setting, meant for the textfile collector of the node
+ * exporter.  gnome-screenshot mostly runs once per screenshot, so the
+ * file is also where the totals are kept: each time a screenshot is done
+ * with, the file is read back, what this process counted since is added
+ * and the result replaces it atomically.  Several gnome-screenshot can
+ * run at once, so this happens under a lock on a file next to it, the
+ * name of the metrics file with ".lock" added.  Only counters and histograms
+ * are kept that way; the latency percentiles are estimated from the
+ * histogram buckets every time, the way histogram_quantile() would.
+ * Gauges, such as the depth of the capture queue, are what this process
+ * last saw and replace what the file had.
+ *
+ * The metric and label names below are what dashboards and alerts match
+ * on, so they must not change.  Stage latencies and byte counts come from
+ * the spans of screenshot-trace.c, which are recorded whenever metrics
+ * are enabled.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <gio/gio.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "screenshot-metrics.h"
+
+typedef enum {
+  FAMILY_COUNTER,
+  FAMILY_HISTOGRAM,
+  FAMILY_QUANTILES,
+  FAMILY_GAUGE,
+  FAMILY_TIMESTAMP
+} FamilyKind;
+
+typedef struct {
+  const gchar *name;
+  FamilyKind kind;
+  const gchar *help;
+  const gdouble *bounds;
+  guint n_bounds;
+} MetricFamily;
+
+static const gdouble duration_bounds[] = {
+  0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10
+};
+
+/* 16 MiB to 4 GiB */
+static const gdouble rss_bounds[] = {
+  16777216, 33554432, 67108864, 134217728, 268435456, 536870912,
+  1073741824, 2147483648.0, 4294967296.0
+};
+
+enum {
+  CAPTURES,
+  BACKEND,
+  FAILURES,
+  STAGE_DURATION,
+  STAGE_QUANTILES,
+  STAGE_BYTES,
+  PEAK_RSS,
+  ADMISSIONS,
+  QUEUE_DEPTH,
+  QUEUE_WAIT,
+  WATCH_CHECKS,
+  WATCH_SAVES,
+  LAST_UPDATE
+};
+
+static const MetricFamily families[] = {
+  [CAPTURES] = {
+    "gnome_screenshot_captures_total", FAMILY_COUNTER,
+    "Screenshots by mode (screen, window, area) and outcome (saved, failed, cancelled, replaced)."
+  },
+  [BACKEND] = {
+    "gnome_screenshot_capture_backend_total", FAMILY_COUNTER,
+    "Captures by backend (shell, x11); fallback is true when the shell was tried and failed."
+  },
+  [FAILURES] = {
+    "gnome_screenshot_failures_total", FAMILY_COUNTER,
+    "Failures by stage (capture, save) and reason."
+  },
+  [STAGE_DURATION] = {
+    "gnome_screenshot_stage_duration_seconds", FAMILY_HISTOGRAM,
+    "Time spent in each stage of taking and saving a screenshot.",
+    duration_bounds, G_N_ELEMENTS (duration_bounds)
+  },
+  [STAGE_QUANTILES] = {
+    "gnome_screenshot_stage_duration_quantile_seconds", FAMILY_QUANTILES,
+    "The 0.5, 0.95 and 0.99 quantiles of the stage durations, estimated from the histogram."
+  },
+  [STAGE_BYTES] = {
+    "gnome_screenshot_stage_bytes_total", FAMILY_COUNTER,
+    "Bytes produced by each stage; stage=\"encode\" is the encoded size of the files."
+  },
+  [PEAK_RSS] = {
+    "gnome_screenshot_peak_rss_bytes", FAMILY_HISTOGRAM,
+    "Peak resident set size of the process when a screenshot is done with.",
+    rss_bounds, G_N_ELEMENTS (rss_bounds)
+  },
+  [ADMISSIONS] = {
+    "gnome_screenshot_capture_admissions_total", FAMILY_COUNTER,
+    "Admission decisions on capture requests: started (at once or after being queued), queued, coalesced, merged and dropped."
+  },
+  [QUEUE_DEPTH] = {
+    "gnome_screenshot_capture_queue_depth", FAMILY_GAUGE,
+    "Capture requests waiting for the one in progress, when this file was last written."
+  },
+  [QUEUE_WAIT] = {
+    "gnome_screenshot_capture_queue_wait_seconds", FAMILY_HISTOGRAM,
+    "Time capture requests spent queued before they started.",
+    duration_bounds, G_N_ELEMENTS (duration_bounds)
+  },
+  [WATCH_CHECKS] = {
+    "gnome_screenshot_watch_checks_total", FAMILY_COUNTER,
+    "Checks of a watched screen, window or area for changes, by source (damage, tiles) and whether enough had changed to take a screenshot."
+  },
+  [WATCH_SAVES] = {
+    "gnome_screenshot_watch_saves_total", FAMILY_COUNTER,
+    "Files saved by a watch, by storage: full screenshots, deltas of the tiles that changed, and links to the last file for checks that found too little changed."
+  },
+  [LAST_UPDATE] = {
+    "gnome_screenshot_metrics_last_update_timestamp_seconds", FAMILY_TIMESTAMP,
+    "When this file was last written."
+  },
+};
+
+static const gdouble quantiles[] = { 0.5, 0.95, 0.99 };
+
+static gchar *metrics_path;
+static GMutex metrics_lock;
+/* series, as written in the file, to what was added since the last flush */
+static GHashTable *pending;
+/* and to the last value of the gauges */
+static GHashTable *gauges;
+
+/**
+ * screenshot_metrics_init:
+ * @path: (nullable): the file to write, or %NULL or "" to count nothing
+ *
+ * Must be called before any screenshot is taken.
+ */
+void
+screenshot_metrics_init (const gchar *path)
+{
+  if (path == NULL || path[0] == '\0')
+    return;
+
+  metrics_path = g_strdup (path);
+  pending = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  gauges = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+}
+
+gboolean
+screenshot_metrics_is_enabled (void)
+{
+  return metrics_path != NULL;
+}
+
+/* name_suffix{labels,le="bound"}, leaving out what is NULL or empty */
+static gchar *
+make_series (const gchar *name,
+             const gchar *suffix,
+             const gchar *labels,
+             const gchar *le)
+{
+  GString *series = g_string_new (name);
+  gboolean has_labels = labels != NULL && labels[0] != '\0';
+
+  if (suffix != NULL)
+    g_string_append (series, suffix);
+
+  if (has_labels || le != NULL)
+    {
+      g_string_append_c (series, '{');
+      if (has_labels)
+        g_string_append (series, labels);
+      if (le != NULL)
+        g_string_append_printf (series, "%sle=\"%s\"", has_labels ? "," : "", le);
+      g_string_append_c (series, '}');
+    }
+
+  return g_string_free (series, FALSE);
+}
+
+static void
+add_to_series (GHashTable *table,
+               gchar      *series,
+               gdouble     value)
+{
+  gdouble *total = g_hash_table_lookup (table, series);
+
+  if (total == NULL)
+    {
+      total = g_new0 (gdouble, 1);
+      g_hash_table_insert (table, series, total);
+    }
+  else
+    {
+      g_free (series);
+    }
+
+  *total += value;
+}
+
+static gchar *
+format_value (gchar   *buf,
+              gdouble  value)
+{
+  return g_ascii_dtostr (buf, G_ASCII_DTOSTR_BUF_SIZE, value);
+}
+
+/* Called with the lock held */
+static void
+observe (const MetricFamily *family,
+         const gchar        *labels,
+         gdouble             value)
+{
+  gchar le[G_ASCII_DTOSTR_BUF_SIZE];
+  guint i;
+
+  /* every bucket is written, even empty, so that the file has them all */
+  for (i = 0; i < family->n_bounds; i++)
+    add_to_series (pending,
+                   make_series (family->name, "_bucket", labels,
+                                format_value (le, family->bounds[i])),
+                   value <= family->bounds[i] ? 1 : 0);
+
+  add_to_series (pending, make_series (family->name, "_bucket", labels, "+Inf"), 1);
+  add_to_series (pending, make_series (family->name, "_sum", labels, NULL), value);
+  add_to_series (pending, make_series (family->name, "_count", labels, NULL), 1);
+}
+
+static void
+count (const MetricFamily *family,
+       const gchar        *labels,
+       gdouble             value)
+{
+  if (!screenshot_metrics_is_enabled ())
+    return;
+
+  g_mutex_lock (&metrics_lock);
+  add_to_series (pending, make_series (family->name, NULL, labels, NULL), value);
+  g_mutex_unlock (&metrics_lock);
+}
+
+/**
+ * screenshot_metrics_observe_stage:
+ * @stage: the name of a trace span
+ * @duration_us: how long it took, in microseconds
+ * @has_bytes: whether @bytes is set
+ * @bytes: how many bytes the stage produced
+ *
+ * Called from any thread for every span that ends.
+ */
+void
+screenshot_metrics_observe_stage (const gchar *stage,
+                                  gint64       duration_us,
+                                  gboolean     has_bytes,
+                                  guint64      bytes)
+{
+  g_autofree gchar *labels = NULL;
+
+  if (!screenshot_metrics_is_enabled ())
+    return;
+
+  labels = g_strdup_printf ("stage=\"%s\"", stage);
+
+  g_mutex_lock (&metrics_lock);
+
+  observe (&families[STAGE_DURATION], labels, duration_us / (gdouble) G_USEC_PER_SEC);
+  if (has_bytes)
+    add_to_series (pending,
+                   make_series (families[STAGE_BYTES].name, NULL, labels, NULL),
+                   bytes);
+
+  g_mutex_unlock (&metrics_lock);
+}
+
+/**
+ * screenshot_metrics_count_capture:
+ * @mode: "screen", "window" or "area"
+ * @outcome: how the screenshot ended
+ *
+ * Counts a screenshot that is done with, along with the memory the
+ * process has needed so far.
+ */
+void
+screenshot_metrics_count_capture (const gchar *mode,
+                                  const gchar *outcome)
+{
+  g_autofree gchar *labels = NULL;
+  struct rusage usage;
+
+  if (!screenshot_metrics_is_enabled ())
+    return;
+
+  labels = g_strdup_printf ("mode=\"%s\",outcome=\"%s\"", mode, outcome);
+  count (&families[CAPTURES], labels, 1);
+
+  /* in kilobytes on Linux */
+  if (getrusage (RUSAGE_SELF, &usage) == 0)
+    {
+      g_mutex_lock (&metrics_lock);
+      observe (&families[PEAK_RSS], NULL, usage.ru_maxrss * 1024.0);
+      g_mutex_unlock (&metrics_lock);
+    }
+}
+
+void
+screenshot_metrics_count_backend (const gchar *backend,
+                                  gboolean     fallback)
+{
+  g_autofree gchar *labels = NULL;
+
+  if (!screenshot_metrics_is_enabled ())
+    return;
+
+  labels = g_strdup_printf ("backend=\"%s\",fallback=\"%s\"",
+                            backend, fallback ? "true" : "false");
+  count (&families[BACKEND], labels, 1);
+}
+
+/**
+ * screenshot_metrics_count_failure:
+ * @stage: "capture" or "save"
+ * @reason: a short, fixed string, see screenshot_metrics_error_reason()
+ */
+void
+screenshot_metrics_count_failure (const gchar *stage,
+                                  const gchar *reason)
+{
+  g_autofree gchar *labels = NULL;
+
+  if (!screenshot_metrics_is_enabled ())
+    return;
+
+  labels = g_strdup_printf ("stage=\"%s\",reason=\"%s\"", stage, reason);
+  count (&families[FAILURES], labels, 1);
+}
+
+/**
+ * screenshot_metrics_count_admission:
+ * @decision: "started", "queued", "coalesced", "merged" or "dropped"
+ */
+void
+screenshot_metrics_count_admission (const gchar *decision)
+{
+  g_autofree gchar *labels = NULL;
+
+  if (!screenshot_metrics_is_enabled ())
+    return;
+
+  labels = g_strdup_printf ("decision=\"%s\"", decision);
+  count (&families[ADMISSIONS], labels, 1);
+}
+
+/**
+ * screenshot_metrics_set_queue_depth:
+ * @depth: how many capture requests are waiting
+ */
+void
+screenshot_metrics_set_queue_depth (guint depth)
+{
+  gdouble *value;
+
+  if (!screenshot_metrics_is_enabled ())
+    return;
+
+  value = g_new (gdouble, 1);
+  *value = depth;
+
+  g_mutex_lock (&metrics_lock);
+  g_hash_table_replace (gauges, make_series (families[QUEUE_DEPTH].name, NULL, NULL, NULL), value);
+  g_mutex_unlock (&metrics_lock);
+}
+
+/**
+ * screenshot_metrics_observe_queue_wait:
+ * @wait_us: how long a capture request was queued, in microseconds
+ */
+void
+screenshot_metrics_observe_queue_wait (gint64 wait_us)
+{
+  if (!screenshot_metrics_is_enabled ())
+    return;
+
+  g_mutex_lock (&metrics_lock);
+  observe (&families[QUEUE_WAIT], NULL, wait_us / (gdouble) G_USEC_PER_SEC);
+  g_mutex_unlock (&metrics_lock);
+}
+
+/**
+ * screenshot_metrics_count_watch_check:
+ * @source: "damage" when the X server reported what changed, "tiles" when
+ *   frames were compared
+ * @changed: whether enough had changed to take a screenshot
+ */
+void
+screenshot_metrics_count_watch_check (const gchar *source,
+                                      gboolean     changed)
+{
+  g_autofree gchar *labels = NULL;
+
+  if (!screenshot_metrics_is_enabled ())
+    return;
+
+  labels = g_strdup_printf ("source=\"%s\",changed=\"%s\"",
+                            source, changed ? "true" : "false");
+  count (&families[WATCH_CHECKS], labels, 1);
+}
+
+/**
+ * screenshot_metrics_count_watch_save:
+ * @storage: "full", "delta" or "link"
+ */
+void
+screenshot_metrics_count_watch_save (const gchar *storage)
+{
+  g_autofree gchar *labels = NULL;
+
+  if (!screenshot_metrics_is_enabled ())
+    return;
+
+  labels = g_strdup_printf ("storage=\"%s\"", storage);
+  count (&families[WATCH_SAVES], labels, 1);
+}
+
+/**
+ * screenshot_metrics_error_reason:
+ * @error: (nullable): why something failed
+ *
+ * Returns: a label value for @error from a small set, such as "exists",
+ *   "permission-denied" or "no-space" for I/O errors and "encode" for
+ *   errors from gdk-pixbuf
+ */
+const gchar *
+screenshot_metrics_error_reason (const GError *error)
+{
+  if (error == NULL)
+    return "unknown";
+
+  if (error->domain == G_IO_ERROR)
+    {
+      GEnumClass *klass = g_type_class_ref (G_TYPE_IO_ERROR_ENUM);
+      GEnumValue *value = g_enum_get_value (klass, error->code);
+      const gchar *nick = value != NULL ? value->value_nick : "io";
+
+      /* the class is static, the nick stays valid */
+      g_type_class_unref (klass);
+
+      return nick;
+    }
+
+  if (error->domain == GDK_PIXBUF_ERROR)
+    return "encode";
+
+  return "other";
+}
+
+/* Reads back the series of a file written by screenshot_metrics_flush(),
+ * leaving out those that are computed each time */
+static void
+load_series (GHashTable *series)
+{
+  g_autofree gchar *contents = NULL;
+  g_auto(GStrv) lines = NULL;
+  guint i;
+
+  if (!g_file_get_contents (metrics_path, &contents, NULL, NULL))
+    return;
+
+  lines = g_strsplit (contents, "\n", -1);
+
+  for (i = 0; lines[i] != NULL; i++)
+    {
+      gchar *space = strrchr (lines[i], ' ');
+      gchar *end;
+      gdouble value;
+
+      if (lines[i][0] == '#' || space == NULL)
+        continue;
+
+      if (g_str_has_prefix (lines[i], families[STAGE_QUANTILES].name) ||
+          g_str_has_prefix (lines[i], families[QUEUE_DEPTH].name) ||
+          g_str_has_prefix (lines[i], families[LAST_UPDATE].name))
+        continue;
+
+      value = g_ascii_strtod (space + 1, &end);
+      if (end == space + 1 || *end != '\0')
+        continue;
+
+      add_to_series (series, g_strndup (lines[i], space - lines[i]), value);
+    }
+}
+
+static gdouble
+lookup_series (GHashTable  *series,
+               const gchar *name,
+               const gchar *suffix,
+               const gchar *labels,
+               const gchar *le)
+{
+  g_autofree gchar *key = make_series (name, suffix, labels, le);
+  gdouble *value = g_hash_table_lookup (series, key);
+
+  return value != NULL ? *value : 0;
+}
+
+static gint
+compare_strings (gconstpointer a,
+                 gconstpointer b)
+{
+  return g_strcmp0 (*(const gchar **) a, *(const gchar **) b);
+}
+
+/* The sorted label sets of the series of @name, "" for none */
+static GPtrArray *
+collect_labels (GHashTable  *series,
+                const gchar *name)
+{
+  GPtrArray *labels = g_ptr_array_new_with_free_func (g_free);
+  gsize name_len = strlen (name);
+  GHashTableIter iter;
+  const gchar *key;
+
+  g_hash_table_iter_init (&iter, series);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &key, NULL))
+    {
+      if (strncmp (key, name, name_len) != 0)
+        continue;
+
+      if (key[name_len] == '\0')
+        g_ptr_array_add (labels, g_strdup (""));
+      else if (key[name_len] == '{')
+        g_ptr_array_add (labels, g_strndup (key + name_len + 1,
+                                            strlen (key + name_len + 1) - 1));
+    }
+
+  g_ptr_array_sort (labels, compare_strings);
+
+  return labels;
+}
+
+static void
+append_sample (GString     *out,
+               const gchar *name,
+               const gchar *suffix,
+               const gchar *labels,
+               const gchar *le,
+               gdouble      value)
+{
+  g_autofree gchar *key = make_series (name, suffix, labels, le);
+  gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+  g_string_append_printf (out, "%s %s\n", key, format_value (buf, value));
+}
+
+/* Where @q of the observations fall, interpolating inside the bucket as
+ * Prometheus does; the largest bound if it is past it */
+static gdouble
+estimate_quantile (const MetricFamily *family,
+                   GHashTable         *series,
+                   const gchar        *labels,
+                   gdouble             q)
+{
+  gdouble total = lookup_series (series, family->name, "_count", labels, NULL);
+  gdouble rank = q * total;
+  gdouble prev_bound = 0, prev_count = 0;
+  guint i;
+
+  for (i = 0; i < family->n_bounds; i++)
+    {
+      gchar le[G_ASCII_DTOSTR_BUF_SIZE];
+      gdouble n = lookup_series (series, family->name, "_bucket", labels,
+                                 format_value (le, family->bounds[i]));
+
+      if (n >= rank)
+        {
+          if (n == prev_count)
+            return family->bounds[i];
+
+          return prev_bound + (family->bounds[i] - prev_bound) *
+            (rank - prev_count) / (n - prev_count);
+        }
+
+      prev_bound = family->bounds[i];
+      prev_count = n;
+    }
+
+  return family->bounds[family->n_bounds - 1];
+}
+
+static void
+append_family (GString            *out,
+               const MetricFamily *family,
+               GHashTable         *series)
+{
+  static const gchar *types[] = {
+    [FAMILY_COUNTER] = "counter",
+    [FAMILY_HISTOGRAM] = "histogram",
+    [FAMILY_QUANTILES] = "gauge",
+    [FAMILY_GAUGE] = "gauge",
+    [FAMILY_TIMESTAMP] = "gauge",
+  };
+  g_autoptr(GPtrArray) labels = NULL;
+  g_autofree gchar *count_name = NULL;
+  gchar le[G_ASCII_DTOSTR_BUF_SIZE];
+  guint i, j;
+
+  g_string_append_printf (out, "# HELP %s %s\n", family->name, family->help);
+  g_string_append_printf (out, "# TYPE %s %s\n", family->name, types[family->kind]);
+
+  switch (family->kind)
+    {
+    case FAMILY_COUNTER:
+    case FAMILY_GAUGE:
+      labels = collect_labels (series, family->name);
+      for (i = 0; i < labels->len; i++)
+        append_sample (out, family->name, NULL, labels->pdata[i], NULL,
+                       lookup_series (series, family->name, NULL, labels->pdata[i], NULL));
+      break;
+
+    case FAMILY_HISTOGRAM:
+      count_name = g_strconcat (family->name, "_count", NULL);
+      labels = collect_labels (series, count_name);
+      for (i = 0; i < labels->len; i++)
+        {
+          const gchar *l = labels->pdata[i];
+
+          for (j = 0; j < family->n_bounds; j++)
+            {
+              format_value (le, family->bounds[j]);
+              append_sample (out, family->name, "_bucket", l, le,
+                             lookup_series (series, family->name, "_bucket", l, le));
+            }
+          append_sample (out, family->name, "_bucket", l, "+Inf",
+                         lookup_series (series, family->name, "_bucket", l, "+Inf"));
+          append_sample (out, family->name, "_sum", l, NULL,
+                         lookup_series (series, family->name, "_sum", l, NULL));
+          append_sample (out, family->name, "_count", l, NULL,
+                         lookup_series (series, family->name, "_count", l, NULL));
+        }
+      break;
+
+    case FAMILY_QUANTILES:
+      count_name = g_strconcat (families[STAGE_DURATION].name, "_count", NULL);
+      labels = collect_labels (series, count_name);
+      for (i = 0; i < labels->len; i++)
+        for (j = 0; j < G_N_ELEMENTS (quantiles); j++)
+          {
+            g_autofree gchar *l = NULL;
+
+            l = g_strdup_printf ("%s,quantile=\"%s\"", (gchar *) labels->pdata[i],
+                                 format_value (le, quantiles[j]));
+            append_sample (out, family->name, NULL, l, NULL,
+                           estimate_quantile (&families[STAGE_DURATION], series,
+                                              labels->pdata[i], quantiles[j]));
+          }
+      break;
+
+    case FAMILY_TIMESTAMP:
+      append_sample (out, family->name, NULL, NULL, NULL,
+                     g_get_real_time () / G_USEC_PER_SEC);
+      break;
+    }
+}
+
+/**
+ * screenshot_metrics_flush:
+ *
+ * Adds what was counted since the last call to the totals in the
+ * metrics file.
+ */
+void
+screenshot_metrics_flush (void)
+{
+  g_autoptr(GHashTable) series = NULL;
+  g_autoptr(GString) out = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree gchar *lock_path = NULL;
+  GHashTableIter iter;
+  gchar *key;
+  gdouble *value;
+  gint lock_fd;
+  guint i;
+
+  if (!screenshot_metrics_is_enabled ())
+    return;
+
+  /* from reading the totals to replacing them, or another process
+   * would lose what this one adds, or the other way around */
+  lock_path = g_strconcat (metrics_path, ".lock", NULL);
+  lock_fd = open (lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (lock_fd < 0)
+    g_warning ("Unable to open %s, writing the metrics without a lock: %s",
+               lock_path, g_strerror (errno));
+  else if (flock (lock_fd, LOCK_EX) != 0)
+    g_warning ("Unable to lock %s: %s", lock_path, g_strerror (errno));
+
+  series = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  load_series (series);
+
+  g_mutex_lock (&metrics_lock);
+  g_hash_table_iter_init (&iter, pending);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &key, (gpointer *) &value))
+    {
+      add_to_series (series, g_strdup (key), *value);
+      g_hash_table_iter_remove (&iter);
+    }
+  g_hash_table_iter_init (&iter, gauges);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &key, (gpointer *) &value))
+    add_to_series (series, g_strdup (key), *value);
+  g_mutex_unlock (&metrics_lock);
+
+  out = g_string_new (NULL);
+  for (i = 0; i < G_N_ELEMENTS (families); i++)
+    append_family (out, &families[i], series);
+
+  /* the collector must never see a half written file */
+  if (!g_file_set_contents (metrics_path, out->str, out->len, &error))
+    g_warning ("Unable to write the metrics to %s: %s", metrics_path, error->message);
+
+  /* which also releases the lock */
+  if (lock_fd >= 0)
+    close (lock_fd);
+}
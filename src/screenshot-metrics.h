@@ -0,0 +1,50 @@
+/* screenshot-metrics.h - counters for fleet monitoring
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+#ifndef __SCREENSHOT_METRICS_H__
+#define __SCREENSHOT_METRICS_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+void         screenshot_metrics_init               (const gchar  *path);
+gboolean     screenshot_metrics_is_enabled         (void);
+
+void         screenshot_metrics_observe_stage      (const gchar  *stage,
+                                                    gint64        duration_us,
+                                                    gboolean      has_bytes,
+                                                    guint64       bytes);
+void         screenshot_metrics_count_capture      (const gchar  *mode,
+                                                    const gchar  *outcome);
+void         screenshot_metrics_count_backend      (const gchar  *backend,
+                                                    gboolean      fallback);
+void         screenshot_metrics_count_failure      (const gchar  *stage,
+                                                    const gchar  *reason);
+void         screenshot_metrics_count_admission    (const gchar  *decision);
+void         screenshot_metrics_set_queue_depth    (guint         depth);
+void         screenshot_metrics_observe_queue_wait (gint64        wait_us);
+void         screenshot_metrics_count_watch_check  (const gchar  *source,
+                                                    gboolean      changed);
+void         screenshot_metrics_count_watch_save   (const gchar  *storage);
+const gchar *screenshot_metrics_error_reason       (const GError *error);
+
+void         screenshot_metrics_flush              (void);
+
+G_END_DECLS
+
+#endif /* __SCREENSHOT_METRICS_H__ */
@@ -0,0 +1,206 @@
+/* screenshot-mipmap.c - downscaled copies of a screenshot
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+/* A mipmap is the screenshot itself (level 0) followed by copies that are
+ * each half the size of the previous one, down to a minimum size.  Anything
+ * that has to show the screenshot smaller than it is picks the level that
+ * is just larger than needed and lets cairo do the rest, instead of
+ * rescaling the full frame every time.
+ *
+ * Averaging does the same to every channel, so the levels built for
+ * drawing are made from the native pixels of the capture and can be
+ * handed to cairo as they are.
+ */
+
+#include "config.h"
+
+#include "screenshot-mipmap.h"
+#include "screenshot-resample.h"
+
+struct _ScreenshotMipmap
+{
+  gint ref_count;
+  GPtrArray *levels;
+};
+
+/* Area-averages @src down to half its size. */
+static GdkPixbuf *
+halve_pixbuf (GdkPixbuf *src)
+{
+  return screenshot_resample (src,
+                              MAX (gdk_pixbuf_get_width (src) / 2, 1),
+                              MAX (gdk_pixbuf_get_height (src) / 2, 1),
+                              SCREENSHOT_RESAMPLE_BOX, 0);
+}
+
+/**
+ * screenshot_mipmap_new:
+ * @source: the full size image
+ * @min_size: stop once both dimensions of a level are at most this big
+ *
+ * Builds the whole pyramid synchronously; on big captures this takes a
+ * while, so user interface code should use screenshot_mipmap_new_async().
+ */
+ScreenshotMipmap *
+screenshot_mipmap_new (GdkPixbuf *source,
+                       gint       min_size)
+{
+  ScreenshotMipmap *mipmap;
+  GdkPixbuf *level;
+
+  g_return_val_if_fail (GDK_IS_PIXBUF (source), NULL);
+  g_return_val_if_fail (gdk_pixbuf_get_bits_per_sample (source) == 8, NULL);
+
+  mipmap = g_slice_new0 (ScreenshotMipmap);
+  mipmap->ref_count = 1;
+  mipmap->levels = g_ptr_array_new_with_free_func (g_object_unref);
+
+  level = g_object_ref (source);
+  g_ptr_array_add (mipmap->levels, level);
+
+  while (gdk_pixbuf_get_width (level) > min_size ||
+         gdk_pixbuf_get_height (level) > min_size)
+    {
+      if (gdk_pixbuf_get_width (level) == 1 &&
+          gdk_pixbuf_get_height (level) == 1)
+        break;
+
+      level = halve_pixbuf (level);
+      g_ptr_array_add (mipmap->levels, level);
+    }
+
+  return mipmap;
+}
+
+typedef struct {
+  ScreenshotImage *source;
+  gint min_size;
+} MipmapJob;
+
+static void
+mipmap_job_free (MipmapJob *job)
+{
+  screenshot_image_unref (job->source);
+  g_slice_free (MipmapJob, job);
+}
+
+static void
+build_mipmap_thread (GTask        *task,
+                     gpointer      source_object,
+                     gpointer      data,
+                     GCancellable *cancellable)
+{
+  MipmapJob *job = data;
+  g_autoptr(GdkPixbuf) native = NULL;
+  ScreenshotMipmap *mipmap;
+
+  /* converts the image here, if it was not captured natively */
+  native = screenshot_image_get_native_pixbuf (job->source);
+  mipmap = screenshot_mipmap_new (native, job->min_size);
+
+  if (g_task_return_error_if_cancelled (task))
+    {
+      screenshot_mipmap_unref (mipmap);
+      return;
+    }
+
+  g_task_return_pointer (task, mipmap, (GDestroyNotify) screenshot_mipmap_unref);
+}
+
+/**
+ * screenshot_mipmap_new_async:
+ *
+ * Builds the pyramid of the native pixels of @source in a worker thread;
+ * the levels are turned into surfaces with
+ * screenshot_native_pixbuf_create_surface().  @source is only read, so it
+ * can keep being drawn from the main thread in the meantime.
+ */
+void
+screenshot_mipmap_new_async (ScreenshotImage     *source,
+                             gint                 min_size,
+                             GCancellable        *cancellable,
+                             GAsyncReadyCallback  callback,
+                             gpointer             user_data)
+{
+  g_autoptr(GTask) task = NULL;
+  MipmapJob *job;
+
+  job = g_slice_new0 (MipmapJob);
+  job->source = screenshot_image_ref (source);
+  job->min_size = min_size;
+
+  task = g_task_new (NULL, cancellable, callback, user_data);
+  g_task_set_task_data (task, job, (GDestroyNotify) mipmap_job_free);
+
+  g_task_run_in_thread (task, build_mipmap_thread);
+}
+
+ScreenshotMipmap *
+screenshot_mipmap_new_finish (GAsyncResult  *result,
+                              GError       **error)
+{
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+ScreenshotMipmap *
+screenshot_mipmap_ref (ScreenshotMipmap *mipmap)
+{
+  g_atomic_int_inc (&mipmap->ref_count);
+  return mipmap;
+}
+
+void
+screenshot_mipmap_unref (ScreenshotMipmap *mipmap)
+{
+  if (!g_atomic_int_dec_and_test (&mipmap->ref_count))
+    return;
+
+  g_ptr_array_unref (mipmap->levels);
+  g_slice_free (ScreenshotMipmap, mipmap);
+}
+
+guint
+screenshot_mipmap_get_n_levels (ScreenshotMipmap *mipmap)
+{
+  return mipmap->levels->len;
+}
+
+/* Level @level is (about) 1 / 2^@level the size of the source. */
+GdkPixbuf *
+screenshot_mipmap_get_level (ScreenshotMipmap *mipmap,
+                             guint             level)
+{
+  g_return_val_if_fail (level < mipmap->levels->len, NULL);
+
+  return g_ptr_array_index (mipmap->levels, level);
+}
+
+/* Returns the smallest level that still has at least @scale times the
+ * resolution of the source, so that drawing it never magnifies.
+ */
+guint
+screenshot_mipmap_find_level (ScreenshotMipmap *mipmap,
+                              gdouble           scale)
+{
+  guint level = 0;
+
+  while (level + 1 < mipmap->levels->len &&
+         scale <= 1.0 / (gdouble) (1 << (level + 1)))
+    level++;
+
+  return level;
+}
@@ -0,0 +1,53 @@
+/* screenshot-mipmap.h - downscaled copies of a screenshot
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+#ifndef __SCREENSHOT_MIPMAP_H__
+#define __SCREENSHOT_MIPMAP_H__
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <gio/gio.h>
+
+#include "screenshot-image.h"
+
+G_BEGIN_DECLS
+
+typedef struct _ScreenshotMipmap ScreenshotMipmap;
+
+ScreenshotMipmap *screenshot_mipmap_new             (GdkPixbuf           *source,
+                                                     gint                 min_size);
+void              screenshot_mipmap_new_async       (ScreenshotImage     *source,
+                                                     gint                 min_size,
+                                                     GCancellable        *cancellable,
+                                                     GAsyncReadyCallback  callback,
+                                                     gpointer             user_data);
+ScreenshotMipmap *screenshot_mipmap_new_finish      (GAsyncResult        *result,
+                                                     GError             **error);
+
+ScreenshotMipmap *screenshot_mipmap_ref             (ScreenshotMipmap    *mipmap);
+void              screenshot_mipmap_unref           (ScreenshotMipmap    *mipmap);
+
+guint             screenshot_mipmap_get_n_levels    (ScreenshotMipmap    *mipmap);
+GdkPixbuf        *screenshot_mipmap_get_level       (ScreenshotMipmap    *mipmap,
+                                                     guint                level);
+guint             screenshot_mipmap_find_level      (ScreenshotMipmap    *mipmap,
+                                                     gdouble              scale);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (ScreenshotMipmap, screenshot_mipmap_unref)
+
+G_END_DECLS
+
+#endif /* __SCREENSHOT_MIPMAP_H__ */
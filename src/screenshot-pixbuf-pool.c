@@ -0,0 +1,313 @@
+/* screenshot-pixbuf-pool.c - recycled pixel buffers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+/* Every capture goes through several frame sized buffers (the XShape
+ * copy, the effect, scaled copies) that only live for a moment.  Instead
+ * of handing them back to malloc, which for sizes like these means
+ * unmapping them and faulting fresh pages in on the next capture, they
+ * are kept here and handed out again.
+ *
+ * Sizes are rounded up to one of four classes per power of two, so a
+ * buffer is at most 25% larger than asked for and buffers for frames of
+ * about the same size are interchangeable.  Each buffer is preceded by a
+ * 64 byte header, which keeps the pixels 64 byte aligned for the SIMD
+ * code.  Cached memory is bounded, and dropped once the pool has not been
+ * used for a while.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include "screenshot-pixbuf-pool.h"
+
+#define POOL_ALIGNMENT 64
+
+/* Smaller requests share the first class */
+#define POOL_MIN_SHIFT 12
+#define POOL_MIN_SIZE (1 << POOL_MIN_SHIFT)
+
+/* Larger ones are not pooled at all */
+#define POOL_MAX_SHIFT 31
+#define POOL_N_CLASSES ((POOL_MAX_SHIFT - POOL_MIN_SHIFT) * 4 + 1)
+#define POOL_NO_CLASS G_MAXUINT
+
+/* Enough for a few 4K frames and their intermediates */
+#define POOL_MAX_CACHED_BYTES (256 * 1024 * 1024)
+
+/* Seconds without any allocation before the cache is dropped */
+#define POOL_IDLE_TRIM_TIMEOUT 30
+
+#define POOL_MAGIC 0x5350424c
+
+typedef struct _PoolHeader PoolHeader;
+
+struct _PoolHeader
+{
+  guint32 magic;
+  guint klass;
+  gsize size;
+  PoolHeader *next;
+};
+
+G_STATIC_ASSERT (sizeof (PoolHeader) <= POOL_ALIGNMENT);
+
+static GMutex pool_lock;
+static PoolHeader *free_lists[POOL_N_CLASSES];
+static ScreenshotPixbufPoolStats pool_stats;
+static gint64 last_used;
+static guint trim_source_id;
+
+/* Returns the class for @size, and the size of the buffers in it */
+static guint
+size_to_class (gsize  size,
+               gsize *class_size)
+{
+  guint shift;
+  gsize step;
+
+  if (size <= POOL_MIN_SIZE)
+    {
+      *class_size = POOL_MIN_SIZE;
+      return 0;
+    }
+
+  /* size is in (2^shift, 2^(shift + 1)] */
+  shift = g_bit_storage (size - 1) - 1;
+  if (shift >= POOL_MAX_SHIFT)
+    {
+      *class_size = size;
+      return POOL_NO_CLASS;
+    }
+
+  step = (gsize) 1 << (shift - 2);
+  *class_size = (size + step - 1) & ~(step - 1);
+
+  /* *class_size / step is 5, 6, 7 or 8 */
+  return (shift - POOL_MIN_SHIFT) * 4 + (guint) (*class_size / step) - 4;
+}
+
+static void
+free_buffer (PoolHeader *header)
+{
+  header->magic = 0;
+  free (header);
+}
+
+static void
+trim_locked (void)
+{
+  guint i;
+
+  for (i = 0; i < POOL_N_CLASSES; i++)
+    {
+      while (free_lists[i] != NULL)
+        {
+          PoolHeader *header = free_lists[i];
+
+          free_lists[i] = header->next;
+          free_buffer (header);
+        }
+    }
+
+  pool_stats.cached_bytes = 0;
+}
+
+static gboolean
+idle_trim_timeout (gpointer data)
+{
+  gboolean idle;
+
+  g_mutex_lock (&pool_lock);
+
+  idle = g_get_monotonic_time () - last_used >= POOL_IDLE_TRIM_TIMEOUT * G_USEC_PER_SEC;
+  if (idle)
+    {
+      trim_locked ();
+      trim_source_id = 0;
+    }
+
+  g_mutex_unlock (&pool_lock);
+
+  return idle ? G_SOURCE_REMOVE : G_SOURCE_CONTINUE;
+}
+
+/**
+ * screenshot_pixbuf_pool_alloc:
+ * @size: the number of bytes needed
+ *
+ * Returns a 64 byte aligned buffer of at least @size bytes, with
+ * undefined contents, or %NULL if memory is exhausted.  It must be given
+ * back with screenshot_pixbuf_pool_release().  This can be called from
+ * any thread.
+ */
+gpointer
+screenshot_pixbuf_pool_alloc (gsize size)
+{
+  PoolHeader *header = NULL;
+  gsize class_size;
+  guint klass;
+  gpointer base;
+
+  klass = size_to_class (size, &class_size);
+
+  g_mutex_lock (&pool_lock);
+
+  last_used = g_get_monotonic_time ();
+
+  if (klass != POOL_NO_CLASS && free_lists[klass] != NULL)
+    {
+      header = free_lists[klass];
+      free_lists[klass] = header->next;
+      pool_stats.cached_bytes -= header->size;
+      pool_stats.hits++;
+    }
+  else
+    {
+      pool_stats.misses++;
+    }
+
+  g_mutex_unlock (&pool_lock);
+
+  if (header == NULL)
+    {
+      if (class_size > G_MAXSIZE - POOL_ALIGNMENT ||
+          posix_memalign (&base, POOL_ALIGNMENT, class_size + POOL_ALIGNMENT) != 0)
+        return NULL;
+
+      header = base;
+      header->magic = POOL_MAGIC;
+      header->klass = klass;
+      header->size = class_size;
+    }
+
+  header->next = NULL;
+
+  return (guchar *) header + POOL_ALIGNMENT;
+}
+
+/**
+ * screenshot_pixbuf_pool_release:
+ * @data: a buffer from screenshot_pixbuf_pool_alloc()
+ *
+ * Gives the buffer back to the pool.
+ */
+void
+screenshot_pixbuf_pool_release (gpointer data)
+{
+  PoolHeader *header;
+
+  if (data == NULL)
+    return;
+
+  header = (PoolHeader *) ((guchar *) data - POOL_ALIGNMENT);
+  g_return_if_fail (header->magic == POOL_MAGIC);
+
+  if (header->klass == POOL_NO_CLASS)
+    {
+      free_buffer (header);
+      return;
+    }
+
+  g_mutex_lock (&pool_lock);
+
+  if (pool_stats.cached_bytes + header->size > POOL_MAX_CACHED_BYTES)
+    {
+      pool_stats.discarded++;
+      g_mutex_unlock (&pool_lock);
+
+      free_buffer (header);
+      return;
+    }
+
+  header->next = free_lists[header->klass];
+  free_lists[header->klass] = header;
+  pool_stats.cached_bytes += header->size;
+  pool_stats.recycled++;
+
+  if (trim_source_id == 0)
+    trim_source_id = g_timeout_add_seconds (POOL_IDLE_TRIM_TIMEOUT,
+                                            idle_trim_timeout, NULL);
+
+  g_mutex_unlock (&pool_lock);
+}
+
+static void
+pool_pixbuf_destroy_notify (guchar   *pixels,
+                            gpointer  data)
+{
+  screenshot_pixbuf_pool_release (pixels);
+}
+
+/**
+ * screenshot_pixbuf_pool_new_pixbuf:
+ *
+ * Like gdk_pixbuf_new() for 8 bit RGB(A), with the pixels coming from the
+ * pool; they go back to it when the pixbuf is finalized.  The contents
+ * are undefined.
+ *
+ * Returns: (transfer full) (nullable): a new pixbuf
+ */
+GdkPixbuf *
+screenshot_pixbuf_pool_new_pixbuf (gboolean has_alpha,
+                                   gint     width,
+                                   gint     height)
+{
+  guchar *pixels;
+  gint rowstride;
+
+  g_return_val_if_fail (width > 0 && height > 0, NULL);
+
+  /* same as gdk_pixbuf_new() */
+  if (width > (G_MAXINT - 3) / (has_alpha ? 4 : 3))
+    return NULL;
+
+  rowstride = ((has_alpha ? 4 : 3) * width + 3) & ~3;
+
+  pixels = screenshot_pixbuf_pool_alloc ((gsize) rowstride * height);
+  if (pixels == NULL)
+    return NULL;
+
+  return gdk_pixbuf_new_from_data (pixels, GDK_COLORSPACE_RGB, has_alpha, 8,
+                                   width, height, rowstride,
+                                   pool_pixbuf_destroy_notify, NULL);
+}
+
+void
+screenshot_pixbuf_pool_get_stats (ScreenshotPixbufPoolStats *stats)
+{
+  g_mutex_lock (&pool_lock);
+  *stats = pool_stats;
+  g_mutex_unlock (&pool_lock);
+}
+
+/* Frees every cached buffer; those in use are not affected. */
+void
+screenshot_pixbuf_pool_trim (void)
+{
+  g_mutex_lock (&pool_lock);
+
+  trim_locked ();
+
+  if (trim_source_id != 0)
+    {
+      g_source_remove (trim_source_id);
+      trim_source_id = 0;
+    }
+
+  g_mutex_unlock (&pool_lock);
+}
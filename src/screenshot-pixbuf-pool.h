@@ -0,0 +1,45 @@
+/* screenshot-pixbuf-pool.h - recycled pixel buffers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+#ifndef __SCREENSHOT_PIXBUF_POOL_H__
+#define __SCREENSHOT_PIXBUF_POOL_H__
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+G_BEGIN_DECLS
+
+typedef struct {
+  guint64 hits;         /* requests served from a cached buffer */
+  guint64 misses;       /* requests that had to allocate */
+  guint64 recycled;     /* buffers kept for reuse when released */
+  guint64 discarded;    /* buffers freed on release because the pool was full */
+  gsize   cached_bytes; /* memory currently held for reuse */
+} ScreenshotPixbufPoolStats;
+
+GdkPixbuf *screenshot_pixbuf_pool_new_pixbuf  (gboolean                   has_alpha,
+                                               gint                       width,
+                                               gint                       height);
+
+gpointer   screenshot_pixbuf_pool_alloc       (gsize                      size);
+void       screenshot_pixbuf_pool_release     (gpointer                   data);
+
+void       screenshot_pixbuf_pool_get_stats   (ScreenshotPixbufPoolStats *stats);
+void       screenshot_pixbuf_pool_trim        (void);
+
+G_END_DECLS
+
+#endif /* __SCREENSHOT_PIXBUF_POOL_H__ */
@@ -0,0 +1,325 @@
+/* screenshot-png8.c - indexed PNG files for captures with few colours
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+/* Terminals, dialogs and most of the UI use only a handful of colours,
+ * yet gdk-pixbuf always writes 24 or 32 bit PNG files.  When a capture has
+ * at most 256 distinct colours it is written here as an indexed PNG
+ * instead, which is exact: every pixel keeps its colour and alpha.  Such
+ * files are a fraction of the size, and faster to write since zlib sees
+ * one byte per pixel, or less with very few colours.
+ *
+ * The colours are counted and the index plane built in the same pass,
+ * with a small open addressing table and a shortcut for runs of the same
+ * colour, which is most of a screenshot.  The pass stops at the 257th
+ * colour, so captures that do not qualify cost little more than a glance.
+ */
+
+#include "config.h"
+
+#include <setjmp.h>
+#include <string.h>
+
+#include <glib/gi18n.h>
+#include <gio/gio.h>
+#include <png.h>
+
+#include "screenshot-png8.h"
+
+/* Open addressing, a quarter full at most */
+#define TABLE_BITS 10
+#define TABLE_SIZE (1 << TABLE_BITS)
+
+typedef struct {
+  guint32 keys[TABLE_SIZE];
+  gint16 indices[TABLE_SIZE];
+} ColorTable;
+
+typedef struct {
+  GdkPixbufSaveFunc save_func;
+  gpointer user_data;
+  GError *error;
+} Png8Writer;
+
+static inline guint32
+read_color (const guchar *p,
+            gint          n_channels)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) |
+         ((guint32) (n_channels == 4 ? p[3] : 0xff) << 24);
+}
+
+/* Returns the index of @color, adding it to the palette if there is still
+ * room, or -1 if there is not */
+static gint
+lookup_color (ColorTable *table,
+              guint32     color,
+              guint32    *palette,
+              guint      *n_colors)
+{
+  guint i = (color * 2654435761u) >> (32 - TABLE_BITS);
+
+  while (table->indices[i] >= 0)
+    {
+      if (table->keys[i] == color)
+        return table->indices[i];
+
+      i = (i + 1) & (TABLE_SIZE - 1);
+    }
+
+  if (*n_colors == SCREENSHOT_PNG8_MAX_COLORS)
+    return -1;
+
+  table->keys[i] = color;
+  table->indices[i] = *n_colors;
+  palette[*n_colors] = color;
+
+  return (*n_colors)++;
+}
+
+/**
+ * screenshot_png8_index:
+ * @pixbuf: an image
+ * @palette: (out caller-allocates): room for %SCREENSHOT_PNG8_MAX_COLORS
+ *   colours, as 0xAABBGGRR
+ * @n_colors: (out): the colours used
+ *
+ * Counts the colours of @pixbuf, giving up past
+ * %SCREENSHOT_PNG8_MAX_COLORS, and maps every pixel to its colour.
+ *
+ * Returns: (transfer full) (nullable): one palette index per pixel, row
+ *   after row, or %NULL if @pixbuf has too many colours
+ */
+guchar *
+screenshot_png8_index (GdkPixbuf *pixbuf,
+                       guint32   *palette,
+                       guint     *n_colors)
+{
+  const guchar *pixels = gdk_pixbuf_read_pixels (pixbuf);
+  gint rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+  gint n_channels = gdk_pixbuf_get_n_channels (pixbuf);
+  gint width = gdk_pixbuf_get_width (pixbuf);
+  gint height = gdk_pixbuf_get_height (pixbuf);
+  ColorTable *table;
+  guchar *indices, *out;
+  guint32 last_color = 0;
+  gint last_index = -1;
+  gint x, y;
+
+  indices = g_try_malloc ((gsize) width * height);
+  if (indices == NULL)
+    return NULL;
+
+  table = g_new (ColorTable, 1);
+  memset (table->indices, 0xff, sizeof (table->indices));
+  *n_colors = 0;
+
+  out = indices;
+  for (y = 0; y < height; y++)
+    {
+      const guchar *p = pixels + (gsize) y * rowstride;
+
+      for (x = 0; x < width; x++, p += n_channels)
+        {
+          guint32 color = read_color (p, n_channels);
+
+          if (color != last_color || last_index < 0)
+            {
+              last_index = lookup_color (table, color, palette, n_colors);
+              last_color = color;
+
+              if (last_index < 0)
+                {
+                  g_free (table);
+                  g_free (indices);
+                  return NULL;
+                }
+            }
+
+          *out++ = last_index;
+        }
+    }
+
+  g_free (table);
+
+  return indices;
+}
+
+static void
+png8_error_cb (png_structp     png,
+               png_const_charp message)
+{
+  Png8Writer *writer = png_get_error_ptr (png);
+
+  if (writer->error == NULL)
+    g_set_error (&writer->error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_FAILED,
+                 _("Unable to encode the screenshot: %s"), message);
+
+  png_longjmp (png, 1);
+}
+
+static void
+png8_warning_cb (png_structp     png,
+                 png_const_charp message)
+{
+}
+
+static void
+png8_write_cb (png_structp  png,
+               png_bytep    data,
+               png_size_t   length)
+{
+  Png8Writer *writer = png_get_io_ptr (png);
+
+  if (!writer->save_func ((const gchar *) data, length,
+                          &writer->error, writer->user_data))
+    png_error (png, "write failed");
+}
+
+static void
+png8_flush_cb (png_structp png)
+{
+}
+
+static gint
+get_bit_depth (guint n_colors)
+{
+  if (n_colors <= 2)
+    return 1;
+  if (n_colors <= 4)
+    return 2;
+  if (n_colors <= 16)
+    return 4;
+
+  return 8;
+}
+
+/**
+ * screenshot_png8_save_to_callback:
+ * @pixbuf: the image to save
+ * @icc_profile_base64: (nullable): the profile to embed
+ *
+ * Writes @pixbuf as an indexed PNG file, with the same text and profile
+ * as gnome-screenshot puts in the files gdk-pixbuf writes.
+ *
+ * Returns: %TRUE on success; if @pixbuf has more colours than a palette
+ *   can hold, %FALSE with %G_IO_ERROR_NOT_SUPPORTED, before anything was
+ *   written
+ */
+gboolean
+screenshot_png8_save_to_callback (GdkPixbuf          *pixbuf,
+                                  const gchar        *icc_profile_base64,
+                                  GdkPixbufSaveFunc   save_func,
+                                  gpointer            user_data,
+                                  GError            **error)
+{
+  guint32 palette[SCREENSHOT_PNG8_MAX_COLORS];
+  png_color plte[SCREENSHOT_PNG8_MAX_COLORS];
+  png_byte trns[SCREENSHOT_PNG8_MAX_COLORS];
+  g_autofree guchar *indices = NULL;
+  g_autofree guchar *icc_profile = NULL;
+  gsize icc_profile_size = 0;
+  Png8Writer writer = { save_func, user_data, NULL };
+  png_structp png;
+  png_infop info;
+  png_text text;
+  guint n_colors, n_trans = 0, i;
+  gint width, height, y;
+
+  indices = screenshot_png8_index (pixbuf, palette, &n_colors);
+  if (indices == NULL)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                           "Too many colours for a palette");
+      return FALSE;
+    }
+
+  for (i = 0; i < n_colors; i++)
+    {
+      plte[i].red = palette[i] & 0xff;
+      plte[i].green = (palette[i] >> 8) & 0xff;
+      plte[i].blue = (palette[i] >> 16) & 0xff;
+      trns[i] = palette[i] >> 24;
+
+      if (trns[i] != 0xff)
+        n_trans = i + 1;
+    }
+
+  if (icc_profile_base64 != NULL)
+    icc_profile = g_base64_decode (icc_profile_base64, &icc_profile_size);
+
+  width = gdk_pixbuf_get_width (pixbuf);
+  height = gdk_pixbuf_get_height (pixbuf);
+
+  png = png_create_write_struct (PNG_LIBPNG_VER_STRING, &writer,
+                                 png8_error_cb, png8_warning_cb);
+  if (png == NULL)
+    {
+      g_set_error (error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_INSUFFICIENT_MEMORY,
+                   _("Unable to encode the screenshot: %s"), "out of memory");
+      return FALSE;
+    }
+
+  info = png_create_info_struct (png);
+  if (info == NULL)
+    {
+      png_destroy_write_struct (&png, NULL);
+      g_set_error (error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_INSUFFICIENT_MEMORY,
+                   _("Unable to encode the screenshot: %s"), "out of memory");
+      return FALSE;
+    }
+
+  if (setjmp (png_jmpbuf (png)))
+    {
+      png_destroy_write_struct (&png, &info);
+      g_propagate_error (error, writer.error);
+      return FALSE;
+    }
+
+  png_set_write_fn (png, &writer, png8_write_cb, png8_flush_cb);
+
+  png_set_IHDR (png, info, width, height, get_bit_depth (n_colors),
+                PNG_COLOR_TYPE_PALETTE,
+                PNG_INTERLACE_NONE,
+                PNG_COMPRESSION_TYPE_DEFAULT,
+                PNG_FILTER_TYPE_DEFAULT);
+  png_set_PLTE (png, info, plte, n_colors);
+  if (n_trans > 0)
+    png_set_tRNS (png, info, trns, n_trans, NULL);
+
+  if (icc_profile != NULL)
+    png_set_iCCP (png, info, "ICC profile", PNG_COMPRESSION_TYPE_BASE,
+                  icc_profile, icc_profile_size);
+
+  memset (&text, 0, sizeof (text));
+  text.compression = PNG_TEXT_COMPRESSION_NONE;
+  text.key = (png_charp) "Software";
+  text.text = (png_charp) "gnome-screenshot";
+  png_set_text (png, info, &text, 1);
+
+  png_write_info (png, info);
+
+  /* one byte per index in, packed to the bit depth on the way out */
+  png_set_packing (png);
+
+  for (y = 0; y < height; y++)
+    png_write_row (png, indices + (gsize) y * width);
+
+  png_write_end (png, info);
+  png_destroy_write_struct (&png, &info);
+
+  return TRUE;
+}
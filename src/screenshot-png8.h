@@ -0,0 +1,39 @@
+/* screenshot-png8.h - indexed PNG files for captures with few colours
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+#ifndef __SCREENSHOT_PNG8_H__
+#define __SCREENSHOT_PNG8_H__
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+G_BEGIN_DECLS
+
+#define SCREENSHOT_PNG8_MAX_COLORS 256
+
+guchar   *screenshot_png8_index            (GdkPixbuf          *pixbuf,
+                                            guint32            *palette,
+                                            guint              *n_colors);
+
+gboolean  screenshot_png8_save_to_callback (GdkPixbuf          *pixbuf,
+                                            const gchar        *icc_profile_base64,
+                                            GdkPixbufSaveFunc   save_func,
+                                            gpointer            user_data,
+                                            GError            **error);
+
+G_END_DECLS
+
+#endif /* __SCREENSHOT_PNG8_H__ */
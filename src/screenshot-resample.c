@@ -0,0 +1,651 @@
+/* screenshot-resample.c - image scaling for previews and export
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+/* Separable resampling: a horizontal pass into an intermediate buffer
+ * followed by a vertical pass into the destination.  For every output
+ * column (or row) the filter taps are computed once, as 14 bit fixed point
+ * weights, so the inner loops are plain integer multiply-adds.
+ *
+ * The vertical pass does the same thing to every byte of a row, whatever
+ * the pixel format, so it is vectorized with SSE2 and, when the CPU has it,
+ * AVX2.  The horizontal pass is vectorized for RGBA only; packed RGB falls
+ * back to the scalar loop.  Large images are split in bands of rows that
+ * are processed in parallel.
+ */
+
+#include "config.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "screenshot-pixbuf-pool.h"
+#include "screenshot-resample.h"
+
+#if defined(__GNUC__) && defined(__SSE2__)
+#include <immintrin.h>
+#define HAVE_SSE2_KERNELS 1
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_AVX2_KERNELS 1
+#endif
+#endif
+
+#define WEIGHT_BITS 14
+#define WEIGHT_ONE (1 << WEIGHT_BITS)
+#define WEIGHT_ROUND (1 << (WEIGHT_BITS - 1))
+
+#define LANCZOS_SUPPORT 3.0
+
+/* Below this many output pixels threads cost more than they save */
+#define MIN_PIXELS_FOR_THREADS (1024 * 1024)
+#define MIN_ROWS_PER_THREAD 64
+#define MAX_THREADS 8
+
+typedef struct {
+  gint n_out;
+  gint max_taps;
+  gint *start;
+  gint *count;
+  gint16 *weights;
+} ResampleKernel;
+
+static gdouble
+sinc (gdouble x)
+{
+  if (x == 0.0)
+    return 1.0;
+
+  x *= G_PI;
+  return sin (x) / x;
+}
+
+static gdouble
+lanczos (gdouble x)
+{
+  if (x <= -LANCZOS_SUPPORT || x >= LANCZOS_SUPPORT)
+    return 0.0;
+
+  return sinc (x) * sinc (x / LANCZOS_SUPPORT);
+}
+
+static void
+resample_kernel_free (ResampleKernel *kernel)
+{
+  g_free (kernel->start);
+  g_free (kernel->count);
+  g_free (kernel->weights);
+  g_slice_free (ResampleKernel, kernel);
+}
+
+/* Converts the taps of one output sample to fixed point; rounding errors
+ * go to the largest weight so that flat areas stay exactly flat.
+ */
+static void
+store_weights (ResampleKernel *kernel,
+               gint            out,
+               gint            first,
+               const gdouble  *taps,
+               gint            n_taps)
+{
+  gint16 *weights = kernel->weights + out * kernel->max_taps;
+  gdouble total = 0.0;
+  gint sum = 0, largest = 0;
+  gint i;
+
+  for (i = 0; i < n_taps; i++)
+    total += taps[i];
+
+  for (i = 0; i < n_taps; i++)
+    {
+      weights[i] = (gint16) lround (taps[i] / total * WEIGHT_ONE);
+      sum += weights[i];
+
+      if (weights[i] > weights[largest])
+        largest = i;
+    }
+
+  weights[largest] += WEIGHT_ONE - sum;
+
+  kernel->start[out] = first;
+  kernel->count[out] = n_taps;
+}
+
+static ResampleKernel *
+resample_kernel_new (gint                     in_size,
+                     gint                     out_size,
+                     ScreenshotResampleFilter filter)
+{
+  ResampleKernel *kernel;
+  g_autofree gdouble *taps = NULL;
+  gdouble scale, filter_scale, support;
+  gint out;
+
+  scale = (gdouble) in_size / out_size;
+  filter_scale = MAX (scale, 1.0);
+
+  if (filter == SCREENSHOT_RESAMPLE_BOX)
+    support = MAX (scale, 1.0) / 2.0;
+  else
+    support = LANCZOS_SUPPORT * filter_scale;
+
+  kernel = g_slice_new0 (ResampleKernel);
+  kernel->n_out = out_size;
+  kernel->max_taps = (gint) ceil (support) * 2 + 2;
+  kernel->start = g_new (gint, out_size);
+  kernel->count = g_new (gint, out_size);
+  kernel->weights = g_new0 (gint16, out_size * kernel->max_taps);
+
+  taps = g_new (gdouble, kernel->max_taps);
+
+  for (out = 0; out < out_size; out++)
+    {
+      gint first, last, i;
+
+      if (filter == SCREENSHOT_RESAMPLE_BOX)
+        {
+          /* each input pixel weighs as much as it overlaps the output one */
+          gdouble lo = out * scale, hi = (out + 1) * scale;
+
+          first = MAX ((gint) floor (lo), 0);
+          last = MIN ((gint) ceil (hi), in_size);
+
+          for (i = first; i < last; i++)
+            taps[i - first] = MIN (i + 1.0, hi) - MAX ((gdouble) i, lo);
+        }
+      else
+        {
+          gdouble center = (out + 0.5) * scale;
+
+          first = MAX ((gint) floor (center - support + 0.5), 0);
+          last = MIN ((gint) floor (center + support + 0.5), in_size);
+
+          for (i = first; i < last; i++)
+            taps[i - first] = lanczos ((i - center + 0.5) / filter_scale);
+        }
+
+      /* drop the taps that do not contribute */
+      while (last - first > 1 && taps[0] == 0.0)
+        {
+          memmove (taps, taps + 1, (last - first - 1) * sizeof (gdouble));
+          first++;
+        }
+      while (last - first > 1 && taps[last - first - 1] == 0.0)
+        last--;
+
+      store_weights (kernel, out, first, taps, MIN (last - first, kernel->max_taps));
+    }
+
+  return kernel;
+}
+
+static inline guchar
+clamp_pixel (gint32 value)
+{
+  return value < 0 ? 0 : value > 255 ? 255 : (guchar) value;
+}
+
+/* Horizontal pass */
+
+static void
+horizontal_row_scalar (const guchar         *src,
+                       guchar               *dest,
+                       gint                  n_channels,
+                       const ResampleKernel *kernel)
+{
+  gint x, c, j;
+
+  for (x = 0; x < kernel->n_out; x++)
+    {
+      const gint16 *weights = kernel->weights + x * kernel->max_taps;
+      const guchar *s = src + kernel->start[x] * n_channels;
+      gint count = kernel->count[x];
+
+      for (c = 0; c < n_channels; c++)
+        {
+          gint32 acc = WEIGHT_ROUND;
+
+          for (j = 0; j < count; j++)
+            acc += s[j * n_channels + c] * weights[j];
+
+          *dest++ = clamp_pixel (acc >> WEIGHT_BITS);
+        }
+    }
+}
+
+#ifdef HAVE_SSE2_KERNELS
+static inline __m128i
+load_rgba (const guchar *p)
+{
+  guint32 v;
+
+  memcpy (&v, p, sizeof (v));
+  return _mm_unpacklo_epi8 (_mm_cvtsi32_si128 ((gint) v), _mm_setzero_si128 ());
+}
+
+/* Two taps at a time: the channels of both pixels are interleaved as 16 bit
+ * pairs, so a single madd gives r0*w0 + r1*w1 and so on for all four.
+ */
+static void
+horizontal_row_rgba_sse2 (const guchar         *src,
+                          guchar               *dest,
+                          const ResampleKernel *kernel)
+{
+  gint x, j;
+
+  for (x = 0; x < kernel->n_out; x++)
+    {
+      const gint16 *weights = kernel->weights + x * kernel->max_taps;
+      const guchar *s = src + kernel->start[x] * 4;
+      gint count = kernel->count[x];
+      __m128i acc = _mm_set1_epi32 (WEIGHT_ROUND);
+      guint32 out;
+
+      for (j = 0; j + 1 < count; j += 2)
+        {
+          __m128i pixels = _mm_unpacklo_epi16 (load_rgba (s + j * 4), load_rgba (s + j * 4 + 4));
+          __m128i w = _mm_set1_epi32 ((gint) (((guint32) (guint16) weights[j + 1] << 16) |
+                                              (guint16) weights[j]));
+          acc = _mm_add_epi32 (acc, _mm_madd_epi16 (pixels, w));
+        }
+
+      if (j < count)
+        {
+          __m128i pixels = _mm_unpacklo_epi16 (load_rgba (s + j * 4), _mm_setzero_si128 ());
+          __m128i w = _mm_set1_epi32 ((guint16) weights[j]);
+          acc = _mm_add_epi32 (acc, _mm_madd_epi16 (pixels, w));
+        }
+
+      acc = _mm_srai_epi32 (acc, WEIGHT_BITS);
+      acc = _mm_packs_epi32 (acc, acc);
+      acc = _mm_packus_epi16 (acc, acc);
+      out = (guint32) _mm_cvtsi128_si32 (acc);
+      memcpy (dest + x * 4, &out, sizeof (out));
+    }
+}
+#endif /* HAVE_SSE2_KERNELS */
+
+/* Vertical pass */
+
+typedef void (* VerticalRowFunc) (guchar        *dest,
+                                  const guchar **rows,
+                                  const gint16  *weights,
+                                  gint           count,
+                                  gint           n_bytes,
+                                  gint           offset);
+
+static void
+vertical_row_scalar (guchar        *dest,
+                     const guchar **rows,
+                     const gint16  *weights,
+                     gint           count,
+                     gint           n_bytes,
+                     gint           offset)
+{
+  gint i, j;
+
+  for (i = offset; i < n_bytes; i++)
+    {
+      gint32 acc = WEIGHT_ROUND;
+
+      for (j = 0; j < count; j++)
+        acc += rows[j][i] * weights[j];
+
+      dest[i] = clamp_pixel (acc >> WEIGHT_BITS);
+    }
+}
+
+#ifdef HAVE_SSE2_KERNELS
+static void
+vertical_row_sse2 (guchar        *dest,
+                   const guchar **rows,
+                   const gint16  *weights,
+                   gint           count,
+                   gint           n_bytes,
+                   gint           offset)
+{
+  const __m128i zero = _mm_setzero_si128 ();
+  gint i, j;
+
+  for (i = offset; i + 16 <= n_bytes; i += 16)
+    {
+      __m128i acc0 = _mm_set1_epi32 (WEIGHT_ROUND);
+      __m128i acc1 = acc0, acc2 = acc0, acc3 = acc0;
+
+      for (j = 0; j < count; j += 2)
+        {
+          __m128i a, b, w, a_lo, a_hi, b_lo, b_hi;
+          guint16 w1 = j + 1 < count ? (guint16) weights[j + 1] : 0;
+
+          a = _mm_loadu_si128 ((const __m128i *) (rows[j] + i));
+          b = j + 1 < count ? _mm_loadu_si128 ((const __m128i *) (rows[j + 1] + i)) : zero;
+          w = _mm_set1_epi32 ((gint) (((guint32) w1 << 16) | (guint16) weights[j]));
+
+          a_lo = _mm_unpacklo_epi8 (a, zero);
+          a_hi = _mm_unpackhi_epi8 (a, zero);
+          b_lo = _mm_unpacklo_epi8 (b, zero);
+          b_hi = _mm_unpackhi_epi8 (b, zero);
+
+          acc0 = _mm_add_epi32 (acc0, _mm_madd_epi16 (_mm_unpacklo_epi16 (a_lo, b_lo), w));
+          acc1 = _mm_add_epi32 (acc1, _mm_madd_epi16 (_mm_unpackhi_epi16 (a_lo, b_lo), w));
+          acc2 = _mm_add_epi32 (acc2, _mm_madd_epi16 (_mm_unpacklo_epi16 (a_hi, b_hi), w));
+          acc3 = _mm_add_epi32 (acc3, _mm_madd_epi16 (_mm_unpackhi_epi16 (a_hi, b_hi), w));
+        }
+
+      acc0 = _mm_packs_epi32 (_mm_srai_epi32 (acc0, WEIGHT_BITS), _mm_srai_epi32 (acc1, WEIGHT_BITS));
+      acc2 = _mm_packs_epi32 (_mm_srai_epi32 (acc2, WEIGHT_BITS), _mm_srai_epi32 (acc3, WEIGHT_BITS));
+      _mm_storeu_si128 ((__m128i *) (dest + i), _mm_packus_epi16 (acc0, acc2));
+    }
+
+  vertical_row_scalar (dest, rows, weights, count, n_bytes, i);
+}
+#endif /* HAVE_SSE2_KERNELS */
+
+#ifdef HAVE_AVX2_KERNELS
+/* Same as the SSE2 version on 32 bytes at a time.  The AVX2 unpack and pack
+ * instructions work within 128 bit lanes, and since both are applied
+ * symmetrically the bytes come back out in order.
+ */
+__attribute__ ((target ("avx2")))
+static void
+vertical_row_avx2 (guchar        *dest,
+                   const guchar **rows,
+                   const gint16  *weights,
+                   gint           count,
+                   gint           n_bytes,
+                   gint           offset)
+{
+  const __m256i zero = _mm256_setzero_si256 ();
+  gint i, j;
+
+  for (i = offset; i + 32 <= n_bytes; i += 32)
+    {
+      __m256i acc0 = _mm256_set1_epi32 (WEIGHT_ROUND);
+      __m256i acc1 = acc0, acc2 = acc0, acc3 = acc0;
+
+      for (j = 0; j < count; j += 2)
+        {
+          __m256i a, b, w, a_lo, a_hi, b_lo, b_hi;
+          guint16 w1 = j + 1 < count ? (guint16) weights[j + 1] : 0;
+
+          a = _mm256_loadu_si256 ((const __m256i *) (rows[j] + i));
+          b = j + 1 < count ? _mm256_loadu_si256 ((const __m256i *) (rows[j + 1] + i)) : zero;
+          w = _mm256_set1_epi32 ((gint) (((guint32) w1 << 16) | (guint16) weights[j]));
+
+          a_lo = _mm256_unpacklo_epi8 (a, zero);
+          a_hi = _mm256_unpackhi_epi8 (a, zero);
+          b_lo = _mm256_unpacklo_epi8 (b, zero);
+          b_hi = _mm256_unpackhi_epi8 (b, zero);
+
+          acc0 = _mm256_add_epi32 (acc0, _mm256_madd_epi16 (_mm256_unpacklo_epi16 (a_lo, b_lo), w));
+          acc1 = _mm256_add_epi32 (acc1, _mm256_madd_epi16 (_mm256_unpackhi_epi16 (a_lo, b_lo), w));
+          acc2 = _mm256_add_epi32 (acc2, _mm256_madd_epi16 (_mm256_unpacklo_epi16 (a_hi, b_hi), w));
+          acc3 = _mm256_add_epi32 (acc3, _mm256_madd_epi16 (_mm256_unpackhi_epi16 (a_hi, b_hi), w));
+        }
+
+      acc0 = _mm256_packs_epi32 (_mm256_srai_epi32 (acc0, WEIGHT_BITS), _mm256_srai_epi32 (acc1, WEIGHT_BITS));
+      acc2 = _mm256_packs_epi32 (_mm256_srai_epi32 (acc2, WEIGHT_BITS), _mm256_srai_epi32 (acc3, WEIGHT_BITS));
+      _mm256_storeu_si256 ((__m256i *) (dest + i), _mm256_packus_epi16 (acc0, acc2));
+    }
+
+  vertical_row_sse2 (dest, rows, weights, count, n_bytes, i);
+}
+#endif /* HAVE_AVX2_KERNELS */
+
+static VerticalRowFunc
+get_vertical_row_func (void)
+{
+#ifdef HAVE_AVX2_KERNELS
+  if (__builtin_cpu_supports ("avx2"))
+    return vertical_row_avx2;
+#endif
+#ifdef HAVE_SSE2_KERNELS
+  return vertical_row_sse2;
+#else
+  return vertical_row_scalar;
+#endif
+}
+
+/* Banding */
+
+typedef struct {
+  const guchar *src;
+  gint src_rowstride;
+  guchar *dest;
+  gint dest_rowstride;
+  gint n_channels;
+  gint n_bytes;
+  const ResampleKernel *kernel;
+  VerticalRowFunc vertical_row;
+} ResamplePass;
+
+typedef void (* ResampleBandFunc) (const ResamplePass *pass,
+                                   gint                first,
+                                   gint                last);
+
+typedef struct {
+  ResampleBandFunc func;
+  const ResamplePass *pass;
+  gint first;
+  gint last;
+} ResampleBand;
+
+static void
+horizontal_band (const ResamplePass *pass,
+                 gint                first,
+                 gint                last)
+{
+  gint y;
+
+  for (y = first; y < last; y++)
+    {
+      const guchar *src = pass->src + y * pass->src_rowstride;
+      guchar *dest = pass->dest + y * pass->dest_rowstride;
+
+#ifdef HAVE_SSE2_KERNELS
+      if (pass->n_channels == 4)
+        {
+          horizontal_row_rgba_sse2 (src, dest, pass->kernel);
+          continue;
+        }
+#endif
+
+      horizontal_row_scalar (src, dest, pass->n_channels, pass->kernel);
+    }
+}
+
+static void
+vertical_band (const ResamplePass *pass,
+               gint                first,
+               gint                last)
+{
+  const ResampleKernel *kernel = pass->kernel;
+  g_autofree const guchar **rows = g_new (const guchar *, kernel->max_taps);
+  gint y, j;
+
+  for (y = first; y < last; y++)
+    {
+      for (j = 0; j < kernel->count[y]; j++)
+        rows[j] = pass->src + (kernel->start[y] + j) * pass->src_rowstride;
+
+      pass->vertical_row (pass->dest + y * pass->dest_rowstride,
+                          rows,
+                          kernel->weights + y * kernel->max_taps,
+                          kernel->count[y],
+                          pass->n_bytes,
+                          0);
+    }
+}
+
+static gpointer
+run_band (gpointer data)
+{
+  ResampleBand *band = data;
+
+  band->func (band->pass, band->first, band->last);
+
+  return NULL;
+}
+
+static void
+run_in_bands (ResampleBandFunc    func,
+              const ResamplePass *pass,
+              gint                n_rows,
+              guint               n_threads)
+{
+  g_autofree ResampleBand *bands = NULL;
+  g_autofree GThread **threads = NULL;
+  guint i;
+
+  n_threads = MIN (n_threads, (guint) MAX (n_rows / MIN_ROWS_PER_THREAD, 1));
+
+  if (n_threads <= 1)
+    {
+      func (pass, 0, n_rows);
+      return;
+    }
+
+  bands = g_new (ResampleBand, n_threads);
+  threads = g_new0 (GThread *, n_threads);
+
+  for (i = 0; i < n_threads; i++)
+    {
+      bands[i].func = func;
+      bands[i].pass = pass;
+      bands[i].first = (gint) ((gint64) n_rows * i / n_threads);
+      bands[i].last = (gint) ((gint64) n_rows * (i + 1) / n_threads);
+    }
+
+  /* the calling thread takes the first band itself */
+  for (i = 1; i < n_threads; i++)
+    threads[i] = g_thread_new ("screenshot-resample", run_band, &bands[i]);
+
+  run_band (&bands[0]);
+
+  for (i = 1; i < n_threads; i++)
+    g_thread_join (threads[i]);
+}
+
+/**
+ * screenshot_resample:
+ * @src: an 8 bit RGB or RGBA pixbuf
+ * @width: the width of the result
+ * @height: the height of the result
+ * @filter: %SCREENSHOT_RESAMPLE_BOX for previews and other UI, where speed
+ *   matters and text should stay crisp, %SCREENSHOT_RESAMPLE_LANCZOS for
+ *   images that are going to be saved
+ * @n_threads: how many threads may be used; 0 picks a number based on the
+ *   image size and the number of CPUs
+ *
+ * Returns: (transfer full): a new pixbuf
+ */
+GdkPixbuf *
+screenshot_resample (GdkPixbuf                *src,
+                     gint                      width,
+                     gint                      height,
+                     ScreenshotResampleFilter  filter,
+                     guint                     n_threads)
+{
+  GdkPixbuf *dest;
+  ResampleKernel *kernel;
+  ResamplePass pass;
+  guchar *tmp = NULL;
+  const guchar *vertical_src;
+  gint vertical_src_rowstride;
+  gint src_width, src_height, n_channels;
+
+  g_return_val_if_fail (GDK_IS_PIXBUF (src), NULL);
+  g_return_val_if_fail (gdk_pixbuf_get_bits_per_sample (src) == 8, NULL);
+  g_return_val_if_fail (width > 0 && height > 0, NULL);
+
+  src_width = gdk_pixbuf_get_width (src);
+  src_height = gdk_pixbuf_get_height (src);
+  n_channels = gdk_pixbuf_get_n_channels (src);
+
+  if (width == src_width && height == src_height)
+    return gdk_pixbuf_copy (src);
+
+  if (n_threads == 0)
+    {
+      if ((gint64) MAX (width, src_width) * MAX (height, src_height) >= MIN_PIXELS_FOR_THREADS)
+        n_threads = MIN (g_get_num_processors (), MAX_THREADS);
+      else
+        n_threads = 1;
+    }
+
+  dest = screenshot_pixbuf_pool_new_pixbuf (gdk_pixbuf_get_has_alpha (src),
+                                            width, height);
+  if (dest == NULL)
+    return NULL;
+
+  vertical_src = gdk_pixbuf_read_pixels (src);
+  vertical_src_rowstride = gdk_pixbuf_get_rowstride (src);
+
+  if (width != src_width)
+    {
+      kernel = resample_kernel_new (src_width, width, filter);
+
+      pass.src = gdk_pixbuf_read_pixels (src);
+      pass.src_rowstride = gdk_pixbuf_get_rowstride (src);
+      pass.n_channels = n_channels;
+      pass.kernel = kernel;
+
+      if (height == src_height)
+        {
+          pass.dest = gdk_pixbuf_get_pixels (dest);
+          pass.dest_rowstride = gdk_pixbuf_get_rowstride (dest);
+        }
+      else
+        {
+          /* 8 bit intermediate rows, like the final image */
+          tmp = screenshot_pixbuf_pool_alloc ((gsize) width * n_channels * src_height);
+          if (tmp == NULL)
+            {
+              resample_kernel_free (kernel);
+              g_object_unref (dest);
+              return NULL;
+            }
+
+          pass.dest = tmp;
+          pass.dest_rowstride = width * n_channels;
+          vertical_src = tmp;
+          vertical_src_rowstride = pass.dest_rowstride;
+        }
+
+      run_in_bands (horizontal_band, &pass, src_height, n_threads);
+      resample_kernel_free (kernel);
+    }
+
+  if (height != src_height)
+    {
+      kernel = resample_kernel_new (src_height, height, filter);
+
+      pass.src = vertical_src;
+      pass.src_rowstride = vertical_src_rowstride;
+      pass.dest = gdk_pixbuf_get_pixels (dest);
+      pass.dest_rowstride = gdk_pixbuf_get_rowstride (dest);
+      pass.n_channels = n_channels;
+      pass.n_bytes = width * n_channels;
+      pass.kernel = kernel;
+      pass.vertical_row = get_vertical_row_func ();
+
+      run_in_bands (vertical_band, &pass, height, n_threads);
+      resample_kernel_free (kernel);
+    }
+
+  screenshot_pixbuf_pool_release (tmp);
+
+  return dest;
+}
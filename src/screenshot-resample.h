@@ -0,0 +1,38 @@
+/* screenshot-resample.h - image scaling for previews and export
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+#ifndef __SCREENSHOT_RESAMPLE_H__
+#define __SCREENSHOT_RESAMPLE_H__
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+  SCREENSHOT_RESAMPLE_BOX,     /* area average; sharp, cheap downscaling of UI */
+  SCREENSHOT_RESAMPLE_LANCZOS  /* Lanczos-3; best quality, used for export */
+} ScreenshotResampleFilter;
+
+GdkPixbuf *screenshot_resample (GdkPixbuf                *src,
+                                gint                      width,
+                                gint                      height,
+                                ScreenshotResampleFilter  filter,
+                                guint                     n_threads);
+
+G_END_DECLS
+
+#endif /* __SCREENSHOT_RESAMPLE_H__ */
@@ -22,14 +22,15 @@
 
 #include "config.h"
 
+#include "screenshot-pixbuf-pool.h"
 #include "screenshot-shadow.h"
 #include <math.h>
+#include <string.h>
 
-#define BLUR_RADIUS    5
-#define SHADOW_OFFSET  (BLUR_RADIUS * 4 / 5)
-#define SHADOW_OPACITY 0.5
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-#define OUTLINE_RADIUS  1
 #define OUTLINE_OFFSET  0
 #define OUTLINE_OPACITY 1.0
 
@@ -37,15 +38,33 @@
 #define VINTAGE_OVERLAY_COLOR 0xFFFBF2A3
 #define VINTAGE_SOURCE_ALPHA 192
 #define VINTAGE_OUTLINE_COLOR 0xFFEEEEEE
-#define VINTAGE_OUTLINE_RADIUS 24
+
+/* Prepared kernels kept around; there is one per effect and size in use,
+ * so this only matters when the parameters keep changing. */
+#define KERNEL_CACHE_SIZE 8
 
 #define dist(x0, y0, x1, y1) sqrt(((x0) - (x1))*((x0) - (x1)) + ((y0) - (y1))*((y0) - (y1)))
 
 typedef struct {
   int size;
   double *data;
+  gint ref_count;
 } ConvFilter;
 
+typedef enum {
+  FILTER_BLUR,
+  FILTER_OUTLINE
+} FilterKind;
+
+typedef struct {
+  FilterKind kind;
+  int radius;
+  ConvFilter *filter;
+} KernelCacheEntry;
+
+static GMutex kernel_cache_lock;
+static GQueue kernel_cache = G_QUEUE_INIT; /* most recently used first */
+
 static double
 gaussian (double x, double y, double r)
 {
@@ -61,6 +80,7 @@ create_blur_filter (int radius)
   double sum;
 
   filter = g_new0 (ConvFilter, 1);
+  filter->ref_count = 1;
   filter->size = radius * 2 + 1;
   filter->data = g_new (double, filter->size * filter->size);
 
@@ -94,6 +114,7 @@ create_outline_filter (int radius)
   double *iter;
 
   filter = g_new0 (ConvFilter, 1);
+  filter->ref_count = 1;
   filter->size = radius * 2 + 1;
   filter->data = g_new (double, filter->size * filter->size);
 
@@ -107,6 +128,100 @@ create_outline_filter (int radius)
   return filter;
 }
 
+static ConvFilter *
+conv_filter_ref (ConvFilter *filter)
+{
+  g_atomic_int_inc (&filter->ref_count);
+  return filter;
+}
+
+static void
+conv_filter_unref (ConvFilter *filter)
+{
+  if (!g_atomic_int_dec_and_test (&filter->ref_count))
+    return;
+
+  g_free (filter->data);
+  g_free (filter);
+}
+
+/* With kernel_cache_lock held: the cached kernel for @kind and @radius,
+ * moved to the front, or NULL */
+static ConvFilter *
+lookup_filter_locked (FilterKind kind,
+                      int        radius)
+{
+  KernelCacheEntry *entry;
+  GList *l;
+
+  for (l = kernel_cache.head; l != NULL; l = l->next)
+    {
+      entry = l->data;
+
+      if (entry->kind == kind && entry->radius == radius)
+        {
+          g_queue_unlink (&kernel_cache, l);
+          g_queue_push_head_link (&kernel_cache, l);
+
+          return conv_filter_ref (entry->filter);
+        }
+    }
+
+  return NULL;
+}
+
+/* Returns the kernel for @kind and @radius from the cache, building it
+ * and evicting the least recently used one if needed. */
+static ConvFilter *
+get_filter (FilterKind kind,
+            int        radius)
+{
+  KernelCacheEntry *entry;
+  ConvFilter *filter, *cached;
+
+  g_mutex_lock (&kernel_cache_lock);
+  filter = lookup_filter_locked (kind, radius);
+  g_mutex_unlock (&kernel_cache_lock);
+
+  if (filter != NULL)
+    return filter;
+
+  /* built without the lock, as another thread may need another kernel */
+  if (kind == FILTER_BLUR)
+    filter = create_blur_filter (radius);
+  else
+    filter = create_outline_filter (radius);
+
+  g_mutex_lock (&kernel_cache_lock);
+
+  /* another thread may have built the same one meanwhile */
+  cached = lookup_filter_locked (kind, radius);
+  if (cached != NULL)
+    {
+      g_mutex_unlock (&kernel_cache_lock);
+      conv_filter_unref (filter);
+
+      return cached;
+    }
+
+  entry = g_slice_new (KernelCacheEntry);
+  entry->kind = kind;
+  entry->radius = radius;
+  entry->filter = conv_filter_ref (filter);
+  g_queue_push_head (&kernel_cache, entry);
+
+  if (kernel_cache.length > KERNEL_CACHE_SIZE)
+    {
+      entry = g_queue_pop_tail (&kernel_cache);
+      conv_filter_unref (entry->filter);
+      g_slice_free (KernelCacheEntry, entry);
+    }
+
+  g_mutex_unlock (&kernel_cache_lock);
+
+  return filter;
+}
+
 static GdkPixbuf *
 create_effect (GdkPixbuf *src,
                ConvFilter const *filter,
@@ -132,10 +247,9 @@ create_effect (GdkPixbuf *src,
   dest_width = src_width + 2 * radius + offset;
   dest_height = src_height + 2 * radius + offset;
 
-  dest = gdk_pixbuf_new (gdk_pixbuf_get_colorspace (src),
-                         TRUE,
-                         gdk_pixbuf_get_bits_per_sample (src),
-                         dest_width, dest_height);
+  dest = screenshot_pixbuf_pool_new_pixbuf (TRUE, dest_width, dest_height);
+  if (dest == NULL)
+    return NULL;
 
   gdk_pixbuf_fill (dest, 0);
 
@@ -187,91 +301,330 @@ create_effect (GdkPixbuf *src,
 }
 
 void
-screenshot_add_shadow (GdkPixbuf **src)
+screenshot_effect_params_init_default (ScreenshotEffectParams *params)
 {
-  GdkPixbuf *dest;
-  static ConvFilter *filter = NULL;
+  params->shadow_radius = SCREENSHOT_DEFAULT_SHADOW_RADIUS;
+  params->shadow_offset = SCREENSHOT_DEFAULT_SHADOW_OFFSET;
+  params->shadow_opacity = SCREENSHOT_DEFAULT_SHADOW_OPACITY;
+  params->border_width = SCREENSHOT_DEFAULT_BORDER_WIDTH;
+  params->vintage_border_width = SCREENSHOT_DEFAULT_VINTAGE_BORDER_WIDTH;
+}
 
-  if (!filter)
-    filter = create_blur_filter (BLUR_RADIUS);
+void
+screenshot_add_shadow (GdkPixbuf                    **src,
+                       const ScreenshotEffectParams  *params)
+{
+  GdkPixbuf *dest;
+  ConvFilter *filter;
+  int radius = params->shadow_radius;
 
+  filter = get_filter (FILTER_BLUR, radius);
   dest = create_effect (*src, filter,
-                        BLUR_RADIUS,
-                        SHADOW_OFFSET, SHADOW_OPACITY);
+                        radius,
+                        params->shadow_offset, params->shadow_opacity);
+  conv_filter_unref (filter);
 
   if (dest == NULL)
     return;
 
   gdk_pixbuf_composite (*src, dest,
-                        BLUR_RADIUS, BLUR_RADIUS,
+                        radius, radius,
                         gdk_pixbuf_get_width (*src),
                         gdk_pixbuf_get_height (*src),
-                        BLUR_RADIUS, BLUR_RADIUS, 1.0, 1.0,
+                        radius, radius, 1.0, 1.0,
                         GDK_INTERP_BILINEAR, 255);
   g_set_object (src, dest);
+  g_object_unref (dest);
 }
 
 void
-screenshot_add_border (GdkPixbuf **src)
+screenshot_add_border (GdkPixbuf                    **src,
+                       const ScreenshotEffectParams  *params)
 {
   GdkPixbuf *dest;
-  static ConvFilter *filter = NULL;
-
-  if (!filter)
-    filter = create_outline_filter (OUTLINE_RADIUS);
+  ConvFilter *filter;
+  int radius = params->border_width;
 
+  filter = get_filter (FILTER_OUTLINE, radius);
   dest = create_effect (*src, filter,
-                        OUTLINE_RADIUS,
+                        radius,
                         OUTLINE_OFFSET, OUTLINE_OPACITY);
+  conv_filter_unref (filter);
 
   if (dest == NULL)
     return;
 
   gdk_pixbuf_composite (*src, dest,
-                        OUTLINE_RADIUS, OUTLINE_RADIUS,
+                        radius, radius,
                         gdk_pixbuf_get_width (*src),
                         gdk_pixbuf_get_height (*src),
-                        OUTLINE_RADIUS, OUTLINE_RADIUS, 1.0, 1.0,
+                        radius, radius, 1.0, 1.0,
                         GDK_INTERP_BILINEAR, 255);
   g_set_object (src, dest);
+  g_object_unref (dest);
 }
 
-void
-screenshot_add_vintage (GdkPixbuf **src)
+/* The vintage look is an opaque outline around the window, then a
+ * desaturation, then a yellow tint over everything.  It used to be four
+ * passes over four buffers; all three steps are per pixel, so they are
+ * now done together, writing each destination pixel once.
+ *
+ * The arithmetic is done in 16 bit fixed point, with the same formulas
+ * in the scalar and the SSE2 code, so both give the same result:
+ *   intensity  = (77 r + 151 g + 28 b) / 256      (0.30, 0.59, 0.11)
+ *   saturated  = ((256 - s) intensity + s v) / 256, s = 256 * saturation
+ *   tinted     = (alpha v + (255 - alpha) tint) / 255
+ */
+
+/* colours are in gdk_pixbuf_fill() order, 0xRRGGBBAA */
+#define VINTAGE_OUTLINE_R ((VINTAGE_OUTLINE_COLOR >> 24) & 0xff)
+#define VINTAGE_OUTLINE_G ((VINTAGE_OUTLINE_COLOR >> 16) & 0xff)
+#define VINTAGE_OUTLINE_B ((VINTAGE_OUTLINE_COLOR >> 8) & 0xff)
+#define VINTAGE_OUTLINE_A (VINTAGE_OUTLINE_COLOR & 0xff)
+#define VINTAGE_TINT_R ((VINTAGE_OVERLAY_COLOR >> 16) & 0xff)
+#define VINTAGE_TINT_G ((VINTAGE_OVERLAY_COLOR >> 8) & 0xff)
+#define VINTAGE_TINT_B (VINTAGE_OVERLAY_COLOR & 0xff)
+
+#define VINTAGE_SATURATION_WEIGHT ((guint) (VINTAGE_SATURATION * 256 + 0.5))
+
+static inline guint
+div255 (guint x)
 {
-  GdkPixbuf *dest;
-  static ConvFilter *filter = NULL;
+  return (x + 1 + (x >> 8)) >> 8;
+}
 
-  if (!filter)
-    filter = create_outline_filter (VINTAGE_OUTLINE_RADIUS);
+static inline guint
+vintage_saturate (guint v,
+                  guint intensity)
+{
+  return (intensity * (256 - VINTAGE_SATURATION_WEIGHT) +
+          v * VINTAGE_SATURATION_WEIGHT + 128) >> 8;
+}
 
-  dest = create_effect (*src, filter,
-                        VINTAGE_OUTLINE_RADIUS,
-                        OUTLINE_OFFSET, OUTLINE_OPACITY);
+static inline guint
+vintage_tint (guint v,
+              guint tint,
+              guint alpha)
+{
+  return div255 (v * alpha + tint * (255 - alpha) + 127);
+}
 
-  if (dest == NULL)
-    return;
+/* Desaturates and tints one pixel of the given opacity, and packs it as
+ * it is laid out in memory, R first.
+ */
+static inline guint32
+vintage_pixel (guint r,
+               guint g,
+               guint b,
+               guint a)
+{
+  guint32 pixel;
+  guchar *p = (guchar *) &pixel;
+  guint intensity, alpha;
 
-  gdk_pixbuf_fill (dest, VINTAGE_OUTLINE_COLOR);
-  gdk_pixbuf_composite (*src, dest,
-                        VINTAGE_OUTLINE_RADIUS, VINTAGE_OUTLINE_RADIUS,
-                        gdk_pixbuf_get_width (*src),
-                        gdk_pixbuf_get_height (*src),
-                        VINTAGE_OUTLINE_RADIUS, VINTAGE_OUTLINE_RADIUS, 1.0, 1.0,
-                        GDK_INTERP_HYPER, 255);
-  g_set_object (src, dest);
+  intensity = (r * 77 + g * 151 + b * 28 + 128) >> 8;
+  alpha = div255 (a * VINTAGE_SOURCE_ALPHA + 127);
 
-  gdk_pixbuf_saturate_and_pixelate (*src, *src,
-                                    VINTAGE_SATURATION, FALSE);
-  dest = gdk_pixbuf_composite_color_simple (*src,
-                                            gdk_pixbuf_get_width(*src),
-                                            gdk_pixbuf_get_height(*src),
-                                            GDK_INTERP_BILINEAR,
-                                            VINTAGE_SOURCE_ALPHA, 64,
-                                            VINTAGE_OVERLAY_COLOR, VINTAGE_OVERLAY_COLOR);
+  p[0] = vintage_tint (vintage_saturate (r, intensity), VINTAGE_TINT_R, alpha);
+  p[1] = vintage_tint (vintage_saturate (g, intensity), VINTAGE_TINT_G, alpha);
+  p[2] = vintage_tint (vintage_saturate (b, intensity), VINTAGE_TINT_B, alpha);
+  p[3] = 0xff;
+
+  return pixel;
+}
+
+/* Same, for a window pixel that lies over the outline */
+static inline guint32
+vintage_window_pixel (guint r,
+                      guint g,
+                      guint b,
+                      guint a)
+{
+  guint outline_weight, total;
+
+  if (a < 255)
+    {
+      outline_weight = div255 ((255 - a) * VINTAGE_OUTLINE_A);
+      total = a + outline_weight;
+
+      if (total > 0)
+        {
+          r = (r * a + VINTAGE_OUTLINE_R * outline_weight + total / 2) / total;
+          g = (g * a + VINTAGE_OUTLINE_G * outline_weight + total / 2) / total;
+          b = (b * a + VINTAGE_OUTLINE_B * outline_weight + total / 2) / total;
+        }
 
+      a = total;
+    }
+
+  return vintage_pixel (r, g, b, a);
+}
+
+#ifdef __SSE2__
+/* Four opaque pixels, one per 32 bit lane with R in the low byte.  Every
+ * intermediate value fits in 16 bits, so 16 bit multiplies are enough.
+ */
+static inline __m128i
+vintage_opaque_sse2 (__m128i pixels)
+{
+  const __m128i mask = _mm_set1_epi32 (0xff);
+  const __m128i round8 = _mm_set1_epi32 (128);
+  __m128i r, g, b, intensity;
+
+  r = _mm_and_si128 (pixels, mask);
+  g = _mm_and_si128 (_mm_srli_epi32 (pixels, 8), mask);
+  b = _mm_and_si128 (_mm_srli_epi32 (pixels, 16), mask);
+
+  intensity = _mm_add_epi32 (_mm_add_epi32 (_mm_mullo_epi16 (r, _mm_set1_epi32 (77)),
+                                            _mm_mullo_epi16 (g, _mm_set1_epi32 (151))),
+                             _mm_add_epi32 (_mm_mullo_epi16 (b, _mm_set1_epi32 (28)), round8));
+  intensity = _mm_mullo_epi16 (_mm_srli_epi32 (intensity, 8), _mm_set1_epi32 (256 - VINTAGE_SATURATION_WEIGHT));
+  intensity = _mm_add_epi32 (intensity, round8);
+
+#define SATURATE_AND_TINT(v, tint)                                                \
+  G_STMT_START {                                                                  \
+    __m128i x;                                                                    \
+    v = _mm_srli_epi32 (_mm_add_epi32 (intensity,                                 \
+                                       _mm_mullo_epi16 (v, _mm_set1_epi32 (VINTAGE_SATURATION_WEIGHT))), \
+                        8);                                                       \
+    x = _mm_add_epi32 (_mm_mullo_epi16 (v, _mm_set1_epi32 (VINTAGE_SOURCE_ALPHA)), \
+                       _mm_set1_epi32 ((tint) * (255 - VINTAGE_SOURCE_ALPHA) + 127)); \
+    v = _mm_srli_epi32 (_mm_add_epi32 (_mm_add_epi32 (x, _mm_set1_epi32 (1)),     \
+                                       _mm_srli_epi32 (x, 8)),                    \
+                        8);                                                       \
+  } G_STMT_END
+
+  SATURATE_AND_TINT (r, VINTAGE_TINT_R);
+  SATURATE_AND_TINT (g, VINTAGE_TINT_G);
+  SATURATE_AND_TINT (b, VINTAGE_TINT_B);
+
+#undef SATURATE_AND_TINT
+
+  return _mm_or_si128 (_mm_or_si128 (r, _mm_slli_epi32 (g, 8)),
+                       _mm_or_si128 (_mm_slli_epi32 (b, 16), _mm_set1_epi32 ((gint) 0xff000000)));
+}
+#endif
+
+static void
+vintage_row (const guchar *src,
+             guchar       *dest,
+             gint          width,
+             gint          n_channels)
+{
+  gint x = 0;
+
+#ifdef __SSE2__
+  if (n_channels == 4)
+    {
+      for (; x + 4 <= width; x += 4)
+        {
+          __m128i pixels = _mm_loadu_si128 ((const __m128i *) (src + x * 4));
+          __m128i alpha = _mm_srli_epi32 (pixels, 24);
+
+          /* translucent pixels are rare; they take the scalar path */
+          if (_mm_movemask_epi8 (_mm_cmpeq_epi32 (alpha, _mm_set1_epi32 (0xff))) != 0xffff)
+            {
+              gint i;
+
+              for (i = x; i < x + 4; i++)
+                {
+                  guint32 pixel = vintage_window_pixel (src[i * 4], src[i * 4 + 1],
+                                                        src[i * 4 + 2], src[i * 4 + 3]);
+                  memcpy (dest + i * 4, &pixel, 4);
+                }
+              continue;
+            }
+
+          _mm_storeu_si128 ((__m128i *) (dest + x * 4), vintage_opaque_sse2 (pixels));
+        }
+    }
+  else
+    {
+      for (; x + 4 <= width; x += 4)
+        {
+          const guchar *p = src + x * 3;
+          __m128i pixels = _mm_setr_epi32 (p[0] | p[1] << 8 | p[2] << 16,
+                                           p[3] | p[4] << 8 | p[5] << 16,
+                                           p[6] | p[7] << 8 | p[8] << 16,
+                                           p[9] | p[10] << 8 | p[11] << 16);
+
+          _mm_storeu_si128 ((__m128i *) (dest + x * 4), vintage_opaque_sse2 (pixels));
+        }
+    }
+#endif
+
+  for (; x < width; x++)
+    {
+      const guchar *p = src + x * n_channels;
+      guint32 pixel = vintage_window_pixel (p[0], p[1], p[2],
+                                            n_channels == 4 ? p[3] : 0xff);
+
+      memcpy (dest + x * 4, &pixel, 4);
+    }
+}
+
+static void
+fill_pixels (guchar  *dest,
+             gint     n_pixels,
+             guint32  pixel)
+{
+  gint i;
+
+  for (i = 0; i < n_pixels; i++)
+    memcpy (dest + i * 4, &pixel, 4);
+}
+
+void
+screenshot_add_vintage (GdkPixbuf                    **src,
+                        const ScreenshotEffectParams  *params)
+{
+  GdkPixbuf *dest;
+  const guchar *src_pixels;
+  guchar *dest_pixels;
+  gint src_width, src_height, src_rowstride, n_channels;
+  gint dest_width, dest_height, dest_rowstride;
+  gint radius = params->vintage_border_width;
+  guint32 outline;
+  gint y;
+
+  src_width = gdk_pixbuf_get_width (*src);
+  src_height = gdk_pixbuf_get_height (*src);
+  src_rowstride = gdk_pixbuf_get_rowstride (*src);
+  n_channels = gdk_pixbuf_get_n_channels (*src);
+  src_pixels = gdk_pixbuf_read_pixels (*src);
+
+  dest_width = src_width + 2 * radius;
+  dest_height = src_height + 2 * radius;
+
+  dest = screenshot_pixbuf_pool_new_pixbuf (TRUE, dest_width, dest_height);
   if (dest == NULL)
     return;
 
+  dest_pixels = gdk_pixbuf_get_pixels (dest);
+  dest_rowstride = gdk_pixbuf_get_rowstride (dest);
+
+  outline = vintage_pixel (VINTAGE_OUTLINE_R, VINTAGE_OUTLINE_G,
+                           VINTAGE_OUTLINE_B, VINTAGE_OUTLINE_A);
+
+  for (y = 0; y < dest_height; y++)
+    {
+      guchar *row = dest_pixels + y * dest_rowstride;
+      gint src_y = y - radius;
+
+      if (src_y < 0 || src_y >= src_height)
+        {
+          fill_pixels (row, dest_width, outline);
+          continue;
+        }
+
+      fill_pixels (row, radius, outline);
+      vintage_row (src_pixels + src_y * src_rowstride,
+                   row + radius * 4,
+                   src_width, n_channels);
+      fill_pixels (row + (radius + src_width) * 4,
+                   radius, outline);
+    }
+
   g_set_object (src, dest);
+  g_object_unref (dest);
 }
@@ -22,8 +22,28 @@
 
 #include <gtk/gtk.h>
 
-void screenshot_add_shadow (GdkPixbuf **src);
-void screenshot_add_border (GdkPixbuf **src);
-void screenshot_add_vintage (GdkPixbuf **src);
+#define SCREENSHOT_DEFAULT_SHADOW_RADIUS        5
+#define SCREENSHOT_DEFAULT_SHADOW_OFFSET        (SCREENSHOT_DEFAULT_SHADOW_RADIUS * 4 / 5)
+#define SCREENSHOT_DEFAULT_SHADOW_OPACITY       0.5
+#define SCREENSHOT_DEFAULT_BORDER_WIDTH         1
+#define SCREENSHOT_DEFAULT_VINTAGE_BORDER_WIDTH 24
+
+/* All sizes are in pixels */
+typedef struct {
+  gint shadow_radius;
+  gint shadow_offset;
+  gdouble shadow_opacity;
+  gint border_width;
+  gint vintage_border_width;
+} ScreenshotEffectParams;
+
+void screenshot_effect_params_init_default (ScreenshotEffectParams *params);
+
+void screenshot_add_shadow (GdkPixbuf **src,
+                            const ScreenshotEffectParams *params);
+void screenshot_add_border (GdkPixbuf **src,
+                            const ScreenshotEffectParams *params);
+void screenshot_add_vintage (GdkPixbuf **src,
+                             const ScreenshotEffectParams *params);
 
 #endif /* __SCREENSHOT_SHADOW_H__ */
@@ -0,0 +1,626 @@
+/* screenshot-stream.c - encodes screenshots a few rows at a time
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+/* gdk-pixbuf can only save an image that is entirely in memory.  On very
+ * large desktops the frame, a copy made on the way and the encoder state
+ * add up to several times the size of the frame.  The encoder here takes
+ * the image a strip of rows at a time instead, so headless captures that
+ * need no processing can read the screen in bands and write each one out
+ * before reading the next: memory use depends on the width of the
+ * desktop, not its size.
+ *
+ * PNG goes through libpng and JPEG, when available, through libjpeg, with
+ * the settings gdk-pixbuf uses by default.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <glib/gi18n.h>
+#include <glib/gstdio.h>
+#include <png.h>
+
+#ifdef HAVE_LIBJPEG
+#include <jpeglib.h>
+#endif
+
+#include "screenshot-stream.h"
+
+/* same as gdk-pixbuf */
+#define JPEG_QUALITY 90
+#define JPEG_BUFFER_SIZE 8192
+
+typedef enum {
+  STREAM_FORMAT_PNG,
+  STREAM_FORMAT_JPEG
+} StreamFormat;
+
+#ifdef HAVE_LIBJPEG
+typedef struct {
+  struct jpeg_error_mgr pub;
+  jmp_buf jmp;
+} JpegErrorMgr;
+#endif
+
+struct _ScreenshotStreamEncoder
+{
+  StreamFormat format;
+  gint width;
+  gint height;
+  gint n_channels;
+  gint rows_written;
+
+  GdkPixbufSaveFunc save_func;
+  gpointer user_data;
+
+  /* set by the callbacks before they bail out of the library */
+  GError *error;
+
+  png_structp png;
+  png_infop png_info;
+
+#ifdef HAVE_LIBJPEG
+  struct jpeg_compress_struct jpeg;
+  JpegErrorMgr jpeg_error;
+  struct jpeg_destination_mgr jpeg_dest;
+  guchar *jpeg_buffer;
+  guchar *jpeg_row;
+  gboolean jpeg_created;
+#endif
+};
+
+static gboolean
+parse_format (const gchar  *format,
+              StreamFormat *format_out)
+{
+  if (g_strcmp0 (format, "png") == 0)
+    {
+      *format_out = STREAM_FORMAT_PNG;
+      return TRUE;
+    }
+
+#ifdef HAVE_LIBJPEG
+  if (g_strcmp0 (format, "jpeg") == 0)
+    {
+      *format_out = STREAM_FORMAT_JPEG;
+      return TRUE;
+    }
+#endif
+
+  return FALSE;
+}
+
+/**
+ * screenshot_stream_supports_format:
+ * @format: a gdk-pixbuf format name
+ *
+ * Returns: whether @format can be written a strip at a time
+ */
+gboolean
+screenshot_stream_supports_format (const gchar *format)
+{
+  StreamFormat stream_format;
+
+  return parse_format (format, &stream_format);
+}
+
+static void
+set_error_once (ScreenshotStreamEncoder *encoder,
+                const gchar             *message)
+{
+  if (encoder->error == NULL)
+    g_set_error (&encoder->error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_FAILED,
+                 _("Unable to encode the screenshot: %s"), message);
+}
+
+static gboolean
+take_error (ScreenshotStreamEncoder  *encoder,
+            GError                  **error)
+{
+  g_propagate_error (error, encoder->error);
+  encoder->error = NULL;
+
+  return FALSE;
+}
+
+static void
+png_error_cb (png_structp     png,
+              png_const_charp message)
+{
+  ScreenshotStreamEncoder *encoder = png_get_error_ptr (png);
+
+  set_error_once (encoder, message);
+  png_longjmp (png, 1);
+}
+
+static void
+png_warning_cb (png_structp     png,
+                png_const_charp message)
+{
+}
+
+static void
+png_write_cb (png_structp  png,
+              png_bytep    data,
+              png_size_t   length)
+{
+  ScreenshotStreamEncoder *encoder = png_get_io_ptr (png);
+
+  if (!encoder->save_func ((const gchar *) data, length,
+                           &encoder->error, encoder->user_data))
+    png_error (png, "write failed");
+}
+
+static void
+png_flush_cb (png_structp png)
+{
+}
+
+static gboolean
+png_encoder_start (ScreenshotStreamEncoder  *encoder,
+                   GError                  **error)
+{
+  png_text text;
+
+  encoder->png = png_create_write_struct (PNG_LIBPNG_VER_STRING, encoder,
+                                          png_error_cb, png_warning_cb);
+  if (encoder->png == NULL)
+    {
+      set_error_once (encoder, "out of memory");
+      return take_error (encoder, error);
+    }
+
+  encoder->png_info = png_create_info_struct (encoder->png);
+  if (encoder->png_info == NULL)
+    {
+      set_error_once (encoder, "out of memory");
+      return take_error (encoder, error);
+    }
+
+  if (setjmp (png_jmpbuf (encoder->png)))
+    return take_error (encoder, error);
+
+  png_set_write_fn (encoder->png, encoder, png_write_cb, png_flush_cb);
+
+  png_set_IHDR (encoder->png, encoder->png_info,
+                encoder->width, encoder->height, 8,
+                encoder->n_channels == 4 ? PNG_COLOR_TYPE_RGB_ALPHA : PNG_COLOR_TYPE_RGB,
+                PNG_INTERLACE_NONE,
+                PNG_COMPRESSION_TYPE_DEFAULT,
+                PNG_FILTER_TYPE_DEFAULT);
+
+  /* what gnome-screenshot always put in its PNG files */
+  memset (&text, 0, sizeof (text));
+  text.compression = PNG_TEXT_COMPRESSION_NONE;
+  text.key = (png_charp) "Software";
+  text.text = (png_charp) "gnome-screenshot";
+  png_set_text (encoder->png, encoder->png_info, &text, 1);
+
+  png_write_info (encoder->png, encoder->png_info);
+
+  return TRUE;
+}
+
+static gboolean
+png_encoder_write_rows (ScreenshotStreamEncoder  *encoder,
+                        const guchar             *pixels,
+                        gint                      rowstride,
+                        gint                      n_rows,
+                        GError                  **error)
+{
+  gint y;
+
+  if (setjmp (png_jmpbuf (encoder->png)))
+    return take_error (encoder, error);
+
+  for (y = 0; y < n_rows; y++)
+    png_write_row (encoder->png, (png_const_bytep) (pixels + y * rowstride));
+
+  return TRUE;
+}
+
+static gboolean
+png_encoder_finish (ScreenshotStreamEncoder  *encoder,
+                    GError                  **error)
+{
+  if (setjmp (png_jmpbuf (encoder->png)))
+    return take_error (encoder, error);
+
+  png_write_end (encoder->png, encoder->png_info);
+
+  return TRUE;
+}
+
+#ifdef HAVE_LIBJPEG
+static void
+jpeg_error_exit_cb (j_common_ptr cinfo)
+{
+  ScreenshotStreamEncoder *encoder = cinfo->client_data;
+  gchar message[JMSG_LENGTH_MAX];
+
+  cinfo->err->format_message (cinfo, message);
+  set_error_once (encoder, message);
+
+  longjmp (encoder->jpeg_error.jmp, 1);
+}
+
+static void
+jpeg_output_message_cb (j_common_ptr cinfo)
+{
+}
+
+static void
+jpeg_init_destination_cb (j_compress_ptr cinfo)
+{
+  ScreenshotStreamEncoder *encoder = cinfo->client_data;
+
+  encoder->jpeg_dest.next_output_byte = encoder->jpeg_buffer;
+  encoder->jpeg_dest.free_in_buffer = JPEG_BUFFER_SIZE;
+}
+
+static boolean
+jpeg_empty_output_buffer_cb (j_compress_ptr cinfo)
+{
+  ScreenshotStreamEncoder *encoder = cinfo->client_data;
+
+  /* libjpeg ignores free_in_buffer here and writes the whole buffer */
+  if (!encoder->save_func ((const gchar *) encoder->jpeg_buffer, JPEG_BUFFER_SIZE,
+                           &encoder->error, encoder->user_data))
+    longjmp (encoder->jpeg_error.jmp, 1);
+
+  encoder->jpeg_dest.next_output_byte = encoder->jpeg_buffer;
+  encoder->jpeg_dest.free_in_buffer = JPEG_BUFFER_SIZE;
+
+  return TRUE;
+}
+
+static void
+jpeg_term_destination_cb (j_compress_ptr cinfo)
+{
+  ScreenshotStreamEncoder *encoder = cinfo->client_data;
+  gsize count = JPEG_BUFFER_SIZE - encoder->jpeg_dest.free_in_buffer;
+
+  if (count > 0 &&
+      !encoder->save_func ((const gchar *) encoder->jpeg_buffer, count,
+                           &encoder->error, encoder->user_data))
+    longjmp (encoder->jpeg_error.jmp, 1);
+}
+
+static gboolean
+jpeg_encoder_start (ScreenshotStreamEncoder  *encoder,
+                    GError                  **error)
+{
+  encoder->jpeg_buffer = g_malloc (JPEG_BUFFER_SIZE);
+  encoder->jpeg_row = g_malloc ((gsize) encoder->width * 3);
+
+  encoder->jpeg.err = jpeg_std_error (&encoder->jpeg_error.pub);
+  encoder->jpeg_error.pub.error_exit = jpeg_error_exit_cb;
+  encoder->jpeg_error.pub.output_message = jpeg_output_message_cb;
+  encoder->jpeg.client_data = encoder;
+
+  if (setjmp (encoder->jpeg_error.jmp))
+    return take_error (encoder, error);
+
+  jpeg_create_compress (&encoder->jpeg);
+  encoder->jpeg_created = TRUE;
+
+  encoder->jpeg_dest.init_destination = jpeg_init_destination_cb;
+  encoder->jpeg_dest.empty_output_buffer = jpeg_empty_output_buffer_cb;
+  encoder->jpeg_dest.term_destination = jpeg_term_destination_cb;
+  encoder->jpeg.dest = &encoder->jpeg_dest;
+
+  encoder->jpeg.image_width = encoder->width;
+  encoder->jpeg.image_height = encoder->height;
+  encoder->jpeg.input_components = 3;
+  encoder->jpeg.in_color_space = JCS_RGB;
+
+  jpeg_set_defaults (&encoder->jpeg);
+  jpeg_set_quality (&encoder->jpeg, JPEG_QUALITY, TRUE);
+  jpeg_start_compress (&encoder->jpeg, TRUE);
+
+  return TRUE;
+}
+
+static gboolean
+jpeg_encoder_write_rows (ScreenshotStreamEncoder  *encoder,
+                         const guchar             *pixels,
+                         gint                      rowstride,
+                         gint                      n_rows,
+                         GError                  **error)
+{
+  gint x, y;
+
+  if (setjmp (encoder->jpeg_error.jmp))
+    return take_error (encoder, error);
+
+  for (y = 0; y < n_rows; y++)
+    {
+      const guchar *src = pixels + y * rowstride;
+      JSAMPROW row;
+
+      if (encoder->n_channels == 4)
+        {
+          /* JPEG has no alpha; screen grabs are opaque anyway */
+          for (x = 0; x < encoder->width; x++)
+            memcpy (encoder->jpeg_row + x * 3, src + x * 4, 3);
+
+          row = encoder->jpeg_row;
+        }
+      else
+        {
+          row = (JSAMPROW) src;
+        }
+
+      jpeg_write_scanlines (&encoder->jpeg, &row, 1);
+    }
+
+  return TRUE;
+}
+
+static gboolean
+jpeg_encoder_finish (ScreenshotStreamEncoder  *encoder,
+                     GError                  **error)
+{
+  if (setjmp (encoder->jpeg_error.jmp))
+    return take_error (encoder, error);
+
+  jpeg_finish_compress (&encoder->jpeg);
+
+  return TRUE;
+}
+#endif /* HAVE_LIBJPEG */
+
+/**
+ * screenshot_stream_encoder_new:
+ * @format: a format for which screenshot_stream_supports_format() is TRUE
+ * @n_channels: 3 for RGB rows, 4 for RGBA
+ * @save_func: called with the encoded data as it is produced
+ *
+ * Starts encoding an image of the given size.  All its rows must then be
+ * given, in order, to screenshot_stream_encoder_write_rows() before
+ * calling screenshot_stream_encoder_close().
+ *
+ * Returns: (transfer full) (nullable): the encoder
+ */
+ScreenshotStreamEncoder *
+screenshot_stream_encoder_new (const gchar        *format,
+                               gint                width,
+                               gint                height,
+                               gint                n_channels,
+                               GdkPixbufSaveFunc   save_func,
+                               gpointer            user_data,
+                               GError            **error)
+{
+  g_autoptr(ScreenshotStreamEncoder) encoder = NULL;
+  StreamFormat stream_format;
+  gboolean started;
+
+  g_return_val_if_fail (width > 0 && height > 0, NULL);
+  g_return_val_if_fail (n_channels == 3 || n_channels == 4, NULL);
+
+  if (!parse_format (format, &stream_format))
+    {
+      g_set_error (error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_UNKNOWN_TYPE,
+                   _("Unable to encode the screenshot: %s"), format);
+      return NULL;
+    }
+
+  encoder = g_slice_new0 (ScreenshotStreamEncoder);
+  encoder->format = stream_format;
+  encoder->width = width;
+  encoder->height = height;
+  encoder->n_channels = n_channels;
+  encoder->save_func = save_func;
+  encoder->user_data = user_data;
+
+#ifdef HAVE_LIBJPEG
+  if (stream_format == STREAM_FORMAT_JPEG)
+    started = jpeg_encoder_start (encoder, error);
+  else
+#endif
+    started = png_encoder_start (encoder, error);
+
+  if (!started)
+    return NULL;
+
+  return g_steal_pointer (&encoder);
+}
+
+gboolean
+screenshot_stream_encoder_write_rows (ScreenshotStreamEncoder  *encoder,
+                                      const guchar             *pixels,
+                                      gint                      rowstride,
+                                      gint                      n_rows,
+                                      GError                  **error)
+{
+  g_return_val_if_fail (encoder->rows_written + n_rows <= encoder->height, FALSE);
+
+  encoder->rows_written += n_rows;
+
+#ifdef HAVE_LIBJPEG
+  if (encoder->format == STREAM_FORMAT_JPEG)
+    return jpeg_encoder_write_rows (encoder, pixels, rowstride, n_rows, error);
+#endif
+
+  return png_encoder_write_rows (encoder, pixels, rowstride, n_rows, error);
+}
+
+/* Writes out the end of the file. */
+gboolean
+screenshot_stream_encoder_close (ScreenshotStreamEncoder  *encoder,
+                                 GError                  **error)
+{
+  g_return_val_if_fail (encoder->rows_written == encoder->height, FALSE);
+
+#ifdef HAVE_LIBJPEG
+  if (encoder->format == STREAM_FORMAT_JPEG)
+    return jpeg_encoder_finish (encoder, error);
+#endif
+
+  return png_encoder_finish (encoder, error);
+}
+
+void
+screenshot_stream_encoder_free (ScreenshotStreamEncoder *encoder)
+{
+  if (encoder->png != NULL)
+    png_destroy_write_struct (&encoder->png, &encoder->png_info);
+
+#ifdef HAVE_LIBJPEG
+  if (encoder->jpeg_created)
+    jpeg_destroy_compress (&encoder->jpeg);
+  g_free (encoder->jpeg_buffer);
+  g_free (encoder->jpeg_row);
+#endif
+
+  g_clear_error (&encoder->error);
+  g_slice_free (ScreenshotStreamEncoder, encoder);
+}
+
+typedef struct {
+  GError *error;
+} PngReadErrorData;
+
+static void
+png_read_error_cb (png_structp     png,
+                   png_const_charp message)
+{
+  PngReadErrorData *data = png_get_error_ptr (png);
+
+  if (data->error == NULL)
+    g_set_error (&data->error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_CORRUPT_IMAGE,
+                 _("Unable to read the screenshot: %s"), message);
+
+  png_longjmp (png, 1);
+}
+
+/**
+ * screenshot_stream_transcode_png:
+ * @filename: a non-interlaced PNG file
+ * @format: the format to encode it to
+ *
+ * Reads @filename a strip at a time and encodes it as @format, so that a
+ * PNG written by another process can be converted, or copied with our
+ * own metadata, without holding the whole image.
+ */
+gboolean
+screenshot_stream_transcode_png (const gchar        *filename,
+                                 const gchar        *format,
+                                 GdkPixbufSaveFunc   save_func,
+                                 gpointer            user_data,
+                                 GError            **error)
+{
+  ScreenshotStreamEncoder *volatile encoder = NULL;
+  guchar *volatile strip = NULL;
+  PngReadErrorData error_data = { NULL, };
+  png_structp png = NULL;
+  png_infop info = NULL;
+  png_uint_32 width, height;
+  volatile gboolean res = FALSE;
+  gint bit_depth, color_type, interlace, n_channels;
+  gsize rowstride;
+  FILE *file;
+  gint y;
+
+  file = g_fopen (filename, "rb");
+  if (file == NULL)
+    {
+      int errsv = errno;
+
+      g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errsv),
+                   "%s: %s", filename, g_strerror (errsv));
+      return FALSE;
+    }
+
+  png = png_create_read_struct (PNG_LIBPNG_VER_STRING, &error_data,
+                                png_read_error_cb, png_warning_cb);
+  if (png != NULL)
+    info = png_create_info_struct (png);
+
+  if (info == NULL)
+    {
+      g_set_error_literal (error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_INSUFFICIENT_MEMORY,
+                           g_strerror (ENOMEM));
+      goto out;
+    }
+
+  if (setjmp (png_jmpbuf (png)))
+    {
+      g_propagate_error (error, error_data.error);
+      error_data.error = NULL;
+      goto out;
+    }
+
+  png_init_io (png, file);
+  png_read_info (png, info);
+  png_get_IHDR (png, info, &width, &height, &bit_depth, &color_type,
+                &interlace, NULL, NULL);
+
+  /* rows of interlaced images only come out in the last pass */
+  if (interlace != PNG_INTERLACE_NONE)
+    {
+      g_set_error (error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_UNSUPPORTED_OPERATION,
+                   _("Unable to read the screenshot: %s"), "interlaced");
+      goto out;
+    }
+
+  /* whatever the shell wrote, get 8 bit RGB or RGBA */
+  png_set_expand (png);
+  png_set_strip_16 (png);
+  png_set_gray_to_rgb (png);
+  png_read_update_info (png, info);
+
+  n_channels = png_get_channels (png, info);
+  rowstride = png_get_rowbytes (png, info);
+
+  encoder = screenshot_stream_encoder_new (format, width, height, n_channels,
+                                           save_func, user_data, error);
+  if (encoder == NULL)
+    goto out;
+
+  strip = g_malloc (rowstride * SCREENSHOT_STREAM_STRIP_HEIGHT);
+
+  for (y = 0; y < (gint) height; y += SCREENSHOT_STREAM_STRIP_HEIGHT)
+    {
+      gint n_rows = MIN (SCREENSHOT_STREAM_STRIP_HEIGHT, (gint) height - y);
+      gint i;
+
+      for (i = 0; i < n_rows; i++)
+        png_read_row (png, strip + i * rowstride, NULL);
+
+      if (!screenshot_stream_encoder_write_rows (encoder, strip, rowstride,
+                                                 n_rows, error))
+        goto out;
+    }
+
+  res = screenshot_stream_encoder_close (encoder, error);
+
+ out:
+  if (png != NULL)
+    png_destroy_read_struct (&png, info != NULL ? &info : NULL, NULL);
+  if (encoder != NULL)
+    screenshot_stream_encoder_free (encoder);
+  g_free (strip);
+  g_clear_error (&error_data.error);
+  fclose (file);
+
+  return res;
+}
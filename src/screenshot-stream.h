@@ -0,0 +1,58 @@
+/* screenshot-stream.h - encodes screenshots a few rows at a time
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+#ifndef __SCREENSHOT_STREAM_H__
+#define __SCREENSHOT_STREAM_H__
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+G_BEGIN_DECLS
+
+/* Rows handed to the encoder at once by the streaming capture paths */
+#define SCREENSHOT_STREAM_STRIP_HEIGHT 64
+
+typedef struct _ScreenshotStreamEncoder ScreenshotStreamEncoder;
+
+gboolean                 screenshot_stream_supports_format     (const gchar              *format);
+
+ScreenshotStreamEncoder *screenshot_stream_encoder_new         (const gchar              *format,
+                                                                gint                      width,
+                                                                gint                      height,
+                                                                gint                      n_channels,
+                                                                GdkPixbufSaveFunc         save_func,
+                                                                gpointer                  user_data,
+                                                                GError                  **error);
+gboolean                 screenshot_stream_encoder_write_rows  (ScreenshotStreamEncoder  *encoder,
+                                                                const guchar             *pixels,
+                                                                gint                      rowstride,
+                                                                gint                      n_rows,
+                                                                GError                  **error);
+gboolean                 screenshot_stream_encoder_close       (ScreenshotStreamEncoder  *encoder,
+                                                                GError                  **error);
+void                     screenshot_stream_encoder_free        (ScreenshotStreamEncoder  *encoder);
+
+gboolean                 screenshot_stream_transcode_png       (const gchar              *filename,
+                                                                const gchar              *format,
+                                                                GdkPixbufSaveFunc         save_func,
+                                                                gpointer                  user_data,
+                                                                GError                  **error);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (ScreenshotStreamEncoder, screenshot_stream_encoder_free)
+
+G_END_DECLS
+
+#endif /* __SCREENSHOT_STREAM_H__ */
@@ -0,0 +1,345 @@
+/* screenshot-tile-hash.c - which parts of a frame changed
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+/* Where the X server cannot report damage, frames are compared instead.
+ * Comparing two frames pixel by pixel needs both of them in memory, so
+ * each frame is reduced to a 64 bit hash per tile of SCREENSHOT_TILE_SIZE
+ * pixels square, and only the hashes of the previous frame are kept: a
+ * tile whose hash differs has changed.  The tiles that differ are also
+ * what a delta of the frame is made of, see screenshot-delta.c.
+ *
+ * The hash accumulates like XXH3: each tile row is read sixteen bytes at
+ * a time into two 64 bit lanes, mixed with a key that depends on where
+ * they are in the row by a 32 by 32 bit multiplication, and the lanes are
+ * scrambled after every row so that the order of the rows counts too.
+ * That is what SSE2 can do two lanes at a time; the scalar code computes
+ * the same hashes.  It is not meant to resist anything but coincidence.
+ *
+ * The image is read in whichever form it already is, row by row so that
+ * each row is only read once, so hashes are only comparable between
+ * frames captured the same way.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "screenshot-tile-hash.h"
+
+#if defined(__GNUC__) && defined(__SSE2__)
+#include <immintrin.h>
+#define HAVE_SSE2_KERNELS 1
+#endif
+
+#define PRIME32_1 0x9e3779b1U
+#define PRIME64_1 G_GUINT64_CONSTANT (0x9e3779b185ebca87)
+#define PRIME64_2 G_GUINT64_CONSTANT (0xc2b2ae3d27d4eb4f)
+#define PRIME64_3 G_GUINT64_CONSTANT (0x165667b19e3779f9)
+#define PRIME64_4 G_GUINT64_CONSTANT (0x85ebca77c2b2ae63)
+
+/* Bytes read at a time, and how many of those make the row of a tile of
+ * four bytes per pixel */
+#define STRIPE_SIZE 16
+#define TILE_STRIPES (SCREENSHOT_TILE_SIZE * 4 / STRIPE_SIZE)
+
+#define KEY(i) ((PRIME64_1 * ((i) + 1)) ^ PRIME64_2)
+
+/* two lanes per stripe */
+static const guint64 stripe_keys[TILE_STRIPES * 2] = {
+  KEY (0), KEY (1), KEY (2), KEY (3), KEY (4), KEY (5), KEY (6), KEY (7),
+  KEY (8), KEY (9), KEY (10), KEY (11), KEY (12), KEY (13), KEY (14), KEY (15)
+};
+
+static const guint64 scramble_keys[2] = { PRIME64_3, PRIME64_4 };
+
+struct _ScreenshotTileHashes
+{
+  gint width;
+  gint height;
+  gint columns;
+  gint rows;
+  guint64 *hashes;
+};
+
+#ifdef HAVE_SSE2_KERNELS
+static inline __m128i
+accumulate_stripe_sse2 (__m128i acc,
+                        __m128i data,
+                        __m128i key)
+{
+  __m128i mixed = _mm_xor_si128 (data, key);
+  __m128i product = _mm_mul_epu32 (mixed, _mm_srli_epi64 (mixed, 32));
+
+  /* each lane also takes the other one as it is */
+  return _mm_add_epi64 (acc,
+                        _mm_add_epi64 (product,
+                                       _mm_shuffle_epi32 (data, _MM_SHUFFLE (1, 0, 3, 2))));
+}
+
+/* acc ^= acc >> 47, ^= the key, *= PRIME32_1, in 32 bit halves */
+static inline __m128i
+scramble_sse2 (__m128i acc)
+{
+  const __m128i prime = _mm_set1_epi32 (PRIME32_1);
+  __m128i low, high;
+
+  acc = _mm_xor_si128 (acc, _mm_srli_epi64 (acc, 47));
+  acc = _mm_xor_si128 (acc, _mm_loadu_si128 ((const __m128i *) scramble_keys));
+
+  low = _mm_mul_epu32 (acc, prime);
+  high = _mm_mul_epu32 (_mm_srli_epi64 (acc, 32), prime);
+
+  return _mm_add_epi64 (low, _mm_slli_epi64 (high, 32));
+}
+
+static inline void
+accumulate_row (guint64      *acc,
+                const guchar *data,
+                gsize         len)
+{
+  __m128i a = _mm_loadu_si128 ((const __m128i *) acc);
+  gint s;
+
+  for (s = 0; len >= STRIPE_SIZE; s++, data += STRIPE_SIZE, len -= STRIPE_SIZE)
+    a = accumulate_stripe_sse2 (a,
+                                _mm_loadu_si128 ((const __m128i *) data),
+                                _mm_loadu_si128 ((const __m128i *) (stripe_keys + 2 * s)));
+
+  if (len > 0)
+    {
+      guint64 stripe[2] = { 0, 0 };
+
+      memcpy (stripe, data, len);
+      a = accumulate_stripe_sse2 (a,
+                                  _mm_loadu_si128 ((const __m128i *) stripe),
+                                  _mm_loadu_si128 ((const __m128i *) (stripe_keys + 2 * s)));
+    }
+
+  _mm_storeu_si128 ((__m128i *) acc, scramble_sse2 (a));
+}
+#else
+static inline void
+accumulate_stripe_scalar (guint64       *acc,
+                          const guint64 *data,
+                          const guint64 *key)
+{
+  gint lane;
+
+  for (lane = 0; lane < 2; lane++)
+    {
+      guint64 mixed = data[lane] ^ key[lane];
+
+      acc[lane] += (mixed & 0xffffffff) * (mixed >> 32) + data[lane ^ 1];
+    }
+}
+
+static inline void
+accumulate_row (guint64      *acc,
+                const guchar *data,
+                gsize         len)
+{
+  guint64 stripe[2];
+  gint s, lane;
+
+  for (s = 0; len >= STRIPE_SIZE; s++, data += STRIPE_SIZE, len -= STRIPE_SIZE)
+    {
+      memcpy (stripe, data, STRIPE_SIZE);
+      accumulate_stripe_scalar (acc, stripe, stripe_keys + 2 * s);
+    }
+
+  if (len > 0)
+    {
+      stripe[0] = stripe[1] = 0;
+      memcpy (stripe, data, len);
+      accumulate_stripe_scalar (acc, stripe, stripe_keys + 2 * s);
+    }
+
+  for (lane = 0; lane < 2; lane++)
+    {
+      acc[lane] ^= acc[lane] >> 47;
+      acc[lane] ^= scramble_keys[lane];
+      acc[lane] *= PRIME32_1;
+    }
+}
+#endif /* HAVE_SSE2_KERNELS */
+
+/* The avalanche of xxHash64, over both lanes */
+static inline guint64
+finish_hash (const guint64 *acc)
+{
+  guint64 hash = acc[0] ^ (acc[1] * PRIME64_1);
+
+  hash ^= hash >> 33;
+  hash *= PRIME64_2;
+  hash ^= hash >> 29;
+  hash *= PRIME64_3;
+  hash ^= hash >> 32;
+
+  return hash;
+}
+
+/**
+ * screenshot_tile_hashes_new:
+ * @image: a frame
+ *
+ * Returns: the hashes of the tiles of @image
+ */
+ScreenshotTileHashes *
+screenshot_tile_hashes_new (ScreenshotImage *image)
+{
+  ScreenshotTileHashes *hashes;
+  ScreenshotImagePixels pixels;
+  g_autofree guint64 *acc = NULL;
+  gsize tile_bytes, row_bytes, n_tiles, i;
+  gint x, y;
+
+  screenshot_image_peek_pixels (image, &pixels);
+
+  hashes = g_slice_new (ScreenshotTileHashes);
+  hashes->width = screenshot_image_get_width (image);
+  hashes->height = screenshot_image_get_height (image);
+  hashes->columns = (hashes->width + SCREENSHOT_TILE_SIZE - 1) / SCREENSHOT_TILE_SIZE;
+  hashes->rows = (hashes->height + SCREENSHOT_TILE_SIZE - 1) / SCREENSHOT_TILE_SIZE;
+
+  n_tiles = (gsize) hashes->columns * hashes->rows;
+  hashes->hashes = g_new (guint64, n_tiles);
+
+  /* two lanes per tile */
+  acc = g_new (guint64, n_tiles * 2);
+  for (i = 0; i < n_tiles; i++)
+    {
+      acc[2 * i] = PRIME64_1;
+      acc[2 * i + 1] = PRIME64_2;
+    }
+
+  tile_bytes = (gsize) SCREENSHOT_TILE_SIZE * pixels.bytes_per_pixel;
+  row_bytes = (gsize) hashes->width * pixels.bytes_per_pixel;
+
+  for (y = 0; y < hashes->height; y++)
+    {
+      const guchar *row = pixels.data + (gsize) y * pixels.rowstride;
+      guint64 *tile_acc = acc + (gsize) (y / SCREENSHOT_TILE_SIZE) * hashes->columns * 2;
+
+      for (x = 0; x < hashes->columns; x++)
+        {
+          gsize offset = x * tile_bytes;
+
+          accumulate_row (tile_acc + 2 * x, row + offset,
+                          MIN (tile_bytes, row_bytes - offset));
+        }
+    }
+
+  for (i = 0; i < n_tiles; i++)
+    hashes->hashes[i] = finish_hash (acc + 2 * i);
+
+  return hashes;
+}
+
+/**
+ * screenshot_tile_hashes_copy:
+ * @hashes: the hashes of a frame
+ *
+ * Returns: a copy of @hashes
+ */
+ScreenshotTileHashes *
+screenshot_tile_hashes_copy (const ScreenshotTileHashes *hashes)
+{
+  ScreenshotTileHashes *copy;
+
+  copy = g_slice_dup (ScreenshotTileHashes, hashes);
+  copy->hashes = g_memdup (hashes->hashes,
+                           (gsize) hashes->columns * hashes->rows * sizeof (guint64));
+
+  return copy;
+}
+
+void
+screenshot_tile_hashes_free (ScreenshotTileHashes *hashes)
+{
+  g_free (hashes->hashes);
+  g_slice_free (ScreenshotTileHashes, hashes);
+}
+
+static gboolean
+same_size (const ScreenshotTileHashes *hashes,
+           const ScreenshotTileHashes *previous)
+{
+  return previous != NULL &&
+         previous->width == hashes->width && previous->height == hashes->height;
+}
+
+/**
+ * screenshot_tile_hashes_changed:
+ * @hashes: the hashes of a frame
+ * @previous: (nullable): the hashes of an earlier frame
+ *
+ * Returns: how many pixels of @hashes lie in tiles that differ from
+ *   @previous, all of them if it has another size or is %NULL
+ */
+guint64
+screenshot_tile_hashes_changed (const ScreenshotTileHashes *hashes,
+                                const ScreenshotTileHashes *previous)
+{
+  guint64 changed = 0;
+  gint x, y;
+
+  if (!same_size (hashes, previous))
+    return (guint64) hashes->width * hashes->height;
+
+  for (y = 0; y < hashes->rows; y++)
+    {
+      gint tile_height = MIN (SCREENSHOT_TILE_SIZE, hashes->height - y * SCREENSHOT_TILE_SIZE);
+
+      for (x = 0; x < hashes->columns; x++)
+        {
+          gsize i = (gsize) y * hashes->columns + x;
+
+          if (hashes->hashes[i] != previous->hashes[i])
+            changed += (guint64) tile_height *
+                       MIN (SCREENSHOT_TILE_SIZE, hashes->width - x * SCREENSHOT_TILE_SIZE);
+        }
+    }
+
+  return changed;
+}
+
+/**
+ * screenshot_tile_hashes_diff:
+ * @hashes: the hashes of a frame
+ * @previous: (nullable): the hashes of an earlier frame
+ *
+ * Returns: (transfer full) (element-type guint): the indices of the
+ *   tiles of @hashes that differ from @previous, row by row, all of them
+ *   if it has another size or is %NULL
+ */
+GArray *
+screenshot_tile_hashes_diff (const ScreenshotTileHashes *hashes,
+                             const ScreenshotTileHashes *previous)
+{
+  guint n_tiles = (guint) hashes->columns * hashes->rows;
+  gboolean all = !same_size (hashes, previous);
+  GArray *tiles;
+  guint i;
+
+  tiles = g_array_new (FALSE, FALSE, sizeof (guint));
+
+  for (i = 0; i < n_tiles; i++)
+    if (all || hashes->hashes[i] != previous->hashes[i])
+      g_array_append_val (tiles, i);
+
+  return tiles;
+}
@@ -0,0 +1,43 @@
+/* screenshot-tile-hash.h - which parts of a frame changed
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+#ifndef __SCREENSHOT_TILE_HASH_H__
+#define __SCREENSHOT_TILE_HASH_H__
+
+#include "screenshot-image.h"
+
+G_BEGIN_DECLS
+
+/* The side of a tile, in pixels */
+#define SCREENSHOT_TILE_SIZE 32
+
+typedef struct _ScreenshotTileHashes ScreenshotTileHashes;
+
+ScreenshotTileHashes *screenshot_tile_hashes_new     (ScreenshotImage            *image);
+ScreenshotTileHashes *screenshot_tile_hashes_copy    (const ScreenshotTileHashes *hashes);
+void                  screenshot_tile_hashes_free    (ScreenshotTileHashes       *hashes);
+
+guint64               screenshot_tile_hashes_changed (const ScreenshotTileHashes *hashes,
+                                                      const ScreenshotTileHashes *previous);
+GArray               *screenshot_tile_hashes_diff    (const ScreenshotTileHashes *hashes,
+                                                      const ScreenshotTileHashes *previous);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (ScreenshotTileHashes, screenshot_tile_hashes_free)
+
+G_END_DECLS
+
+#endif /* __SCREENSHOT_TILE_HASH_H__ */
@@ -0,0 +1,266 @@
+/* screenshot-trace.c - timing of the capture pipeline
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+/* Between the key press and the file there are a delay, a capture by the
+ * shell or the X server, effects, the choice of a file name, encoding and
+ * writing, partly in worker threads.  Each of them is a span here, which
+ * records when it started, how long it took and, where it applies, how
+ * many bytes it produced and which backend did the work.
+ *
+ * Nothing is recorded unless GNOME_SCREENSHOT_TRACE names a file, so the
+ * instrumentation costs a branch in normal use.  The spans are then
+ * written to that file in the Chrome trace event format, which
+ * about:tracing, Perfetto and speedscope open, after every screenshot and
+ * on exit.  When built with sysprof-capture, each span is also sent as a
+ * mark to Sysprof if it is recording.
+ *
+ * A long running instance, such as one keeping a history or watching the
+ * screen, keeps only the latest TRACE_MAX_SPANS spans, so that neither
+ * the list nor the time to write it out keeps growing.
+ *
+ * Spans are also recorded when metrics are enabled, which aggregate their
+ * durations and byte counts, see screenshot-metrics.c.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#ifdef HAVE_SYSPROF
+#include <sysprof-capture.h>
+#endif
+
+#include "screenshot-metrics.h"
+#include "screenshot-trace.h"
+
+struct _ScreenshotTraceSpan
+{
+  const gchar *name;
+  gint64 start;
+  gint64 duration;
+  gint thread;
+  guint64 bytes;
+  gboolean has_bytes;
+  gchar *backend;
+};
+
+/* dropped a quarter at a time, oldest first, once reached */
+#define TRACE_MAX_SPANS 4096
+
+static gchar *trace_path;
+static GMutex trace_lock;
+static GPtrArray *trace_events;
+
+static GPrivate thread_index;
+static gint n_threads;
+
+static void
+trace_span_free (ScreenshotTraceSpan *span)
+{
+  g_free (span->backend);
+  g_slice_free (ScreenshotTraceSpan, span);
+}
+
+/**
+ * screenshot_trace_is_enabled:
+ *
+ * Returns: whether spans are being recorded
+ */
+gboolean
+screenshot_trace_is_enabled (void)
+{
+  static gsize initialized = 0;
+
+  if (g_once_init_enter (&initialized))
+    {
+      const gchar *path = g_getenv ("GNOME_SCREENSHOT_TRACE");
+
+      if (path != NULL && path[0] != '\0')
+        {
+          trace_path = g_strdup (path);
+          trace_events = g_ptr_array_new_with_free_func ((GDestroyNotify) trace_span_free);
+          atexit (screenshot_trace_flush);
+        }
+
+      g_once_init_leave (&initialized, 1);
+    }
+
+  return trace_path != NULL;
+}
+
+/* Small, stable thread numbers, the main thread being 1 */
+static gint
+get_thread_index (void)
+{
+  gint index = GPOINTER_TO_INT (g_private_get (&thread_index));
+
+  if (index == 0)
+    {
+      index = g_atomic_int_add (&n_threads, 1) + 1;
+      g_private_set (&thread_index, GINT_TO_POINTER (index));
+    }
+
+  return index;
+}
+
+/**
+ * screenshot_trace_begin:
+ * @name: a static string naming the stage
+ *
+ * Starts timing a stage.  The span can be ended from another thread.
+ *
+ * Returns: (nullable): the span, or %NULL if neither tracing nor metrics
+ *   are on; every function taking a span accepts %NULL
+ */
+ScreenshotTraceSpan *
+screenshot_trace_begin (const gchar *name)
+{
+  ScreenshotTraceSpan *span;
+
+  if (!screenshot_trace_is_enabled () && !screenshot_metrics_is_enabled ())
+    return NULL;
+
+  span = g_slice_new0 (ScreenshotTraceSpan);
+  span->name = name;
+  span->thread = get_thread_index ();
+  span->start = g_get_monotonic_time ();
+
+  return span;
+}
+
+void
+screenshot_trace_set_bytes (ScreenshotTraceSpan *span,
+                            guint64              bytes)
+{
+  if (span == NULL)
+    return;
+
+  span->bytes = bytes;
+  span->has_bytes = TRUE;
+}
+
+void
+screenshot_trace_set_backend (ScreenshotTraceSpan *span,
+                              const gchar         *backend)
+{
+  if (span == NULL)
+    return;
+
+  g_free (span->backend);
+  span->backend = g_strdup (backend);
+}
+
+/**
+ * screenshot_trace_end:
+ * @span: (transfer full) (nullable): a span
+ *
+ * Records @span, which must not be used anymore.
+ */
+void
+screenshot_trace_end (ScreenshotTraceSpan *span)
+{
+  if (span == NULL)
+    return;
+
+  span->duration = g_get_monotonic_time () - span->start;
+
+#ifdef HAVE_SYSPROF
+  {
+    g_autofree gchar *message = NULL;
+
+    message = g_strdup_printf ("backend=%s bytes=%" G_GUINT64_FORMAT,
+                               span->backend != NULL ? span->backend : "-",
+                               span->bytes);
+    sysprof_collector_mark (span->start * 1000, span->duration * 1000,
+                            "gnome-screenshot", span->name, message);
+  }
+#endif
+
+  screenshot_metrics_observe_stage (span->name, span->duration,
+                                    span->has_bytes, span->bytes);
+
+  if (!screenshot_trace_is_enabled ())
+    {
+      trace_span_free (span);
+      return;
+    }
+
+  g_mutex_lock (&trace_lock);
+  if (trace_events->len >= TRACE_MAX_SPANS)
+    g_ptr_array_remove_range (trace_events, 0, TRACE_MAX_SPANS / 4);
+  g_ptr_array_add (trace_events, span);
+  g_mutex_unlock (&trace_lock);
+}
+
+/**
+ * screenshot_trace_flush:
+ *
+ * Writes the spans kept so far to the trace file, replacing it.
+ */
+void
+screenshot_trace_flush (void)
+{
+  g_autoptr(GString) json = NULL;
+  g_autoptr(GError) error = NULL;
+  gint pid = getpid ();
+  guint i;
+
+  if (!screenshot_trace_is_enabled ())
+    return;
+
+  json = g_string_new ("{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+  g_string_append_printf (json,
+                          "  {\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, "
+                          "\"args\": {\"name\": \"gnome-screenshot\"}}",
+                          pid);
+
+  g_mutex_lock (&trace_lock);
+
+  for (i = 0; i < trace_events->len; i++)
+    {
+      ScreenshotTraceSpan *span = g_ptr_array_index (trace_events, i);
+
+      g_string_append_printf (json,
+                              ",\n  {\"name\": \"%s\", \"cat\": \"capture\", \"ph\": \"X\", "
+                              "\"ts\": %" G_GINT64_FORMAT ", \"dur\": %" G_GINT64_FORMAT ", "
+                              "\"pid\": %d, \"tid\": %d, \"args\": {",
+                              span->name, span->start, span->duration,
+                              pid, span->thread);
+
+      if (span->backend != NULL)
+        {
+          g_autofree gchar *backend = g_strescape (span->backend, NULL);
+
+          g_string_append_printf (json, "\"backend\": \"%s\"", backend);
+        }
+
+      if (span->has_bytes)
+        g_string_append_printf (json, "%s\"bytes\": %" G_GUINT64_FORMAT,
+                                span->backend != NULL ? ", " : "",
+                                span->bytes);
+
+      g_string_append (json, "}}");
+    }
+
+  g_mutex_unlock (&trace_lock);
+
+  g_string_append (json, "\n]}\n");
+
+  if (!g_file_set_contents (trace_path, json->str, json->len, &error))
+    g_warning ("Unable to write the trace to %s: %s", trace_path, error->message);
+}
@@ -0,0 +1,40 @@
+/* screenshot-trace.h - timing of the capture pipeline
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+#ifndef __SCREENSHOT_TRACE_H__
+#define __SCREENSHOT_TRACE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _ScreenshotTraceSpan ScreenshotTraceSpan;
+
+gboolean             screenshot_trace_is_enabled  (void);
+
+ScreenshotTraceSpan *screenshot_trace_begin       (const gchar         *name);
+void                 screenshot_trace_set_bytes   (ScreenshotTraceSpan *span,
+                                                   guint64              bytes);
+void                 screenshot_trace_set_backend (ScreenshotTraceSpan *span,
+                                                   const gchar         *backend);
+void                 screenshot_trace_end         (ScreenshotTraceSpan *span);
+
+void                 screenshot_trace_flush       (void);
+
+G_END_DECLS
+
+#endif /* __SCREENSHOT_TRACE_H__ */
@@ -26,7 +26,12 @@
 #include <glib/gi18n.h>
 #include <glib/gstdio.h>
 #include <canberra-gtk.h>
+#include <gio/gunixoutputstream.h>
+#include <errno.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include <X11/Xutil.h>
 
 #ifdef HAVE_X11_EXTENSIONS_SHAPE_H
 #include <X11/extensions/shape.h>
@@ -34,7 +39,12 @@
 
 #include "cheese-flash.h"
 #include "screenshot-application.h"
-#include "screenshot-config.h"
+#include "screenshot-encoder.h"
+#include "screenshot-image.h"
+#include "screenshot-mask.h"
+#include "screenshot-stream.h"
+#include "screenshot-metrics.h"
+#include "screenshot-trace.h"
 #include "screenshot-utils.h"
 
 static GdkWindow *
@@ -115,82 +125,13 @@ make_region_with_monitors (GdkScreen *screen)
   return region;
 }
 
-static void
-blank_rectangle_in_pixbuf (GdkPixbuf *pixbuf, GdkRectangle *rect)
-{
-  int x, y;
-  int x2, y2;
-  guchar *pixels;
-  int rowstride;
-  int n_channels;
-  guchar *row;
-  gboolean has_alpha;
-
-  g_assert (gdk_pixbuf_get_colorspace (pixbuf) == GDK_COLORSPACE_RGB);
-
-  x2 = rect->x + rect->width;
-  y2 = rect->y + rect->height;
-
-  pixels = gdk_pixbuf_get_pixels (pixbuf);
-  rowstride = gdk_pixbuf_get_rowstride (pixbuf);
-  has_alpha = gdk_pixbuf_get_has_alpha (pixbuf);
-  n_channels = gdk_pixbuf_get_n_channels (pixbuf);
-
-  for (y = rect->y; y < y2; y++)
-    {
-      guchar *p;
-
-      row = pixels + y * rowstride;
-      p = row + rect->x * n_channels;
-
-      for (x = rect->x; x < x2; x++)
-        {
-          *p++ = 0;
-          *p++ = 0;
-          *p++ = 0;
-
-          if (has_alpha)
-            *p++ = 255; /* opaque black */
-        }
-    }
-}
-
-static void
-blank_region_in_pixbuf (GdkPixbuf *pixbuf, cairo_region_t *region)
-{
-  int n_rects;
-  int i;
-  int width, height;
-  cairo_rectangle_int_t pixbuf_rect;
-
-  n_rects = cairo_region_num_rectangles (region);
-
-  width = gdk_pixbuf_get_width (pixbuf);
-  height = gdk_pixbuf_get_height (pixbuf);
-
-  pixbuf_rect.x      = 0;
-  pixbuf_rect.y      = 0;
-  pixbuf_rect.width  = width;
-  pixbuf_rect.height = height;
-
-  for (i = 0; i < n_rects; i++)
-    {
-      cairo_rectangle_int_t rect, dest;
-
-      cairo_region_get_rectangle (region, i, &rect);
-      if (gdk_rectangle_intersect (&rect, &pixbuf_rect, &dest))
-        blank_rectangle_in_pixbuf (pixbuf, &dest);
-    }
-}
-
 /* When there are multiple monitors with different resolutions, the visible area
  * within the root window may not be rectangular (it may have an L-shape, for
- * example).  In that case, mask out the areas of the root window which would
- * not be visible in the monitors, so that screenshot do not end up with content
- * that the user won't ever see.
+ * example).  Returns the areas of the root window which would not be visible
+ * in the monitors.
  */
-static void
-mask_monitors (GdkPixbuf *pixbuf, GdkWindow *root_window)
+static cairo_region_t *
+get_invisible_region (GdkWindow *root_window)
 {
   GdkScreen *screen;
   cairo_region_t *region_with_monitors;
@@ -209,9 +150,21 @@ mask_monitors (GdkPixbuf *pixbuf, GdkWindow *root_window)
   invisible_region = cairo_region_create_rectangle (&rect);
   cairo_region_subtract (invisible_region, region_with_monitors);
 
-  blank_region_in_pixbuf (pixbuf, invisible_region);
-
   cairo_region_destroy (region_with_monitors);
+
+  return invisible_region;
+}
+
+/* Masks out the invisible areas, so that screenshot do not end up with
+ * content that the user won't ever see.
+ */
+static void
+mask_monitors (cairo_surface_t *surface, GdkWindow *root_window)
+{
+  cairo_region_t *invisible_region;
+
+  invisible_region = get_invisible_region (root_window);
+  screenshot_mask_surface (surface, invisible_region);
   cairo_region_destroy (invisible_region);
 }
 
@@ -308,7 +261,8 @@ screenshot_play_sound_effect (const gchar *event_id,
 
 static void
 screenshot_fallback_fire_flash (GdkWindow *window,
-                                GdkRectangle *rectangle)
+                                GdkRectangle *rectangle,
+                                gboolean include_border)
 {
   GdkRectangle rect;
   CheeseFlash *flash = NULL;
@@ -317,7 +271,7 @@ screenshot_fallback_fire_flash (GdkWindow *window,
     rect = *rectangle;
   else
     screenshot_fallback_get_window_rect_coords (window,
-                                                screenshot_config->include_border,
+                                                include_border,
                                                 NULL,
                                                 &rect);
 
@@ -357,17 +311,19 @@ do_find_current_window (void)
   return current_window;
 }
 
+/* Falls back to the whole screen when there is no window to capture,
+ * which the request then records */
 static GdkWindow *
-screenshot_fallback_find_current_window (void)
+screenshot_fallback_find_current_window (ScreenshotCaptureOptions *options)
 {
   GdkWindow *window = NULL;
 
-  if (screenshot_config->take_window_shot)
+  if (options->take_window_shot)
     {
       window = do_find_current_window ();
 
       if (window == NULL)
-        screenshot_config->take_window_shot = FALSE;
+        options->take_window_shot = FALSE;
     }
 
   if (window == NULL)
@@ -376,20 +332,51 @@ screenshot_fallback_find_current_window (void)
   return window;
 }
 
-static GdkPixbuf *
-screenshot_fallback_get_pixbuf (GdkRectangle *rectangle)
+/**
+ * screenshot_get_window_rectangle:
+ * @include_border: whether to include the frame of the window
+ * @rectangle: (out): where the current window is on the screen
+ *
+ * Returns: whether there is a current window, which only X11 tells
+ */
+gboolean
+screenshot_get_window_rectangle (gboolean      include_border,
+                                 GdkRectangle *rectangle)
+{
+  GdkWindow *window;
+
+  if (!GDK_IS_X11_DISPLAY (gdk_display_get_default ()))
+    return FALSE;
+
+  window = do_find_current_window ();
+  if (window == NULL)
+    return FALSE;
+
+  screenshot_fallback_get_window_rect_coords (window, include_border, NULL, rectangle);
+
+  return TRUE;
+}
+
+/* Captures natively: the pixels stay in the X server's format, and are
+ * only converted if something asks the image for a pixbuf. */
+static ScreenshotImage *
+screenshot_fallback_get_image (ScreenshotCaptureOptions *options,
+                               GdkRectangle             *rectangle)
 {
   GdkWindow *root, *wm_window = NULL;
-  GdkPixbuf *screenshot = NULL;
+  cairo_surface_t *screenshot = NULL;
+  ScreenshotImage *image;
   GdkRectangle real_coords, screenshot_coords;
   Window wm;
   GtkBorder frame_offset = { 0, 0, 0, 0 };
   GdkWindow *window;
+  cairo_t *cr;
+  gint root_scale;
 
-  window = screenshot_fallback_find_current_window ();
+  window = screenshot_fallback_find_current_window (options);
 
   screenshot_fallback_get_window_rect_coords (window,
-                                              screenshot_config->include_border,
+                                              options->include_border,
                                               &real_coords,
                                               &screenshot_coords);
 
@@ -420,17 +407,27 @@ screenshot_fallback_get_pixbuf (GdkRectangle *rectangle)
       screenshot_coords.height = rectangle->height;
     }
 
+  /* what gdk_pixbuf_get_from_window() does, without the conversion;
+   * the surface is in device pixels and drawn to in display pixels */
   root = gdk_get_default_root_window ();
-  screenshot = gdk_pixbuf_get_from_window (root,
-                                           screenshot_coords.x, screenshot_coords.y,
-                                           screenshot_coords.width, screenshot_coords.height);
-
-  if (!screenshot_config->take_window_shot &&
-      !screenshot_config->take_area_shot)
+  root_scale = gdk_window_get_scale_factor (root);
+  screenshot = cairo_image_surface_create (CAIRO_FORMAT_RGB24,
+                                           screenshot_coords.width * root_scale,
+                                           screenshot_coords.height * root_scale);
+  cairo_surface_set_device_scale (screenshot, root_scale, root_scale);
+
+  cr = cairo_create (screenshot);
+  cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+  gdk_cairo_set_source_window (cr, root, -screenshot_coords.x, -screenshot_coords.y);
+  cairo_paint (cr);
+  cairo_destroy (cr);
+
+  if (!options->take_window_shot &&
+      !options->take_area_shot)
     mask_monitors (screenshot, root);
 
 #ifdef HAVE_X11_EXTENSIONS_SHAPE_H
-  if (screenshot_config->include_border && (wm != None))
+  if (options->include_border && (wm != None))
     {
       XRectangle *rectangles;
       int rectangle_count, rectangle_order, i;
@@ -446,17 +443,13 @@ screenshot_fallback_get_pixbuf (GdkRectangle *rectangle)
       if (rectangles && rectangle_count > 0)
         {
           int scale_factor = gdk_window_get_scale_factor (wm_window);
-          gboolean has_alpha = gdk_pixbuf_get_has_alpha (screenshot);
-          GdkPixbuf *tmp = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8,
-                                           gdk_pixbuf_get_width (screenshot),
-                                           gdk_pixbuf_get_height (screenshot));
-          gdk_pixbuf_fill (tmp, 0);
+          cairo_region_t *shape = cairo_region_create ();
+          cairo_surface_t *tmp;
 
           for (i = 0; i < rectangle_count; i++)
             {
               gint rec_x, rec_y;
               gint rec_width, rec_height;
-              gint y;
 
               /* If we're using invisible borders, the ShapeBounding might not
                * have the same size as the frame extents, as it would include the
@@ -493,34 +486,19 @@ screenshot_fallback_get_pixbuf (GdkRectangle *rectangle)
               if (screenshot_coords.y + rec_y + rec_height > gdk_screen_height ())
                 rec_height = gdk_screen_height () - screenshot_coords.y - rec_y;
 
-              /* Undo the scale factor in order to copy the pixbuf data pixel-wise */
-              for (y = rec_y * scale_factor; y < (rec_y + rec_height) * scale_factor; y++)
+              if (rec_width > 0 && rec_height > 0)
                 {
-                  guchar *src_pixels, *dest_pixels;
-                  gint x;
-
-                  src_pixels = gdk_pixbuf_get_pixels (screenshot)
-                             + y * gdk_pixbuf_get_rowstride(screenshot)
-                             + rec_x * scale_factor * (has_alpha ? 4 : 3);
-                  dest_pixels = gdk_pixbuf_get_pixels (tmp)
-                              + y * gdk_pixbuf_get_rowstride (tmp)
-                              + rec_x * scale_factor * 4;
-
-                  for (x = 0; x < rec_width * scale_factor; x++)
-                    {
-                      *dest_pixels++ = *src_pixels++;
-                      *dest_pixels++ = *src_pixels++;
-                      *dest_pixels++ = *src_pixels++;
-
-                      if (has_alpha)
-                        *dest_pixels++ = *src_pixels++;
-                      else
-                        *dest_pixels++ = 255;
-                    }
+                  cairo_rectangle_int_t rect = { rec_x, rec_y, rec_width, rec_height };
+
+                  cairo_region_union_rectangle (shape, &rect);
                 }
             }
 
-          g_set_object (&screenshot, tmp);
+          tmp = screenshot_copy_shaped_surface (screenshot, shape);
+          cairo_region_destroy (shape);
+
+          cairo_surface_destroy (screenshot);
+          screenshot = tmp;
 
           XFree (rectangles);
         }
@@ -529,7 +507,7 @@ screenshot_fallback_get_pixbuf (GdkRectangle *rectangle)
 
   /* if we have a selected area, there were by definition no cursor in the
    * screenshot */
-  if (screenshot_config->include_pointer && !rectangle)
+  if (options->include_pointer && !rectangle)
     {
       g_autoptr(GdkCursor) cursor = NULL;
       g_autoptr(GdkPixbuf) cursor_pixbuf = NULL;
@@ -570,45 +548,49 @@ screenshot_fallback_get_pixbuf (GdkRectangle *rectangle)
 
               cursor_x = cx - xhot - frame_offset.left;
               cursor_y = cy - yhot - frame_offset.top;
-              gdk_pixbuf_composite (cursor_pixbuf, screenshot,
-                                    cursor_x, cursor_y,
-                                    rect.width, rect.height,
-                                    cursor_x, cursor_y,
-                                    1.0, 1.0,
-                                    GDK_INTERP_BILINEAR,
-                                    255);
+
+              /* only the cursor itself is converted */
+              cr = cairo_create (screenshot);
+              gdk_cairo_set_source_pixbuf (cr, cursor_pixbuf, cursor_x, cursor_y);
+              cairo_rectangle (cr, cursor_x, cursor_y, rect.width, rect.height);
+              cairo_fill (cr);
+              cairo_destroy (cr);
             }
         }
     }
 
-  screenshot_fallback_fire_flash (window, rectangle);
+  if (options->flash)
+    screenshot_fallback_fire_flash (window, rectangle, options->include_border);
 
-  return screenshot;
+  /* the image is in device pixels, as the pixbuf used to be */
+  cairo_surface_set_device_scale (screenshot, 1, 1);
+  image = screenshot_image_new_for_surface (screenshot);
+  cairo_surface_destroy (screenshot);
+
+  return image;
 }
 
-static GdkPixbuf *
-screenshot_shell_get_pixbuf (GdkRectangle *rectangle)
+/* Asks the shell to write a PNG of the screen, a window or @rectangle to
+ * @filename.
+ */
+static gboolean
+screenshot_shell_capture_to_file (GDBusConnection                 *connection,
+                                  const ScreenshotCaptureOptions  *options,
+                                  GdkRectangle                    *rectangle,
+                                  const gchar                     *filename,
+                                  GError                         **error)
 {
-  g_autoptr(GError) error = NULL;
-  g_autofree gchar *path = NULL, *filename = NULL, *tmpname = NULL;
-  GdkPixbuf *screenshot = NULL;
+  g_autoptr(GVariant) result = NULL;
   const gchar *method_name;
   GVariant *method_params;
-  GDBusConnection *connection;
-
-  path = g_build_filename (g_get_user_cache_dir (), "gnome-screenshot", NULL);
-  g_mkdir_with_parents (path, 0700);
 
-  tmpname = g_strdup_printf ("scr-%d.png", g_random_int ());
-  filename = g_build_filename (path, tmpname, NULL);
-
-  if (screenshot_config->take_window_shot)
+  if (options->take_window_shot)
     {
       method_name = "ScreenshotWindow";
       method_params = g_variant_new ("(bbbs)",
-                                     screenshot_config->include_border,
-                                     screenshot_config->include_pointer,
-                                     TRUE, /* flash */
+                                     options->include_border,
+                                     options->include_pointer,
+                                     options->flash,
                                      filename);
     }
   else if (rectangle != NULL)
@@ -617,65 +599,841 @@ screenshot_shell_get_pixbuf (GdkRectangle *rectangle)
       method_params = g_variant_new ("(iiiibs)",
                                      rectangle->x, rectangle->y,
                                      rectangle->width, rectangle->height,
-                                     TRUE, /* flash */
+                                     options->flash,
                                      filename);
     }
   else
     {
       method_name = "Screenshot";
       method_params = g_variant_new ("(bbs)",
-                                     screenshot_config->include_pointer,
-                                     TRUE, /* flash */
+                                     options->include_pointer,
+                                     options->flash,
                                      filename);
     }
 
-  connection = g_application_get_dbus_connection (g_application_get_default ());
-  g_dbus_connection_call_sync (connection,
-                               "org.gnome.Shell.Screenshot",
-                               "/org/gnome/Shell/Screenshot",
-                               "org.gnome.Shell.Screenshot",
-                               method_name,
-                               method_params,
-                               NULL,
-                               G_DBUS_CALL_FLAGS_NONE,
-                               -1,
-                               NULL,
-                               &error);
+  result = g_dbus_connection_call_sync (connection,
+                                        "org.gnome.Shell.Screenshot",
+                                        "/org/gnome/Shell/Screenshot",
+                                        "org.gnome.Shell.Screenshot",
+                                        method_name,
+                                        method_params,
+                                        NULL,
+                                        G_DBUS_CALL_FLAGS_NONE,
+                                        -1,
+                                        NULL,
+                                        error);
+
+  return result != NULL;
+}
 
-  if (error == NULL)
-    {
-      screenshot = gdk_pixbuf_new_from_file (filename, &error);
+static gchar *
+get_shell_tmp_filename (void)
+{
+  g_autofree gchar *path = NULL, *tmpname = NULL;
+
+  path = g_build_filename (g_get_user_cache_dir (), "gnome-screenshot", NULL);
+  g_mkdir_with_parents (path, 0700);
+
+  tmpname = g_strdup_printf ("scr-%d.png", g_random_int ());
+
+  return g_build_filename (path, tmpname, NULL);
+}
+
+static ScreenshotImage *
+screenshot_shell_get_image (const ScreenshotCaptureOptions *options,
+                            GdkRectangle                   *rectangle)
+{
+  g_autoptr(GError) error = NULL;
+  g_autofree gchar *filename = get_shell_tmp_filename ();
+  g_autoptr(GdkPixbuf) pixbuf = NULL;
+  GDBusConnection *connection;
+  ScreenshotTraceSpan *span;
 
-      /* remove the temporary file created by the shell */
-      g_unlink (filename);
+  span = screenshot_trace_begin ("shell-capture");
+  connection = g_application_get_dbus_connection (g_application_get_default ());
+  if (!screenshot_shell_capture_to_file (connection, options, rectangle, filename, &error))
+    {
+      screenshot_trace_set_backend (span, "failed");
+      screenshot_trace_end (span);
+      return NULL;
     }
+  screenshot_trace_end (span);
 
-  return screenshot;
+  /* the shell hands the capture over as a PNG file */
+  span = screenshot_trace_begin ("shell-decode");
+  pixbuf = gdk_pixbuf_new_from_file (filename, &error);
+  if (pixbuf != NULL)
+    screenshot_trace_set_bytes (span, gdk_pixbuf_get_byte_length (pixbuf));
+  screenshot_trace_end (span);
+
+  /* remove the temporary file created by the shell */
+  g_unlink (filename);
+
+  if (pixbuf == NULL)
+    return NULL;
+
+  return screenshot_image_new_for_pixbuf (pixbuf);
 }
 
-GdkPixbuf *
-screenshot_get_pixbuf (GdkRectangle *rectangle)
+/**
+ * screenshot_get_image:
+ * @options: what to capture
+ * @rectangle: (nullable): the area to capture, for area captures
+ *
+ * Captures through the shell, or X11 when it is not there.  A window
+ * capture becomes one of the screen when there is no window to take,
+ * which is then recorded in @options.
+ */
+ScreenshotImage *
+screenshot_get_image (ScreenshotCaptureOptions *options,
+                      GdkRectangle             *rectangle)
 {
-  GdkPixbuf *screenshot = NULL;
+  ScreenshotImage *screenshot = NULL;
+  ScreenshotTraceSpan *span;
   gboolean force_fallback;
 
+  span = screenshot_trace_begin ("capture");
+
   force_fallback = g_getenv ("GNOME_SCREENSHOT_FORCE_FALLBACK") != NULL;
   if (!force_fallback)
     {
-      screenshot = screenshot_shell_get_pixbuf (rectangle);
+      screenshot = screenshot_shell_get_image (options, rectangle);
       if (!screenshot)
         g_message ("Unable to use GNOME Shell's builtin screenshot interface, "
                    "resorting to fallback X11.");
+      else
+        {
+          screenshot_trace_set_backend (span, "shell");
+          screenshot_metrics_count_backend ("shell", FALSE);
+        }
     }
   else
     g_message ("Using fallback X11 as requested");
 
   if (!screenshot)
-    screenshot = screenshot_fallback_get_pixbuf (rectangle);
+    {
+      screenshot = screenshot_fallback_get_image (options, rectangle);
+      screenshot_trace_set_backend (span, "x11");
+      if (screenshot != NULL)
+        screenshot_metrics_count_backend ("x11", !force_fallback);
+    }
+
+  /* in the form it was captured in, see screenshot-image.c */
+  if (span != NULL && screenshot != NULL)
+    {
+      ScreenshotImagePixels pixels;
+
+      screenshot_image_peek_pixels (screenshot, &pixels);
+      screenshot_trace_set_bytes (span, (guint64) pixels.rowstride *
+                                  screenshot_image_get_height (screenshot));
+    }
+  screenshot_trace_end (span);
 
   return screenshot;
 }
 
+/* Returns the 8 bit value of the channel selected by @mask in @pixel */
+static guchar
+get_channel_value (gulong pixel,
+                   gulong mask)
+{
+  gulong value;
+  gint shift, bits;
+
+  if (mask == 0)
+    return 0;
+
+  shift = g_bit_nth_lsf (mask, -1);
+  bits = g_bit_storage (mask >> shift);
+  value = (pixel & mask) >> shift;
+
+  if (bits >= 8)
+    return value >> (bits - 8);
+
+  return value * 255 / ((1 << bits) - 1);
+}
+
+/* Converts the rows of a ZPixmap image to RGB */
+static void
+ximage_to_rgb (XImage *image,
+               guchar *dest,
+               gint    dest_rowstride)
+{
+  gint x, y;
+
+  /* what every X server nowadays uses */
+  if (image->bits_per_pixel == 32 &&
+      image->red_mask == 0xff0000 &&
+      image->green_mask == 0x00ff00 &&
+      image->blue_mask == 0x0000ff &&
+      image->byte_order == (G_BYTE_ORDER == G_LITTLE_ENDIAN ? LSBFirst : MSBFirst))
+    {
+      for (y = 0; y < image->height; y++)
+        {
+          const guint32 *src = (const guint32 *) (image->data + y * image->bytes_per_line);
+          guchar *d = dest + y * dest_rowstride;
+
+          for (x = 0; x < image->width; x++)
+            {
+              guint32 pixel = src[x];
+
+              *d++ = pixel >> 16;
+              *d++ = pixel >> 8;
+              *d++ = pixel;
+            }
+        }
+
+      return;
+    }
+
+  for (y = 0; y < image->height; y++)
+    {
+      guchar *d = dest + y * dest_rowstride;
+
+      for (x = 0; x < image->width; x++)
+        {
+          gulong pixel = XGetPixel (image, x, y);
+
+          *d++ = get_channel_value (pixel, image->red_mask);
+          *d++ = get_channel_value (pixel, image->green_mask);
+          *d++ = get_channel_value (pixel, image->blue_mask);
+        }
+    }
+}
+
+/* Blends the part of the cursor image at (@cursor_x, @cursor_y) that falls
+ * on the RGB rows of @strip_rect.
+ */
+static void
+composite_cursor_in_strip (guchar       *strip,
+                           gint          rowstride,
+                           GdkRectangle *strip_rect,
+                           GdkPixbuf    *cursor,
+                           gint          cursor_x,
+                           gint          cursor_y)
+{
+  GdkRectangle cursor_rect, dest;
+  const guchar *cursor_pixels;
+  gint cursor_rowstride, n_channels;
+  gint x, y;
+
+  cursor_rect.x = cursor_x;
+  cursor_rect.y = cursor_y;
+  cursor_rect.width = gdk_pixbuf_get_width (cursor);
+  cursor_rect.height = gdk_pixbuf_get_height (cursor);
+
+  if (!gdk_rectangle_intersect (&cursor_rect, strip_rect, &dest))
+    return;
+
+  cursor_pixels = gdk_pixbuf_read_pixels (cursor);
+  cursor_rowstride = gdk_pixbuf_get_rowstride (cursor);
+  n_channels = gdk_pixbuf_get_n_channels (cursor);
+
+  for (y = dest.y; y < dest.y + dest.height; y++)
+    {
+      const guchar *s = cursor_pixels
+                      + (y - cursor_y) * cursor_rowstride
+                      + (dest.x - cursor_x) * n_channels;
+      guchar *d = strip
+                + (y - strip_rect->y) * rowstride
+                + (dest.x - strip_rect->x) * 3;
+
+      for (x = 0; x < dest.width; x++)
+        {
+          guint alpha = n_channels == 4 ? s[3] : 255;
+          gint i;
+
+          for (i = 0; i < 3; i++)
+            d[i] = (s[i] * alpha + d[i] * (255 - alpha) + 127) / 255;
+
+          s += n_channels;
+          d += 3;
+        }
+    }
+}
+
+typedef struct {
+  /* only the flags are read, from the capture thread */
+  ScreenshotCaptureOptions options;
+  GdkRectangle rectangle;
+  gboolean has_rectangle;
+
+  GFile *file;
+  GFile *tmp_file;
+  GOutputStream *os;
+  gint fd;
+  gboolean overwrite;
+  gchar *format;
+
+  GDBusConnection *connection;
+  gboolean force_fallback;
+  gboolean shell_captured;
+
+  /* for the X11 fallback: a copy of the area kept by the X server, read
+   * back by the thread over a connection of its own */
+  gchar *display_name;
+  Pixmap snapshot;
+  GdkRectangle area;
+  gint scale;
+  cairo_region_t *invisible_region;
+  GdkPixbuf *cursor_pixbuf;
+  gint cursor_x;
+  gint cursor_y;
+} StreamCaptureJob;
+
+static void
+stream_capture_job_free (StreamCaptureJob *job)
+{
+  g_clear_object (&job->file);
+  g_clear_object (&job->tmp_file);
+  g_clear_object (&job->os);
+  g_free (job->format);
+  g_clear_object (&job->connection);
+  g_free (job->display_name);
+  g_clear_pointer (&job->invisible_region, cairo_region_destroy);
+  g_clear_object (&job->cursor_pixbuf);
+
+  g_slice_free (StreamCaptureJob, job);
+}
+
+static GdkRectangle *
+stream_capture_job_get_rectangle (StreamCaptureJob *job)
+{
+  return job->has_rectangle ? &job->rectangle : NULL;
+}
+
+/* Opens the temporary file next to the destination, or the descriptor */
+static gboolean
+stream_capture_open (StreamCaptureJob  *job,
+                     GError           **error)
+{
+  if (job->os != NULL)
+    return TRUE;
+
+  if (job->file == NULL)
+    {
+      job->os = g_unix_output_stream_new (job->fd, FALSE);
+      return TRUE;
+    }
+
+  if (!job->overwrite && g_file_query_exists (job->file, NULL))
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_EXISTS,
+                           g_strerror (EEXIST));
+      return FALSE;
+    }
+
+  job->os = G_OUTPUT_STREAM (screenshot_create_tmp_file (job->file, &job->tmp_file,
+                                                         NULL, error));
+
+  return job->os != NULL;
+}
+
+/* Closes the stream and moves the temporary file into place if @res,
+ * or removes it otherwise.
+ */
+static gboolean
+stream_capture_close (StreamCaptureJob  *job,
+                      gboolean           res,
+                      GError           **error)
+{
+  if (res && !g_output_stream_is_closed (job->os))
+    {
+      if (job->tmp_file != NULL)
+        res = screenshot_close_tmp_file (G_FILE_OUTPUT_STREAM (job->os), NULL, error);
+      else
+        res = g_output_stream_close (job->os, NULL, error);
+    }
+
+  if (job->tmp_file != NULL)
+    {
+      if (res)
+        res = g_file_move (job->tmp_file, job->file,
+                           job->overwrite ? G_FILE_COPY_OVERWRITE : G_FILE_COPY_NONE,
+                           NULL, NULL, NULL, error);
+
+      if (!res)
+        g_file_delete (job->tmp_file, NULL, NULL);
+    }
+
+  return res;
+}
+
+static gboolean
+write_to_output_stream (const gchar  *buf,
+                        gsize         count,
+                        GError      **error,
+                        gpointer      data)
+{
+  return g_output_stream_write_all (G_OUTPUT_STREAM (data), buf, count,
+                                    NULL, NULL, error);
+}
+
+/* Takes what the X11 fallback needs from GDK, which only the main thread
+ * may use, and copies the area to a pixmap so that the screen is taken
+ * now, and the flash can fire before the first strip is encoded.
+ */
+static gboolean
+stream_fallback_prepare (StreamCaptureJob  *job,
+                         GError           **error)
+{
+  GdkRectangle *rectangle = stream_capture_job_get_rectangle (job);
+  GdkWindow *root;
+  GdkDisplay *display;
+  Display *xdisplay;
+  GdkRectangle root_rect;
+  XGCValues values;
+  GC gc;
+
+  root = gdk_get_default_root_window ();
+  display = gdk_window_get_display (root);
+  xdisplay = GDK_DISPLAY_XDISPLAY (display);
+  job->scale = gdk_window_get_scale_factor (root);
+
+  root_rect.x = 0;
+  root_rect.y = 0;
+  root_rect.width = gdk_window_get_width (root);
+  root_rect.height = gdk_window_get_height (root);
+
+  if (rectangle == NULL)
+    job->area = root_rect;
+  else if (!gdk_rectangle_intersect (rectangle, &root_rect, &job->area))
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                           _("The selected area is not on the screen"));
+      return FALSE;
+    }
+
+  if (rectangle == NULL)
+    {
+      job->invisible_region = get_invisible_region (root);
+
+      /* as in screenshot_fallback_get_image(), only on full screens */
+      if (job->options.include_pointer)
+        {
+          g_autoptr(GdkCursor) cursor = NULL;
+
+          cursor = gdk_cursor_new_for_display (display, GDK_LEFT_PTR);
+          job->cursor_pixbuf = gdk_cursor_get_image (cursor);
+        }
+
+      if (job->cursor_pixbuf != NULL)
+        {
+          GdkDeviceManager *manager;
+          GdkDevice *device;
+          gint cx, cy, xhot, yhot;
+
+          manager = gdk_display_get_device_manager (display);
+          device = gdk_device_manager_get_client_pointer (manager);
+          gdk_window_get_device_position (root, device, &cx, &cy, NULL);
+
+          sscanf (gdk_pixbuf_get_option (job->cursor_pixbuf, "x_hot"), "%d", &xhot);
+          sscanf (gdk_pixbuf_get_option (job->cursor_pixbuf, "y_hot"), "%d", &yhot);
+
+          job->cursor_x = (cx - xhot) * job->scale;
+          job->cursor_y = (cy - yhot) * job->scale;
+        }
+    }
+
+  /* the X server works in device pixels */
+  job->area.x *= job->scale;
+  job->area.y *= job->scale;
+  job->area.width *= job->scale;
+  job->area.height *= job->scale;
+
+  /* the copy lives in the X server, not in this process */
+  gdk_x11_display_error_trap_push (display);
+  job->snapshot = XCreatePixmap (xdisplay, GDK_WINDOW_XID (root),
+                                 job->area.width, job->area.height,
+                                 gdk_visual_get_depth (gdk_window_get_visual (root)));
+  values.subwindow_mode = IncludeInferiors;
+  gc = XCreateGC (xdisplay, job->snapshot, GCSubwindowMode, &values);
+  XCopyArea (xdisplay, GDK_WINDOW_XID (root), job->snapshot, gc,
+             job->area.x, job->area.y, job->area.width, job->area.height, 0, 0);
+  XFreeGC (xdisplay, gc);
+
+  if (gdk_x11_display_error_trap_pop (display) != 0)
+    {
+      gdk_x11_display_error_trap_push (display);
+      XFreePixmap (xdisplay, job->snapshot);
+      gdk_x11_display_error_trap_pop_ignored (display);
+      job->snapshot = None;
+
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                           _("Unable to read the screen"));
+      return FALSE;
+    }
+
+  job->display_name = g_strdup (DisplayString (xdisplay));
+
+  return TRUE;
+}
+
+/* The X11 counterpart of screenshot_fallback_get_image() for the screen
+ * or an area: reads the copy made by stream_fallback_prepare() a band at
+ * a time and feeds each band to the encoder.
+ */
+static gboolean
+stream_fallback_read (StreamCaptureJob   *job,
+                      GdkPixbufSaveFunc   save_func,
+                      gpointer            user_data,
+                      GError            **error)
+{
+  g_autoptr(ScreenshotStreamEncoder) encoder = NULL;
+  g_autofree guchar *strip = NULL;
+  Display *xdisplay;
+  Visual *visual;
+  gint rowstride, y;
+  gboolean res = FALSE;
+
+  /* GDK's connection belongs to the main thread */
+  xdisplay = XOpenDisplay (job->display_name);
+  if (xdisplay == NULL)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                           _("Unable to read the screen"));
+      return FALSE;
+    }
+
+  visual = DefaultVisual (xdisplay, DefaultScreen (xdisplay));
+
+  encoder = screenshot_stream_encoder_new (job->format, job->area.width,
+                                           job->area.height, 3,
+                                           save_func, user_data, error);
+  if (encoder == NULL)
+    goto out;
+
+  rowstride = job->area.width * 3;
+  strip = g_malloc ((gsize) rowstride * SCREENSHOT_STREAM_STRIP_HEIGHT);
+
+  for (y = 0; y < job->area.height; y += SCREENSHOT_STREAM_STRIP_HEIGHT)
+    {
+      GdkRectangle strip_rect;
+      XImage *image;
+
+      strip_rect.x = job->area.x;
+      strip_rect.y = job->area.y + y;
+      strip_rect.width = job->area.width;
+      strip_rect.height = MIN (SCREENSHOT_STREAM_STRIP_HEIGHT, job->area.height - y);
+
+      image = XGetImage (xdisplay, job->snapshot,
+                         0, y, strip_rect.width, strip_rect.height,
+                         AllPlanes, ZPixmap);
+      if (image == NULL)
+        {
+          g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                               _("Unable to read the screen"));
+          goto out;
+        }
+
+      /* pixmaps have no visual, but the copy has the root window's */
+      if (image->red_mask == 0 && image->green_mask == 0 && image->blue_mask == 0)
+        {
+          image->red_mask = visual->red_mask;
+          image->green_mask = visual->green_mask;
+          image->blue_mask = visual->blue_mask;
+        }
+
+      ximage_to_rgb (image, strip, rowstride);
+      XDestroyImage (image);
+
+      if (job->invisible_region != NULL)
+        screenshot_mask_strip (strip, rowstride, &strip_rect,
+                               job->invisible_region, job->scale);
+
+      if (job->cursor_pixbuf != NULL)
+        composite_cursor_in_strip (strip, rowstride, &strip_rect,
+                                   job->cursor_pixbuf, job->cursor_x, job->cursor_y);
+
+      if (!screenshot_stream_encoder_write_rows (encoder, strip, rowstride,
+                                                 strip_rect.height, error))
+        goto out;
+    }
+
+  res = screenshot_stream_encoder_close (encoder, error);
+
+ out:
+  XCloseDisplay (xdisplay);
+
+  return res;
+}
+
+static void
+stream_fallback_thread (GTask        *task,
+                        gpointer      source_object,
+                        gpointer      data,
+                        GCancellable *cancellable)
+{
+  StreamCaptureJob *job = data;
+  g_autoptr(GError) error = NULL;
+  gboolean res;
+
+  res = stream_capture_open (job, &error) &&
+        stream_fallback_read (job, write_to_output_stream, job->os, &error);
+
+  if (job->os != NULL)
+    res = stream_capture_close (job, res, res ? &error : NULL);
+
+  if (!res)
+    {
+      g_task_return_error (task, g_steal_pointer (&error));
+      return;
+    }
+
+  g_task_return_boolean (task, TRUE);
+}
+
+static void
+stream_fallback_ready_cb (GObject      *source,
+                          GAsyncResult *res,
+                          gpointer      user_data)
+{
+  g_autoptr(GTask) task = user_data;
+  StreamCaptureJob *job = g_task_get_task_data (task);
+  GdkDisplay *display = gdk_display_get_default ();
+  GError *error = NULL;
+
+  gdk_x11_display_error_trap_push (display);
+  XFreePixmap (GDK_DISPLAY_XDISPLAY (display), job->snapshot);
+  gdk_x11_display_error_trap_pop_ignored (display);
+  job->snapshot = None;
+
+  if (!g_task_propagate_boolean (G_TASK (res), &error))
+    {
+      g_task_return_error (task, error);
+      return;
+    }
+
+  screenshot_metrics_count_backend ("x11", !job->force_fallback);
+  g_task_return_boolean (task, TRUE);
+}
+
+static void
+stream_fallback_start (GTask *task)
+{
+  StreamCaptureJob *job = g_task_get_task_data (task);
+  GError *error = NULL;
+  GTask *read_task;
+
+  if (!stream_fallback_prepare (job, &error))
+    {
+      g_task_return_error (task, error);
+      g_object_unref (task);
+      return;
+    }
+
+  if (job->options.flash)
+    screenshot_fallback_fire_flash (gdk_get_default_root_window (),
+                                    stream_capture_job_get_rectangle (job),
+                                    job->options.include_border);
+
+  read_task = g_task_new (NULL, g_task_get_cancellable (task),
+                          stream_fallback_ready_cb, task);
+  g_task_set_task_data (read_task, job, NULL);
+  g_task_run_in_thread (read_task, stream_fallback_thread);
+  g_object_unref (read_task);
+}
+
+/* Returns FALSE without an error when the shell could not take the
+ * capture, so that the X11 fallback is used instead.
+ */
+static void
+stream_shell_thread (GTask        *task,
+                     gpointer      source_object,
+                     gpointer      data,
+                     GCancellable *cancellable)
+{
+  StreamCaptureJob *job = data;
+  GdkRectangle *rectangle = stream_capture_job_get_rectangle (job);
+  g_autoptr(GError) error = NULL;
+  g_autoptr(GError) shell_error = NULL;
+  g_autofree gchar *tmp_path = NULL;
+  gboolean res = FALSE;
+
+  if (!stream_capture_open (job, &error))
+    {
+      g_task_return_error (task, g_steal_pointer (&error));
+      return;
+    }
+
+  if (job->tmp_file != NULL)
+    tmp_path = g_file_get_path (job->tmp_file);
+
+  if (tmp_path != NULL && g_strcmp0 (job->format, "png") == 0)
+    {
+      /* let the shell write the file */
+      g_output_stream_close (job->os, NULL, NULL);
+      job->shell_captured = screenshot_shell_capture_to_file (job->connection, &job->options,
+                                                              rectangle, tmp_path, &shell_error);
+      res = job->shell_captured;
+
+      if (!job->shell_captured)
+        {
+          g_clear_object (&job->os);
+          job->os = G_OUTPUT_STREAM (g_file_replace (job->tmp_file, NULL, FALSE,
+                                                     G_FILE_CREATE_NONE,
+                                                     NULL, &error));
+          if (job->os == NULL)
+            {
+              g_file_delete (job->tmp_file, NULL, NULL);
+              g_task_return_error (task, g_steal_pointer (&error));
+              return;
+            }
+        }
+    }
+  else
+    {
+      g_autofree gchar *shell_filename = get_shell_tmp_filename ();
+
+      job->shell_captured = screenshot_shell_capture_to_file (job->connection, &job->options,
+                                                              rectangle, shell_filename,
+                                                              &shell_error);
+      if (job->shell_captured)
+        {
+          res = screenshot_stream_transcode_png (shell_filename, job->format,
+                                                 write_to_output_stream, job->os,
+                                                 &error);
+          g_unlink (shell_filename);
+        }
+    }
+
+  if (!job->shell_captured)
+    {
+      g_task_return_boolean (task, FALSE);
+      return;
+    }
+
+  if (!stream_capture_close (job, res, res ? &error : NULL))
+    {
+      g_task_return_error (task, g_steal_pointer (&error));
+      return;
+    }
+
+  g_task_return_boolean (task, TRUE);
+}
+
+static void
+stream_shell_ready_cb (GObject      *source,
+                       GAsyncResult *res,
+                       gpointer      user_data)
+{
+  GTask *task = user_data;
+  StreamCaptureJob *job = g_task_get_task_data (task);
+  GError *error = NULL;
+
+  if (g_task_propagate_boolean (G_TASK (res), &error))
+    {
+      screenshot_metrics_count_backend ("shell", FALSE);
+      g_task_return_boolean (task, TRUE);
+      g_object_unref (task);
+      return;
+    }
+
+  if (error != NULL)
+    {
+      g_task_return_error (task, error);
+      g_object_unref (task);
+      return;
+    }
+
+  g_message ("Unable to use GNOME Shell's builtin screenshot interface, "
+             "resorting to fallback X11.");
+  stream_fallback_start (task);
+}
+
+/**
+ * screenshot_stream_capture_async:
+ * @options: what to capture, which must not be a window
+ * @rectangle: (nullable): the area to capture, or %NULL for the screen
+ * @file: (nullable): the destination, or %NULL to write to @fd
+ * @fd: the descriptor to write to when @file is %NULL
+ * @overwrite: whether @file may be replaced
+ * @format: a format for which screenshot_stream_supports_format() is TRUE
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: called once the capture is written
+ * @user_data: data for @callback
+ *
+ * Captures the screen or an area straight into a file, a strip at a time,
+ * so that memory use does not grow with the size of the desktop.  Window
+ * captures, and anything that needs the whole image such as effects,
+ * scaling or the dialog, go through screenshot_get_image().
+ *
+ * When the shell is available it writes the PNG itself, next to @file,
+ * and the image never goes through this process; otherwise its output is
+ * converted a strip at a time.  Files are written under a temporary name
+ * and moved into place once complete.
+ *
+ * The capture, encoding and writing happen in a thread.  The X11 fallback
+ * has the X server copy the area first, on the main thread, and flashes
+ * before reading it back.
+ */
+void
+screenshot_stream_capture_async (const ScreenshotCaptureOptions *options,
+                                 GdkRectangle                   *rectangle,
+                                 GFile                          *file,
+                                 gint                            fd,
+                                 gboolean                        overwrite,
+                                 const gchar                    *format,
+                                 GCancellable                   *cancellable,
+                                 GAsyncReadyCallback             callback,
+                                 gpointer                        user_data)
+{
+  StreamCaptureJob *job;
+  GTask *task, *shell_task;
+
+  g_return_if_fail (!options->take_window_shot);
+
+  job = g_slice_new0 (StreamCaptureJob);
+  job->options = *options;
+  job->has_rectangle = rectangle != NULL;
+  if (rectangle != NULL)
+    job->rectangle = *rectangle;
+  job->file = file != NULL ? g_object_ref (file) : NULL;
+  job->fd = fd;
+  job->overwrite = overwrite;
+  job->format = g_strdup (format);
+  job->force_fallback = g_getenv ("GNOME_SCREENSHOT_FORCE_FALLBACK") != NULL;
+
+  task = g_task_new (NULL, cancellable, callback, user_data);
+  g_task_set_task_data (task, job, (GDestroyNotify) stream_capture_job_free);
+
+  if (job->force_fallback)
+    {
+      g_message ("Using fallback X11 as requested");
+      stream_fallback_start (task);
+      return;
+    }
+
+  job->connection = g_application_get_dbus_connection (g_application_get_default ());
+  if (job->connection == NULL)
+    {
+      g_message ("Unable to use GNOME Shell's builtin screenshot interface, "
+                 "resorting to fallback X11.");
+      stream_fallback_start (task);
+      return;
+    }
+
+  g_object_ref (job->connection);
+  shell_task = g_task_new (NULL, cancellable, stream_shell_ready_cb, task);
+  g_task_set_task_data (shell_task, job, NULL);
+  g_task_run_in_thread (shell_task, stream_shell_thread);
+  g_object_unref (shell_task);
+}
+
+/**
+ * screenshot_stream_capture_finish:
+ * @result: the result passed to the callback
+ * @error: return location for an error
+ *
+ * Returns: whether the capture was written
+ */
+gboolean
+screenshot_stream_capture_finish (GAsyncResult  *result,
+                                  GError       **error)
+{
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
+
 gint
 screenshot_show_dialog (GtkWindow   *parent,
                         GtkMessageType message_type,
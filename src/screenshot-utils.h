@@ -23,11 +23,28 @@
 #include <gtk/gtk.h>
 #include <gdk/gdkx.h>
 
+#include "screenshot-capture-request.h"
+#include "screenshot-image.h"
+
 G_BEGIN_DECLS
 
 #define SCREENSHOT_ICON_NAME "org.gnome.Screenshot"
 
-GdkPixbuf *screenshot_get_pixbuf          (GdkRectangle *rectangle);
+ScreenshotImage *screenshot_get_image     (ScreenshotCaptureOptions       *options,
+                                          GdkRectangle                   *rectangle);
+void       screenshot_stream_capture_async  (const ScreenshotCaptureOptions *options,
+                                            GdkRectangle                   *rectangle,
+                                            GFile                          *file,
+                                            gint                            fd,
+                                            gboolean                        overwrite,
+                                            const gchar                    *format,
+                                            GCancellable                   *cancellable,
+                                            GAsyncReadyCallback             callback,
+                                            gpointer                        user_data);
+gboolean   screenshot_stream_capture_finish (GAsyncResult                   *result,
+                                            GError                        **error);
+gboolean   screenshot_get_window_rectangle (gboolean                     include_border,
+                                            GdkRectangle                *rectangle);
 
 gint       screenshot_show_dialog   (GtkWindow   *parent,
                                      GtkMessageType message_type,
@@ -0,0 +1,544 @@
+/* screenshot-viewer.c - zoomable screenshot viewer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+/* The viewer never rescales the whole screenshot.  A mipmap of it is built
+ * once in a worker thread, and each frame only the tiles that intersect the
+ * visible area are drawn from the level closest to the current zoom.  The
+ * levels hold the native pixels of the capture, so a tile is only a cairo
+ * surface sharing them, made on demand and kept in a small LRU cache.
+ */
+
+#include "config.h"
+
+#include <math.h>
+
+#include "screenshot-mipmap.h"
+#include "screenshot-viewer.h"
+
+/* Size of a tile, in pixels of the level it is cut from */
+#define TILE_SIZE 256
+
+/* At most this many tile surfaces are kept around */
+#define MAX_CACHED_TILES 256
+
+/* Levels smaller than this are not worth building */
+#define MIPMAP_MIN_SIZE 256
+
+#define MAX_SCALE 16.0
+#define SCROLL_ZOOM_STEP 1.1
+
+typedef struct {
+  gint64 key;
+  cairo_surface_t *surface;
+} ViewerTile;
+
+struct _ScreenshotViewer
+{
+  GtkDrawingArea parent_instance;
+
+  ScreenshotImage *image;
+  GdkPixbuf *native;
+  ScreenshotMipmap *mipmap;
+  GCancellable *cancellable;
+
+  GHashTable *tiles;
+  GQueue tiles_lru;
+
+  gboolean fit;
+  gdouble scale;
+  gdouble x_offset;
+  gdouble y_offset;
+
+  gboolean dragging;
+  gdouble drag_start_x;
+  gdouble drag_start_y;
+  gdouble drag_start_x_offset;
+  gdouble drag_start_y_offset;
+};
+
+G_DEFINE_TYPE (ScreenshotViewer, screenshot_viewer, GTK_TYPE_DRAWING_AREA)
+
+static gint64
+tile_key (guint level,
+          gint  tile_x,
+          gint  tile_y)
+{
+  return ((gint64) level << 48) | ((gint64) tile_y << 24) | (gint64) tile_x;
+}
+
+static void
+viewer_tile_free (ViewerTile *tile)
+{
+  cairo_surface_destroy (tile->surface);
+  g_slice_free (ViewerTile, tile);
+}
+
+static void
+clear_tiles (ScreenshotViewer *self)
+{
+  /* the table is keyed by the tiles, so it goes first */
+  g_hash_table_remove_all (self->tiles);
+  g_queue_clear_full (&self->tiles_lru, (GDestroyNotify) viewer_tile_free);
+}
+
+static GdkPixbuf *
+get_level_pixbuf (ScreenshotViewer *self,
+                  guint             level)
+{
+  if (self->mipmap == NULL)
+    {
+      /* until the levels are ready, the image itself */
+      if (self->native == NULL)
+        self->native = screenshot_image_get_native_pixbuf (self->image);
+
+      return self->native;
+    }
+
+  return screenshot_mipmap_get_level (self->mipmap, level);
+}
+
+static cairo_surface_t *
+get_tile (ScreenshotViewer *self,
+          guint             level,
+          gint              tile_x,
+          gint              tile_y)
+{
+  g_autoptr(GdkPixbuf) sub = NULL;
+  GdkPixbuf *level_pixbuf;
+  ViewerTile *tile;
+  GList *link;
+  gint64 key;
+  gint x, y;
+
+  key = tile_key (level, tile_x, tile_y);
+  link = g_hash_table_lookup (self->tiles, &key);
+  if (link != NULL)
+    {
+      /* move to the front, the tail is what gets evicted */
+      g_queue_unlink (&self->tiles_lru, link);
+      g_queue_push_head_link (&self->tiles_lru, link);
+
+      tile = link->data;
+      return tile->surface;
+    }
+
+  if (g_queue_get_length (&self->tiles_lru) >= MAX_CACHED_TILES)
+    {
+      ViewerTile *oldest = g_queue_pop_tail (&self->tiles_lru);
+
+      g_hash_table_remove (self->tiles, &oldest->key);
+      viewer_tile_free (oldest);
+    }
+
+  level_pixbuf = get_level_pixbuf (self, level);
+  x = tile_x * TILE_SIZE;
+  y = tile_y * TILE_SIZE;
+
+  /* a subpixbuf shares the pixels, and so does the surface */
+  sub = gdk_pixbuf_new_subpixbuf (level_pixbuf, x, y,
+                                  MIN (TILE_SIZE, gdk_pixbuf_get_width (level_pixbuf) - x),
+                                  MIN (TILE_SIZE, gdk_pixbuf_get_height (level_pixbuf) - y));
+
+  tile = g_slice_new0 (ViewerTile);
+  tile->key = key;
+  tile->surface = screenshot_native_pixbuf_create_surface (sub,
+                                                           screenshot_image_get_native_format (self->image));
+
+  g_queue_push_head (&self->tiles_lru, tile);
+  g_hash_table_insert (self->tiles, &tile->key, self->tiles_lru.head);
+
+  return tile->surface;
+}
+
+static gdouble
+get_fit_scale (ScreenshotViewer *self)
+{
+  gint width, height;
+  gdouble scale;
+
+  width = gtk_widget_get_allocated_width (GTK_WIDGET (self));
+  height = gtk_widget_get_allocated_height (GTK_WIDGET (self));
+
+  scale = MIN ((gdouble) width / screenshot_image_get_width (self->image),
+               (gdouble) height / screenshot_image_get_height (self->image));
+
+  /* never blow small screenshots up just to fill the window */
+  return MIN (scale, 1.0);
+}
+
+static gdouble
+get_scale (ScreenshotViewer *self)
+{
+  return self->fit ? get_fit_scale (self) : self->scale;
+}
+
+/* Keeps the image on screen: when it is larger than the view the offsets
+ * must not scroll past its edges, otherwise it is centered.
+ */
+static void
+clamp_offsets (ScreenshotViewer *self)
+{
+  gdouble scale, view_width, view_height;
+
+  scale = get_scale (self);
+  if (scale <= 0)
+    return;
+
+  view_width = gtk_widget_get_allocated_width (GTK_WIDGET (self)) / scale;
+  view_height = gtk_widget_get_allocated_height (GTK_WIDGET (self)) / scale;
+
+  self->x_offset = CLAMP (self->x_offset, 0, MAX (screenshot_image_get_width (self->image) - view_width, 0));
+  self->y_offset = CLAMP (self->y_offset, 0, MAX (screenshot_image_get_height (self->image) - view_height, 0));
+}
+
+/* Where the top left corner of the image is, in widget coordinates */
+static void
+get_origin (ScreenshotViewer *self,
+            gdouble          *origin_x,
+            gdouble          *origin_y)
+{
+  gdouble scale, image_width, image_height;
+  gint width, height;
+
+  scale = get_scale (self);
+  width = gtk_widget_get_allocated_width (GTK_WIDGET (self));
+  height = gtk_widget_get_allocated_height (GTK_WIDGET (self));
+  image_width = screenshot_image_get_width (self->image) * scale;
+  image_height = screenshot_image_get_height (self->image) * scale;
+
+  if (image_width <= width)
+    *origin_x = floor ((width - image_width) / 2);
+  else
+    *origin_x = -self->x_offset * scale;
+
+  if (image_height <= height)
+    *origin_y = floor ((height - image_height) / 2);
+  else
+    *origin_y = -self->y_offset * scale;
+}
+
+static gboolean
+screenshot_viewer_draw (GtkWidget *widget,
+                        cairo_t   *cr)
+{
+  ScreenshotViewer *self = SCREENSHOT_VIEWER (widget);
+  GdkPixbuf *level_pixbuf;
+  gdouble scale, level_scale_x, level_scale_y;
+  gdouble origin_x, origin_y;
+  gdouble clip_x1, clip_y1, clip_x2, clip_y2;
+  gint image_width, image_height;
+  gint level_width, level_height;
+  gint first_x, first_y, last_x, last_y;
+  gint tile_x, tile_y;
+  guint level = 0;
+
+  scale = get_scale (self);
+  if (scale <= 0)
+    return FALSE;
+
+  get_origin (self, &origin_x, &origin_y);
+
+  if (self->mipmap != NULL)
+    level = screenshot_mipmap_find_level (self->mipmap, scale);
+
+  level_pixbuf = get_level_pixbuf (self, level);
+  image_width = screenshot_image_get_width (self->image);
+  image_height = screenshot_image_get_height (self->image);
+  level_width = gdk_pixbuf_get_width (level_pixbuf);
+  level_height = gdk_pixbuf_get_height (level_pixbuf);
+  level_scale_x = (gdouble) level_width / image_width;
+  level_scale_y = (gdouble) level_height / image_height;
+
+  /* from here on we are working in pixels of the chosen level */
+  cairo_translate (cr, origin_x, origin_y);
+  cairo_scale (cr, scale / level_scale_x, scale / level_scale_y);
+  cairo_set_antialias (cr, CAIRO_ANTIALIAS_NONE);
+
+  cairo_clip_extents (cr, &clip_x1, &clip_y1, &clip_x2, &clip_y2);
+  first_x = CLAMP (floor (clip_x1), 0, level_width - 1) / TILE_SIZE;
+  first_y = CLAMP (floor (clip_y1), 0, level_height - 1) / TILE_SIZE;
+  last_x = CLAMP (ceil (clip_x2) - 1, 0, level_width - 1) / TILE_SIZE;
+  last_y = CLAMP (ceil (clip_y2) - 1, 0, level_height - 1) / TILE_SIZE;
+
+  for (tile_y = first_y; tile_y <= last_y; tile_y++)
+    {
+      for (tile_x = first_x; tile_x <= last_x; tile_x++)
+        {
+          cairo_surface_t *surface;
+          gint x = tile_x * TILE_SIZE;
+          gint y = tile_y * TILE_SIZE;
+
+          surface = get_tile (self, level, tile_x, tile_y);
+
+          cairo_set_source_surface (cr, surface, x, y);
+          /* pad, so that neighbouring tiles do not bleed transparency into
+           * each other when filtered */
+          cairo_pattern_set_extend (cairo_get_source (cr), CAIRO_EXTEND_PAD);
+          cairo_rectangle (cr, x, y,
+                           cairo_image_surface_get_width (surface),
+                           cairo_image_surface_get_height (surface));
+          cairo_fill (cr);
+        }
+    }
+
+  return FALSE;
+}
+
+static void
+zoom_at (ScreenshotViewer *self,
+         gdouble           new_scale,
+         gdouble           widget_x,
+         gdouble           widget_y)
+{
+  gdouble scale, origin_x, origin_y;
+  gdouble image_x, image_y;
+
+  scale = get_scale (self);
+  new_scale = CLAMP (new_scale, get_fit_scale (self), MAX_SCALE);
+
+  /* keep the image point under the pointer where it is */
+  get_origin (self, &origin_x, &origin_y);
+  image_x = (widget_x - origin_x) / scale;
+  image_y = (widget_y - origin_y) / scale;
+
+  self->fit = FALSE;
+  self->scale = new_scale;
+  self->x_offset = image_x - widget_x / new_scale;
+  self->y_offset = image_y - widget_y / new_scale;
+  clamp_offsets (self);
+
+  gtk_widget_queue_draw (GTK_WIDGET (self));
+}
+
+static gboolean
+screenshot_viewer_scroll_event (GtkWidget      *widget,
+                                GdkEventScroll *event)
+{
+  ScreenshotViewer *self = SCREENSHOT_VIEWER (widget);
+  gdouble factor;
+
+  switch (event->direction)
+    {
+    case GDK_SCROLL_UP:
+      factor = SCROLL_ZOOM_STEP;
+      break;
+    case GDK_SCROLL_DOWN:
+      factor = 1.0 / SCROLL_ZOOM_STEP;
+      break;
+    case GDK_SCROLL_SMOOTH:
+      factor = pow (SCROLL_ZOOM_STEP, -event->delta_y);
+      break;
+    default:
+      return FALSE;
+    }
+
+  zoom_at (self, get_scale (self) * factor, event->x, event->y);
+
+  return TRUE;
+}
+
+static gboolean
+screenshot_viewer_button_press_event (GtkWidget      *widget,
+                                      GdkEventButton *event)
+{
+  ScreenshotViewer *self = SCREENSHOT_VIEWER (widget);
+
+  if (event->button != GDK_BUTTON_PRIMARY)
+    return FALSE;
+
+  /* double click toggles between fitting the window and 1:1 */
+  if (event->type == GDK_2BUTTON_PRESS)
+    {
+      if (self->fit)
+        zoom_at (self, 1.0, event->x, event->y);
+      else
+        screenshot_viewer_zoom_to_fit (self);
+
+      return TRUE;
+    }
+
+  self->dragging = TRUE;
+  self->drag_start_x = event->x;
+  self->drag_start_y = event->y;
+  self->drag_start_x_offset = self->x_offset;
+  self->drag_start_y_offset = self->y_offset;
+
+  return TRUE;
+}
+
+static gboolean
+screenshot_viewer_button_release_event (GtkWidget      *widget,
+                                        GdkEventButton *event)
+{
+  ScreenshotViewer *self = SCREENSHOT_VIEWER (widget);
+
+  if (event->button != GDK_BUTTON_PRIMARY)
+    return FALSE;
+
+  self->dragging = FALSE;
+
+  return TRUE;
+}
+
+static gboolean
+screenshot_viewer_motion_notify_event (GtkWidget      *widget,
+                                       GdkEventMotion *event)
+{
+  ScreenshotViewer *self = SCREENSHOT_VIEWER (widget);
+  gdouble scale;
+
+  if (!self->dragging)
+    return FALSE;
+
+  scale = get_scale (self);
+  self->x_offset = self->drag_start_x_offset - (event->x - self->drag_start_x) / scale;
+  self->y_offset = self->drag_start_y_offset - (event->y - self->drag_start_y) / scale;
+  clamp_offsets (self);
+
+  gtk_widget_queue_draw (widget);
+
+  return TRUE;
+}
+
+static void
+screenshot_viewer_size_allocate (GtkWidget     *widget,
+                                 GtkAllocation *allocation)
+{
+  GTK_WIDGET_CLASS (screenshot_viewer_parent_class)->size_allocate (widget, allocation);
+
+  /* nothing to rescale, the next draw just picks another level */
+  clamp_offsets (SCREENSHOT_VIEWER (widget));
+}
+
+static void
+mipmap_ready_cb (GObject      *source,
+                 GAsyncResult *res,
+                 gpointer      user_data)
+{
+  g_autoptr(ScreenshotViewer) self = user_data;
+  g_autoptr(GError) error = NULL;
+  ScreenshotMipmap *mipmap;
+
+  mipmap = screenshot_mipmap_new_finish (res, &error);
+  if (mipmap == NULL)
+    {
+      if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        g_warning ("Unable to build the screenshot mipmap: %s", error->message);
+      return;
+    }
+
+  /* level 0 has the same pixels, so the cached tiles stay valid */
+  self->mipmap = mipmap;
+  gtk_widget_queue_draw (GTK_WIDGET (self));
+}
+
+static void
+screenshot_viewer_dispose (GObject *object)
+{
+  ScreenshotViewer *self = SCREENSHOT_VIEWER (object);
+
+  if (self->cancellable != NULL)
+    g_cancellable_cancel (self->cancellable);
+  g_clear_object (&self->cancellable);
+
+  if (self->tiles != NULL)
+    clear_tiles (self);
+
+  g_clear_pointer (&self->mipmap, screenshot_mipmap_unref);
+  g_clear_object (&self->native);
+  g_clear_pointer (&self->image, screenshot_image_unref);
+
+  G_OBJECT_CLASS (screenshot_viewer_parent_class)->dispose (object);
+}
+
+static void
+screenshot_viewer_finalize (GObject *object)
+{
+  ScreenshotViewer *self = SCREENSHOT_VIEWER (object);
+
+  g_hash_table_unref (self->tiles);
+
+  G_OBJECT_CLASS (screenshot_viewer_parent_class)->finalize (object);
+}
+
+static void
+screenshot_viewer_class_init (ScreenshotViewerClass *klass)
+{
+  GObjectClass *oclass = G_OBJECT_CLASS (klass);
+  GtkWidgetClass *wclass = GTK_WIDGET_CLASS (klass);
+
+  oclass->dispose = screenshot_viewer_dispose;
+  oclass->finalize = screenshot_viewer_finalize;
+
+  wclass->draw = screenshot_viewer_draw;
+  wclass->size_allocate = screenshot_viewer_size_allocate;
+  wclass->scroll_event = screenshot_viewer_scroll_event;
+  wclass->button_press_event = screenshot_viewer_button_press_event;
+  wclass->button_release_event = screenshot_viewer_button_release_event;
+  wclass->motion_notify_event = screenshot_viewer_motion_notify_event;
+}
+
+static void
+screenshot_viewer_init (ScreenshotViewer *self)
+{
+  /* of links in tiles_lru, which owns the tiles */
+  self->tiles = g_hash_table_new (g_int64_hash, g_int64_equal);
+  g_queue_init (&self->tiles_lru);
+
+  self->fit = TRUE;
+  self->scale = 1.0;
+
+  gtk_widget_add_events (GTK_WIDGET (self),
+                         GDK_BUTTON_PRESS_MASK |
+                         GDK_BUTTON_RELEASE_MASK |
+                         GDK_BUTTON1_MOTION_MASK |
+                         GDK_SCROLL_MASK |
+                         GDK_SMOOTH_SCROLL_MASK);
+}
+
+/**
+ * screenshot_viewer_new:
+ * @image: the screenshot to show; a reference is taken, not a copy
+ */
+GtkWidget *
+screenshot_viewer_new (ScreenshotImage *image)
+{
+  ScreenshotViewer *self;
+
+  g_return_val_if_fail (image != NULL, NULL);
+
+  self = g_object_new (SCREENSHOT_TYPE_VIEWER, NULL);
+  self->image = screenshot_image_ref (image);
+  self->cancellable = g_cancellable_new ();
+
+  screenshot_mipmap_new_async (image, MIPMAP_MIN_SIZE, self->cancellable,
+                               mipmap_ready_cb, g_object_ref (self));
+
+  return GTK_WIDGET (self);
+}
+
+void
+screenshot_viewer_zoom_to_fit (ScreenshotViewer *self)
+{
+  g_return_if_fail (SCREENSHOT_IS_VIEWER (self));
+
+  self->fit = TRUE;
+  self->x_offset = 0;
+  self->y_offset = 0;
+
+  gtk_widget_queue_draw (GTK_WIDGET (self));
+}
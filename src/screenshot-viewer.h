@@ -0,0 +1,35 @@
+/* screenshot-viewer.h - zoomable screenshot viewer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+#ifndef __SCREENSHOT_VIEWER_H__
+#define __SCREENSHOT_VIEWER_H__
+
+#include <gtk/gtk.h>
+
+#include "screenshot-image.h"
+
+G_BEGIN_DECLS
+
+#define SCREENSHOT_TYPE_VIEWER (screenshot_viewer_get_type ())
+G_DECLARE_FINAL_TYPE (ScreenshotViewer, screenshot_viewer, SCREENSHOT, VIEWER, GtkDrawingArea)
+
+GtkWidget *screenshot_viewer_new          (ScreenshotImage  *image);
+void       screenshot_viewer_zoom_to_fit  (ScreenshotViewer *viewer);
+
+G_END_DECLS
+
+#endif /* __SCREENSHOT_VIEWER_H__ */
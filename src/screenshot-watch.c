@@ -0,0 +1,308 @@
+/* screenshot-watch.c - screenshots taken when the screen changes
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+/* With --watch, gnome-screenshot keeps running and takes a screenshot of
+ * the screen, a window or an area each time enough of it has changed,
+ * rather than every few seconds whether anything changed or not.
+ *
+ * On X11, the server reports what is redrawn through the DAMAGE
+ * extension.  The damaged rectangles that fall in the watched area are
+ * collected, and once they cover more than the threshold, a fraction of
+ * the area, a frame is captured and they are forgotten.  A blinking
+ * cursor redraws the same few pixels, so it never adds up to much.
+ *
+ * Elsewhere, and when the extension is missing, frames are captured all
+ * the time instead and compared with the last one passed on, tile by
+ * tile, see screenshot-tile-hash.c, which costs a capture per check but
+ * still saves encoding and writing the frames that did not change.  The
+ * frames captured after damage are compared too, and dropped if not a
+ * single tile differs, as a redraw often draws the same pixels again.
+ *
+ * Either way, the area is checked at most max_rate times a second, and
+ * the first check always passes a frame on.  Checks that find too little
+ * changed are passed on without a frame, for the caller to keep a record
+ * of every check if it wants to.
+ */
+
+#include "config.h"
+
+#include <gdk/gdkx.h>
+
+#ifdef HAVE_XDAMAGE
+#include <X11/extensions/Xdamage.h>
+#endif
+
+#include "screenshot-metrics.h"
+#include "screenshot-tile-hash.h"
+#include "screenshot-utils.h"
+#include "screenshot-watch.h"
+
+/* Checks are made at most this often */
+#define WATCH_MAX_RATE 30.0
+
+struct _ScreenshotWatch
+{
+  ScreenshotCaptureRequest *request;
+  gdouble threshold;
+  ScreenshotWatchFunc func;
+  gpointer user_data;
+
+  guint timeout_id;
+  gboolean started;
+
+  /* with DAMAGE: the watched area in device pixels, and what was redrawn
+   * in it since the last frame */
+#ifdef HAVE_XDAMAGE
+  Damage damage;
+  gint damage_event_base;
+#endif
+  GdkRectangle device_area;
+  cairo_region_t *damaged;
+
+  /* the tiles of the last frame passed on */
+  ScreenshotTileHashes *previous;
+};
+
+#ifdef HAVE_XDAMAGE
+static GdkFilterReturn
+damage_filter (GdkXEvent *gdk_xevent,
+               GdkEvent  *event,
+               gpointer   user_data)
+{
+  ScreenshotWatch *watch = user_data;
+  XEvent *xevent = gdk_xevent;
+  XDamageNotifyEvent *notify;
+  GdkRectangle rect;
+
+  if (xevent->type != watch->damage_event_base + XDamageNotify)
+    return GDK_FILTER_CONTINUE;
+
+  notify = (XDamageNotifyEvent *) xevent;
+  if (notify->damage != watch->damage)
+    return GDK_FILTER_CONTINUE;
+
+  rect.x = notify->area.x;
+  rect.y = notify->area.y;
+  rect.width = notify->area.width;
+  rect.height = notify->area.height;
+
+  if (gdk_rectangle_intersect (&rect, &watch->device_area, &rect))
+    cairo_region_union_rectangle (watch->damaged, &rect);
+
+  return GDK_FILTER_REMOVE;
+}
+#endif
+
+/* Asks the X server to report what is redrawn on the root window, which
+ * includes its children */
+static gboolean
+watch_start_damage (ScreenshotWatch *watch)
+{
+#ifdef HAVE_XDAMAGE
+  GdkDisplay *display = gdk_display_get_default ();
+  Display *xdisplay;
+  gint error_base;
+
+  if (!GDK_IS_X11_DISPLAY (display))
+    return FALSE;
+
+  xdisplay = GDK_DISPLAY_XDISPLAY (display);
+  if (!XDamageQueryExtension (xdisplay, &watch->damage_event_base, &error_base))
+    return FALSE;
+
+  gdk_x11_display_error_trap_push (display);
+  watch->damage = XDamageCreate (xdisplay, GDK_ROOT_WINDOW (), XDamageReportRawRectangles);
+  if (gdk_x11_display_error_trap_pop (display) != 0)
+    return FALSE;
+
+  watch->damaged = cairo_region_create ();
+  gdk_window_add_filter (NULL, damage_filter, watch);
+
+  return TRUE;
+#else
+  return FALSE;
+#endif
+}
+
+static guint64
+region_area (cairo_region_t *region)
+{
+  cairo_rectangle_int_t rect;
+  guint64 area = 0;
+  gint i;
+
+  for (i = 0; i < cairo_region_num_rectangles (region); i++)
+    {
+      cairo_region_get_rectangle (region, i, &rect);
+      area += (guint64) rect.width * rect.height;
+    }
+
+  return area;
+}
+
+/* Whether enough was redrawn since the last frame to capture another */
+static gboolean
+check_damage (ScreenshotWatch *watch)
+{
+  guint64 area = (guint64) watch->device_area.width * watch->device_area.height;
+
+  if (watch->started &&
+      region_area (watch->damaged) < MAX (watch->threshold * area, 1))
+    return FALSE;
+
+  cairo_region_destroy (watch->damaged);
+  watch->damaged = cairo_region_create ();
+
+  return TRUE;
+}
+
+/* Whether enough of @frame differs from the last frame passed on.  After
+ * damage any tile will do, the threshold was already met */
+static gboolean
+check_tiles (ScreenshotWatch            *watch,
+             ScreenshotImage            *frame,
+             const ScreenshotTileHashes *hashes)
+{
+  guint64 area, changed_area;
+
+  if (!watch->started)
+    return TRUE;
+
+  area = (guint64) screenshot_image_get_width (frame) * screenshot_image_get_height (frame);
+  changed_area = screenshot_tile_hashes_changed (hashes, watch->previous);
+
+  if (watch->damaged != NULL)
+    return changed_area > 0;
+
+  return changed_area >= MAX (watch->threshold * area, 1);
+}
+
+static gboolean
+watch_timeout (gpointer user_data)
+{
+  ScreenshotWatch *watch = user_data;
+  ScreenshotCaptureRequest *request = watch->request;
+  const gchar *source = watch->damaged != NULL ? "damage" : "tiles";
+  g_autoptr(ScreenshotImage) frame = NULL;
+  g_autoptr(ScreenshotTileHashes) hashes = NULL;
+
+  /* nothing to capture until enough was redrawn */
+  if (watch->damaged != NULL && !check_damage (watch))
+    goto unchanged;
+
+  frame = screenshot_get_image (&request->options,
+                                request->has_rectangle ? &request->rectangle : NULL);
+  if (frame == NULL)
+    {
+      g_warning ("Unable to capture the watched %s", request->mode);
+      return G_SOURCE_CONTINUE;
+    }
+
+  hashes = screenshot_tile_hashes_new (frame);
+  if (!check_tiles (watch, frame, hashes))
+    goto unchanged;
+
+  screenshot_metrics_count_watch_check (source, TRUE);
+  watch->started = TRUE;
+  watch->func (frame, hashes, watch->user_data);
+
+  g_clear_pointer (&watch->previous, screenshot_tile_hashes_free);
+  watch->previous = g_steal_pointer (&hashes);
+
+  return G_SOURCE_CONTINUE;
+
+unchanged:
+  screenshot_metrics_count_watch_check (source, FALSE);
+  watch->func (NULL, NULL, watch->user_data);
+
+  return G_SOURCE_CONTINUE;
+}
+
+/**
+ * screenshot_watch_new:
+ * @request: what to capture, and the area to watch if it has one
+ * @threshold: the fraction of the area that has to change
+ * @max_rate: how many times a second to check at most
+ * @func: called with each frame taken, and after each check that found
+ *   too little changed
+ * @user_data: passed to @func
+ *
+ * Starts watching, until freed.
+ */
+ScreenshotWatch *
+screenshot_watch_new (ScreenshotCaptureRequest *request,
+                      gdouble                   threshold,
+                      gdouble                   max_rate,
+                      ScreenshotWatchFunc       func,
+                      gpointer                  user_data)
+{
+  ScreenshotWatch *watch;
+  GdkWindow *root = gdk_get_default_root_window ();
+  gint scale = gdk_window_get_scale_factor (root);
+  guint interval;
+
+  watch = g_slice_new0 (ScreenshotWatch);
+  watch->request = screenshot_capture_request_ref (request);
+  watch->threshold = CLAMP (threshold, 0.0, 1.0);
+  watch->func = func;
+  watch->user_data = user_data;
+
+  if (request->has_rectangle)
+    watch->device_area = request->rectangle;
+  else
+    {
+      watch->device_area.x = watch->device_area.y = 0;
+      watch->device_area.width = gdk_window_get_width (root);
+      watch->device_area.height = gdk_window_get_height (root);
+    }
+
+  watch->device_area.x *= scale;
+  watch->device_area.y *= scale;
+  watch->device_area.width *= scale;
+  watch->device_area.height *= scale;
+
+  if (!watch_start_damage (watch))
+    g_debug ("No damage reports from the display server, comparing frames instead");
+
+  interval = 1000 / CLAMP (max_rate, 0.1, WATCH_MAX_RATE);
+  watch->timeout_id = g_timeout_add (interval, watch_timeout, watch);
+
+  return watch;
+}
+
+void
+screenshot_watch_free (ScreenshotWatch *watch)
+{
+  g_source_remove (watch->timeout_id);
+
+#ifdef HAVE_XDAMAGE
+  if (watch->damaged != NULL)
+    {
+      GdkDisplay *display = gdk_display_get_default ();
+
+      gdk_window_remove_filter (NULL, damage_filter, watch);
+      gdk_x11_display_error_trap_push (display);
+      XDamageDestroy (GDK_DISPLAY_XDISPLAY (display), watch->damage);
+      gdk_x11_display_error_trap_pop_ignored (display);
+    }
+#endif
+
+  g_clear_pointer (&watch->damaged, cairo_region_destroy);
+  g_clear_pointer (&watch->previous, screenshot_tile_hashes_free);
+  screenshot_capture_request_unref (watch->request);
+  g_slice_free (ScreenshotWatch, watch);
+}
@@ -0,0 +1,48 @@
+/* screenshot-watch.h - screenshots taken when the screen changes
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ */
+
+#ifndef __SCREENSHOT_WATCH_H__
+#define __SCREENSHOT_WATCH_H__
+
+#include "screenshot-capture-request.h"
+#include "screenshot-tile-hash.h"
+
+G_BEGIN_DECLS
+
+/* What --watch does with the checks that find too little changed */
+typedef enum {
+  SCREENSHOT_WATCH_UNCHANGED_SKIP,
+  SCREENSHOT_WATCH_UNCHANGED_LINK
+} ScreenshotWatchUnchanged;
+
+/* @frame and @hashes are %NULL when the check found too little changed */
+typedef void (*ScreenshotWatchFunc) (ScreenshotImage            *frame,
+                                     const ScreenshotTileHashes *hashes,
+                                     gpointer                    user_data);
+
+typedef struct _ScreenshotWatch ScreenshotWatch;
+
+ScreenshotWatch *screenshot_watch_new  (ScreenshotCaptureRequest *request,
+                                        gdouble                   threshold,
+                                        gdouble                   max_rate,
+                                        ScreenshotWatchFunc       func,
+                                        gpointer                  user_data);
+void             screenshot_watch_free (ScreenshotWatch          *watch);
+
+G_END_DECLS
+
+#endif /* __SCREENSHOT_WATCH_H__ */